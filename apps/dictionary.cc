@@ -0,0 +1,47 @@
+#include <iostream>
+#include <string>
+
+#include "src/cottontail.h"
+
+void usage(std::string program_name) {
+  std::cerr << "usage: " << program_name << " [--burrow burrow]\n";
+}
+
+// Builds the term dictionary used to expand prefix, wildcard and regex
+// patterns in GCL, and stores it in the burrow.
+int main(int argc, char **argv) {
+  std::string program_name = argv[0];
+  if (argc == 2 && argv[1] == std::string("--help")) {
+    usage(program_name);
+    return 0;
+  }
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  if (argc > 2 &&
+      (argv[1] == std::string("-b") || argv[1] == std::string("--burrow"))) {
+    burrow = argv[2];
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc != 1) {
+    usage(program_name);
+    return 1;
+  }
+  std::string error;
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make(burrow, &error);
+  if (warren == nullptr) {
+    std::cerr << program_name << ": " << error << "\n";
+    return 1;
+  }
+  warren->start();
+  std::shared_ptr<cottontail::Dictionary> dictionary =
+      cottontail::Dictionary::build(warren, &error);
+  if (dictionary == nullptr ||
+      !dictionary->store(warren->working(), &error)) {
+    std::cerr << program_name << ": " << error << "\n";
+    return 1;
+  }
+  std::cout << dictionary->size() << " terms\n";
+  warren->end();
+  return 0;
+}
@@ -0,0 +1,55 @@
+#include <iostream>
+#include <string>
+
+#include "src/cottontail.h"
+
+void usage(std::string program_name) {
+  std::cerr << "usage: " << program_name
+            << " [--burrow burrow] [--container gcl] [--id gcl]\n";
+}
+
+// Builds the index from docnos to containers used by qrels loading and the
+// ssr-server document op, and stores it in the burrow.
+int main(int argc, char **argv) {
+  std::string program_name = argv[0];
+  if (argc == 2 && argv[1] == std::string("--help")) {
+    usage(program_name);
+    return 0;
+  }
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  std::string container, id;
+  while (argc > 2) {
+    std::string option = argv[1];
+    if (option == "-b" || option == "--burrow")
+      burrow = argv[2];
+    else if (option == "--container")
+      container = argv[2];
+    else if (option == "--id")
+      id = argv[2];
+    else
+      break;
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc != 1) {
+    usage(program_name);
+    return 1;
+  }
+  std::string error;
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make(burrow, &error);
+  if (warren == nullptr) {
+    std::cerr << program_name << ": " << error << "\n";
+    return 1;
+  }
+  warren->start();
+  std::shared_ptr<cottontail::DocnoIndex> index =
+      cottontail::DocnoIndex::build(warren, container, id, &error);
+  if (index == nullptr || !index->store(warren->working(), &error)) {
+    std::cerr << program_name << ": " << error << "\n";
+    return 1;
+  }
+  std::cout << index->size() << " docnos\n";
+  warren->end();
+  return 0;
+}
@@ -10,7 +10,7 @@
 
 void usage(std::string program_name) {
   std::cerr << "usage: " << program_name
-            << " [--burrow burrow] [--addr|--fval]\n";
+            << " [--burrow burrow] [--profile] [--addr|--fval]\n";
 }
 
 int main(int argc, char **argv) {
@@ -27,6 +27,12 @@ int main(int argc, char **argv) {
     argc -= 2;
     argv += 2;
   }
+  bool profile = false;
+  if (argc > 1 && argv[1] == std::string("--profile")) {
+    profile = true;
+    argc -= 1;
+    argv += 1;
+  }
   if (argc == 2) {
     if (argv[1] == std::string("-a") || argv[1] == std::string("--addr")) {
       report_addr = true;
@@ -64,8 +70,11 @@ int main(int argc, char **argv) {
 
     warren->start();
     std::shared_ptr<cottontail::Txt> txt = warren->txt();
+    std::shared_ptr<cottontail::gcl::Profile> tree;
     std::unique_ptr<cottontail::Hopper> fluffy =
-        warren->hopper_from_gcl(line, &error);
+        profile ? cottontail::gcl::profiled_hopper(line, warren.get(), &tree,
+                                                   &error)
+                : warren->hopper_from_gcl(line, &error);
     if (fluffy == nullptr) {
       std::cerr << error << "\n";
       free(line);
@@ -108,6 +117,8 @@ int main(int argc, char **argv) {
         std::cout << a << "... " << c << "\n";
       }
     }
+    if (tree != nullptr)
+      std::cerr << tree->dump();
     warren->end();
   }
   return 0;
@@ -0,0 +1,142 @@
+#include "apps/frames.h"
+
+#include <cstdint>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "src/core.h"
+#include "src/nlohmann.h"
+
+namespace cottontail {
+
+namespace {
+const char STRING = 's';
+const char INTEGER = 'i';
+const char DOUBLE = 'd';
+const char BOOLEAN = 'b';
+const char JSON = 'j';
+
+void put_u32(uint32_t value, std::string *out) {
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out->push_back(static_cast<char>((value >> shift) & 0xFF));
+}
+
+void put_u64(uint64_t value, std::string *out) {
+  for (int shift = 56; shift >= 0; shift -= 8)
+    out->push_back(static_cast<char>((value >> shift) & 0xFF));
+}
+
+uint64_t get_be(const char *in, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; i++)
+    value = (value << 8) | static_cast<unsigned char>(in[i]);
+  return value;
+}
+
+void put_field(const std::string &key, char type, size_t length,
+               std::string *out) {
+  out->push_back(static_cast<char>(key.size()));
+  *out += key;
+  out->push_back(type);
+  put_u32(length, out);
+}
+} // namespace
+
+void encode_frame(json *object, const std::set<std::string> &big,
+                  std::vector<std::string> *pieces) {
+  pieces->clear();
+  pieces->emplace_back(FRAME_HEADER, '\0');
+  for (auto &item : object->items()) {
+    std::string key = item.key().substr(0, 255);
+    json &value = item.value();
+    std::string &out = pieces->back();
+    if (value.is_string() && big.count(key) > 0) {
+      std::string text = std::move(value.get_ref<std::string &>());
+      put_field(key, STRING, text.size(), &out);
+      pieces->push_back(std::move(text));
+      pieces->emplace_back();
+    } else if (value.is_string()) {
+      const std::string &text = value.get_ref<const std::string &>();
+      put_field(key, STRING, text.size(), &out);
+      out += text;
+    } else if (value.is_boolean()) {
+      put_field(key, BOOLEAN, 1, &out);
+      out.push_back(value.get<bool>() ? 1 : 0);
+    } else if (value.is_number_integer()) {
+      put_field(key, INTEGER, 8, &out);
+      put_u64(static_cast<uint64_t>(value.get<int64_t>()), &out);
+    } else if (value.is_number_float()) {
+      double d = value.get<double>();
+      uint64_t bits;
+      std::memcpy(&bits, &d, sizeof(bits));
+      put_field(key, DOUBLE, 8, &out);
+      put_u64(bits, &out);
+    } else {
+      std::string text = value.dump();
+      put_field(key, JSON, text.size(), &out);
+      out += text;
+    }
+  }
+  if (pieces->size() > 1 && pieces->back().empty())
+    pieces->pop_back();
+  size_t length = 0;
+  for (auto &piece : *pieces)
+    length += piece.size();
+  std::string header;
+  put_u32(length - FRAME_HEADER, &header);
+  (*pieces)[0].replace(0, FRAME_HEADER, header);
+}
+
+size_t frame_length(const char *header) {
+  return get_be(header, FRAME_HEADER);
+}
+
+bool decode_frame(const std::string &fields, json *object,
+                  std::string *error) {
+  *object = json::object();
+  for (size_t where = 0; where < fields.size();) {
+    size_t key_length = static_cast<unsigned char>(fields[where++]);
+    if (key_length + 5 > fields.size() - where) {
+      safe_error(error) = "Truncated frame field";
+      return false;
+    }
+    std::string key = fields.substr(where, key_length);
+    where += key_length;
+    char type = fields[where++];
+    size_t length = get_be(fields.data() + where, 4);
+    where += 4;
+    if (length > fields.size() - where) {
+      safe_error(error) = "Truncated frame field";
+      return false;
+    }
+    const char *value = fields.data() + where;
+    if (type == STRING) {
+      (*object)[key] = std::string(value, length);
+    } else if (type == BOOLEAN && length == 1) {
+      (*object)[key] = value[0] != 0;
+    } else if (type == INTEGER && length == 8) {
+      (*object)[key] = static_cast<int64_t>(get_be(value, 8));
+    } else if (type == DOUBLE && length == 8) {
+      uint64_t bits = get_be(value, 8);
+      double d;
+      std::memcpy(&d, &bits, sizeof(d));
+      (*object)[key] = d;
+    } else if (type == JSON) {
+      try {
+        (*object)[key] = json::parse(std::string(value, length));
+      } catch (json::parse_error &e) {
+        safe_error(error) = "Bad JSON in frame field";
+        return false;
+      }
+    } else {
+      safe_error(error) = "Bad frame field type";
+      return false;
+    }
+    where += length;
+  }
+  return true;
+}
+
+} // namespace cottontail
@@ -0,0 +1,41 @@
+#ifndef COTTONTAIL_APPS_FRAMES_H_
+#define COTTONTAIL_APPS_FRAMES_H_
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "src/nlohmann.h"
+
+namespace cottontail {
+
+// Length-prefixed binary frames, the alternative to JSON lines spoken by
+// ssr-server once a connection asks for it. A frame is a four-byte
+// big-endian length followed by that many bytes of fields. Each field is a
+// one-byte key length, the key, a one-byte type, a four-byte big-endian
+// value length and the value. Values are strings, eight-byte big-endian
+// integers and doubles, one-byte booleans, or JSON text for anything
+// nested, so a frame carries the same flat objects as a JSON line without
+// escaping any text.
+static const size_t FRAME_HEADER = 4;
+static const size_t MAX_FRAME = 64 * 1024 * 1024;
+
+// Encodes the object as a frame split into pieces, moving the string values
+// of any big fields out of the object into pieces of their own, so that
+// they can be sent by scatter-gather I/O without being copied.
+void encode_frame(json *object, const std::set<std::string> &big,
+                  std::vector<std::string> *pieces);
+inline std::string encode_frame(json object) {
+  std::vector<std::string> pieces;
+  encode_frame(&object, {}, &pieces);
+  return pieces.empty() ? "" : pieces[0];
+}
+// The length of the fields following a frame header.
+size_t frame_length(const char *header);
+// Decodes the fields of a frame, without its header.
+bool decode_frame(const std::string &fields, json *object,
+                  std::string *error = nullptr);
+
+} // namespace cottontail
+
+#endif // COTTONTAIL_APPS_FRAMES_H_
@@ -0,0 +1,109 @@
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "apps/http.h"
+#include "src/cottontail.h"
+
+namespace {
+
+constexpr size_t WORKERS = 4;
+constexpr long TEXT_CACHE_MEGABYTES = 64;
+
+void usage(const std::string &program_name) {
+  std::cerr << "usage: " << program_name
+            << " [--port n] [--workers n] [--pipeline pipeline] "
+            << "[--stats name] [--gcl-cache megabytes] "
+            << "[--text-cache megabytes] burrow\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string program_name = argv[0];
+  std::vector<std::string> arguments;
+  std::map<std::string, long> numbers = {
+      {"--port", 0},
+      {"--workers", WORKERS},
+      {"--gcl-cache", 0},
+      {"--text-cache", TEXT_CACHE_MEGABYTES}};
+  std::string pipeline = "bm25";
+  std::string stats_name = "";
+  for (int i = 1; i < argc; i++) {
+    std::string argument = argv[i];
+    if (argument == "--help") {
+      usage(program_name);
+      return 0;
+    } else if (argument == "--pipeline" || argument == "--stats") {
+      if (++i >= argc) {
+        std::cerr << program_name << ": missing " << argument << " value\n";
+        return 1;
+      }
+      (argument == "--pipeline" ? pipeline : stats_name) = argv[i];
+    } else if (numbers.count(argument) > 0) {
+      if (++i >= argc) {
+        std::cerr << program_name << ": missing " << argument << " value\n";
+        return 1;
+      }
+      long value;
+      try {
+        value = std::stol(argv[i]);
+      } catch (...) {
+        value = -1;
+      }
+      if (value < 0 || (argument == "--workers" && value == 0) ||
+          (argument == "--port" && value > 65535)) {
+        std::cerr << program_name << ": bad " << argument
+                  << " value: " << argv[i] << "\n";
+        return 1;
+      }
+      numbers[argument] = value;
+    } else {
+      arguments.push_back(argument);
+    }
+  }
+  if (arguments.size() != 1) {
+    usage(program_name);
+    return 1;
+  }
+  std::string error;
+  std::string burrow = arguments[0];
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make(burrow, &error);
+  if (warren == nullptr) {
+    std::cerr << program_name << ": " << burrow << ": " << error << "\n";
+    return 1;
+  }
+  if (numbers["--gcl-cache"] > 0)
+    warren->set_gcl_cache(
+        cottontail::gcl::Cache::make(numbers["--gcl-cache"] * 1024 * 1024));
+  warren->start();
+  std::shared_ptr<cottontail::QueryContextPool> pool =
+      cottontail::QueryContextPool::make(warren, stats_name, "", &error);
+  if (pool == nullptr) {
+    std::cerr << program_name << ": " << burrow << ": " << error << "\n";
+    warren->end();
+    return 1;
+  }
+  uint16_t actual_port = 0;
+  int server = cottontail::http::listen_local(numbers["--port"], &actual_port);
+  if (server < 0) {
+    std::cerr << program_name << ": cannot listen: " << std::strerror(errno)
+              << "\n";
+    return 1;
+  }
+  std::cerr << program_name << ": listening on port " << actual_port << "\n";
+  cottontail::http::Service service(burrow, warren, pool, pipeline,
+                  numbers["--text-cache"] > 0
+                      ? cottontail::TextCache::make(numbers["--text-cache"] *
+                                                    1024 * 1024)
+                      : nullptr);
+  cottontail::http::EventLoop loop(&service, server, numbers["--workers"]);
+  loop.run(&error);
+  std::cerr << program_name << ": " << error << "\n";
+  return 1;
+}
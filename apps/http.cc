@@ -0,0 +1,862 @@
+#include "apps/http.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "src/cottontail.h"
+#include "src/nlohmann.h"
+
+namespace cottontail {
+namespace http {
+
+namespace {
+// Requests waiting for a worker; beyond this they are answered as busy
+constexpr size_t BACKLOG = 256;
+constexpr addr SNIPPET_TOKENS = 40;
+// Upper bounds of the latency histogram buckets, in seconds
+const std::vector<double> BUCKETS = {0.0005, 0.001, 0.0025, 0.005, 0.01,
+                                     0.025,  0.05,  0.1,    0.25,  0.5,
+                                     1.0,    2.5,   5.0,    10.0};
+
+std::string url_decode(const std::string &text) {
+  std::string decoded;
+  for (size_t i = 0; i < text.size(); i++) {
+    if (text[i] == '+') {
+      decoded.push_back(' ');
+    } else if (text[i] == '%' && i + 2 < text.size() &&
+               std::isxdigit((unsigned char)text[i + 1]) &&
+               std::isxdigit((unsigned char)text[i + 2])) {
+      decoded.push_back((char)std::stoi(text.substr(i + 1, 2), nullptr, 16));
+      i += 2;
+    } else {
+      decoded.push_back(text[i]);
+    }
+  }
+  return decoded;
+}
+
+void form_parameters(const std::string &text,
+                     std::map<std::string, std::string> *parameters) {
+  size_t begin = 0;
+  while (begin <= text.size()) {
+    size_t end = text.find('&', begin);
+    if (end == std::string::npos)
+      end = text.size();
+    std::string pair = text.substr(begin, end - begin);
+    if (!pair.empty()) {
+      size_t equals = pair.find('=');
+      if (equals == std::string::npos)
+        (*parameters)[url_decode(pair)] = "";
+      else
+        (*parameters)[url_decode(pair.substr(0, equals))] =
+            url_decode(pair.substr(equals + 1));
+    }
+    begin = end + 1;
+  }
+}
+
+std::string lowercase(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return text;
+}
+
+std::string reason(int status) {
+  switch (status) {
+  case 200:
+    return "OK";
+  case 400:
+    return "Bad Request";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  case 413:
+    return "Payload Too Large";
+  case 503:
+    return "Service Unavailable";
+  default:
+    return "Internal Server Error";
+  }
+}
+
+void gauge(std::ostream &out, const std::string &name, const std::string &help,
+           double value, const std::string &type = "gauge") {
+  out << "# HELP " << name << " " << help << "\n"
+      << "# TYPE " << name << " " << type << "\n"
+      << name << " " << value << "\n";
+}
+
+bool number_parameter(const Request &request, const std::string &name,
+                      long long fallback, long long *value,
+                      std::string *error) {
+  auto found = request.parameters.find(name);
+  if (found == request.parameters.end()) {
+    *value = fallback;
+    return true;
+  }
+  try {
+    size_t used;
+    *value = std::stoll(found->second, &used);
+    if (used == found->second.size())
+      return true;
+  } catch (...) {
+  }
+  *error = "Bad value for " + name + ": " + found->second;
+  return false;
+}
+
+bool nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+} // namespace
+
+std::string http_response(const Response &response, bool keep_alive) {
+  std::string head = "HTTP/1.1 " + std::to_string(response.status) + " " +
+                     reason(response.status) + "\r\nContent-Type: " +
+                     response.type + "\r\nContent-Length: " +
+                     std::to_string(response.body.size()) + "\r\nConnection: ";
+  head += keep_alive ? "keep-alive\r\n\r\n" : "close\r\n\r\n";
+  return head + response.body;
+}
+
+Response error_response(int status, const std::string &error) {
+  json body;
+  body["ok"] = false;
+  body["error"] = error;
+  Response response;
+  response.status = status;
+  response.body = body.dump() + "\n";
+  return response;
+}
+
+size_t parse_request(const std::string &input, Request *request,
+                     int *status) {
+  *status = 0;
+  size_t header_end = input.find("\r\n\r\n");
+  if (header_end == std::string::npos) {
+    if (input.size() > MAX_HEADER)
+      *status = 413;
+    return 0;
+  }
+  std::istringstream head(input.substr(0, header_end));
+  std::string line, target, version;
+  std::getline(head, line);
+  if (!line.empty() && line.back() == '\r')
+    line.pop_back();
+  std::istringstream request_line(line);
+  if (!(request_line >> request->method >> target >> version) ||
+      version.compare(0, 5, "HTTP/") != 0) {
+    *status = 400;
+    return 0;
+  }
+  std::map<std::string, std::string> headers;
+  while (std::getline(head, line)) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    size_t colon = line.find(':');
+    if (colon == std::string::npos)
+      continue;
+    std::string value = line.substr(colon + 1);
+    value.erase(0, value.find_first_not_of(" \t"));
+    headers[lowercase(line.substr(0, colon))] = value;
+  }
+  if (headers.count("transfer-encoding") > 0) {
+    *status = 400;
+    return 0;
+  }
+  size_t length = 0;
+  if (headers.count("content-length") > 0) {
+    try {
+      length = std::stoul(headers["content-length"]);
+    } catch (...) {
+      *status = 400;
+      return 0;
+    }
+    if (length > MAX_BODY) {
+      *status = 413;
+      return 0;
+    }
+  }
+  if (input.size() < header_end + 4 + length)
+    return 0;
+  std::string connection = lowercase(headers["connection"]);
+  request->keep_alive = version == "HTTP/1.0" ? connection == "keep-alive"
+                                              : connection != "close";
+  size_t question = target.find('?');
+  request->path = url_decode(target.substr(0, question));
+  request->parameters.clear();
+  if (question != std::string::npos)
+    form_parameters(target.substr(question + 1), &request->parameters);
+  std::string body = input.substr(header_end + 4, length);
+  if (request->method == "POST" && !body.empty()) {
+    if (lowercase(headers["content-type"]).find("json") !=
+        std::string::npos) {
+      try {
+        json object = json::parse(body);
+        if (!object.is_object()) {
+          *status = 400;
+          return 0;
+        }
+        for (auto &item : object.items()) {
+          json value = item.value();
+          request->parameters[item.key()] =
+              value.is_string() ? value.get<std::string>() : value.dump();
+        }
+      } catch (json::exception &e) {
+        *status = 400;
+        return 0;
+      }
+    } else {
+      form_parameters(body, &request->parameters);
+    }
+  }
+  return header_end + 4 + length;
+}
+
+int listen_local(uint16_t port, uint16_t *actual_port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  int yes = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+  if (listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return -1;
+  }
+  socklen_t length = sizeof(address);
+  if (getsockname(fd, reinterpret_cast<sockaddr *>(&address), &length) != 0) {
+    close(fd);
+    return -1;
+  }
+  *actual_port = ntohs(address.sin_port);
+  return fd;
+}
+
+void Metrics::record(const std::string &endpoint, int status, double seconds) {
+  std::lock_guard<std::mutex> guard(lock_);
+  Histogram &histogram = latency_[endpoint];
+  if (histogram.buckets.empty())
+    histogram.buckets.assign(BUCKETS.size(), 0);
+  for (size_t i = 0; i < BUCKETS.size(); i++)
+    if (seconds <= BUCKETS[i]) {
+      histogram.buckets[i]++;
+      break;
+    }
+  histogram.count++;
+  histogram.sum += seconds;
+  requests_[std::make_pair(endpoint, status)]++;
+}
+
+void Metrics::exposition(std::ostream &out) {
+  std::lock_guard<std::mutex> guard(lock_);
+  out << "# HELP cottontail_http_requests_total Requests answered.\n"
+      << "# TYPE cottontail_http_requests_total counter\n";
+  for (auto &request : requests_)
+    out << "cottontail_http_requests_total{endpoint=\"" << request.first.first
+        << "\",code=\"" << request.first.second << "\"} " << request.second
+        << "\n";
+  out << "# HELP cottontail_http_request_duration_seconds Time taken to "
+      << "answer requests.\n"
+      << "# TYPE cottontail_http_request_duration_seconds histogram\n";
+  for (auto &endpoint : latency_) {
+    std::string prefix =
+        "cottontail_http_request_duration_seconds_bucket{endpoint=\"" +
+        endpoint.first + "\",le=\"";
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < BUCKETS.size(); i++) {
+      cumulative += endpoint.second.buckets[i];
+      out << prefix << BUCKETS[i] << "\"} " << cumulative << "\n";
+    }
+    out << prefix << "+Inf\"} " << endpoint.second.count << "\n";
+    out << "cottontail_http_request_duration_seconds_sum{endpoint=\""
+        << endpoint.first << "\"} " << endpoint.second.sum << "\n";
+    out << "cottontail_http_request_duration_seconds_count{endpoint=\""
+        << endpoint.first << "\"} " << endpoint.second.count << "\n";
+  }
+}
+
+Service::Service(const std::string &burrow, std::shared_ptr<Warren> warren,
+                 std::shared_ptr<QueryContextPool> pool,
+                 const std::string &pipeline,
+                 std::shared_ptr<TextCache> text_cache)
+    : burrow_(burrow), warren_(warren), pool_(pool), pipeline_(pipeline),
+      text_cache_(text_cache),
+      bigwig_(std::dynamic_pointer_cast<Bigwig>(warren)) {}
+
+Response Service::handle(const Request &request) {
+  auto start = std::chrono::steady_clock::now();
+  std::string endpoint = "other";
+  Response response;
+  if (request.method != "GET" && request.method != "POST") {
+    response = error_response(405, "Method not allowed");
+  } else if (request.path == "/query") {
+    endpoint = "query";
+    response = query(request);
+  } else if (request.path == "/rank") {
+    endpoint = "rank";
+    response = rank(request);
+  } else if (request.path == "/document") {
+    endpoint = "document";
+    response = document(request);
+  } else if (request.path == "/stats") {
+    endpoint = "stats";
+    response = stats();
+  } else if (request.path == "/metrics") {
+    endpoint = "metrics";
+    response = metrics();
+  } else {
+    response = error_response(404, "Unknown path: " + request.path);
+  }
+  record(endpoint, response.status, start);
+  return response;
+}
+
+void Service::record(const std::string &endpoint, int status,
+                     std::chrono::steady_clock::time_point start) {
+  metrics_.record(
+      endpoint, status,
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count());
+}
+
+// Intervals matching a GCL expression, n at a time from an address.
+Response Service::query(const Request &request) {
+  auto gcl = request.parameters.find("gcl");
+  if (gcl == request.parameters.end())
+    return error_response(400, "Missing gcl");
+  long long n, from;
+  std::string error;
+  if (!number_parameter(request, "n", RESULTS, &n, &error) ||
+      !number_parameter(request, "from", 0, &from, &error))
+    return error_response(400, error);
+  n = std::max(0LL, std::min(n, MAX_RESULTS));
+  std::shared_ptr<QueryContext> context = pool_->acquire(&error);
+  if (context == nullptr)
+    return error_response(500, error);
+  std::shared_ptr<Warren> warren = context->warren();
+  std::unique_ptr<Hopper> hopper =
+      warren->cached_hopper_from_gcl(gcl->second, &error);
+  if (hopper == nullptr)
+    return error_response(400, error.empty() ? "Cannot parse gcl" : error);
+  bool text = request.parameters.count("text") > 0;
+  json results = json::array();
+  addr p, q;
+  fval v;
+  hopper->tau(from, &p, &q, &v);
+  for (long long i = 0; i < n && p < maxfinity; i++) {
+    json result;
+    result["p"] = p;
+    result["q"] = q;
+    result["v"] = v;
+    if (text)
+      result["text"] = translate(warren, p, q);
+    results.push_back(result);
+    hopper->tau(p + 1, &p, &q, &v);
+  }
+  json body;
+  body["ok"] = true;
+  body["results"] = results;
+  if (p < maxfinity)
+    body["next"] = p;
+  Response response;
+  response.body = body.dump() + "\n";
+  return response;
+}
+
+// Results of a ranking pipeline, with snippets of their containers.
+Response Service::rank(const Request &request) {
+  auto query = request.parameters.find("query");
+  if (query == request.parameters.end())
+    return error_response(400, "Missing query");
+  auto found = request.parameters.find("pipeline");
+  std::string pipeline =
+      found == request.parameters.end() ? pipeline_ : found->second;
+  long long n;
+  std::string error;
+  if (!number_parameter(request, "n", RESULTS, &n, &error))
+    return error_response(400, error);
+  n = std::max(0LL, std::min(n, MAX_RESULTS));
+  std::shared_ptr<QueryContext> context = pool_->acquire(&error);
+  if (context == nullptr)
+    return error_response(500, error);
+  std::shared_ptr<Ranker> ranker = context->ranker(pipeline, &error);
+  if (ranker == nullptr)
+    return error_response(400, error);
+  std::shared_ptr<Warren> warren = context->warren();
+  std::vector<std::string> terms;
+  for (auto &token : warren->tokenizer()->split(query->second)) {
+    terms.push_back(token);
+    terms.push_back(warren->stemmer()->stem(token));
+  }
+  json results = json::array();
+  size_t rank = 0;
+  for (auto &result : ranker->page(query->second, n)) {
+    json item;
+    item["rank"] = ++rank;
+    item["p"] = result.p();
+    item["q"] = result.q();
+    item["score"] = result.score();
+    addr p = result.p(), q = result.q();
+    if (result.container_p() <= p && q <= result.container_q()) {
+      item["container_p"] = p = result.container_p();
+      item["container_q"] = q = result.container_q();
+    }
+    Snippet snippet;
+    if (cottontail::snippet(warren, terms, p, q, SNIPPET_TOKENS, &snippet,
+                            text_cache_, burrow_)) {
+      item["snippet"] = snippet.text;
+      item["highlights"] = snippet.highlights;
+    }
+    results.push_back(item);
+  }
+  json body;
+  body["ok"] = true;
+  body["pipeline"] = pipeline;
+  body["results"] = results;
+  Response response;
+  response.body = body.dump() + "\n";
+  return response;
+}
+
+// Text of the tokens from p through q, or of the first MAX_TOKENS of them,
+// when next gives where the rest start.
+Response Service::document(const Request &request) {
+  long long p, q;
+  std::string error;
+  if (request.parameters.count("p") == 0 ||
+      request.parameters.count("q") == 0)
+    return error_response(400, "Missing p or q");
+  if (!number_parameter(request, "p", 0, &p, &error) ||
+      !number_parameter(request, "q", 0, &q, &error))
+    return error_response(400, error);
+  if (p < 0 || p > q)
+    return error_response(400, "Bad range");
+  std::shared_ptr<QueryContext> context = pool_->acquire(&error);
+  if (context == nullptr)
+    return error_response(500, error);
+  json body;
+  body["ok"] = true;
+  body["p"] = p;
+  if (q - p >= MAX_TOKENS) {
+    q = p + MAX_TOKENS - 1;
+    body["next"] = q + 1;
+  }
+  body["q"] = q;
+  body["text"] = translate(context->warren(), p, q);
+  Response response;
+  response.body = body.dump() + "\n";
+  return response;
+}
+
+Response Service::stats() {
+  json body;
+  body["ok"] = true;
+  body["burrow"] = burrow_;
+  body["warren"] = warren_->name();
+  body["tokens"] = warren_->txt()->tokens();
+  body["snapshot"] = warren_->snapshot();
+  body["idle_contexts"] = pool_->idle();
+  body["connections"] = connections_.load();
+  if (bigwig_ != nullptr) {
+    body["shards"] = bigwig_->shards();
+    body["merging"] = bigwig_->merging();
+  }
+  if (warren_->gcl_cache() != nullptr) {
+    gcl::CacheMetrics metrics = warren_->gcl_cache()->metrics();
+    json cache;
+    cache["hits"] = metrics.hits;
+    cache["misses"] = metrics.misses;
+    cache["entries"] = metrics.entries;
+    cache["bytes"] = metrics.bytes;
+    body["gcl_cache"] = cache;
+  }
+  if (text_cache_ != nullptr) {
+    json cache;
+    cache["hits"] = text_cache_->hits();
+    cache["misses"] = text_cache_->misses();
+    cache["bytes"] = text_cache_->bytes();
+    body["text_cache"] = cache;
+  }
+  Response response;
+  response.body = body.dump() + "\n";
+  return response;
+}
+
+Response Service::metrics() {
+  std::ostringstream out;
+  metrics_.exposition(out);
+  gauge(out, "cottontail_http_connections", "Open client connections.",
+        connections_.load());
+  gauge(out, "cottontail_tokens", "Tokens in the warren.",
+        warren_->txt()->tokens());
+  gauge(out, "cottontail_snapshot", "Snapshot of the warren.",
+        warren_->snapshot());
+  if (bigwig_ != nullptr) {
+    gauge(out, "cottontail_bigwig_shards", "Shards of the bigwig.",
+          bigwig_->shards());
+    gauge(out, "cottontail_bigwig_merge_backlog",
+          "Shards being merged in the background.", bigwig_->merging());
+  }
+  auto ratio = [](double hits, double misses) {
+    return hits + misses == 0.0 ? 0.0 : hits / (hits + misses);
+  };
+  if (warren_->gcl_cache() != nullptr) {
+    gcl::CacheMetrics metrics = warren_->gcl_cache()->metrics();
+    gauge(out, "cottontail_gcl_cache_hits_total", "GCL cache hits.",
+          metrics.hits, "counter");
+    gauge(out, "cottontail_gcl_cache_misses_total", "GCL cache misses.",
+          metrics.misses, "counter");
+    gauge(out, "cottontail_gcl_cache_hit_ratio",
+          "Fraction of GCL cache lookups that hit.",
+          ratio(metrics.hits, metrics.misses));
+    gauge(out, "cottontail_gcl_cache_bytes", "Bytes held by the GCL cache.",
+          metrics.bytes);
+  }
+  if (text_cache_ != nullptr) {
+    double hits = text_cache_->hits(), misses = text_cache_->misses();
+    gauge(out, "cottontail_text_cache_hits_total", "Text cache hits.", hits,
+          "counter");
+    gauge(out, "cottontail_text_cache_misses_total", "Text cache misses.",
+          misses, "counter");
+    gauge(out, "cottontail_text_cache_hit_ratio",
+          "Fraction of text cache lookups that hit.", ratio(hits, misses));
+    gauge(out, "cottontail_text_cache_bytes", "Bytes held by the text cache.",
+          text_cache_->bytes());
+  }
+  Response response;
+  response.type = "text/plain; version=0.0.4";
+  response.body = out.str();
+  return response;
+}
+
+std::string Service::translate(std::shared_ptr<Warren> warren, addr p,
+                               addr q) {
+  std::string text;
+  if (text_cache_ != nullptr &&
+      text_cache_->text(burrow_, warren->txt(), warren->tokenizer(), p, q,
+                        &text))
+    return text;
+  return warren->txt()->translate(p, q);
+}
+
+EventLoop::EventLoop(Service *service, int listener, size_t workers)
+    : service_(service), listener_(listener), workers_(workers),
+      epoll_(epoll_create1(0)), wake_(eventfd(0, EFD_NONBLOCK)) {}
+
+EventLoop::~EventLoop() {
+  if (epoll_ >= 0)
+    close(epoll_);
+  if (wake_ >= 0)
+    close(wake_);
+}
+
+bool EventLoop::run(std::string *error) {
+  if (epoll_ < 0 || wake_ < 0 || !nonblocking(listener_) ||
+      !watch(listener_, EPOLLIN) || !watch(wake_, EPOLLIN)) {
+    *error = std::strerror(errno);
+    return false;
+  }
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < workers_; i++)
+    threads.emplace_back(std::thread([this] { work(); }));
+  bool okay = true;
+  epoll_event events[64];
+  while (!stopping_) {
+    int n = epoll_wait(epoll_, events, 64, -1);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      *error = std::strerror(errno);
+      okay = false;
+      break;
+    }
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+      if (fd == listener_) {
+        accept_all();
+      } else if (fd == wake_) {
+        uint64_t count;
+        while (read(wake_, &count, sizeof(count)) > 0)
+          ;
+        std::vector<std::shared_ptr<Connection>> ready;
+        {
+          std::lock_guard<std::mutex> guard(lock_);
+          ready.swap(ready_);
+        }
+        for (auto &connection : ready) {
+          parse(connection);
+          flush(connection);
+        }
+      } else {
+        auto found = connections_.find(fd);
+        if (found == connections_.end())
+          continue;
+        std::shared_ptr<Connection> connection = found->second;
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+          receive(connection);
+        flush(connection);
+      }
+    }
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stopping_ = true;
+    tasks_.clear();
+  }
+  available_.notify_all();
+  for (auto &thread : threads)
+    thread.join();
+  while (!connections_.empty())
+    close_connection(connections_.begin()->second);
+  epoll_ctl(epoll_, EPOLL_CTL_DEL, listener_, nullptr);
+  epoll_ctl(epoll_, EPOLL_CTL_DEL, wake_, nullptr);
+  return okay;
+}
+
+void EventLoop::stop() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stopping_ = true;
+  }
+  available_.notify_all();
+  uint64_t one = 1;
+  if (write(wake_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    std::cerr << "http-server: cannot wake event loop\n";
+}
+
+bool EventLoop::watch(int fd, uint32_t events) {
+  epoll_event event;
+  std::memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.fd = fd;
+  return epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+void EventLoop::accept_all() {
+  for (;;) {
+    int fd = accept4(listener_, nullptr, nullptr, SOCK_NONBLOCK);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        std::cerr << "http-server: accept failed: " << std::strerror(errno)
+                  << "\n";
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    if (!watch(fd, EPOLLIN)) {
+      close(fd);
+      continue;
+    }
+    std::shared_ptr<Connection> connection = std::make_shared<Connection>();
+    connection->fd = fd;
+    connection->events = EPOLLIN;
+    connections_[fd] = connection;
+    service_->connected(1);
+  }
+}
+
+void EventLoop::receive(std::shared_ptr<Connection> connection) {
+  char buffer[65536];
+  for (;;) {
+    ssize_t n = recv(connection->fd, buffer, sizeof(buffer), 0);
+    if (n > 0) {
+      connection->input.append(buffer, n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      connection->reading = false;
+    break;
+  }
+  parse(connection);
+}
+
+// Hands the next complete request to the workers, unless one is already
+// with them. A bad request is answered here, and ends the connection.
+void EventLoop::parse(std::shared_ptr<Connection> connection) {
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> guard(connection->lock);
+      if (connection->busy || !connection->open)
+        return;
+    }
+    Request request;
+    int status;
+    size_t used = parse_request(connection->input, &request, &status);
+    if (status != 0) {
+      auto start = std::chrono::steady_clock::now();
+      connection->input.clear();
+      connection->reading = false;
+      queue(connection,
+            http_response(error_response(status, "Bad request"), false));
+      service_->record("other", status, start);
+      return;
+    }
+    if (used == 0) {
+      if (!connection->reading)
+        connection->input.clear();
+      return;
+    }
+    connection->input.erase(0, used);
+    if (!request.keep_alive) {
+      connection->reading = false;
+      connection->input.clear();
+    }
+    std::lock_guard<std::mutex> guard(lock_);
+    if (tasks_.size() >= BACKLOG) {
+      queue(connection,
+            http_response(error_response(503, "Busy"), request.keep_alive));
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> guard(connection->lock);
+      connection->busy = true;
+    }
+    tasks_.push_back(Task{connection, request});
+    available_.notify_one();
+    return;
+  }
+}
+
+void EventLoop::queue(std::shared_ptr<Connection> connection,
+                      std::string response) {
+  std::lock_guard<std::mutex> guard(connection->lock);
+  connection->output.push_back(std::move(response));
+}
+
+void EventLoop::work() {
+  for (;;) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> guard(lock_);
+      available_.wait(guard,
+                      [this] { return !tasks_.empty() || stopping_; });
+      if (stopping_)
+        return;
+      task = tasks_.front();
+      tasks_.pop_front();
+    }
+    Response response = service_->handle(task.request);
+    {
+      std::lock_guard<std::mutex> guard(task.connection->lock);
+      task.connection->output.push_back(
+          http_response(response, task.request.keep_alive));
+      task.connection->busy = false;
+    }
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      ready_.push_back(task.connection);
+    }
+    uint64_t one = 1;
+    if (write(wake_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+      std::cerr << "http-server: cannot wake event loop\n";
+  }
+}
+
+// Writes what it can of the queued responses, then watches for room to
+// write the rest, and closes the connection once the client has stopped
+// sending, or asked to close, and everything has been answered.
+void EventLoop::flush(std::shared_ptr<Connection> connection) {
+  {
+    std::lock_guard<std::mutex> guard(connection->lock);
+    if (!connection->open)
+      return;
+    std::deque<std::string> &output = connection->output;
+    while (!output.empty()) {
+      iovec pieces[64];
+      size_t count = 0;
+      for (auto it = output.begin(); it != output.end() && count < 64;
+           ++it, ++count) {
+        size_t skip = count == 0 ? connection->offset : 0;
+        pieces[count].iov_base = const_cast<char *>(it->data()) + skip;
+        pieces[count].iov_len = it->size() - skip;
+      }
+      msghdr message;
+      std::memset(&message, 0, sizeof(message));
+      message.msg_iov = pieces;
+      message.msg_iovlen = count;
+      ssize_t n = sendmsg(connection->fd, &message, MSG_NOSIGNAL);
+      if (n > 0) {
+        size_t sent = n;
+        while (sent > 0) {
+          size_t left = output.front().size() - connection->offset;
+          if (sent < left) {
+            connection->offset += sent;
+            break;
+          }
+          sent -= left;
+          output.pop_front();
+          connection->offset = 0;
+        }
+      } else if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        break;
+      } else {
+        connection->reading = false;
+        output.clear();
+        connection->offset = 0;
+      }
+    }
+    if (connection->reading || connection->busy || !output.empty()) {
+      uint32_t events = (connection->reading ? EPOLLIN : 0) |
+                        (output.empty() ? 0 : EPOLLOUT);
+      // Hangups are reported whatever the events asked for, so a connection
+      // with nothing to do is left out of epoll altogether.
+      if (events != connection->events) {
+        epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = events;
+        event.data.fd = connection->fd;
+        int op = events == 0                ? EPOLL_CTL_DEL
+                 : connection->events == 0 ? EPOLL_CTL_ADD
+                                           : EPOLL_CTL_MOD;
+        epoll_ctl(epoll_, op, connection->fd, &event);
+        connection->events = events;
+      }
+      return;
+    }
+  }
+  close_connection(connection);
+}
+
+void EventLoop::close_connection(std::shared_ptr<Connection> connection) {
+  {
+    std::lock_guard<std::mutex> guard(connection->lock);
+    connection->open = false;
+  }
+  if (connection->events != 0)
+    epoll_ctl(epoll_, EPOLL_CTL_DEL, connection->fd, nullptr);
+  close(connection->fd);
+  connections_.erase(connection->fd);
+  service_->connected(-1);
+}
+
+} // namespace http
+} // namespace cottontail
@@ -0,0 +1,173 @@
+#ifndef COTTONTAIL_APPS_HTTP_H_
+#define COTTONTAIL_APPS_HTTP_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "src/cottontail.h"
+
+namespace cottontail {
+namespace http {
+
+// HTTP/1.1 for http-server: requests are parsed by parse_request, answered
+// by a Service, and carried to and from clients by an EventLoop.
+static const size_t MAX_HEADER = 64 * 1024;
+static const size_t MAX_BODY = 16 * 1024 * 1024;
+static const long long RESULTS = 10;
+// Caps on the results of /query and /rank, and the tokens of /document
+static const long long MAX_RESULTS = 1000;
+static const long long MAX_TOKENS = 64 * 1024;
+
+struct Request {
+  std::string method;
+  std::string path;
+  std::map<std::string, std::string> parameters;
+  bool keep_alive = true;
+};
+
+struct Response {
+  int status = 200;
+  std::string type = "application/json";
+  std::string body;
+};
+
+// Parses a request from the start of the input, giving the bytes it took,
+// or zero when more input is needed. A bad request gives its status instead,
+// to be answered before the connection is closed. Parameters come from the
+// query string, and from a POST body, whether JSON or form encoded.
+size_t parse_request(const std::string &input, Request *request,
+                     int *status);
+std::string http_response(const Response &response, bool keep_alive);
+Response error_response(int status, const std::string &error);
+
+// A socket listening on the loopback interface, on any free port if port is
+// zero; -1 with errno set if it can't be made.
+int listen_local(uint16_t port, uint16_t *actual_port);
+
+// Request counts and latency histograms by endpoint, in the Prometheus text
+// format.
+class Metrics final {
+public:
+  Metrics(){};
+  void record(const std::string &endpoint, int status, double seconds);
+  void exposition(std::ostream &out);
+  Metrics(const Metrics &) = delete;
+  Metrics &operator=(const Metrics &) = delete;
+  Metrics(Metrics &&) = delete;
+  Metrics &operator=(Metrics &&) = delete;
+
+private:
+  struct Histogram {
+    std::vector<uint64_t> buckets;
+    uint64_t count = 0;
+    double sum = 0.0;
+  };
+  std::mutex lock_;
+  std::map<std::string, Histogram> latency_;
+  std::map<std::pair<std::string, int>, uint64_t> requests_;
+};
+
+// Answers requests against one warren from any thread, each through a clone
+// checked out of a pool.
+class Service final {
+public:
+  Service(const std::string &burrow, std::shared_ptr<Warren> warren,
+          std::shared_ptr<QueryContextPool> pool, const std::string &pipeline,
+          std::shared_ptr<TextCache> text_cache);
+  Response handle(const Request &request);
+  void record(const std::string &endpoint, int status,
+              std::chrono::steady_clock::time_point start);
+  void connected(int change) { connections_ += change; }
+  Service(const Service &) = delete;
+  Service &operator=(const Service &) = delete;
+  Service(Service &&) = delete;
+  Service &operator=(Service &&) = delete;
+
+private:
+  Response query(const Request &request);
+  Response rank(const Request &request);
+  Response document(const Request &request);
+  Response stats();
+  Response metrics();
+  std::string translate(std::shared_ptr<Warren> warren, addr p, addr q);
+  std::string burrow_;
+  std::shared_ptr<Warren> warren_;
+  std::shared_ptr<QueryContextPool> pool_;
+  std::string pipeline_;
+  std::shared_ptr<TextCache> text_cache_;
+  std::shared_ptr<Bigwig> bigwig_;
+  std::atomic<long> connections_{0};
+  Metrics metrics_;
+};
+
+// Accepts any number of clients on one thread, parsing their requests and
+// handing them to a fixed pool of workers. HTTP/1.1 answers pipelined
+// requests in order, so a connection has one request with the workers at a
+// time, and the next is parsed once its response is queued.
+class EventLoop final {
+public:
+  EventLoop(Service *service, int listener, size_t workers);
+  // Serves until stopped, or until it fails, closing its connections but
+  // not the listener.
+  bool run(std::string *error);
+  // Ends run from any thread.
+  void stop();
+  ~EventLoop();
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+  EventLoop(EventLoop &&) = delete;
+  EventLoop &operator=(EventLoop &&) = delete;
+
+private:
+  struct Connection {
+    int fd = -1;
+    // Owned by the event loop
+    std::string input;
+    bool reading = true;
+    uint32_t events = 0;
+    // Shared with the workers
+    std::mutex lock;
+    bool busy = false;
+    std::deque<std::string> output;
+    size_t offset = 0;
+    bool open = true;
+  };
+  struct Task {
+    std::shared_ptr<Connection> connection;
+    Request request;
+  };
+  bool watch(int fd, uint32_t events);
+  void accept_all();
+  void receive(std::shared_ptr<Connection> connection);
+  void parse(std::shared_ptr<Connection> connection);
+  void queue(std::shared_ptr<Connection> connection, std::string response);
+  void work();
+  void flush(std::shared_ptr<Connection> connection);
+  void close_connection(std::shared_ptr<Connection> connection);
+  Service *service_;
+  int listener_;
+  size_t workers_;
+  int epoll_ = -1;
+  int wake_ = -1;
+  std::atomic<bool> stopping_{false};
+  std::map<int, std::shared_ptr<Connection>> connections_;
+  std::mutex lock_;
+  std::condition_variable available_;
+  std::deque<Task> tasks_;
+  std::vector<std::shared_ptr<Connection>> ready_;
+};
+
+} // namespace http
+} // namespace cottontail
+
+#endif // COTTONTAIL_APPS_HTTP_H_
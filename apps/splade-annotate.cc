@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <string>
 
 #include "src/cottontail.h"
 #include "src/json.h"
@@ -70,6 +73,7 @@ int main(int argc, char **argv) {
     warren->end();
     return 1;
   }
+  std::map<std::string, cottontail::addr> maxima;
   std::string line;
   unsigned number = 0;
   while (std::getline(vectorsf, line)) {
@@ -124,9 +128,17 @@ int main(int argc, char **argv) {
           warren->end();
           return 1;
         }
+        cottontail::addr &maximum = maxima[element.key()];
+        maximum = std::max(maximum, value);
       }
     }
   }
+  if (!cottontail::impact_max_annotations(warren, maxima, "splade", &error)) {
+    std::cerr << program_name << ": error: " << error << "\n";
+    warren->annotator()->abort();
+    warren->end();
+    return 1;
+  }
   if (warren->annotator()->ready()) {
     warren->annotator()->commit();
   } else {
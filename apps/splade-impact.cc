@@ -0,0 +1,76 @@
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "src/cottontail.h"
+#include "src/json.h"
+#include "src/nlohmann.h"
+
+void usage(std::string program_name) {
+  std::cerr << "usage: " << program_name << " [--burrow burrow] vectors\n";
+}
+
+int main(int argc, char **argv) {
+  std::string program_name = argv[0];
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  if (argc == 2 && argv[1] == std::string("--help")) {
+    usage(program_name);
+    return 0;
+  }
+  if (argc > 2 &&
+      (argv[1] == std::string("-b") || argv[1] == std::string("--burrow"))) {
+    burrow = argv[2];
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc != 2) {
+    usage(program_name);
+    return 1;
+  }
+  std::string vectors = argv[1];
+  std::ifstream vectorsf(vectors);
+  if (vectorsf.fail()) {
+    std::cerr << program_name << ": can't open splade vectors: " << vectors
+              << "\n";
+    return 1;
+  }
+  // The vocabulary is whatever appears in the vectors passed to
+  // splade-annotate
+  std::set<std::string> vocabulary;
+  std::string line;
+  unsigned number = 0;
+  while (std::getline(vectorsf, line)) {
+    number++;
+    json j;
+    try {
+      j = json::parse(line);
+    } catch (json::parse_error &e) {
+      std::cerr << program_name << ": can't parse JSON: " << number << ": "
+                << vectors << "\n";
+      continue;
+    }
+    if (!j["splade_vector"].is_object())
+      continue;
+    for (auto &element : j["splade_vector"].items())
+      vocabulary.insert(element.key());
+  }
+  std::string error;
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", burrow, &error);
+  if (warren == nullptr) {
+    std::cerr << program_name << ": " << error << "\n";
+    return 1;
+  }
+  warren->start();
+  std::vector<std::string> terms(vocabulary.begin(), vocabulary.end());
+  std::shared_ptr<cottontail::ImpactIndex> index =
+      cottontail::ImpactIndex::build(warren, "splade", terms, true, &error);
+  if (index == nullptr || !index->store(warren->working(), "splade", &error)) {
+    std::cerr << program_name << ": error: " << error << "\n";
+    warren->end();
+    return 1;
+  }
+  warren->end();
+  return 0;
+}
@@ -14,7 +14,7 @@
 
 void usage(std::string program_name) {
   std::cerr << "usage: " << program_name
-            << " [--threads n] [--burrow burrow] queries\n";
+            << " [--threads n] [--burrow burrow] [--impact postings] queries\n";
 }
 
 constexpr int THREADS = 50;
@@ -52,6 +52,26 @@ int main(int argc, char **argv) {
     usage(program_name);
     return 1;
   }
+  // Anytime ranking over the impact index from splade-impact, stopping
+  // after this many postings (0 for all of them)
+  bool impact = false;
+  size_t postings = 0;
+  if (argc > 2 &&
+      (argv[1] == std::string("-i") || argv[1] == std::string("--impact"))) {
+    impact = true;
+    try {
+      postings = std::stoul(argv[2]);
+    } catch (std::exception &e) {
+      usage(program_name);
+      return 1;
+    }
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc < 2) {
+    usage(program_name);
+    return 1;
+  }
   std::string queries_filename = argv[1];
   std::string runid = "cottontail";
   std::string error;
@@ -75,6 +95,14 @@ int main(int argc, char **argv) {
               << "\n";
     return 1;
   }
+  std::shared_ptr<cottontail::ImpactIndex> index;
+  if (impact) {
+    index = cottontail::ImpactIndex::load(warren->working(), "splade", &error);
+    if (index == nullptr) {
+      std::cerr << program_name << ": " << error << "\n";
+      return 1;
+    }
+  }
   std::ifstream queriesf(queries_filename);
   if (queriesf.fail()) {
     std::cerr << program_name << ": can't open queries: " + queries_filename
@@ -124,7 +152,9 @@ int main(int argc, char **argv) {
       parameters["splade:depth"] = 10;
       std::string topic = topics[j];
       std::vector<cottontail::RankingResult> ranking =
-          product_ranking(warren, queries[topic], parameters, "splade", true);
+          impact ? index->rank(queries[topic], 10, postings)
+                 : product_ranking(warren, queries[topic], parameters,
+                                   "splade", true);
       output_lock.lock();
       if (ranking.size() == 0) {
         std::cerr << program_name << ": no results for topic \"" << topic
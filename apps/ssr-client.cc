@@ -1,7 +1,14 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -11,14 +18,27 @@
 #include <readline/history.h>
 #include <readline/readline.h>
 
+#include "apps/frames.h"
 #include "src/nlohmann.h"
 
 namespace {
 
 void usage(const std::string &program_name) {
-  std::cerr << "usage: " << program_name << " port\n";
+  std::cerr << "usage: " << program_name
+            << " [--binary] [--load queries [--connections n] "
+            << "[--results k]] port\n";
 }
 
+constexpr size_t CONNECTIONS = 8;
+constexpr size_t RESULTS = 10;
+
+// A connection to the server, buffering what it has received.
+struct Server {
+  int fd = -1;
+  bool binary = false;
+  std::string received;
+};
+
 int connect_local(uint16_t port) {
   int fd = socket(AF_INET, SOCK_STREAM, 0);
   if (fd < 0)
@@ -49,29 +69,78 @@ ssize_t write_all(int fd, const std::string &text) {
   return static_cast<ssize_t>(text.size());
 }
 
-bool read_line(int fd, std::string *line) {
-  line->clear();
-  for (;;) {
-    char c;
-    ssize_t n = recv(fd, &c, 1, 0);
-    if (n == 0)
+bool receive_more(Server *server) {
+  char buffer[64 * 1024];
+  ssize_t n;
+  do {
+    n = recv(server->fd, buffer, sizeof(buffer), 0);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0)
+    return false;
+  server->received.append(buffer, n);
+  return true;
+}
+
+bool read_line(Server *server, std::string *line) {
+  size_t end;
+  while ((end = server->received.find('\n')) == std::string::npos)
+    if (!receive_more(server)) {
+      *line = server->received;
+      server->received.clear();
       return !line->empty();
-    if (n < 0)
+    }
+  *line = server->received.substr(0, end);
+  server->received.erase(0, end + 1);
+  if (!line->empty() && line->back() == '\r')
+    line->pop_back();
+  return true;
+}
+
+bool read_frame(Server *server, std::string *fields) {
+  while (server->received.size() < cottontail::FRAME_HEADER)
+    if (!receive_more(server))
       return false;
-    if (c == '\n')
-      return true;
-    if (c != '\r')
-      line->push_back(c);
-  }
+  size_t length = cottontail::frame_length(server->received.data());
+  if (length > cottontail::MAX_FRAME)
+    return false;
+  while (server->received.size() < cottontail::FRAME_HEADER + length)
+    if (!receive_more(server))
+      return false;
+  *fields = server->received.substr(cottontail::FRAME_HEADER, length);
+  server->received.erase(0, cottontail::FRAME_HEADER + length);
+  return true;
 }
 
-bool request(int fd, const json &query, json *record,
+// Sends the query and reads the record of its response. Binary responses
+// carry the time taken in the response itself, which is moved into the
+// record to match the JSON lines.
+bool request(Server *server, const json &query, json *record,
              const std::string &program_name) {
+  if (server->binary) {
+    std::string fields;
+    if (write_all(server->fd, cottontail::encode_frame(query)) <= 0 ||
+        !read_frame(server, &fields))
+      return false;
+    json response;
+    std::string error;
+    if (!cottontail::decode_frame(fields, &response, &error)) {
+      std::cerr << program_name << ": bad server response: " << error
+                << "\n";
+      return false;
+    }
+    *record = json::object();
+    if (response.contains("time")) {
+      (*record)["time"] = response["time"];
+      response.erase("time");
+    }
+    (*record)["response"] = response;
+    return true;
+  }
   std::string line = query.dump() + "\n";
-  if (write_all(fd, line) <= 0)
+  if (write_all(server->fd, line) <= 0)
     return false;
   std::string response;
-  if (!read_line(fd, &response))
+  if (!read_line(server, &response))
     return false;
   try {
     *record = json::parse(response);
@@ -83,6 +152,31 @@ bool request(int fd, const json &query, json *record,
   return true;
 }
 
+bool open_server(uint16_t port, bool binary, Server *server,
+                 const std::string &program_name) {
+  server->fd = connect_local(port);
+  if (server->fd < 0) {
+    std::cerr << program_name << ": cannot connect to 127.0.0.1:" << port
+              << "\n";
+    return false;
+  }
+  if (!binary)
+    return true;
+  json query;
+  query["op"] = "protocol";
+  query["protocol"] = "binary";
+  json record;
+  if (!request(server, query, &record, program_name) ||
+      !record.value("response", json::object()).value("ok", false)) {
+    std::cerr << program_name << ": server refused binary protocol\n";
+    close(server->fd);
+    server->fd = -1;
+    return false;
+  }
+  server->binary = true;
+  return true;
+}
+
 bool print_record(const json &record, std::string *qid, std::string *docno,
                   const std::string &program_name) {
   json response = record.value("response", json::object());
@@ -114,21 +208,138 @@ bool print_record(const json &record, std::string *qid, std::string *docno,
   return true;
 }
 
+// Runs every query from the file, spread over the given number of
+// connections each sending one request at a time, and asks for up to results
+// results for each. Reports requests per second and the latency of requests
+// as seen by the client.
+bool load_test(uint16_t port, bool binary, const std::string &filename,
+               size_t connections, size_t results,
+               const std::string &program_name) {
+  std::ifstream in(filename);
+  if (in.fail()) {
+    std::cerr << program_name << ": cannot open " << filename << "\n";
+    return false;
+  }
+  std::vector<std::string> queries;
+  std::string line;
+  while (std::getline(in, line))
+    if (!line.empty())
+      queries.push_back(line);
+  if (connections == 0)
+    connections = 1;
+  std::vector<Server> servers(connections);
+  for (auto &server : servers)
+    if (!open_server(port, binary, &server, program_name))
+      return false;
+  std::vector<std::vector<double>> latencies(connections);
+  std::vector<size_t> failures(connections, 0);
+  auto client = [&](size_t t) {
+    Server *server = &servers[t];
+    for (size_t i = t; i < queries.size(); i += connections) {
+      json query;
+      query["op"] = "query";
+      query["query"] = queries[i];
+      for (size_t r = 0; r < results; r++) {
+        auto start = std::chrono::steady_clock::now();
+        json record;
+        if (!request(server, query, &record, program_name)) {
+          failures[t]++;
+          return;
+        }
+        latencies[t].push_back(
+            std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start)
+                .count());
+        json response = record.value("response", json::object());
+        if (!response.value("ok", false)) {
+          failures[t]++;
+          break;
+        }
+        if (response.value("done", false) || !response.contains("qid"))
+          break;
+        query = json::object();
+        query["op"] = "next";
+        query["qid"] = response["qid"];
+      }
+    }
+  };
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < connections; t++)
+    threads.emplace_back(client, t);
+  for (auto &thread : threads)
+    thread.join();
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  for (auto &server : servers)
+    close(server.fd);
+  std::vector<double> all;
+  size_t failed = 0;
+  for (size_t t = 0; t < connections; t++) {
+    all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+    failed += failures[t];
+  }
+  std::sort(all.begin(), all.end());
+  auto percentile = [&](double p) {
+    if (all.empty())
+      return 0.0;
+    size_t i = static_cast<size_t>(p * (all.size() - 1) + 0.5);
+    return all[i];
+  };
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << "queries: " << queries.size() << "\n";
+  std::cout << "requests: " << all.size() << "\n";
+  std::cout << "failures: " << failed << "\n";
+  std::cout << "seconds: " << seconds << "\n";
+  std::cout << "qps: " << (seconds > 0.0 ? all.size() / seconds : 0.0)
+            << "\n";
+  std::cout << "p50 ms: " << percentile(0.50) << "\n";
+  std::cout << "p90 ms: " << percentile(0.90) << "\n";
+  std::cout << "p99 ms: " << percentile(0.99) << "\n";
+  std::cout << "max ms: " << (all.empty() ? 0.0 : all.back()) << "\n";
+  return failed == 0;
+}
+
 } // namespace
 
 int main(int argc, char **argv) {
   std::string program_name = argv[0];
-  if (argc != 2 || argv[1] == std::string("--help")) {
-    usage(program_name);
-    return argc == 2 ? 0 : 1;
+  bool binary = false;
+  std::string load;
+  size_t connections = CONNECTIONS;
+  size_t results = RESULTS;
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-' && argv[i][1] == '-'; i++) {
+    std::string option = argv[i];
+    if (option == "--help") {
+      usage(program_name);
+      return 0;
+    } else if (option == "--binary") {
+      binary = true;
+    } else if (option == "--load" && i + 1 < argc) {
+      load = argv[++i];
+    } else if (option == "--connections" && i + 1 < argc) {
+      connections = std::strtoul(argv[++i], nullptr, 10);
+    } else if (option == "--results" && i + 1 < argc) {
+      results = std::strtoul(argv[++i], nullptr, 10);
+    } else {
+      usage(program_name);
+      return 1;
+    }
   }
-  uint16_t port = static_cast<uint16_t>(std::strtoul(argv[1], nullptr, 10));
-  int fd = connect_local(port);
-  if (fd < 0) {
-    std::cerr << program_name << ": cannot connect to 127.0.0.1:" << port
-              << "\n";
+  if (i + 1 != argc) {
+    usage(program_name);
     return 1;
   }
+  uint16_t port = static_cast<uint16_t>(std::strtoul(argv[i], nullptr, 10));
+  if (load != "")
+    return load_test(port, binary, load, connections, results, program_name)
+               ? 0
+               : 1;
+  Server server;
+  if (!open_server(port, binary, &server, program_name))
+    return 1;
 
   std::string qid;
   std::string docno;
@@ -156,13 +367,13 @@ int main(int argc, char **argv) {
       query["query"] = input;
     }
     json record;
-    if (!request(fd, query, &record, program_name)) {
+    if (!request(&server, query, &record, program_name)) {
       std::cerr << program_name << ": server connection closed\n";
-      close(fd);
+      close(server.fd);
       return 1;
     }
     print_record(record, &qid, &docno, program_name);
   }
-  close(fd);
+  close(server.fd);
   return 0;
 }
@@ -0,0 +1,1250 @@
+#include "apps/ssr.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "apps/frames.h"
+#include "gcl/parse.h"
+#include "src/cottontail.h"
+#include "src/nlohmann.h"
+
+namespace cottontail {
+namespace ssr {
+
+namespace {
+
+constexpr cottontail::addr WINDOW_TOKENS = 200;
+constexpr size_t DEPTH = 1000;
+// Results ranked from a collection at a time, handed out a page at a time by
+// next, and ranked again from where they left off only once used up. GCL
+// ranking walks every posting of the query whatever the depth, so a block as
+// deep as the ranking costs no more to rank than a first page would.
+constexpr size_t BLOCK = DEPTH;
+// Requests waiting for a worker; beyond this they are answered as busy
+constexpr size_t BACKLOG = 256;
+// Milliseconds between saves of the feature logs, when warming
+constexpr cottontail::addr FEATURE_LOG_SAVE = 60000;
+
+struct Result {
+  size_t collection = 0;
+  cottontail::RankingResult ranking;
+  std::string docno;
+};
+
+std::string trim(const std::string &text) {
+  size_t begin = 0;
+  while (begin < text.size() &&
+         std::isspace(static_cast<unsigned char>(text[begin])))
+    begin++;
+  size_t end = text.size();
+  while (end > begin && std::isspace(static_cast<unsigned char>(text[end - 1])))
+    end--;
+  return text.substr(begin, end - begin);
+}
+
+std::string clean_text(std::string text) {
+  std::replace(text.begin(), text.end(), '\n', ' ');
+  std::replace(text.begin(), text.end(), '\r', ' ');
+  return text;
+}
+
+std::string double_quote_if_needed(const std::string &text) {
+  std::string value = text;
+  if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+    value = value.substr(1, value.size() - 2);
+  std::string quoted = "\"";
+  for (char c : value) {
+    if (c == '\\' || c == '"')
+      quoted.push_back('\\');
+    quoted.push_back(c);
+  }
+  quoted.push_back('"');
+  return quoted;
+}
+
+std::string strip_outer_quotes(const std::string &text) {
+  if (text.size() >= 2 && text.front() == '"' && text.back() == '"')
+    return text.substr(1, text.size() - 2);
+  return text;
+}
+
+std::string translate(std::shared_ptr<cottontail::Warren> warren,
+                      cottontail::addr p, cottontail::addr q) {
+  return clean_text(warren->txt()->translate(p, q));
+}
+
+std::string display_docno(const std::string &text) {
+  return cottontail::trec_docno(cottontail::json_translate(text));
+}
+
+// Text of start through end with the cover marked. Through the text cache,
+// the text is decoded once, with the cover placed by token offsets.
+std::string highlighted(const Collection &collection, cottontail::addr start,
+                        cottontail::addr end, cottontail::addr highlight_start,
+                        cottontail::addr highlight_end) {
+  std::shared_ptr<cottontail::Warren> warren = collection.warren;
+  if (collection.text != nullptr) {
+    std::string text;
+    std::vector<size_t> offsets;
+    if (collection.text->text(collection.burrow, warren->txt(),
+                              warren->tokenizer(), start, end, &text,
+                              &offsets)) {
+      if (highlight_start < start || highlight_end > end ||
+          highlight_start > highlight_end ||
+          (size_t)(highlight_end - start + 1) >= offsets.size())
+        return clean_text(text);
+      size_t b = offsets[highlight_start - start];
+      size_t e = offsets[highlight_end - start + 1];
+      return clean_text(text.substr(0, b) + "<cover>" +
+                        text.substr(b, e - b) + "</cover>" + text.substr(e));
+    }
+  }
+  if (highlight_start < start || highlight_end > end ||
+      highlight_start > highlight_end)
+    return translate(warren, start, end);
+  std::string text;
+  if (start < highlight_start)
+    text += translate(warren, start, highlight_start - 1);
+  text += "<cover>";
+  text += translate(warren, highlight_start, highlight_end);
+  text += "</cover>";
+  if (highlight_end < end)
+    text += translate(warren, highlight_end + 1, end);
+  return text;
+}
+
+std::string snippet(const Collection &collection, const Result &result) {
+  cottontail::addr cp = result.ranking.container_p();
+  cottontail::addr cq = result.ranking.container_q();
+  cottontail::addr p = result.ranking.p();
+  cottontail::addr q = result.ranking.q();
+  if (cq - cp + 1 <= WINDOW_TOKENS)
+    return highlighted(collection, cp, cq, p, q);
+  if (q - p + 1 >= WINDOW_TOKENS) {
+    cottontail::addr end = p + WINDOW_TOKENS - 1;
+    if (end > q)
+      end = q;
+    if (end > cq)
+      end = cq;
+    return highlighted(collection, p, end, p, end);
+  }
+  cottontail::addr extra = WINDOW_TOKENS - (q - p + 1);
+  cottontail::addr start = p - extra / 2;
+  cottontail::addr end = q + extra - extra / 2;
+  if (start < cp) {
+    end += cp - start;
+    start = cp;
+  }
+  if (end > cq) {
+    start -= end - cq;
+    end = cq;
+    if (start < cp)
+      start = cp;
+  }
+  return highlighted(collection, start, end, p, q);
+}
+
+std::unique_ptr<cottontail::Hopper>
+hopper(std::shared_ptr<cottontail::Warren> warren, const std::string &gcl,
+       const std::string &name, std::string *error, bool cached = true) {
+  std::unique_ptr<cottontail::Hopper> h =
+      cached ? warren->cached_hopper_from_gcl(gcl, error)
+             : warren->hopper_from_gcl(gcl, error);
+  if (h == nullptr && error != nullptr && error->empty())
+    *error = "Cannot create hopper for " + name;
+  return h;
+}
+
+bool container_for(std::shared_ptr<cottontail::Warren> warren,
+                   const std::string &container,
+                   const cottontail::RankingResult &ranking,
+                   cottontail::addr *cp, cottontail::addr *cq,
+                   std::string *error) {
+  std::unique_ptr<cottontail::Hopper> chopper =
+      hopper(warren, container, "container", error);
+  if (chopper == nullptr)
+    return false;
+  chopper->rho(ranking.q(), cp, cq);
+  return *cp <= ranking.p() && ranking.q() <= *cq;
+}
+
+bool docno_in(std::shared_ptr<cottontail::Warren> warren,
+              const std::string &docno_query, cottontail::addr cp,
+              cottontail::addr cq, std::string *docno, std::string *error) {
+  std::unique_ptr<cottontail::Hopper> dhopper =
+      hopper(warren, docno_query, "docno", error);
+  if (dhopper == nullptr)
+    return false;
+  cottontail::addr dp, dq;
+  dhopper->tau(cp, &dp, &dq);
+  if (dq > cq)
+    return false;
+  *docno = display_docno(warren->txt()->translate(dp, dq));
+  return true;
+}
+
+bool make_result(const Collection &collection, size_t collection_index,
+                 const std::string &container, const std::string &docno_query,
+                 const cottontail::RankingResult &ranking, Result *result) {
+  std::string error;
+  cottontail::addr cp, cq;
+  if (!container_for(collection.warren, container, ranking, &cp, &cq, &error)) {
+    if (!error.empty())
+      std::cerr << "ssr-server: " << collection.burrow << ": " << error
+                << "\n";
+    return false;
+  }
+  std::string docno;
+  if (!docno_in(collection.warren, docno_query, cp, cq, &docno, &error)) {
+    if (!error.empty())
+      std::cerr << "ssr-server: " << collection.burrow << ": " << error
+                << "\n";
+    return false;
+  }
+  result->collection = collection_index;
+  result->ranking = ranking;
+  result->docno = docno;
+  return true;
+}
+
+// At least two threads for each collection, with the rest split by the
+// cost of the query in each.
+std::vector<size_t> thread_budget(const std::vector<cottontail::fval> &costs) {
+  size_t allowed = cottontail::allowed_threads(0);
+  std::vector<size_t> budget = cottontail::schedule_threads(
+      costs, allowed > costs.size() ? allowed - costs.size() : 0);
+  for (auto &threads : budget)
+    threads++;
+  return budget;
+}
+
+cottontail::fval query_cost(std::shared_ptr<cottontail::Warren> warren,
+                            const std::string &query) {
+  cottontail::fval cost = 0.0;
+  for (auto &term : warren->tokenizer()->split(query))
+    cost += warren->idx()->count(warren->featurizer()->featurize(term));
+  return cost;
+}
+
+json result_response(const std::string &op, const std::string &qid,
+                     size_t rank, const Collection &collection,
+                     const Result &result) {
+  json response;
+  response["op"] = op;
+  response["ok"] = true;
+  response["qid"] = qid;
+  response["rank"] = rank;
+  response["burrow"] = collection.burrow;
+  response["docno"] = result.docno;
+  response["snippet"] = snippet(collection, result);
+  return response;
+}
+
+json error_response(const std::string &op, const std::string &error) {
+  json response;
+  response["op"] = op;
+  response["ok"] = false;
+  response["error"] = error;
+  return response;
+}
+
+bool nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+} // namespace
+
+bool split_fields(const std::string &spec, std::vector<std::string> *fields,
+                  std::string *error) {
+  if (spec.empty()) {
+    *error = "--fields cannot be empty";
+    return false;
+  }
+  fields->clear();
+  size_t begin = 0;
+  for (;;) {
+    size_t end = spec.find(',', begin);
+    std::string field =
+        trim(spec.substr(begin, end == std::string::npos ? end : end - begin));
+    if (field.empty()) {
+      *error = "--fields contains an empty field query";
+      return false;
+    }
+    fields->push_back(field);
+    if (end == std::string::npos)
+      return true;
+    begin = end + 1;
+  }
+}
+
+int listen_local(uint16_t port, uint16_t *actual_port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  int yes = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+  if (listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return -1;
+  }
+  socklen_t length = sizeof(address);
+  if (getsockname(fd, reinterpret_cast<sockaddr *>(&address), &length) != 0) {
+    close(fd);
+    return -1;
+  }
+  *actual_port = ntohs(address.sin_port);
+  return fd;
+}
+
+bool ResultCache::find(size_t collection, cottontail::addr snapshot,
+                       const std::string &key, Page *page) {
+  std::lock_guard<std::mutex> guard(lock_);
+  retire(collection, snapshot);
+  auto found = entries_.find(key);
+  if (found == entries_.end() || found->second.snapshot != snapshot) {
+    misses_++;
+    return false;
+  }
+  hits_++;
+  lru_.splice(lru_.begin(), lru_, found->second.lru);
+  *page = found->second.page;
+  return true;
+}
+
+void ResultCache::insert(size_t collection, cottontail::addr snapshot,
+                         const std::string &key, const Page &page) {
+  size_t bytes = key.size() + sizeof(Entry) +
+                 page.results.capacity() * sizeof(cottontail::RankingResult);
+  std::lock_guard<std::mutex> guard(lock_);
+  retire(collection, snapshot);
+  if (budget_ == 0 || bytes > budget_ || entries_.count(key) > 0)
+    return;
+  while (bytes_ + bytes > budget_)
+    evict(entries_.find(lru_.back()));
+  lru_.push_front(key);
+  entries_[key] = Entry{collection, snapshot, page, bytes, lru_.begin()};
+  bytes_ += bytes;
+}
+
+json ResultCache::metrics() {
+  std::lock_guard<std::mutex> guard(lock_);
+  json metrics;
+  metrics["hits"] = hits_;
+  metrics["misses"] = misses_;
+  metrics["hit_rate"] =
+      hits_ + misses_ == 0 ? 0.0 : hits_ / (double)(hits_ + misses_);
+  metrics["entries"] = entries_.size();
+  metrics["bytes"] = bytes_;
+  return metrics;
+}
+
+void ResultCache::evict(std::map<std::string, Entry>::iterator it) {
+  bytes_ -= it->second.bytes;
+  lru_.erase(it->second.lru);
+  entries_.erase(it);
+}
+
+void ResultCache::retire(size_t collection, cottontail::addr snapshot) {
+  auto latest = latest_.find(collection);
+  if (latest != latest_.end() && latest->second >= snapshot)
+    return;
+  latest_[collection] = snapshot;
+  for (auto it = entries_.begin(); it != entries_.end();)
+    if (it->second.collection == collection &&
+        it->second.snapshot < snapshot)
+      evict(it++);
+    else
+      ++it;
+}
+
+std::string Sessions::insert(std::shared_ptr<QueryState> state) {
+  std::lock_guard<std::mutex> guard(lock_);
+  cottontail::addr now = cottontail::now();
+  std::string qid = "q" + std::to_string(next_qid_++);
+  lru_.push_front(qid);
+  entries_[qid] = Entry{state, now, lru_.begin()};
+  expire(now);
+  return qid;
+}
+
+std::shared_ptr<QueryState> Sessions::find(const std::string &qid) {
+  std::lock_guard<std::mutex> guard(lock_);
+  cottontail::addr now = cottontail::now();
+  expire(now);
+  auto found = entries_.find(qid);
+  if (found == entries_.end())
+    return nullptr;
+  found->second.used = now;
+  lru_.splice(lru_.begin(), lru_, found->second.lru);
+  return found->second.state;
+}
+
+json Sessions::metrics() {
+  std::lock_guard<std::mutex> guard(lock_);
+  expire(cottontail::now());
+  size_t bytes = 0;
+  for (auto &entry : entries_)
+    bytes += entry.first.size() + sizeof(Entry) + entry.second.state->bytes;
+  json metrics;
+  metrics["sessions"] = entries_.size();
+  metrics["bytes"] = bytes;
+  metrics["expired"] = expired_;
+  metrics["evicted"] = evicted_;
+  return metrics;
+}
+
+void Sessions::expire(cottontail::addr now) {
+  while (!lru_.empty()) {
+    auto oldest = entries_.find(lru_.back());
+    if (entries_.size() > limit_) {
+      evicted_++;
+    } else if (now - oldest->second.used > ttl_) {
+      expired_++;
+    } else {
+      return;
+    }
+    entries_.erase(oldest);
+    lru_.pop_back();
+  }
+}
+
+Server::Server(std::string container, std::string content, std::string docno,
+               std::vector<std::string> fields,
+               std::vector<Collection> collections, size_t cache_budget,
+               addr deadline, size_t sessions, addr session_ttl,
+               std::shared_ptr<TextCache> text_cache)
+    : container_(container), content_(content), docno_(docno),
+      fields_(fields), collections_(collections), cache_(cache_budget),
+      deadline_(deadline), sessions_(sessions, session_ttl),
+      text_cache_(text_cache) {
+  for (auto &collection : collections_)
+    collection.text = text_cache_;
+}
+
+std::string Server::respond(const std::string &line, bool busy,
+                            cottontail::addr waited) {
+  cottontail::addr start = cottontail::now();
+  json request;
+  json response;
+  try {
+    request = json::parse(line);
+  } catch (json::parse_error &e) {
+    request = json::object();
+    request["op"] = "parse";
+    response = error_response("parse", e.what());
+    return record(request, response, cottontail::now() - start);
+  }
+  response = run(request, busy, waited);
+  return record(request, response, cottontail::now() - start);
+}
+
+void Server::respond_frame(const std::string &fields,
+                           std::vector<std::string> *pieces, bool busy,
+                           cottontail::addr waited) {
+  cottontail::addr start = cottontail::now();
+  json request;
+  json response;
+  std::string error;
+  if (cottontail::decode_frame(fields, &request, &error)) {
+    response = run(request, busy, waited);
+  } else {
+    request = json::object();
+    request["op"] = "parse";
+    response = error_response("parse", error);
+  }
+  cottontail::addr time = cottontail::now() - start;
+  response["time"] = time;
+  cottontail::encode_frame(&response, {"snippet", "document"}, pieces);
+  response.erase("snippet");
+  response.erase("document");
+  record(request, response, time);
+}
+
+std::string Server::refuse(const std::string &error) {
+  json request = json::object();
+  request["op"] = "parse";
+  return record(request, error_response("parse", error), 0);
+}
+
+bool Server::negotiate(const std::string &line, bool *binary,
+                       std::string *answer) {
+  if (line.find("protocol") == std::string::npos)
+    return false;
+  cottontail::addr start = cottontail::now();
+  json request;
+  try {
+    request = json::parse(line);
+  } catch (json::parse_error &e) {
+    return false;
+  }
+  if (!request.is_object() || !request.contains("op") ||
+      request["op"] != "protocol")
+    return false;
+  json response;
+  std::string protocol = request.value("protocol", "json");
+  if (protocol == "binary" || protocol == "json") {
+    *binary = protocol == "binary";
+    response["op"] = "protocol";
+    response["ok"] = true;
+    response["protocol"] = protocol;
+  } else {
+    response = error_response("protocol", "Unknown protocol");
+  }
+  if (request.contains("id"))
+    response["id"] = request["id"];
+  *answer = record(request, response, cottontail::now() - start);
+  return true;
+}
+
+json Server::run(const json &request, bool busy, cottontail::addr waited) {
+  json response;
+  std::string op;
+  try {
+    op = request.value("op", "");
+    // A request may shorten the server's deadline, but never lift it.
+    cottontail::addr deadline = deadline_;
+    cottontail::addr asked = request.value("deadline", deadline_);
+    if (request.contains("deadline") && asked > 0)
+      deadline = (deadline_ > 0 ? std::min(asked, deadline_) : asked);
+    if (deadline > 0 && waited >= deadline)
+      busy = true;
+    cottontail::QueryBudget budget(deadline > 0 ? deadline - waited : 0);
+    if (request.contains("deadline") && asked <= 0)
+      response = error_response(op, "Deadline must be positive");
+    else if (busy)
+      response = error_response(op, "Server busy");
+    else if (op == "query")
+      response = query(request, &budget);
+    else if (op == "next")
+      response = next(request, &budget);
+    else if (op == "document")
+      response = document(request);
+    else if (op == "stats")
+      response = stats();
+    else if (op == "protocol")
+      response = error_response(op, "Protocol must be the first request");
+    else
+      response = error_response(op, "Unknown op");
+  } catch (json::exception &e) {
+    response = error_response(op, e.what());
+  }
+  if (request.is_object() && request.contains("id"))
+    response["id"] = request["id"];
+  return response;
+}
+
+std::string Server::record(const json &request, const json &response,
+                           cottontail::addr time) {
+  json record;
+  record["query"] = request;
+  record["response"] = response;
+  record["time"] = time;
+  record["cache"] = cache_.metrics();
+  std::string line = record.dump() + "\n";
+  std::lock_guard<std::mutex> guard(log_lock_);
+  std::cout << line << std::flush;
+  return line;
+}
+
+// The collection as seen through a clone of its warren, checked out of its
+// pool for as long as the context is held, since workers share the server.
+bool Server::checkout(size_t i, std::shared_ptr<QueryContext> *context,
+                      Collection *collection, std::string *error) {
+  *context = collections_[i].pool->acquire(error);
+  if (*context == nullptr)
+    return false;
+  *collection = collections_[i];
+  collection->warren = (*context)->warren();
+  return true;
+}
+
+json Server::query(const json &request, cottontail::QueryBudget *budget) {
+  std::string query = request.value("query", "");
+  if (query.empty())
+    return error_response("query", "Missing query");
+  save_features();
+  std::shared_ptr<QueryState> state = std::make_shared<QueryState>();
+  for (size_t i = 0; i < collections_.size(); i++) {
+    std::string error;
+    std::shared_ptr<cottontail::QueryContext> context;
+    Collection collection;
+    if (!checkout(i, &context, &collection, &error))
+      return error_response("query", error);
+    if (collection.warren->hopper_from_gcl(query, &error) == nullptr)
+      return error_response("query",
+                            error.empty() ? "Cannot parse query" : error);
+    state->costs.push_back(query_cost(collection.warren, query));
+  }
+  state->query = query;
+  state->normalized = normalize(query);
+  state->pages.resize(collections_.size());
+  state->early.resize(collections_.size());
+  std::string qid = sessions_.insert(state);
+  std::lock_guard<std::mutex> guard(state->lock);
+  return advance("query", qid, state.get(), budget);
+}
+
+json Server::next(const json &request, cottontail::QueryBudget *budget) {
+  std::string qid = request.value("qid", "");
+  std::shared_ptr<QueryState> state = sessions_.find(qid);
+  if (state == nullptr)
+    return error_response("next", "Unknown qid");
+  std::lock_guard<std::mutex> guard(state->lock);
+  return advance("next", qid, state.get(), budget);
+}
+
+json Server::stats() {
+  json response;
+  response["op"] = "stats";
+  response["ok"] = true;
+  response["sessions"] = sessions_.metrics();
+  response["cache"] = cache_.metrics();
+  if (text_cache_ != nullptr) {
+    json text;
+    text["hits"] = text_cache_->hits();
+    text["misses"] = text_cache_->misses();
+    text["bytes"] = text_cache_->bytes();
+    response["text_cache"] = text;
+  }
+  for (auto &collection : collections_)
+    if (collection.warmer != nullptr) {
+      json warmup;
+      warmup["burrow"] = collection.burrow;
+      warmup["logged"] = collection.features->size();
+      warmup["features"] = collection.warmer->features();
+      warmup["bytes"] = collection.warmer->bytes();
+      warmup["done"] = collection.warmer->done();
+      response["warmup"].push_back(warmup);
+    }
+  return response;
+}
+
+// Stores the feature logs in their burrows now and then, so that a
+// restarted server can warm its caches with what queries have read.
+void Server::save_features() {
+  {
+    std::lock_guard<std::mutex> guard(save_lock_);
+    if (cottontail::now() - saved_ < FEATURE_LOG_SAVE)
+      return;
+    saved_ = cottontail::now();
+  }
+  for (auto &collection : collections_) {
+    std::string error;
+    if (collection.features != nullptr &&
+        !collection.features->store(collection.warren->working(), &error))
+      std::cerr << "ssr-server: " << collection.burrow << ": " << error
+                << "\n";
+  }
+}
+
+std::string Server::normalize(const std::string &query) {
+  std::shared_ptr<cottontail::gcl::SExpression> expression =
+      cottontail::gcl::SExpression::from_string(query, nullptr);
+  return expression == nullptr ? query : expression->to_string();
+}
+
+std::string Server::cache_key(size_t collection, const QueryState &state,
+                              const Page &page) {
+  std::string key = std::to_string(collection) + "\t" + container_ + "\t" +
+                    content_ + "\t" + state.normalized + "\t" +
+                    std::to_string(BLOCK);
+  if (page.resume) {
+    char cursor[64];
+    std::snprintf(cursor, sizeof(cursor), "\t%a\t%ld", page.last.score(),
+                  (long)page.last.p());
+    key += cursor;
+  }
+  return key;
+}
+
+// Ranks the next block for each collection that has run out, resuming
+// after its last ranked result. A block cut short by the budget holds the
+// best of what was ranked. It is not cached, and the next page resumes
+// from the same cursor, since containers the search never reached may
+// outrank anything on it.
+void Server::fill(QueryState *state, cottontail::QueryBudget *budget) {
+  std::vector<size_t> threads = thread_budget(state->costs);
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < collections_.size(); i++) {
+    Page &page = state->pages[i];
+    if (page.done || page.next < page.results.size())
+      continue;
+    workers.emplace_back(std::thread([&, i] {
+      Page &page = state->pages[i];
+      std::string error;
+      std::shared_ptr<cottontail::QueryContext> context;
+      Collection collection;
+      if (!checkout(i, &context, &collection, &error)) {
+        std::cerr << "ssr-server: " << collection.burrow << ": " << error
+                  << "\n";
+        page.done = true;
+        return;
+      }
+      cottontail::addr snapshot = collection.warren->snapshot();
+      std::string key = cache_key(i, *state, page);
+      if (cache_.find(i, snapshot, key, &page))
+        return;
+      std::map<std::string, cottontail::fval> parameters;
+      if (page.resume)
+        cottontail::resume_after(page.last, &parameters);
+      auto ranking = cottontail::parallel_ssr(
+          collection.warren, state->query, content_, parameters, BLOCK,
+          threads[i], collection.pool, budget);
+      page.results = ranking;
+      page.next = 0;
+      page.partial = budget->truncated();
+      if (page.partial)
+        return;
+      page.done = ranking.size() < BLOCK;
+      if (ranking.size() > 0) {
+        page.resume = true;
+        page.last = ranking.back();
+      }
+      cache_.insert(i, snapshot, key, page);
+    }));
+  }
+  for (auto &worker : workers)
+    worker.join();
+}
+
+// The collection holding the best unreturned result, ranking more of
+// them only when one has nothing left in hand and the budget allows.
+size_t Server::best_page(QueryState *state, cottontail::QueryBudget *budget) {
+  size_t best = collections_.size();
+  if (state->returned >= DEPTH)
+    return best;
+  while (!budget->spent()) {
+    bool empty = false;
+    for (auto &page : state->pages)
+      empty = empty || (!page.done && page.next >= page.results.size());
+    if (!empty)
+      break;
+    fill(state, budget);
+  }
+  for (size_t i = 0; i < state->pages.size(); i++) {
+    Page &page = state->pages[i];
+    if (page.next < page.results.size() &&
+        (best == collections_.size() ||
+         page.results[page.next].score() >
+             state->pages[best].results[state->pages[best].next].score()))
+      best = i;
+  }
+  return best;
+}
+
+// Returns the best unreturned result over all collections, skipping any
+// whose docno cannot be found.
+json Server::advance(const std::string &op, const std::string &qid,
+                     QueryState *state, cottontail::QueryBudget *budget) {
+  json response;
+  for (;;) {
+    size_t best = best_page(state, budget);
+    if (best == collections_.size()) {
+      response["op"] = op;
+      response["ok"] = true;
+      response["qid"] = qid;
+      // Not done if the budget ran out first; next may find more
+      response["done"] = !budget->truncated();
+      break;
+    }
+    std::string error;
+    std::shared_ptr<cottontail::QueryContext> context;
+    Collection collection;
+    if (!checkout(best, &context, &collection, &error))
+      return error_response(op, error);
+    Page &page = state->pages[best];
+    const cottontail::RankingResult &ranked = page.results[page.next++];
+    std::set<cottontail::addr> &early = state->early[best];
+    if (page.partial)
+      early.insert(ranked.container_p());
+    else if (early.erase(ranked.container_p()) > 0)
+      continue;
+    Result result;
+    if (make_result(collection, best, container_, docno_, ranked,
+                    &result)) {
+      response =
+          result_response(op, qid, ++state->returned, collection, result);
+      break;
+    }
+  }
+  if (budget->truncated())
+    response["truncated"] = true;
+  size_t bytes = sizeof(QueryState) + state->query.size() +
+                 state->normalized.size();
+  for (auto &page : state->pages)
+    bytes += sizeof(Page) +
+             page.results.capacity() * sizeof(cottontail::RankingResult);
+  for (auto &early : state->early)
+    bytes += early.size() * (sizeof(cottontail::addr) + 3 * sizeof(void *));
+  state->bytes = bytes;
+  return response;
+}
+
+json Server::document(const json &request) {
+  std::string wanted = request.value("docno", "");
+  if (wanted.empty())
+    return error_response("document", "Missing docno");
+  std::string error;
+  LocatedDocument document;
+  if (!locate_document(wanted, &document, &error))
+    return error_response("document", error);
+  std::shared_ptr<cottontail::QueryContext> context;
+  Collection collection;
+  if (!checkout(document.collection, &context, &collection, &error))
+    return error_response("document", error);
+  std::string text;
+  if (!document_text(collection, document.container_p, document.container_q,
+                     &text, &error))
+    return error_response("document", error);
+  json response;
+  response["op"] = "document";
+  response["ok"] = true;
+  response["burrow"] = collection.burrow;
+  response["docno"] = wanted;
+  response["document"] = std::move(text);
+  return response;
+}
+
+bool Server::locate_document(const std::string &wanted,
+                             LocatedDocument *document, std::string *error) {
+  std::string query = "(>> " + container_ + " (>> " + docno_ + " " +
+                      double_quote_if_needed(wanted) + "))";
+  size_t matches = 0;
+  for (size_t i = 0; i < collections_.size(); i++) {
+    std::shared_ptr<cottontail::QueryContext> context;
+    Collection collection;
+    if (!checkout(i, &context, &collection, error))
+      return false;
+    // An index built before the warren last changed is passed over
+    if (collection.docnos != nullptr &&
+        collection.docnos->current(collection.warren)) {
+      cottontail::addr p = cottontail::minfinity, q = cottontail::minfinity;
+      if (collection.docnos->lookup(wanted, &p, &q)) {
+        if (matches == 0)
+          *document = LocatedDocument{i, p, q};
+        matches++;
+      } else if (p == cottontail::maxfinity) {
+        matches += 2;
+      }
+      if (matches > 1) {
+        std::cerr << "ssr-server: ambiguous docno: " << wanted << "\n";
+        *error = "Ambiguous docno";
+        return false;
+      }
+      continue;
+    }
+    std::string hopper_error;
+    std::unique_ptr<cottontail::Hopper> h =
+        hopper(collection.warren, query, "document", &hopper_error, false);
+    if (h == nullptr) {
+      *error = hopper_error;
+      return false;
+    }
+    cottontail::addr p, q;
+    h->tau(cottontail::minfinity + 1, &p, &q);
+    while (p < cottontail::maxfinity) {
+      if (matches == 0)
+        *document = LocatedDocument{i, p, q};
+      matches++;
+      if (matches > 1) {
+        std::cerr << "ssr-server: ambiguous docno: " << wanted << "\n";
+        *error = "Ambiguous docno";
+        return false;
+      }
+      h->tau(p + 1, &p, &q);
+    }
+  }
+  if (matches == 0) {
+    *error = "Unknown docno";
+    return false;
+  }
+  return true;
+}
+
+bool Server::document_text(const Collection &collection, cottontail::addr cp,
+                           cottontail::addr cq, std::string *text,
+                           std::string *error) {
+  if (fields_.empty()) {
+    *text = clean_text(collection.warren->txt()->translate(cp, cq));
+    return true;
+  }
+  text->clear();
+  for (auto &field : fields_) {
+    std::string hopper_error;
+    std::unique_ptr<cottontail::Hopper> h =
+        hopper(collection.warren, field, "field", &hopper_error);
+    if (h == nullptr) {
+      *error = hopper_error;
+      return false;
+    }
+    cottontail::addr p, q;
+    h->tau(cp, &p, &q);
+    while (p < cottontail::maxfinity && p <= cq) {
+      if (q <= cq) {
+        if (!text->empty())
+          *text += " ... ";
+        *text += strip_outer_quotes(translate(collection.warren, p, q));
+      }
+      h->tau(p + 1, &p, &q);
+    }
+  }
+  *text = clean_text(*text);
+  return true;
+}
+
+EventLoop::EventLoop(Server *server, int listener, size_t workers)
+    : server_(server), listener_(listener), workers_(workers),
+      epoll_(epoll_create1(0)), wake_(eventfd(0, EFD_NONBLOCK)) {}
+
+EventLoop::~EventLoop() {
+  if (epoll_ >= 0)
+    close(epoll_);
+  if (wake_ >= 0)
+    close(wake_);
+}
+
+bool EventLoop::run(std::string *error) {
+  if (epoll_ < 0 || wake_ < 0 || !nonblocking(listener_) ||
+      !watch(listener_, EPOLLIN) || !watch(wake_, EPOLLIN)) {
+    *error = std::strerror(errno);
+    return false;
+  }
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < workers_; i++)
+    threads.emplace_back(std::thread([this] { work(); }));
+  bool okay = true;
+  epoll_event events[64];
+  while (!stopping_) {
+    int n = epoll_wait(epoll_, events, 64, -1);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      *error = std::strerror(errno);
+      okay = false;
+      break;
+    }
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+      if (fd == listener_) {
+        accept_all();
+      } else if (fd == wake_) {
+        uint64_t count;
+        while (read(wake_, &count, sizeof(count)) > 0)
+          ;
+        std::vector<std::shared_ptr<Connection>> ready;
+        {
+          std::lock_guard<std::mutex> guard(lock_);
+          ready.swap(ready_);
+        }
+        for (auto &connection : ready)
+          flush(connection);
+      } else {
+        auto found = connections_.find(fd);
+        if (found == connections_.end())
+          continue;
+        std::shared_ptr<Connection> connection = found->second;
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+          receive(connection);
+        flush(connection);
+      }
+    }
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stopping_ = true;
+    tasks_.clear();
+  }
+  available_.notify_all();
+  for (auto &thread : threads)
+    thread.join();
+  while (!connections_.empty())
+    close_connection(connections_.begin()->second);
+  epoll_ctl(epoll_, EPOLL_CTL_DEL, listener_, nullptr);
+  epoll_ctl(epoll_, EPOLL_CTL_DEL, wake_, nullptr);
+  return okay;
+}
+
+void EventLoop::stop() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stopping_ = true;
+  }
+  available_.notify_all();
+  uint64_t one = 1;
+  if (write(wake_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    std::cerr << "ssr-server: cannot wake event loop\n";
+}
+
+bool EventLoop::watch(int fd, uint32_t events) {
+  epoll_event event;
+  std::memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.fd = fd;
+  return epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+void EventLoop::accept_all() {
+  for (;;) {
+    int fd = accept4(listener_, nullptr, nullptr, SOCK_NONBLOCK);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        std::cerr << "ssr-server: accept failed: " << std::strerror(errno)
+                  << "\n";
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    if (!watch(fd, EPOLLIN)) {
+      close(fd);
+      continue;
+    }
+    std::shared_ptr<Connection> connection = std::make_shared<Connection>();
+    connection->fd = fd;
+    connection->events = EPOLLIN;
+    connections_[fd] = connection;
+    std::cerr << "ssr-server: client connected\n";
+  }
+}
+
+// Reads no more than a whole request of the longest allowed, leaving the
+// rest for later, so that a client can't make the server buffer without
+// limit. Lines are allowed to be as long as frames.
+void EventLoop::receive(std::shared_ptr<Connection> connection) {
+  char buffer[65536];
+  for (;;) {
+    if (connection->input.size() > cottontail::FRAME_HEADER +
+                                       cottontail::MAX_FRAME)
+      break;
+    ssize_t n = recv(connection->fd, buffer, sizeof(buffer), 0);
+    if (n > 0) {
+      connection->input.append(buffer, n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      connection->reading = false;
+    break;
+  }
+  std::string &input = connection->input;
+  size_t begin = 0;
+  for (;;) {
+    if (connection->binary) {
+      if (input.size() - begin < cottontail::FRAME_HEADER)
+        break;
+      size_t length = cottontail::frame_length(input.data() + begin);
+      if (length > cottontail::MAX_FRAME) {
+        std::cerr << "ssr-server: frame too long\n";
+        connection->reading = false;
+        begin = input.size();
+        break;
+      }
+      if (input.size() - begin - cottontail::FRAME_HEADER < length)
+        break;
+      dispatch(connection,
+               input.substr(begin + cottontail::FRAME_HEADER, length));
+      begin += cottontail::FRAME_HEADER + length;
+      continue;
+    }
+    size_t end = input.find('\n', begin);
+    if (end == std::string::npos) {
+      if (input.size() - begin > cottontail::MAX_FRAME) {
+        std::cerr << "ssr-server: line too long\n";
+        queue(connection, {server_->refuse("Request line too long")});
+        connection->reading = false;
+        begin = input.size();
+      }
+      break;
+    }
+    std::string line = input.substr(begin, end - begin);
+    begin = end + 1;
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (connection->first) {
+      connection->first = false;
+      std::string answer;
+      if (server_->negotiate(line, &connection->binary, &answer)) {
+        queue(connection, {answer});
+        continue;
+      }
+    }
+    dispatch(connection, line);
+  }
+  input.erase(0, begin);
+  if (!connection->reading && !connection->binary && !input.empty())
+    dispatch(connection, input);
+  if (!connection->reading)
+    input.clear();
+}
+
+void EventLoop::dispatch(std::shared_ptr<Connection> connection,
+                         const std::string &request) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (tasks_.size() < BACKLOG) {
+      {
+        std::lock_guard<std::mutex> guard(connection->lock);
+        connection->pending++;
+      }
+      tasks_.push_back(
+          Task{connection, request, connection->binary, cottontail::now()});
+      available_.notify_one();
+      return;
+    }
+  }
+  queue(connection, answer(request, connection->binary, true, 0));
+}
+
+std::vector<std::string> EventLoop::answer(const std::string &request,
+                                           bool binary, bool busy,
+                                           addr waited) {
+  std::vector<std::string> pieces;
+  if (binary)
+    server_->respond_frame(request, &pieces, busy, waited);
+  else
+    pieces.push_back(server_->respond(request, busy, waited));
+  return pieces;
+}
+
+void EventLoop::queue(std::shared_ptr<Connection> connection,
+                      std::vector<std::string> pieces) {
+  std::lock_guard<std::mutex> guard(connection->lock);
+  for (auto &piece : pieces)
+    if (!piece.empty())
+      connection->output.push_back(std::move(piece));
+}
+
+void EventLoop::work() {
+  for (;;) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> guard(lock_);
+      available_.wait(guard,
+                      [this] { return !tasks_.empty() || stopping_; });
+      if (stopping_)
+        return;
+      task = tasks_.front();
+      tasks_.pop_front();
+    }
+    queue(task.connection,
+          answer(task.request, task.binary, false,
+                 cottontail::now() - task.received));
+    {
+      std::lock_guard<std::mutex> guard(task.connection->lock);
+      task.connection->pending--;
+    }
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      ready_.push_back(task.connection);
+    }
+    uint64_t one = 1;
+    if (write(wake_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+      std::cerr << "ssr-server: cannot wake event loop\n";
+  }
+}
+
+// Writes what it can of the queued responses, then watches for room to
+// write the rest, and closes the connection once the client has stopped
+// sending and everything it asked for has been answered.
+void EventLoop::flush(std::shared_ptr<Connection> connection) {
+  std::unique_lock<std::mutex> guard(connection->lock);
+  if (!connection->open)
+    return;
+  std::deque<std::string> &output = connection->output;
+  while (!output.empty()) {
+    iovec pieces[64];
+    size_t count = 0;
+    for (auto it = output.begin(); it != output.end() && count < 64;
+         ++it, ++count) {
+      size_t skip = count == 0 ? connection->offset : 0;
+      pieces[count].iov_base = const_cast<char *>(it->data()) + skip;
+      pieces[count].iov_len = it->size() - skip;
+    }
+    msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = pieces;
+    message.msg_iovlen = count;
+    ssize_t n = sendmsg(connection->fd, &message, MSG_NOSIGNAL);
+    if (n > 0) {
+      size_t sent = n;
+      while (sent > 0) {
+        size_t left = output.front().size() - connection->offset;
+        if (sent < left) {
+          connection->offset += sent;
+          break;
+        }
+        sent -= left;
+        output.pop_front();
+        connection->offset = 0;
+      }
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else {
+      connection->reading = false;
+      output.clear();
+      connection->offset = 0;
+    }
+  }
+  if (!connection->reading && connection->pending == 0 &&
+      connection->output.empty()) {
+    guard.unlock();
+    close_connection(connection);
+    return;
+  }
+  uint32_t events = (connection->reading ? EPOLLIN : 0) |
+                    (connection->output.empty() ? 0 : EPOLLOUT);
+  // Hangups are reported whatever the events asked for, so a connection
+  // with nothing to do is left out of epoll altogether.
+  if (events != connection->events) {
+    epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = connection->fd;
+    int op = events == 0                ? EPOLL_CTL_DEL
+             : connection->events == 0 ? EPOLL_CTL_ADD
+                                       : EPOLL_CTL_MOD;
+    epoll_ctl(epoll_, op, connection->fd, &event);
+    connection->events = events;
+  }
+}
+
+void EventLoop::close_connection(std::shared_ptr<Connection> connection) {
+  {
+    std::lock_guard<std::mutex> guard(connection->lock);
+    connection->open = false;
+  }
+  if (connection->events != 0)
+    epoll_ctl(epoll_, EPOLL_CTL_DEL, connection->fd, nullptr);
+  close(connection->fd);
+  connections_.erase(connection->fd);
+  std::cerr << "ssr-server: client closed\n";
+}
+
+} // namespace ssr
+} // namespace cottontail
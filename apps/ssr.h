@@ -0,0 +1,291 @@
+#ifndef COTTONTAIL_APPS_SSR_H_
+#define COTTONTAIL_APPS_SSR_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "src/cottontail.h"
+#include "src/nlohmann.h"
+
+namespace cottontail {
+namespace ssr {
+
+// Search sessions for ssr-server: requests are answered by a Server, over
+// any number of collections, and carried to and from clients by an
+// EventLoop, as JSON lines or binary frames.
+
+struct Collection {
+  std::string burrow;
+  std::shared_ptr<Warren> warren;
+  // Clones for parallel_ssr, kept between queries
+  std::shared_ptr<QueryContextPool> pool;
+  // Built by docno-index for the same container and docno queries, if any
+  std::shared_ptr<DocnoIndex> docnos;
+  // Decoded text shared by all collections, each under its burrow, if any
+  std::shared_ptr<TextCache> text;
+  // Features read by queries, and the warmer filling caches from them
+  std::shared_ptr<FeatureLog> features;
+  std::shared_ptr<Warmer> warmer;
+};
+
+struct LocatedDocument {
+  size_t collection = 0;
+  addr container_p = maxfinity;
+  addr container_q = minfinity;
+};
+
+// Ranked but unreturned results from one collection, and where to resume.
+// Docnos and snippets are found only as results are returned.
+struct Page {
+  std::vector<RankingResult> results;
+  size_t next = 0;
+  bool resume = false;
+  RankingResult last;
+  bool done = false;
+  // Ranked only in part before the budget ran out
+  bool partial = false;
+};
+
+struct QueryState {
+  std::mutex lock;
+  std::string query;
+  // The query as a canonical S-expression, for the result cache
+  std::string normalized;
+  std::vector<Page> pages;
+  // Containers returned from partial pages, for each collection, to be
+  // skipped when the pages they came from are ranked in full
+  std::vector<std::set<addr>> early;
+  // Postings of the query's terms in each collection, as the cost of
+  // ranking it
+  std::vector<fval> costs;
+  size_t returned = 0;
+  // Memory held, as last counted, for stats without taking the lock
+  std::atomic<size_t> bytes{0};
+};
+
+// Splits a comma separated list of field queries.
+bool split_fields(const std::string &spec, std::vector<std::string> *fields,
+                  std::string *error);
+
+// A socket listening on the loopback interface, on any free port if port is
+// zero; -1 with errno set if it can't be made.
+int listen_local(uint16_t port, uint16_t *actual_port);
+
+// Pages of results shared between queries, so that a query issued again
+// costs no ranking. Keys name the collection, the normalized query, the
+// container and content queries, the page size and the cursor the page
+// resumes after; each entry also records the snapshot it was ranked
+// against. Once a collection reports a newer snapshot, its older entries are
+// dropped. Least recently used pages are evicted to stay within the budget.
+class ResultCache final {
+public:
+  explicit ResultCache(size_t budget) : budget_(budget) {}
+  bool find(size_t collection, addr snapshot, const std::string &key,
+            Page *page);
+  void insert(size_t collection, addr snapshot, const std::string &key,
+              const Page &page);
+  json metrics();
+  ResultCache(const ResultCache &) = delete;
+  ResultCache &operator=(const ResultCache &) = delete;
+  ResultCache(ResultCache &&) = delete;
+  ResultCache &operator=(ResultCache &&) = delete;
+
+private:
+  struct Entry {
+    size_t collection;
+    addr snapshot;
+    Page page;
+    size_t bytes;
+    std::list<std::string>::iterator lru;
+  };
+  void evict(std::map<std::string, Entry>::iterator it);
+  void retire(size_t collection, addr snapshot);
+  std::mutex lock_;
+  size_t budget_;
+  size_t bytes_ = 0;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+  std::map<std::string, Entry> entries_;
+  std::list<std::string> lru_;
+  std::map<size_t, addr> latest_;
+};
+
+// Query sessions by qid. Sessions idle for longer than the time to live, in
+// milliseconds, are dropped, as are the least recently used beyond the
+// limit, so a long-lived server holds a bounded number of them.
+class Sessions final {
+public:
+  Sessions(size_t limit, addr ttl) : limit_(limit), ttl_(ttl) {}
+  std::string insert(std::shared_ptr<QueryState> state);
+  std::shared_ptr<QueryState> find(const std::string &qid);
+  json metrics();
+  Sessions(const Sessions &) = delete;
+  Sessions &operator=(const Sessions &) = delete;
+  Sessions(Sessions &&) = delete;
+  Sessions &operator=(Sessions &&) = delete;
+
+private:
+  struct Entry {
+    std::shared_ptr<QueryState> state;
+    addr used;
+    std::list<std::string>::iterator lru;
+  };
+  void expire(addr now);
+  std::mutex lock_;
+  size_t limit_;
+  addr ttl_;
+  size_t next_qid_ = 0;
+  size_t expired_ = 0;
+  size_t evicted_ = 0;
+  std::map<std::string, Entry> entries_;
+  std::list<std::string> lru_;
+};
+
+// Answers requests against the collections from any thread, logging each
+// with its response to standard output. Deadlines are in milliseconds, with
+// zero for none.
+class Server final {
+public:
+  Server(std::string container, std::string content, std::string docno,
+         std::vector<std::string> fields, std::vector<Collection> collections,
+         size_t cache_budget, addr deadline, size_t sessions,
+         addr session_ttl, std::shared_ptr<TextCache> text_cache);
+  // Answers a request line with a record line. A request carrying an id has
+  // it copied to the response, so that pipelined requests can be matched
+  // with responses arriving out of order. When busy, or when the request has
+  // already waited past its deadline, it is refused without being run.
+  // Otherwise ranking stops at the deadline, and the response is marked
+  // truncated.
+  std::string respond(const std::string &line, bool busy = false,
+                      addr waited = 0);
+  // As respond, but for the fields of a binary frame, answered by a frame in
+  // pieces. Snippets and document text go out as pieces of their own,
+  // without being copied, and are left out of the log.
+  void respond_frame(const std::string &fields,
+                     std::vector<std::string> *pieces, bool busy = false,
+                     addr waited = 0);
+  // Answers a request that can't be read at all, as a JSON line.
+  std::string refuse(const std::string &error);
+  // Answers the first request of a connection if it asks for a protocol,
+  // which may be binary frames or the default JSON lines.
+  bool negotiate(const std::string &line, bool *binary, std::string *answer);
+  Server(const Server &) = delete;
+  Server &operator=(const Server &) = delete;
+  Server(Server &&) = delete;
+  Server &operator=(Server &&) = delete;
+
+private:
+  json run(const json &request, bool busy, addr waited);
+  std::string record(const json &request, const json &response, addr time);
+  bool checkout(size_t i, std::shared_ptr<QueryContext> *context,
+                Collection *collection, std::string *error);
+  json query(const json &request, QueryBudget *budget);
+  json next(const json &request, QueryBudget *budget);
+  json stats();
+  void save_features();
+  static std::string normalize(const std::string &query);
+  std::string cache_key(size_t collection, const QueryState &state,
+                        const Page &page);
+  void fill(QueryState *state, QueryBudget *budget);
+  size_t best_page(QueryState *state, QueryBudget *budget);
+  json advance(const std::string &op, const std::string &qid,
+               QueryState *state, QueryBudget *budget);
+  json document(const json &request);
+  bool locate_document(const std::string &wanted, LocatedDocument *document,
+                       std::string *error);
+  bool document_text(const Collection &collection, addr cp, addr cq,
+                     std::string *text, std::string *error);
+  std::string container_;
+  std::string content_;
+  std::string docno_;
+  std::vector<std::string> fields_;
+  std::vector<Collection> collections_;
+  std::mutex log_lock_;
+  ResultCache cache_;
+  addr deadline_;
+  Sessions sessions_;
+  std::shared_ptr<TextCache> text_cache_;
+  std::mutex save_lock_;
+  addr saved_ = now();
+};
+
+// Accepts any number of clients on one thread, reading requests from each
+// and handing them to a fixed pool of workers, which may answer pipelined
+// requests in any order. Requests are newline-delimited JSON, or binary
+// frames on a connection whose first request asks for them. Workers queue
+// their responses on the connection and wake the loop through an eventfd to
+// write them, gathering pieces from several responses into each write.
+class EventLoop final {
+public:
+  EventLoop(Server *server, int listener, size_t workers);
+  // Serves until stopped, or until it fails, closing its connections but
+  // not the listener.
+  bool run(std::string *error);
+  // Ends run from any thread.
+  void stop();
+  ~EventLoop();
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+  EventLoop(EventLoop &&) = delete;
+  EventLoop &operator=(EventLoop &&) = delete;
+
+private:
+  struct Connection {
+    int fd = -1;
+    // Owned by the event loop
+    std::string input;
+    bool reading = true;
+    bool first = true;
+    bool binary = false;
+    uint32_t events = 0;
+    // Shared with the workers; responses in pieces, written from offset
+    std::mutex lock;
+    std::deque<std::string> output;
+    size_t offset = 0;
+    size_t pending = 0;
+    bool open = true;
+  };
+  struct Task {
+    std::shared_ptr<Connection> connection;
+    std::string request;
+    bool binary;
+    addr received;
+  };
+  bool watch(int fd, uint32_t events);
+  void accept_all();
+  void receive(std::shared_ptr<Connection> connection);
+  void dispatch(std::shared_ptr<Connection> connection,
+                const std::string &request);
+  std::vector<std::string> answer(const std::string &request, bool binary,
+                                  bool busy, addr waited);
+  void queue(std::shared_ptr<Connection> connection,
+             std::vector<std::string> pieces);
+  void work();
+  void flush(std::shared_ptr<Connection> connection);
+  void close_connection(std::shared_ptr<Connection> connection);
+  Server *server_;
+  int listener_;
+  size_t workers_;
+  int epoll_ = -1;
+  int wake_ = -1;
+  std::atomic<bool> stopping_{false};
+  std::map<int, std::shared_ptr<Connection>> connections_;
+  std::mutex lock_;
+  std::condition_variable available_;
+  std::deque<Task> tasks_;
+  std::vector<std::shared_ptr<Connection>> ready_;
+};
+
+} // namespace ssr
+} // namespace cottontail
+
+#endif // COTTONTAIL_APPS_SSR_H_
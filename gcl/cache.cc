@@ -0,0 +1,89 @@
+#include "gcl/cache.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "gcl/materialize.h"
+#include "src/core.h"
+
+namespace cottontail {
+namespace gcl {
+
+std::shared_ptr<Cache> Cache::make(addr budget, addr entries) {
+  if (budget <= 0 || entries <= 0)
+    return nullptr;
+  return std::shared_ptr<Cache>(new Cache(budget, entries));
+}
+
+std::shared_ptr<Intervals> Cache::find(addr snapshot, const std::string &key) {
+  std::lock_guard<std::mutex> _(lock_);
+  auto it = entries_.find(Key(snapshot, key));
+  if (it == entries_.end()) {
+    metrics_.misses++;
+    return nullptr;
+  }
+  metrics_.hits++;
+  lru_.splice(lru_.begin(), lru_, it->second.lru);
+  return it->second.intervals;
+}
+
+void Cache::insert(addr snapshot, const std::string &key,
+                   std::shared_ptr<Intervals> intervals) {
+  if (intervals == nullptr)
+    return;
+  addr bytes = key.size() + intervals->bytes();
+  if (bytes > budget_)
+    return;
+  std::lock_guard<std::mutex> _(lock_);
+  Key k(snapshot, key);
+  auto it = entries_.find(k);
+  if (it != entries_.end())
+    evict(it);
+  while (!lru_.empty() && (metrics_.bytes + bytes > budget_ ||
+                           metrics_.entries + 1 > max_entries_)) {
+    evict(entries_.find(lru_.back()));
+    metrics_.evictions++;
+  }
+  lru_.push_front(k);
+  entries_[k] = Entry{intervals, bytes, lru_.begin()};
+  metrics_.bytes += bytes;
+  metrics_.entries++;
+  metrics_.insertions++;
+}
+
+void Cache::retire(addr snapshot) {
+  std::lock_guard<std::mutex> _(lock_);
+  auto it = entries_.begin();
+  while (it != entries_.end() && it->first.first < snapshot) {
+    auto stale = it++;
+    evict(stale);
+    metrics_.invalidations++;
+  }
+}
+
+void Cache::clear() {
+  std::lock_guard<std::mutex> _(lock_);
+  metrics_.invalidations += entries_.size();
+  entries_.clear();
+  lru_.clear();
+  metrics_.bytes = 0;
+  metrics_.entries = 0;
+}
+
+CacheMetrics Cache::metrics() {
+  std::lock_guard<std::mutex> _(lock_);
+  return metrics_;
+}
+
+void Cache::evict(std::map<Key, Entry>::iterator it) {
+  metrics_.bytes -= it->second.bytes;
+  metrics_.entries--;
+  lru_.erase(it->second.lru);
+  entries_.erase(it);
+}
+
+} // namespace gcl
+} // namespace cottontail
@@ -0,0 +1,73 @@
+#ifndef COTTONTAIL_GCL_CACHE_H_
+#define COTTONTAIL_GCL_CACHE_H_
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "gcl/materialize.h"
+#include "src/core.h"
+
+namespace cottontail {
+namespace gcl {
+
+struct CacheMetrics {
+  addr hits = 0;
+  addr misses = 0;
+  addr insertions = 0;
+  addr evictions = 0;
+  addr invalidations = 0;
+  addr entries = 0;
+  addr bytes = 0;
+};
+
+// Cross-query cache of materialized GCL results. Keys are canonical
+// S-expression strings (as from SExpression::to_string(), but with substitute
+// references replaced by the stages they name) qualified by the warren
+// snapshot they were computed against, so a result is never returned to a
+// reader with a different view of the index. Entries are immutable interval
+// arrays shared with every hopper created from them. Least recently used
+// entries are evicted to stay within the byte and entry limits.
+class Cache final {
+public:
+  static constexpr addr DEFAULT_BUDGET = 256 * 1024 * 1024;
+  static constexpr addr DEFAULT_ENTRIES = 4096;
+  static std::shared_ptr<Cache> make(addr budget = DEFAULT_BUDGET,
+                                     addr entries = DEFAULT_ENTRIES);
+  std::shared_ptr<Intervals> find(addr snapshot, const std::string &key);
+  void insert(addr snapshot, const std::string &key,
+              std::shared_ptr<Intervals> intervals);
+  // Drops every entry computed against a snapshot older than this one.
+  void retire(addr snapshot);
+  void clear();
+  CacheMetrics metrics();
+  Cache(Cache const &) = delete;
+  Cache &operator=(Cache const &) = delete;
+  Cache(Cache &&) = delete;
+  Cache &operator=(Cache &&) = delete;
+
+private:
+  Cache(addr budget, addr entries) : budget_(budget), max_entries_(entries){};
+  typedef std::pair<addr, std::string> Key;
+  struct Entry {
+    std::shared_ptr<Intervals> intervals;
+    addr bytes;
+    std::list<Key>::iterator lru;
+  };
+  void evict(std::map<Key, Entry>::iterator it);
+
+  std::mutex lock_;
+  addr budget_;
+  addr max_entries_;
+  std::map<Key, Entry> entries_;
+  std::list<Key> lru_;
+  CacheMetrics metrics_;
+};
+
+} // namespace gcl
+} // namespace cottontail
+
+#endif // COTTONTAIL_GCL_CACHE_H_
@@ -23,34 +23,116 @@
 
 #include <algorithm>
 #include <iostream>
+#include <stdexcept>
 #include <set>
 
 #include "gcl/optimizer.h"
 #include "gcl/parse.h"
+#include "gcl/profile.h"
 #include "src/array_hopper.h"
+#include "src/dictionary.h"
+#include "src/query_budget.h"
 #include "src/warren.h"
 
 namespace cottontail {
 
 namespace gcl {
 
-std::unique_ptr<Hopper> hopper(const std::string &query, Warren *warren,
-                               std::string *error) {
+namespace {
+std::unique_ptr<Hopper> make_hopper(const std::string &query, Warren *warren,
+                                    std::shared_ptr<Profile> profile,
+                                    std::string *error,
+                                    std::shared_ptr<Cache> cache = nullptr,
+                                    addr limit = 0) {
   if (warren == nullptr) {
     safe_error(error) = "Cannot construct hopper from gcl without Warren";
     return nullptr;
   }
+  if (QueryBudget::expired_now()) {
+    safe_error(error) = "Query budget spent";
+    return nullptr;
+  }
   std::shared_ptr<SExpression> expr = SExpression::from_string(query, error);
   if (expr == nullptr)
     return nullptr;
+  if (expr->has_patterns()) {
+    std::shared_ptr<Dictionary> dictionary = warren->dictionary(error);
+    if (dictionary == nullptr)
+      return nullptr;
+    size_t limit = Dictionary::DEFAULT_EXPANSIONS;
+    std::string value;
+    if (warren->get_parameter("expansions", &value) && value != "") {
+      size_t used = 0;
+      try {
+        limit = std::stoul(value, &used);
+      } catch (std::exception &e) {
+        used = 0;
+      }
+      if (used != value.size() || value[0] == '-') {
+        safe_error(error) = "Invalid expansions parameter: " + value;
+        return nullptr;
+      }
+    }
+    expr = expr->expand_patterns(dictionary, limit, error);
+    if (expr == nullptr)
+      return nullptr;
+    if (QueryBudget::expired_now()) {
+      safe_error(error) = "Query budget spent";
+      return nullptr;
+    }
+  }
   expr = expr->expand_phrases(warren->tokenizer());
   expr = Optimizer::optimize(expr, warren);
+  if (cache == nullptr) {
+    cache = warren->gcl_cache();
+  } else {
+    std::shared_ptr<Featurizer> featurizer = warren->featurizer();
+    std::shared_ptr<Idx> idx = warren->idx();
+    expr = expr->substitute_terms([&](const std::string &term) {
+      return idx->count(featurizer->featurize(term)) <= limit;
+    });
+  }
   std::unique_ptr<Hopper> hopper =
-      expr->to_hopper(warren->featurizer(), warren->idx());
+      expr->to_hopper(warren->featurizer(), warren->idx(), cache,
+                      cache == nullptr ? 0 : warren->snapshot(), profile);
   if (hopper == nullptr)
     safe_error(error) = "Could not construct hopper from valid gcl: " + query;
   return hopper;
 }
+} // namespace
+
+std::unique_ptr<Hopper> hopper(const std::string &query, Warren *warren,
+                               std::string *error) {
+  return make_hopper(query, warren, nullptr, error);
+}
+
+std::unique_ptr<Hopper> shared_hopper(const std::string &query, Warren *warren,
+                                      std::shared_ptr<Cache> cache,
+                                      addr limit, std::string *error) {
+  if (cache == nullptr) {
+    safe_error(error) = "Shared hopper needs a cache";
+    return nullptr;
+  }
+  return make_hopper(query, warren, nullptr, error, cache, limit);
+}
+
+std::unique_ptr<Hopper> profiled_hopper(const std::string &query,
+                                        Warren *warren,
+                                        std::shared_ptr<Profile> *profile,
+                                        std::string *error) {
+  std::shared_ptr<Profile> root = Profile::make();
+  std::unique_ptr<Hopper> hopper = make_hopper(query, warren, root, error);
+  if (hopper != nullptr && profile != nullptr)
+    *profile = root;
+  return hopper;
+}
+
+std::unique_ptr<Hopper> cached_hopper(const std::string &query, Warren *warren,
+                                      std::string *error) {
+  if (warren == nullptr || warren->gcl_cache() == nullptr)
+    return hopper(query, warren, error);
+  return hopper("(materialize " + query + ")", warren, error);
+}
 
 void Combinational::tau_(addr k, addr *p, addr *q, fval *v) {
   *p = L(*q = R(k));
@@ -112,6 +194,10 @@ addr FollowedBy::R_(addr k) {
 
 void ContainedIn::tau_(addr k, addr *p, addr *q, fval *v) {
   for (;;) {
+    if (QueryBudget::expired()) {
+      *p = *q = maxfinity;
+      return;
+    }
     addr pp, qq;
     left_->tau(k, p, q, v);
     if (*p == maxfinity)
@@ -131,6 +217,10 @@ void ContainedIn::rho_(addr k, addr *p, addr *q, fval *v) {
 
 void ContainedIn::uat_(addr k, addr *p, addr *q, fval *v) {
   for (;;) {
+    if (QueryBudget::expired()) {
+      *p = *q = minfinity;
+      return;
+    }
     addr pp, qq;
     left_->uat(k, p, q, v);
     if (*q == minfinity)
@@ -156,6 +246,10 @@ void Containing::tau_(addr k, addr *p, addr *q, fval *v) {
 
 void Containing::rho_(addr k, addr *p, addr *q, fval *v) {
   for (;;) {
+    if (QueryBudget::expired()) {
+      *p = *q = maxfinity;
+      return;
+    }
     addr pp, qq;
     left_->rho(k, p, q, v);
     if (*q == maxfinity)
@@ -175,6 +269,10 @@ void Containing::uat_(addr k, addr *p, addr *q, fval *v) {
 
 void Containing::ohr_(addr k, addr *p, addr *q, fval *v) {
   for (;;) {
+    if (QueryBudget::expired()) {
+      *p = *q = minfinity;
+      return;
+    }
     addr pp, qq;
     left_->ohr(k, p, q, v);
     if (*p == minfinity)
@@ -191,6 +289,10 @@ void NotContainedIn::tau_(addr k, addr *p, addr *q, fval *v) {
   if (*p == maxfinity || *q == minfinity)
     return;
   for (;;) {
+    if (QueryBudget::expired()) {
+      *p = *q = maxfinity;
+      return;
+    }
     addr pp, qq;
     right_->rho(*q, &pp, &qq);
     if (pp > *p)
@@ -212,6 +314,10 @@ void NotContainedIn::uat_(addr k, addr *p, addr *q, fval *v) {
   if (*q == minfinity || *p == maxfinity)
     return;
   for (;;) {
+    if (QueryBudget::expired()) {
+      *p = *q = minfinity;
+      return;
+    }
     addr pp, qq;
     right_->ohr(*p, &pp, &qq);
     if (qq < *q)
@@ -239,6 +345,10 @@ void NotContaining::rho_(addr k, addr *p, addr *q, fval *v) {
   if (*q == maxfinity || *p == minfinity)
     return;
   for (;;) {
+    if (QueryBudget::expired()) {
+      *p = *q = maxfinity;
+      return;
+    }
     addr pp, qq;
     right_->tau(*p, &pp, &qq);
     if (qq > *q)
@@ -260,6 +370,10 @@ void NotContaining::ohr_(addr k, addr *p, addr *q, fval *v) {
   if (*p == minfinity || *q == maxfinity)
     return;
   for (;;) {
+    if (QueryBudget::expired()) {
+      *p = *q = minfinity;
+      return;
+    }
     addr pp, qq;
     right_->uat(*q, &pp, &qq);
     if (pp < *p)
@@ -368,10 +482,14 @@ void Link::tau_(addr k, addr *p, addr *q, fval *v) {
   if (!linked_) {
     addr p0, q0, v0;
     std::set<addr> s;
-    for (expr_->tau(minfinity + 1, &p0, &q0, &v0); p0 < maxfinity;
+    for (expr_->tau(minfinity + 1, &p0, &q0, &v0);
+         p0 < maxfinity && !QueryBudget::expired();
          expr_->tau(p0 + 1, &p0, &q0, &v0))
       if (v0 > minfinity && v0 < maxfinity)
         s.insert(v0);
+    // Cut short by the query budget, the set serves only this call
+    if (QueryBudget::cut_short())
+      return make_link_hopper(s)->tau(k, p, q, v);
     expr_ = make_link_hopper(s);
     linked_ = true;
   }
@@ -382,10 +500,14 @@ void Link::rho_(addr k, addr *p, addr *q, fval *v) {
   if (!linked_) {
     addr p0, q0, v0;
     std::set<addr> s;
-    for (expr_->rho(minfinity + 1, &p0, &q0, &v0); q0 < maxfinity;
+    for (expr_->rho(minfinity + 1, &p0, &q0, &v0);
+         q0 < maxfinity && !QueryBudget::expired();
          expr_->rho(q0 + 1, &p0, &q0, &v0))
       if (v0 > minfinity && v0 < maxfinity)
         s.insert(v0);
+    // Cut short by the query budget, the set serves only this call
+    if (QueryBudget::cut_short())
+      return make_link_hopper(s)->rho(k, p, q, v);
     expr_ = make_link_hopper(s);
     linked_ = true;
   }
@@ -396,10 +518,14 @@ void Link::uat_(addr k, addr *p, addr *q, fval *v) {
   if (!linked_) {
     addr p0, q0, v0;
     std::set<addr> s;
-    for (expr_->uat(maxfinity - 1, &p0, &q0, &v0); q0 > minfinity;
+    for (expr_->uat(maxfinity - 1, &p0, &q0, &v0);
+         q0 > minfinity && !QueryBudget::expired();
          expr_->uat(q0 - 1, &p0, &q0, &v0))
       if (v0 > minfinity && v0 < maxfinity)
         s.insert(v0);
+    // Cut short by the query budget, the set serves only this call
+    if (QueryBudget::cut_short())
+      return make_link_hopper(s)->uat(k, p, q, v);
     expr_ = make_link_hopper(s);
     linked_ = true;
   }
@@ -410,10 +536,14 @@ void Link::ohr_(addr k, addr *p, addr *q, fval *v) {
   if (!linked_) {
     addr p0, q0, v0;
     std::set<addr> s;
-    for (expr_->ohr(maxfinity - 1, &p0, &q0, &v0); p0 > minfinity;
+    for (expr_->ohr(maxfinity - 1, &p0, &q0, &v0);
+         p0 > minfinity && !QueryBudget::expired();
          expr_->ohr(p0 - 1, &p0, &q0, &v0))
       if (v0 > minfinity && v0 < maxfinity)
         s.insert(v0);
+    // Cut short by the query budget, the set serves only this call
+    if (QueryBudget::cut_short())
+      return make_link_hopper(s)->ohr(k, p, q, v);
     expr_ = make_link_hopper(s);
     linked_ = true;
   }
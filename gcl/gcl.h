@@ -16,6 +16,32 @@ namespace gcl {
 std::unique_ptr<Hopper> hopper(const std::string &query, Warren *warren,
                                std::string *error = nullptr);
 
+// As above, but the result as a whole is materialized and shared through the
+// warren's cache, if it has one. Intended for queries that are evaluated
+// over and over again, such as container definitions.
+std::unique_ptr<Hopper> cached_hopper(const std::string &query, Warren *warren,
+                                      std::string *error = nullptr);
+
+class Cache;
+
+// As hopper() above, but terms with no more than limit postings are
+// enumerated once and shared, through the given cache, between all of their
+// occurrences in the query and all other queries built against the same
+// cache. Intended for families of overlapping queries, such as ranking tiers.
+std::unique_ptr<Hopper> shared_hopper(const std::string &query, Warren *warren,
+                                      std::shared_ptr<Cache> cache,
+                                      addr limit, std::string *error = nullptr);
+
+class Profile;
+
+// As hopper() above, but every node of the resulting tree counts its calls
+// and the time spent in them. Call profile->dump() after the hopper has been
+// used to see where the time went.
+std::unique_ptr<Hopper> profiled_hopper(const std::string &query,
+                                        Warren *warren,
+                                        std::shared_ptr<Profile> *profile,
+                                        std::string *error = nullptr);
+
 class Unary : public Hopper {
 public:
   Unary(std::unique_ptr<Hopper> expr) : expr_(std::move(expr)){};
@@ -1,42 +1,56 @@
 #include "gcl/materialize.h"
 
 #include <memory>
+#include <string>
 #include <vector>
 
+#include "gcl/cache.h"
 #include "src/array_hopper.h"
 #include "src/core.h"
 #include "src/hopper.h"
+#include "src/query_budget.h"
 
 namespace cottontail {
 namespace gcl {
-namespace {
 
-std::unique_ptr<Hopper> make_hopper(const std::vector<addr> &postings,
-                                    const std::vector<addr> &qostings,
-                                    const std::vector<fval> &fostings) {
-  if (postings.size() == 0)
+std::unique_ptr<Hopper> Intervals::hopper() const {
+  if (n == 0)
     return std::make_unique<EmptyHopper>();
-  if (postings.size() == 1)
-    return std::make_unique<SingletonHopper>(postings[0], qostings[0],
-                                             fostings[0]);
-  addr n = postings.size();
-  std::shared_ptr<addr> posting_storage = shared_array<addr>(n);
-  std::shared_ptr<addr> qosting_storage = shared_array<addr>(n);
-  std::shared_ptr<fval> fosting_storage = shared_array<fval>(n);
-  for (addr i = 0; i < n; i++) {
-    posting_storage.get()[i] = postings[i];
-    qosting_storage.get()[i] = qostings[i];
-    fosting_storage.get()[i] = fostings[i];
-  }
-  return ArrayHopper::make(n, posting_storage, qosting_storage,
-                           fosting_storage);
+  if (n == 1)
+    return std::make_unique<SingletonHopper>(postings.get()[0],
+                                             qostings.get()[0],
+                                             fostings.get()[0]);
+  return ArrayHopper::make(n, postings, qostings, fostings);
 }
 
-} // namespace
+std::shared_ptr<Materialization>
+Materialization::make(std::unique_ptr<Hopper> expr,
+                      std::shared_ptr<Cache> cache, addr snapshot,
+                      const std::string &key) {
+  if (expr == nullptr)
+    return nullptr;
+  std::shared_ptr<Materialization> materialization =
+      std::shared_ptr<Materialization>(new Materialization());
+  materialization->expr_ = std::move(expr);
+  materialization->cache_ = cache;
+  materialization->snapshot_ = snapshot;
+  materialization->key_ = key;
+  return materialization;
+}
 
-void Materialize::materialize() {
-  if (materialized_)
-    return;
+std::shared_ptr<Materialization>
+Materialization::make(std::shared_ptr<Intervals> intervals) {
+  if (intervals == nullptr)
+    return nullptr;
+  std::shared_ptr<Materialization> materialization =
+      std::shared_ptr<Materialization>(new Materialization());
+  materialization->intervals_ = intervals;
+  return materialization;
+}
+
+std::shared_ptr<Intervals> Materialization::materialize() {
+  if (intervals_ != nullptr)
+    return intervals_;
   std::vector<addr> postings;
   std::vector<addr> qostings;
   std::vector<fval> fostings;
@@ -44,12 +58,48 @@ void Materialize::materialize() {
   fval v;
   for (expr_->tau(minfinity + 1, &p, &q, &v); p < maxfinity;
        expr_->tau(p + 1, &p, &q, &v)) {
+    if (QueryBudget::expired())
+      break;
     postings.push_back(p);
     qostings.push_back(q);
     fostings.push_back(v);
   }
-  expr_ = make_hopper(postings, qostings, fostings);
-  materialized_ = true;
+  std::shared_ptr<Intervals> intervals = std::make_shared<Intervals>();
+  intervals->n = postings.size();
+  if (intervals->n > 0) {
+    intervals->postings = shared_array<addr>(intervals->n);
+    intervals->qostings = shared_array<addr>(intervals->n);
+    intervals->fostings = shared_array<fval>(intervals->n);
+    for (addr i = 0; i < intervals->n; i++) {
+      intervals->postings.get()[i] = postings[i];
+      intervals->qostings.get()[i] = qostings[i];
+      intervals->fostings.get()[i] = fostings[i];
+    }
+  }
+  // Cut short by the query budget, here or in the expression below, the
+  // result serves only this query
+  if (QueryBudget::cut_short())
+    return intervals;
+  intervals_ = intervals;
+  expr_ = nullptr;
+  if (cache_ != nullptr) {
+    cache_->insert(snapshot_, key_, intervals_);
+    cache_ = nullptr;
+  }
+  return intervals_;
+}
+
+std::unique_ptr<Hopper> Materialization::hopper() {
+  return materialize()->hopper();
+}
+
+addr Materialization::size() {
+  return materialize()->n;
+}
+
+void Materialize::materialize() {
+  if (expr_ == nullptr)
+    expr_ = materialization_->hopper();
 }
 
 void Materialize::tau_(addr k, addr *p, addr *q, fval *v) {
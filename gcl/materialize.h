@@ -2,6 +2,7 @@
 #define COTTONTAIL_GCL_MATERIALIZE_H_
 
 #include <memory>
+#include <string>
 
 #include "gcl/gcl.h"
 #include "src/core.h"
@@ -10,9 +11,57 @@
 namespace cottontail {
 namespace gcl {
 
+class Cache;
+
+// Immutable array-backed result of enumerating a GCL expression.
+struct Intervals {
+  addr n = 0;
+  std::shared_ptr<addr> postings;
+  std::shared_ptr<addr> qostings;
+  std::shared_ptr<fval> fostings;
+  inline addr bytes() const {
+    return n * (2 * sizeof(addr) + sizeof(fval));
+  }
+  std::unique_ptr<Hopper> hopper() const;
+};
+
+// Materialized result of a GCL expression. The expression is enumerated once,
+// on first use, into array-backed storage. Any number of hoppers may then be
+// created over that storage without copying it. When given a cache, the
+// result is published there once it exists. An enumeration cut short by a
+// query budget is neither kept nor published.
+class Materialization final {
+public:
+  static std::shared_ptr<Materialization>
+  make(std::unique_ptr<Hopper> expr, std::shared_ptr<Cache> cache = nullptr,
+       addr snapshot = 0, const std::string &key = "");
+  static std::shared_ptr<Materialization>
+  make(std::shared_ptr<Intervals> intervals);
+  std::unique_ptr<Hopper> hopper();
+  addr size();
+  Materialization(Materialization const &) = delete;
+  Materialization &operator=(Materialization const &) = delete;
+  Materialization(Materialization &&) = delete;
+  Materialization &operator=(Materialization &&) = delete;
+
+private:
+  Materialization(){};
+  std::shared_ptr<Intervals> materialize();
+
+  std::unique_ptr<Hopper> expr_;
+  std::shared_ptr<Intervals> intervals_;
+  std::shared_ptr<Cache> cache_;
+  addr snapshot_ = 0;
+  std::string key_;
+};
+
 class Materialize final : public Unary {
 public:
-  Materialize(std::unique_ptr<Hopper> expr) : Unary(std::move(expr)){};
+  Materialize(std::unique_ptr<Hopper> expr)
+      : Unary(nullptr),
+        materialization_(Materialization::make(std::move(expr))){};
+  Materialize(std::shared_ptr<Materialization> materialization)
+      : Unary(nullptr), materialization_(materialization){};
   virtual ~Materialize(){};
   Materialize(Materialize const &) = delete;
   Materialize &operator=(Materialize const &) = delete;
@@ -26,7 +75,7 @@ private:
   void uat_(addr k, addr *p, addr *q, fval *v) final;
   void ohr_(addr k, addr *p, addr *q, fval *v) final;
 
-  bool materialized_ = false;
+  std::shared_ptr<Materialization> materialization_;
 };
 
 } // namespace gcl
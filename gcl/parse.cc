@@ -4,11 +4,16 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "src/core.h"
+#include "src/dictionary.h"
 #include "src/featurizer.h"
+#include "gcl/cache.h"
 #include "gcl/gcl.h"
 #include "gcl/materialize.h"
+#include "gcl/profile.h"
+#include "gcl/vector_hopper.h"
 #include "src/hopper.h"
 #include "src/idx.h"
 
@@ -37,7 +42,12 @@ static std::map<std::string, enum Operator> gcl_operator_forward = {
     {"not_containing", NOT_CONTAINING},
     {"@", LINK},
     {"link", LINK},
-    {"materialize", MATERIALIZE}};
+    {"materialize", MATERIALIZE},
+    {"substitute", SUBSTITUTE},
+    {"$", REFERENCE},
+    {"prefix", PREFIX},
+    {"wildcard", WILDCARD},
+    {"regex", REGEX}};
 
 static std::map<enum Operator, std::string> gcl_operator_reverse = {
     {TERM, ""},
@@ -50,7 +60,12 @@ static std::map<enum Operator, std::string> gcl_operator_reverse = {
     {NOT_CONTAINED_IN, "!<"},
     {NOT_CONTAINING, "!>"},
     {LINK, "@"},
-    {MATERIALIZE, "materialize"}};
+    {MATERIALIZE, "materialize"},
+    {SUBSTITUTE, "substitute"},
+    {REFERENCE, "$"},
+    {PREFIX, "prefix"},
+    {WILDCARD, "wildcard"},
+    {REGEX, "regex"}};
 
 static std::map<enum Operator, unsigned> gcl_operator_min_operands = {
     {TERM, 0},           {FIXED, 0},
@@ -58,7 +73,9 @@ static std::map<enum Operator, unsigned> gcl_operator_min_operands = {
     {FOLLOWED_BY, 1},    {CONTAINED_IN, 2},
     {CONTAINING, 2},     {NOT_CONTAINED_IN, 2},
     {NOT_CONTAINING, 2}, {LINK, 1},
-    {MATERIALIZE, 1}};
+    {MATERIALIZE, 1},    {SUBSTITUTE, 1},
+    {REFERENCE, 0},      {PREFIX, 1},
+    {WILDCARD, 1},       {REGEX, 1}};
 
 static std::map<enum Operator, unsigned> gcl_operator_max_operands = {
     {TERM, 0},
@@ -71,7 +88,12 @@ static std::map<enum Operator, unsigned> gcl_operator_max_operands = {
     {NOT_CONTAINED_IN, maxfinity},
     {NOT_CONTAINING, maxfinity},
     {LINK, 1},
-    {MATERIALIZE, 1}};
+    {MATERIALIZE, 1},
+    {SUBSTITUTE, maxfinity},
+    {REFERENCE, 0},
+    {PREFIX, 1},
+    {WILDCARD, 1},
+    {REGEX, 1}};
 
 inline bool is_whitespace(char c) { return c == ' ' || c == '\t'; }
 
@@ -136,7 +158,7 @@ const char *parse_expr(const char *where, std::shared_ptr<SExpression> expr,
   expr->kind_ = opfind->second;
   while (is_whitespace(*where))
     where++;
-  if (expr->kind_ == Operator::FIXED) {
+  if (expr->kind_ == Operator::FIXED || expr->kind_ == Operator::REFERENCE) {
     if (!is_width_character(*where))
       return where;
     addr width = width_character_value(*where++);
@@ -180,11 +202,33 @@ std::shared_ptr<SExpression> SExpression::from_string(std::string s,
   std::shared_ptr<SExpression> expr = std::make_shared<SExpression>();
   bool okay;
   const char *where = parse_expr(s.c_str(), expr, &okay);
-  if (okay)
-    return expr;
-  safe_error(error) =
-      "parse error at offset " + std::to_string(where - s.c_str()) + ":" + s;
-  return nullptr;
+  if (!okay) {
+    safe_error(error) =
+        "parse error at offset " + std::to_string(where - s.c_str()) + ":" + s;
+    return nullptr;
+  }
+  if (!expr->check_references(0)) {
+    safe_error(error) = "reference to unbound substitute stage:" + s;
+    return nullptr;
+  }
+  return expr;
+}
+
+// A reference ($ n) may only name a stage that precedes it in the innermost
+// enclosing substitute.
+bool SExpression::check_references(size_t stages) {
+  if (kind_ == REFERENCE)
+    return width_ >= 1 && static_cast<size_t>(width_) <= stages;
+  if (kind_ == SUBSTITUTE) {
+    for (size_t i = 0; i < subx_.size(); i++)
+      if (!subx_[i]->check_references(i))
+        return false;
+    return true;
+  }
+  for (auto &sub : subx_)
+    if (!sub->check_references(stages))
+      return false;
+  return true;
 }
 
 std::string SExpression::to_string() {
@@ -192,6 +236,8 @@ std::string SExpression::to_string() {
     return term_;
   if (kind_ == Operator::FIXED)
     return "(# " + std::to_string(width_) + ")";
+  if (kind_ == Operator::REFERENCE)
+    return "($ " + std::to_string(width_) + ")";
   std::string s = "(" + gcl_operator_reverse[kind_];
   for (size_t i = 0; i < subx_.size(); i++) {
     s += ' ';
@@ -236,6 +282,66 @@ SExpression::expand_phrases(std::shared_ptr<cottontail::Tokenizer> tokenizer,
   return expr;
 }
 
+bool SExpression::has_patterns() {
+  if (kind_ == PREFIX || kind_ == WILDCARD || kind_ == REGEX)
+    return true;
+  for (auto &sub : subx_)
+    if (sub->has_patterns())
+      return true;
+  return false;
+}
+
+std::shared_ptr<SExpression>
+SExpression::expand_patterns(std::shared_ptr<Dictionary> dictionary,
+                             size_t limit, std::string *error) {
+  std::shared_ptr<SExpression> expr = std::make_shared<SExpression>();
+  expr->kind_ = kind_;
+  expr->term_ = term_;
+  expr->width_ = width_;
+  if (kind_ == PREFIX || kind_ == WILDCARD || kind_ == REGEX) {
+    if (dictionary == nullptr) {
+      safe_error(error) = "No dictionary for pattern expansion";
+      return nullptr;
+    }
+    if (subx_.size() != 1 || subx_[0]->kind_ != TERM) {
+      safe_error(error) = "Pattern must be a term: " + to_string();
+      return nullptr;
+    }
+    std::string pattern = subx_[0]->term_;
+    if (pattern.length() >= 2 && is_quote_character(pattern[0]) &&
+        pattern[pattern.length() - 1] == pattern[0])
+      pattern = pattern.substr(1, pattern.length() - 2);
+    std::vector<std::string> terms;
+    bool okay;
+    if (kind_ == PREFIX)
+      okay = dictionary->prefix(pattern, &terms, limit, error);
+    else if (kind_ == WILDCARD)
+      okay = dictionary->wildcard(pattern, &terms, limit, error);
+    else
+      okay = dictionary->regex(pattern, &terms, limit, error);
+    if (!okay)
+      return nullptr;
+    expr->kind_ = ONE_OF;
+    expr->term_ = "";
+    for (auto &term : terms) {
+      std::shared_ptr<SExpression> subx = std::make_shared<SExpression>();
+      subx->kind_ = TERM;
+      subx->term_ = term;
+      subx->width_ = 0;
+      expr->subx_.push_back(subx);
+    }
+    return expr;
+  }
+  for (size_t i = 0; i < subx_.size(); i++) {
+    std::shared_ptr<SExpression> subx =
+        subx_[i]->expand_patterns(dictionary, limit, error);
+    if (subx == nullptr)
+      return nullptr;
+    expr->subx_.push_back(subx);
+  }
+  return expr;
+}
+
 std::shared_ptr<SExpression> SExpression::to_binary() {
   std::shared_ptr<SExpression> expr = std::make_shared<SExpression>();
   expr->kind_ = kind_;
@@ -256,9 +362,137 @@ std::shared_ptr<SExpression> SExpression::to_binary() {
   return expr;
 }
 
+bool SExpression::has_stages() {
+  if (kind_ == SUBSTITUTE || kind_ == REFERENCE)
+    return true;
+  for (auto &sub : subx_)
+    if (sub->has_stages())
+      return true;
+  return false;
+}
+
+std::shared_ptr<SExpression>
+SExpression::replace_terms(const std::map<std::string, size_t> &stages) {
+  std::shared_ptr<SExpression> expr = std::make_shared<SExpression>();
+  auto it = stages.find(term_);
+  if (kind_ == TERM && it != stages.end()) {
+    expr->kind_ = REFERENCE;
+    expr->width_ = it->second;
+    return expr;
+  }
+  expr->kind_ = kind_;
+  expr->term_ = term_;
+  expr->width_ = width_;
+  for (auto &sub : subx_)
+    expr->subx_.push_back(sub->replace_terms(stages));
+  return expr;
+}
+
+std::shared_ptr<SExpression> SExpression::substitute_terms(
+    std::function<bool(const std::string &)> share) {
+  if (has_stages())
+    return replace_terms({});
+  std::vector<std::shared_ptr<SExpression>> terms;
+  std::map<std::string, size_t> stages;
+  std::function<void(SExpression *)> collect = [&](SExpression *expr) {
+    if (expr->kind_ == TERM && stages.find(expr->term_) == stages.end() &&
+        share(expr->term_)) {
+      std::shared_ptr<SExpression> term = std::make_shared<SExpression>();
+      term->kind_ = TERM;
+      term->term_ = expr->term_;
+      term->width_ = 0;
+      terms.push_back(term);
+      stages[expr->term_] = terms.size();
+    }
+    for (auto &sub : expr->subx_)
+      collect(sub.get());
+  };
+  collect(this);
+  if (terms.size() == 0)
+    return replace_terms({});
+  std::shared_ptr<SExpression> expr = std::make_shared<SExpression>();
+  expr->kind_ = SUBSTITUTE;
+  expr->width_ = 0;
+  expr->subx_ = terms;
+  expr->subx_.push_back(replace_terms(stages));
+  return expr;
+}
+
 std::unique_ptr<cottontail::Hopper>
 SExpression::to_hopper(std::shared_ptr<Featurizer> featurizer,
-                       std::shared_ptr<Idx> idx) {
+                       std::shared_ptr<Idx> idx, std::shared_ptr<Cache> cache,
+                       addr snapshot, std::shared_ptr<Profile> profile) {
+  return to_hopper(featurizer, idx, cache, snapshot, nullptr, profile);
+}
+
+// Like to_string(), but with each ($ n) replaced by the canonical form of the
+// stage it refers to, so that the result identifies the intervals the
+// expression generates without reference to its surroundings.
+std::string SExpression::canonical(const std::vector<Binding> *bindings) {
+  if (kind_ == REFERENCE && bindings != nullptr && width_ >= 1 &&
+      static_cast<size_t>(width_) <= bindings->size())
+    return (*bindings)[width_ - 1].key;
+  if (bindings == nullptr || kind_ == TERM || kind_ == FIXED ||
+      kind_ == SUBSTITUTE)
+    return to_string();
+  std::string s = "(" + gcl_operator_reverse[kind_];
+  for (size_t i = 0; i < subx_.size(); i++) {
+    s += ' ';
+    s += subx_[i]->canonical(bindings);
+  }
+  return s + ")";
+}
+
+// Materialized results are shared through the cache, when there is one,
+// keyed by their canonical form.
+std::shared_ptr<Materialization> SExpression::materialization(
+    std::shared_ptr<Featurizer> featurizer, std::shared_ptr<Idx> idx,
+    std::shared_ptr<Cache> cache, addr snapshot,
+    const std::vector<Binding> *bindings, std::shared_ptr<Profile> profile) {
+  std::string key;
+  if (cache != nullptr) {
+    key = canonical(bindings);
+    std::shared_ptr<Intervals> intervals = cache->find(snapshot, key);
+    if (intervals != nullptr)
+      return Materialization::make(intervals);
+  }
+  std::unique_ptr<cottontail::Hopper> expr =
+      to_hopper(featurizer, idx, cache, snapshot, bindings, profile);
+  if (expr == nullptr)
+    return nullptr;
+  return Materialization::make(std::move(expr), cache, snapshot, key);
+}
+
+std::string SExpression::label() {
+  if (kind_ == TERM || kind_ == FIXED || kind_ == REFERENCE)
+    return to_string();
+  return gcl_operator_reverse[kind_];
+}
+
+// When profiling, each node is wrapped to record calls into its own node of
+// the profile tree, a child of the profile node of its parent.
+std::unique_ptr<cottontail::Hopper> SExpression::to_hopper(
+    std::shared_ptr<Featurizer> featurizer, std::shared_ptr<Idx> idx,
+    std::shared_ptr<Cache> cache, addr snapshot,
+    const std::vector<Binding> *bindings, std::shared_ptr<Profile> profile) {
+  if (profile == nullptr)
+    return to_hopper_(featurizer, idx, cache, snapshot, bindings, nullptr);
+  std::shared_ptr<Profile> node = profile->child(label());
+  std::unique_ptr<cottontail::Hopper> hopper =
+      to_hopper_(featurizer, idx, cache, snapshot, bindings, node);
+  if (hopper == nullptr)
+    return nullptr;
+  return std::make_unique<Profiled>(std::move(hopper), node);
+}
+
+// Each stage of a substitute is lowered to a shared Materialization. Every
+// ($ n) reference becomes its own Materialize hopper over the shared storage
+// of stage n, so a stage is enumerated at most once, when first needed, no
+// matter how often later stages refer to it. The final stage is the result.
+std::unique_ptr<cottontail::Hopper> SExpression::to_hopper_(
+    std::shared_ptr<Featurizer> featurizer, std::shared_ptr<Idx> idx,
+    std::shared_ptr<Cache> cache, addr snapshot,
+    const std::vector<Binding> *bindings, std::shared_ptr<Profile> profile) {
   if (kind_ == TERM) {
     return idx->hopper(featurizer->featurize(term_));
   }
@@ -268,32 +502,80 @@ SExpression::to_hopper(std::shared_ptr<Featurizer> featurizer,
   if (kind_ == LINK) {
     if (subx_.size() != 1)
       return nullptr;
-    std::unique_ptr<cottontail::Hopper> expr =
-        subx_[0]->to_hopper(featurizer, idx);
+    std::unique_ptr<cottontail::Hopper> expr = subx_[0]->to_hopper(
+        featurizer, idx, cache, snapshot, bindings, profile);
     return std::make_unique<cottontail::gcl::Link>(std::move(expr));
   }
+  if (kind_ == REFERENCE) {
+    if (bindings == nullptr || width_ < 1 ||
+        static_cast<size_t>(width_) > bindings->size())
+      return nullptr;
+    return std::make_unique<cottontail::gcl::Materialize>(
+        (*bindings)[width_ - 1].materialization);
+  }
+  if (kind_ == SUBSTITUTE) {
+    if (subx_.size() == 0)
+      return nullptr;
+    std::vector<Binding> stages;
+    for (auto &sub : subx_) {
+      std::shared_ptr<Materialization> stage =
+          sub->materialization(featurizer, idx, cache, snapshot, &stages,
+                               profile);
+      if (stage == nullptr)
+        return nullptr;
+      stages.push_back(
+          Binding{cache == nullptr ? "" : sub->canonical(&stages), stage});
+    }
+    return std::make_unique<cottontail::gcl::Materialize>(
+        stages.back().materialization);
+  }
   if (kind_ == MATERIALIZE) {
     if (subx_.size() != 1)
       return nullptr;
-    std::unique_ptr<cottontail::Hopper> expr =
-        subx_[0]->to_hopper(featurizer, idx);
-    if (expr == nullptr)
+    std::shared_ptr<Materialization> materialization =
+        subx_[0]->materialization(featurizer, idx, cache, snapshot, bindings,
+                                  profile);
+    if (materialization == nullptr)
       return nullptr;
-    return std::make_unique<cottontail::gcl::Materialize>(std::move(expr));
+    return std::make_unique<cottontail::gcl::Materialize>(materialization);
+  }
+  if (kind_ == PREFIX || kind_ == WILDCARD || kind_ == REGEX)
+    return nullptr; // never expanded
+  // A one_of over many terms, typically from pattern expansion, is merged
+  // by a single priority queue rather than a deep tree of binary ors.
+  if (kind_ == ONE_OF) {
+    if (subx_.size() == 0)
+      return std::make_unique<cottontail::EmptyHopper>();
+    bool terms = (subx_.size() > 2);
+    for (size_t i = 0; terms && i < subx_.size(); i++)
+      terms = (subx_[i]->kind_ == TERM);
+    if (terms) {
+      std::vector<std::unique_ptr<cottontail::Hopper>> hoppers;
+      for (auto &sub : subx_) {
+        std::unique_ptr<cottontail::Hopper> hopper = sub->to_hopper(
+            featurizer, idx, cache, snapshot, bindings, profile);
+        if (hopper == nullptr)
+          return nullptr;
+        hoppers.push_back(std::move(hopper));
+      }
+      return VectorHopper::make(&hoppers, false);
+    }
   }
   if (subx_.size() > 2) {
     std::shared_ptr<SExpression> binary_expr = to_binary();
-    return binary_expr->to_hopper(featurizer, idx);
+    return binary_expr->to_hopper_(featurizer, idx, cache, snapshot, bindings,
+                                   profile);
   }
   if (subx_.size() == 1 &&
       (kind_ == ONE_OF || kind_ == ALL_OF || kind_ == FOLLOWED_BY))
-    return subx_[0]->to_hopper(featurizer, idx);
+    return subx_[0]->to_hopper(featurizer, idx, cache, snapshot, bindings,
+                               profile);
   if (subx_.size() < 2)
     return nullptr;
-  std::unique_ptr<cottontail::Hopper> left =
-      subx_[0]->to_hopper(featurizer, idx);
-  std::unique_ptr<cottontail::Hopper> right =
-      subx_[1]->to_hopper(featurizer, idx);
+  std::unique_ptr<cottontail::Hopper> left = subx_[0]->to_hopper(
+      featurizer, idx, cache, snapshot, bindings, profile);
+  std::unique_ptr<cottontail::Hopper> right = subx_[1]->to_hopper(
+      featurizer, idx, cache, snapshot, bindings, profile);
   switch (kind_) {
   case ONE_OF:
     return std::make_unique<cottontail::gcl::Or>(std::move(left),
@@ -1,11 +1,14 @@
 #ifndef COTTONTAIL_GCL_PARSE_H_
 #define COTTONTAIL_GCL_PARSE_H_
 
+#include <functional>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include "src/core.h"
+#include "src/dictionary.h"
 #include "src/featurizer.h"
 #include "gcl/gcl.h"
 #include "src/hopper.h"
@@ -16,7 +19,10 @@ namespace cottontail {
 
 namespace gcl {
 
+class Cache;
+class Materialization;
 class Optimizer;
+class Profile;
 
 enum Operator {
   TERM,
@@ -29,7 +35,12 @@ enum Operator {
   NOT_CONTAINED_IN,
   NOT_CONTAINING,
   LINK,
-  MATERIALIZE
+  MATERIALIZE,
+  SUBSTITUTE,
+  REFERENCE,
+  PREFIX,
+  WILDCARD,
+  REGEX
 };
 
 class SExpression final {
@@ -47,17 +58,59 @@ public:
   std::shared_ptr<SExpression> to_binary();
   std::shared_ptr<SExpression>
   expand_phrases(std::shared_ptr<Tokenizer> tokenizer, char marker = '"');
+  // Replaces each (prefix t), (wildcard t) and (regex t) with a one_of over
+  // the matching terms in the dictionary, failing if any pattern matches
+  // more than limit terms.
+  bool has_patterns();
+  std::shared_ptr<SExpression>
+  expand_patterns(std::shared_ptr<Dictionary> dictionary, size_t limit,
+                  std::string *error = nullptr);
+  // Rewrites the expression as a substitute whose first stages are the
+  // distinct terms accepted by share, so that each is enumerated once no
+  // matter how often it appears. Expressions that already refer to stages
+  // are returned as they are.
+  std::shared_ptr<SExpression>
+  substitute_terms(std::function<bool(const std::string &)> share);
   std::unique_ptr<Hopper> to_hopper(std::shared_ptr<Featurizer> featurizer,
-                                    std::shared_ptr<Idx> idx);
+                                    std::shared_ptr<Idx> idx,
+                                    std::shared_ptr<Cache> cache = nullptr,
+                                    addr snapshot = 0,
+                                    std::shared_ptr<Profile> profile = nullptr);
 
   friend const char *parse_expr(const char *where,
                                 std::shared_ptr<SExpression> expr, bool *okay);
   friend class Optimizer;
 
 private:
+  struct Binding {
+    std::string key;
+    std::shared_ptr<Materialization> materialization;
+  };
+  bool check_references(size_t stages);
+  bool has_stages();
+  std::shared_ptr<SExpression>
+  replace_terms(const std::map<std::string, size_t> &stages);
+  std::string canonical(const std::vector<Binding> *bindings);
+  std::string label();
+  std::shared_ptr<Materialization>
+  materialization(std::shared_ptr<Featurizer> featurizer,
+                  std::shared_ptr<Idx> idx, std::shared_ptr<Cache> cache,
+                  addr snapshot, const std::vector<Binding> *bindings,
+                  std::shared_ptr<Profile> profile);
+  std::unique_ptr<Hopper>
+  to_hopper(std::shared_ptr<Featurizer> featurizer, std::shared_ptr<Idx> idx,
+            std::shared_ptr<Cache> cache, addr snapshot,
+            const std::vector<Binding> *bindings,
+            std::shared_ptr<Profile> profile);
+  std::unique_ptr<Hopper>
+  to_hopper_(std::shared_ptr<Featurizer> featurizer, std::shared_ptr<Idx> idx,
+             std::shared_ptr<Cache> cache, addr snapshot,
+             const std::vector<Binding> *bindings,
+             std::shared_ptr<Profile> profile);
+
   Operator kind_;
   std::string term_;
-  addr width_;
+  addr width_; // also the stage number for a REFERENCE
   std::vector<std::shared_ptr<SExpression>> subx_;
 };
 } // namespace gcl
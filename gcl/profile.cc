@@ -0,0 +1,141 @@
+#include "gcl/profile.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/core.h"
+#include "src/hopper.h"
+
+namespace cottontail {
+namespace gcl {
+
+std::shared_ptr<Profile> Profile::make(const std::string &label) {
+  std::shared_ptr<Profile> profile = std::shared_ptr<Profile>(new Profile());
+  profile->label_ = label;
+  return profile;
+}
+
+std::shared_ptr<Profile> Profile::child(const std::string &label) {
+  std::shared_ptr<Profile> profile = make(label);
+  children_.push_back(profile);
+  return profile;
+}
+
+addr Profile::calls() {
+  return tau.calls + rho.calls + uat.calls + ohr.calls + L + R;
+}
+
+addr Profile::self_nanoseconds() {
+  addr ns = nanoseconds;
+  for (auto &child : children_)
+    ns -= child->nanoseconds;
+  return ns;
+}
+
+std::string Profile::dump() {
+  std::string s;
+  dump(&s, 0);
+  return s;
+}
+
+void Profile::dump(std::string *s, size_t depth) {
+  auto counts = [](const std::string &name, const ProfileCounts &c) {
+    std::string t = " " + name + " " + std::to_string(c.calls);
+    if (c.memo_hits > 0)
+      t += "/" + std::to_string(c.memo_hits);
+    return t;
+  };
+  if (label_ != "" || depth > 0) {
+    *s += std::string(2 * depth, ' ') + label_ + ":";
+    *s += counts("tau", tau) + counts("rho", rho) + counts("uat", uat) +
+          counts("ohr", ohr);
+    *s += " L " + std::to_string(L) + " R " + std::to_string(R);
+    *s += " ns " + std::to_string(nanoseconds) + " self " +
+          std::to_string(self_nanoseconds()) + "\n";
+    depth++;
+  }
+  for (auto &child : children_)
+    child->dump(s, depth);
+}
+
+namespace {
+class Timer {
+public:
+  Timer(addr *nanoseconds)
+      : nanoseconds_(nanoseconds), start_(std::chrono::steady_clock::now()){};
+  ~Timer() {
+    *nanoseconds_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start_)
+                         .count();
+  }
+
+private:
+  addr *nanoseconds_;
+  std::chrono::steady_clock::time_point start_;
+};
+} // namespace
+
+addr Profiled::L_(addr k) {
+  Timer _(&profile_->nanoseconds);
+  profile_->L++;
+  return expr_->L(k);
+}
+
+addr Profiled::R_(addr k) {
+  Timer _(&profile_->nanoseconds);
+  profile_->R++;
+  return expr_->R(k);
+}
+
+void Profiled::tau_(addr k, addr *p, addr *q, fval *v) {
+  {
+    Timer _(&profile_->nanoseconds);
+    profile_->tau.calls++;
+    if (k == last_tau_)
+      profile_->tau.memo_hits++;
+    last_tau_ = k;
+    expr_->tau(k, p, q, v);
+  }
+  rekey_tau();
+}
+
+void Profiled::rho_(addr k, addr *p, addr *q, fval *v) {
+  {
+    Timer _(&profile_->nanoseconds);
+    profile_->rho.calls++;
+    if (k == last_rho_)
+      profile_->rho.memo_hits++;
+    last_rho_ = k;
+    expr_->rho(k, p, q, v);
+  }
+  rekey_rho();
+}
+
+void Profiled::uat_(addr k, addr *p, addr *q, fval *v) {
+  {
+    Timer _(&profile_->nanoseconds);
+    profile_->uat.calls++;
+    if (k == last_uat_)
+      profile_->uat.memo_hits++;
+    last_uat_ = k;
+    expr_->uat(k, p, q, v);
+  }
+  rekey_uat();
+}
+
+void Profiled::ohr_(addr k, addr *p, addr *q, fval *v) {
+  {
+    Timer _(&profile_->nanoseconds);
+    profile_->ohr.calls++;
+    if (k == last_ohr_)
+      profile_->ohr.memo_hits++;
+    last_ohr_ = k;
+    expr_->ohr(k, p, q, v);
+  }
+  rekey_ohr();
+}
+
+} // namespace gcl
+} // namespace cottontail
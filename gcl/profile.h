@@ -0,0 +1,86 @@
+#ifndef COTTONTAIL_GCL_PROFILE_H_
+#define COTTONTAIL_GCL_PROFILE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gcl/gcl.h"
+#include "src/core.h"
+#include "src/hopper.h"
+
+namespace cottontail {
+namespace gcl {
+
+// Call counts for one primitive of one node. Memo hits are calls that asked
+// for the same key as the previous call, which the node itself answered from
+// its memo without doing any work.
+struct ProfileCounts {
+  addr calls = 0;
+  addr memo_hits = 0;
+};
+
+// Profile of a hopper tree, built alongside it by SExpression::to_hopper, one
+// node per hopper. Times are inclusive of the node's children.
+class Profile final {
+public:
+  static std::shared_ptr<Profile> make(const std::string &label = "");
+  std::shared_ptr<Profile> child(const std::string &label);
+  inline std::string label() { return label_; };
+  inline const std::vector<std::shared_ptr<Profile>> &children() {
+    return children_;
+  };
+  ProfileCounts tau, rho, uat, ohr;
+  addr L = 0, R = 0;
+  addr nanoseconds = 0;
+  // Total calls over all primitives
+  addr calls();
+  // Time not accounted for by children
+  addr self_nanoseconds();
+  // Annotated tree, one line per node
+  std::string dump();
+  Profile(Profile const &) = delete;
+  Profile &operator=(Profile const &) = delete;
+  Profile(Profile &&) = delete;
+  Profile &operator=(Profile &&) = delete;
+
+private:
+  Profile(){};
+  void dump(std::string *s, size_t depth);
+  std::string label_;
+  std::vector<std::shared_ptr<Profile>> children_;
+};
+
+// Decorator that records calls and time into a Profile node. It rekeys its
+// memo after every call, so it sees every call its parent makes, except a
+// repeat of a key equal to the endpoint of the last answer, which is still
+// served from its memo and goes uncounted.
+class Profiled final : public Hopper {
+public:
+  Profiled(std::unique_ptr<Hopper> expr, std::shared_ptr<Profile> profile)
+      : expr_(std::move(expr)), profile_(profile){};
+  virtual ~Profiled(){};
+  Profiled(Profiled const &) = delete;
+  Profiled &operator=(Profiled const &) = delete;
+  Profiled(Profiled &&) = delete;
+  Profiled &operator=(Profiled &&) = delete;
+
+private:
+  addr L_(addr k) final;
+  addr R_(addr k) final;
+  void tau_(addr k, addr *p, addr *q, fval *v) final;
+  void rho_(addr k, addr *p, addr *q, fval *v) final;
+  void uat_(addr k, addr *p, addr *q, fval *v) final;
+  void ohr_(addr k, addr *p, addr *q, fval *v) final;
+  std::unique_ptr<Hopper> expr_;
+  std::shared_ptr<Profile> profile_;
+  addr last_tau_ = minfinity;
+  addr last_rho_ = minfinity;
+  addr last_uat_ = maxfinity;
+  addr last_ohr_ = maxfinity;
+};
+
+} // namespace gcl
+} // namespace cottontail
+
+#endif // COTTONTAIL_GCL_PROFILE_H_
@@ -16,6 +16,7 @@
 #include "src/bigwig.h"
 #include "src/builder.h"
 #include "src/core.h"
+#include "src/enumerate.h"
 #include "src/json.h"
 #include "src/warren.h"
 
@@ -502,18 +503,23 @@ bool forage(std::shared_ptr<Warren> warren, const std::string &gcl, addr start,
             std::string *error, size_t threads) {
   assert(warren != nullptr);
   warren->start();
-  std::shared_ptr<cottontail::Hopper> hopper =
-      warren->hopper_from_gcl(gcl, error);
-  if (hopper == nullptr) {
+  std::vector<std::vector<std::pair<addr, addr>>> chunks(
+      enumeration_chunks(threads));
+  if (!parallel_enumerate(
+          warren, gcl, start, end, threads,
+          [&](std::shared_ptr<Warren> warren, size_t chunk, addr p, addr q,
+              fval v) {
+            chunks[chunk].emplace_back(p, q);
+            return true;
+          },
+          error)) {
     warren->end();
     return false;
   }
-  end = (end < maxfinity ? end + 1 : maxfinity);
-  addr q, p = (start == minfinity ? minfinity + 1 : start);
-  std::vector<std::pair<addr, addr>> intervals;
-  for (hopper->tau(p, &p, &q); q < end; hopper->tau(p + 1, &p, &q))
-    intervals.emplace_back(p, q);
   warren->end();
+  std::vector<std::pair<addr, addr>> intervals;
+  for (auto &chunk : chunks)
+    intervals.insert(intervals.end(), chunk.begin(), chunk.end());
   std::map<std::string, std::string> params = parameters;
   params["gcl"] = gcl;
   return forage(warren, intervals, name, tag, params, error, threads);
@@ -22,6 +22,7 @@
 #include "src/compressor.h"
 #include "src/core.h"
 #include "src/featurizer.h"
+#include "gcl/cache.h"
 #include "src/fluffle.h"
 #include "src/hazel.h"
 #include "src/hopper.h"
@@ -667,6 +668,20 @@ void Bigwig::merge(bool on) {
   }
 }
 
+size_t Bigwig::shards() {
+  std::lock_guard<std::mutex> _(fluffle_->lock);
+  size_t shards = 0;
+  for (auto &warren : fluffle_->warrens)
+    if (warren != nullptr && warren->name() != "remove")
+      shards++;
+  return shards;
+}
+
+size_t Bigwig::merging() {
+  std::lock_guard<std::mutex> _(fluffle_->lock);
+  return fluffle_->merging.size();
+}
+
 std::shared_ptr<Warren> Bigwig::clone_(std::string *error) {
   std::shared_ptr<Bigwig> bigwig = std::shared_ptr<Bigwig>(
       new Bigwig(working_, featurizer_, tokenizer_, nullptr, nullptr));
@@ -677,6 +692,10 @@ std::shared_ptr<Warren> Bigwig::clone_(std::string *error) {
   bigwig->posting_factory_ = posting_factory_;
   bigwig->text_compressor_ = text_compressor_;
   bigwig->default_container_ = default_container_;
+  bigwig->gcl_cache_ = gcl_cache_;
+  bigwig->feature_log_ = feature_log_;
+  bigwig->dictionary_ = dictionary_;
+  bigwig->columns_ = columns_;
   if (stemmer_ != nullptr) {
     std::shared_ptr<cottontail::Stemmer> the_stemmer =
         cottontail::Stemmer::make(stemmer_->name(), stemmer_->recipe(), error);
@@ -690,6 +709,7 @@ std::shared_ptr<Warren> Bigwig::clone_(std::string *error) {
     for (auto &warren : warrens_)
       bigwig->warrens_.push_back(warren);
     bigwig->cache_ = cache_;
+    bigwig->snapshot_number_ = snapshot_number_;
     bigwig->warrens_valid_ = true;
     warrens_lock_.unlock();
     bigwig->start();
@@ -713,6 +733,7 @@ void Bigwig::start_() {
       if (fluffle_->cache == nullptr)
         fluffle_->cache = std::make_shared<OwslaCache>();
       cache_ = fluffle_->cache;
+      snapshot_number_ = fluffle_->snapshot;
       fluffle_->lock.unlock();
       warrens_valid_ = true;
     }
@@ -1353,8 +1374,11 @@ void Bigwig::commit_() {
   fluffle_->lock.lock();
   fiver_->commit();
   fluffle_->cache = std::make_shared<OwslaCache>();
+  addr snapshot = ++fluffle_->snapshot;
   fiver_->start();
   fluffle_->lock.unlock();
+  if (gcl_cache_ != nullptr)
+    gcl_cache_->retire(snapshot);
   appender_ = nullptr;
   annotator_ = nullptr;
   fiver_ = nullptr;
@@ -39,6 +39,9 @@ public:
   };
   static bool commit_all(std::vector<std::shared_ptr<Bigwig>> bigwigs);
   void merge(bool on = true);
+  // Shards committed so far, and those being merged by background workers.
+  size_t shards();
+  size_t merging();
 
   virtual ~Bigwig(){};
   Bigwig(const Bigwig &) = delete;
@@ -59,6 +62,7 @@ private:
   std::string recipe_() final;
   void start_() final;
   void end_() final;
+  addr snapshot_() final { return snapshot_number_; };
   bool set_parameter_(const std::string &key, const std::string &value,
                       std::string *error) final;
   bool get_parameter_(const std::string &key, std::string *value,
@@ -73,6 +77,7 @@ private:
   bool warrens_valid_ = false;
   std::vector<std::shared_ptr<Owsla>> warrens_;
   std::shared_ptr<OwslaCache> cache_;
+  addr snapshot_number_ = 0;
   std::shared_ptr<Compressor> posting_compressor_;
   std::shared_ptr<Compressor> fvalue_compressor_;
   std::shared_ptr<SimplePostingFactory> posting_factory_;
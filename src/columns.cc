@@ -0,0 +1,310 @@
+#include "src/columns.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "src/core.h"
+#include "src/hopper.h"
+#include "src/vbyte.h"
+#include "src/working.h"
+
+namespace cottontail {
+
+namespace {
+const std::string COLUMNS_MAGIC = "COTTONTAIL_COLUMNS_2\n";
+
+// Containers in a column, found by galloping forward from the last ordinal
+// visited, or back when a search moves backwards.
+class ColumnHopper final : public Hopper {
+public:
+  ColumnHopper(const addr *ps, const addr *qs, const fval *values, size_t n)
+      : ps_(ps), qs_(qs), values_(values), n_(n){};
+  virtual ~ColumnHopper(){};
+  ColumnHopper(const ColumnHopper &) = delete;
+  ColumnHopper &operator=(const ColumnHopper &) = delete;
+  ColumnHopper(ColumnHopper &&) = delete;
+  ColumnHopper &operator=(ColumnHopper &&) = delete;
+
+private:
+  // First ordinal whose element of v is at least k.
+  size_t first(const addr *v, addr k) {
+    size_t n = n_;
+    if (last_ >= n)
+      last_ = n == 0 ? 0 : n - 1;
+    if (n == 0 || v[last_] < k) {
+      size_t lo = last_, step = 1, hi = lo + 1;
+      while (hi < n && v[hi] < k) {
+        lo = hi;
+        step *= 2;
+        hi = lo + step;
+      }
+      hi = std::min(hi, n);
+      last_ = std::lower_bound(v + lo, v + hi, k) - v;
+    } else {
+      last_ = std::lower_bound(v, v + last_ + 1, k) - v;
+    }
+    return last_;
+  }
+  void at(size_t i, addr *p, addr *q, fval *v) {
+    if (i >= n_) {
+      *p = *q = maxfinity;
+    } else {
+      *p = ps_[i];
+      *q = qs_[i];
+      *v = values_[i];
+    }
+  }
+  void tau_(addr k, addr *p, addr *q, fval *v) final {
+    if (k == minfinity)
+      *p = *q = minfinity;
+    else
+      at(first(ps_, k), p, q, v);
+  }
+  void rho_(addr k, addr *p, addr *q, fval *v) final {
+    if (k == minfinity)
+      *p = *q = minfinity;
+    else
+      at(first(qs_, k), p, q, v);
+  }
+  void uat_(addr k, addr *p, addr *q, fval *v) final {
+    if (k == maxfinity) {
+      *p = *q = maxfinity;
+      return;
+    }
+    size_t i = first(qs_, k);
+    if (i < n_ && qs_[i] == k)
+      at(i, p, q, v);
+    else if (i == 0)
+      *p = *q = minfinity;
+    else
+      at(i - 1, p, q, v);
+  }
+  void ohr_(addr k, addr *p, addr *q, fval *v) final {
+    if (k == maxfinity) {
+      *p = *q = maxfinity;
+      return;
+    }
+    size_t i = first(ps_, k);
+    if (i < n_ && ps_[i] == k)
+      at(i, p, q, v);
+    else if (i == 0)
+      *p = *q = minfinity;
+    else
+      at(i - 1, p, q, v);
+  }
+  const addr *ps_;
+  const addr *qs_;
+  const fval *values_;
+  size_t n_;
+  size_t last_ = 0;
+};
+
+// Points at an array of n elements in the mapping, if there is room for it.
+template <typename T>
+bool get_array(const char *data, size_t length, size_t *where, size_t n,
+               const T **v) {
+  if (n > (length - *where) / sizeof(T))
+    return false;
+  *v = reinterpret_cast<const T *>(data + *where);
+  *where += n * sizeof(T);
+  return true;
+}
+
+template <typename T>
+void put_array(const T *v, size_t n, std::ofstream *f) {
+  f->write(reinterpret_cast<const char *>(v), n * sizeof(T));
+}
+} // namespace
+
+std::shared_ptr<Columns> Columns::make(const std::string &container,
+                                       const std::vector<std::string> &names,
+                                       addr extent) {
+  std::shared_ptr<Columns> columns = std::shared_ptr<Columns>(new Columns());
+  columns->container_ = container;
+  columns->names_ = names;
+  columns->extent_ = extent;
+  columns->built_values_.resize(names.size());
+  columns->view();
+  return columns;
+}
+
+void Columns::view() {
+  size_ = built_ps_.size();
+  ps_ = built_ps_.data();
+  qs_ = built_qs_.data();
+  values_.clear();
+  for (auto &values : built_values_)
+    values_.push_back(values.data());
+}
+
+std::shared_ptr<Columns> Columns::load(std::shared_ptr<Working> working,
+                                       std::string *error) {
+  if (working == nullptr) {
+    safe_error(error) = "Columns need a working directory";
+    return nullptr;
+  }
+  std::string name = working->make_name(COLUMNS_NAME);
+  int fd = open(name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    safe_error(error) = "No columns in: " + working->make_name("");
+    return nullptr;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0 || status.st_size == 0) {
+    close(fd);
+    safe_error(error) = "Can't read: " + name;
+    return nullptr;
+  }
+  void *mapped = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    safe_error(error) = "Can't map: " + name;
+    return nullptr;
+  }
+  std::shared_ptr<Columns> columns = std::shared_ptr<Columns>(new Columns());
+  columns->mapped_ = mapped;
+  columns->mapped_length_ = status.st_size;
+  columns->loaded_ = true;
+  const char *data = static_cast<const char *>(mapped);
+  size_t length = status.st_size;
+  if (length < COLUMNS_MAGIC.size() ||
+      std::memcmp(data, COLUMNS_MAGIC.data(), COLUMNS_MAGIC.size()) != 0) {
+    safe_error(error) = "Bad columns header";
+    return nullptr;
+  }
+  size_t where = COLUMNS_MAGIC.size(), size, count;
+  if (!get_vbyte(data, length, &where, &size) || size > length - where) {
+    safe_error(error) = "Bad columns header";
+    return nullptr;
+  }
+  columns->container_ = std::string(data + where, size);
+  where += size;
+  if (!get_vbyte(data, length, &where, &count) ||
+      !get_vbyte(data, length, &where, &size)) {
+    safe_error(error) = "Bad columns header";
+    return nullptr;
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t name_length;
+    if (!get_vbyte(data, length, &where, &name_length) ||
+        name_length > length - where) {
+      safe_error(error) = "Corrupt columns";
+      return nullptr;
+    }
+    columns->names_.emplace_back(data + where, name_length);
+    where += name_length;
+  }
+  // Arrays are aligned to their elements
+  where += (sizeof(addr) - where % sizeof(addr)) % sizeof(addr);
+  const addr *extent = nullptr;
+  bool okay = where <= length &&
+              get_array(data, length, &where, 1, &extent) &&
+              get_array(data, length, &where, size, &columns->ps_) &&
+              get_array(data, length, &where, size, &columns->qs_);
+  columns->values_.resize(count);
+  for (size_t i = 0; okay && i < count; i++)
+    okay = get_array(data, length, &where, size, &columns->values_[i]);
+  if (!okay || where != length) {
+    safe_error(error) = "Corrupt columns";
+    return nullptr;
+  }
+  columns->extent_ = *extent;
+  columns->size_ = size;
+  return columns;
+}
+
+bool Columns::store(std::shared_ptr<Working> working, std::string *error) {
+  if (working == nullptr) {
+    safe_error(error) = "Columns need a working directory";
+    return false;
+  }
+  std::string temp = working->make_temp("columns");
+  std::ofstream f(temp, std::ios::binary);
+  if (f.fail()) {
+    safe_error(error) = "Can't create: " + temp;
+    return false;
+  }
+  std::string header = COLUMNS_MAGIC;
+  put_vbyte(container_.size(), &header);
+  header += container_;
+  put_vbyte(names_.size(), &header);
+  put_vbyte(size_, &header);
+  for (auto &name : names_) {
+    put_vbyte(name.size(), &header);
+    header += name;
+  }
+  while (header.size() % sizeof(addr) != 0)
+    header.push_back('\0');
+  f.write(header.data(), header.size());
+  put_array(&extent_, 1, &f);
+  put_array(ps_, size_, &f);
+  put_array(qs_, size_, &f);
+  for (auto &values : values_)
+    put_array(values, size_, &f);
+  f.close();
+  if (f.fail() || std::rename(temp.c_str(),
+                              working->make_name(COLUMNS_NAME).c_str()) != 0) {
+    std::remove(temp.c_str());
+    safe_error(error) = "Can't write columns";
+    return false;
+  }
+  return true;
+}
+
+bool Columns::append(addr p, addr q, const std::vector<fval> &values,
+                     std::string *error) {
+  if (loaded_) {
+    safe_error(error) = "Loaded columns can't be appended to";
+    return false;
+  }
+  if (values.size() != names_.size()) {
+    safe_error(error) = "Columns need one value for each column";
+    return false;
+  }
+  if (q < p || (size_ > 0 && (p <= ps_[size_ - 1] || q <= qs_[size_ - 1]))) {
+    safe_error(error) = "Columns need containers in order";
+    return false;
+  }
+  built_ps_.push_back(p);
+  built_qs_.push_back(q);
+  for (size_t i = 0; i < values.size(); i++)
+    built_values_[i].push_back(values[i]);
+  view();
+  return true;
+}
+
+size_t Columns::column(const std::string &name) const {
+  auto it = std::find(names_.begin(), names_.end(), name);
+  return it == names_.end() ? NO_ORDINAL : it - names_.begin();
+}
+
+size_t Columns::ordinal(addr p) const {
+  const addr *it = std::lower_bound(ps_, ps_ + size_, p);
+  if (it == ps_ + size_ || *it != p)
+    return NO_ORDINAL;
+  return it - ps_;
+}
+
+std::unique_ptr<Hopper> Columns::hopper(const std::string &name) {
+  size_t i = column(name);
+  if (i == NO_ORDINAL)
+    return std::make_unique<EmptyHopper>();
+  return std::make_unique<ColumnHopper>(ps_, qs_, values_[i], size_);
+}
+
+Columns::~Columns() {
+  if (mapped_ != nullptr)
+    munmap(mapped_, mapped_length_);
+}
+
+} // namespace cottontail
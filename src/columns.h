@@ -0,0 +1,82 @@
+#ifndef COTTONTAIL_SRC_COLUMNS_H_
+#define COTTONTAIL_SRC_COLUMNS_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/core.h"
+#include "src/hopper.h"
+#include "src/working.h"
+
+namespace cottontail {
+
+static const std::string COLUMNS_NAME = "columns";
+static const std::string COLUMN_LENGTH = "length";
+static const size_t NO_ORDINAL = static_cast<size_t>(-1);
+
+// Dense per-container attributes, such as lengths, field lengths and static
+// priors, addressable by container ordinal. Containers are held in order as
+// arrays of starts and ends, with one array of values per named column, so a
+// value is a single index once the ordinal is known. Ordinals come from a
+// binary search on starts, or from a column hopper, which steps forward from
+// its last position and so costs little when scoring visits containers in
+// order. The containers are those of the GCL container query over the text
+// ending at the extent, both recorded so that stale columns are not used
+// after the query changes or items are appended. Stored columns are mapped
+// into memory by load, as for the docno index.
+class Columns final {
+public:
+  static std::shared_ptr<Columns> make(const std::string &container,
+                                       const std::vector<std::string> &names,
+                                       addr extent = maxfinity);
+  static std::shared_ptr<Columns> load(std::shared_ptr<Working> working,
+                                       std::string *error = nullptr);
+  bool store(std::shared_ptr<Working> working, std::string *error = nullptr);
+  // Containers must be appended in order, with one value for each column.
+  // Loaded columns cannot be appended to.
+  bool append(addr p, addr q, const std::vector<fval> &values,
+              std::string *error = nullptr);
+  inline const std::string &container() const { return container_; };
+  // The last address of the text when the columns were made.
+  inline addr extent() const { return extent_; };
+  inline size_t size() const { return size_; };
+  inline const std::vector<std::string> &names() const { return names_; };
+  // NO_ORDINAL if there is no such column or container.
+  size_t column(const std::string &name) const;
+  size_t ordinal(addr p) const;
+  inline addr p(size_t ordinal) const { return ps_[ordinal]; };
+  inline addr q(size_t ordinal) const { return qs_[ordinal]; };
+  inline fval value(size_t column, size_t ordinal) const {
+    return values_[column][ordinal];
+  };
+  // The containers, valued by the column; empty if there is no such column.
+  std::unique_ptr<Hopper> hopper(const std::string &name);
+  ~Columns();
+  Columns(Columns const &) = delete;
+  Columns &operator=(Columns const &) = delete;
+  Columns(Columns &&) = delete;
+  Columns &operator=(Columns &&) = delete;
+
+private:
+  Columns(){};
+  void view();
+  std::string container_;
+  std::vector<std::string> names_;
+  addr extent_ = maxfinity;
+  size_t size_ = 0;
+  const addr *ps_ = nullptr;
+  const addr *qs_ = nullptr;
+  std::vector<const fval *> values_;
+  // Arrays of columns being built; loaded columns point into the mapping
+  bool loaded_ = false;
+  std::vector<addr> built_ps_;
+  std::vector<addr> built_qs_;
+  std::vector<std::vector<fval>> built_values_;
+  void *mapped_ = nullptr;
+  size_t mapped_length_ = 0;
+};
+
+} // namespace cottontail
+
+#endif // COTTONTAIL_SRC_COLUMNS_H_
@@ -4,28 +4,41 @@
 #include "src/annotator.h"
 #include "src/appender.h"
 #include "src/bigwig.h"
+#include "src/columns.h"
 #include "src/builder.h"
 #include "src/compressor.h"
 #include "src/core.h"
+#include "src/dictionary.h"
+#include "src/docno_index.h"
+#include "src/enumerate.h"
 #include "src/eval.h"
 #include "src/fastid_txt.h"
 #include "src/featurizer.h"
+#include "src/federation.h"
+#include "gcl/cache.h"
 #include "gcl/gcl.h"
+#include "gcl/profile.h"
 #include "src/hopper.h"
 #include "src/idx.h"
+#include "src/impact.h"
 #include "src/json.h"
 #include "src/porter.h"
+#include "src/query_budget.h"
+#include "src/query_context.h"
 #include "src/ranker.h"
 #include "src/ranking.h"
 #include "src/recipe.h"
 #include "src/scribe.h"
 #include "src/simple.h"
 #include "src/simple_builder.h"
+#include "src/snippet.h"
 #include "src/stemmer.h"
 #include "src/tagging_featurizer.h"
 #include "src/tokenizer.h"
+#include "src/top_k.h"
 #include "src/txt.h"
 #include "gcl/vector_hopper.h"
+#include "src/warmup.h"
 #include "src/warren.h"
 #include "src/working.h"
 
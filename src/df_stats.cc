@@ -59,6 +59,22 @@ std::shared_ptr<Stats> DfStats::make(const std::string &recipe,
       TaggingFeaturizer::make(warren->featurizer(), "tf", error);
   if (stats->tf_featurizer_ == nullptr)
     return nullptr;
+  stats->tfmax_featurizer_ =
+      TaggingFeaturizer::make(warren->featurizer(), "tfmax", error);
+  if (stats->tfmax_featurizer_ == nullptr)
+    return nullptr;
+  stats->lmin_featurizer_ =
+      TaggingFeaturizer::make(warren->featurizer(), "lmin", error);
+  if (stats->lmin_featurizer_ == nullptr)
+    return nullptr;
+  stats->tfpeak_featurizer_ =
+      TaggingFeaturizer::make(warren->featurizer(), "tfpeak", error);
+  if (stats->tfpeak_featurizer_ == nullptr)
+    return nullptr;
+  stats->lpeak_featurizer_ =
+      TaggingFeaturizer::make(warren->featurizer(), "lpeak", error);
+  if (stats->lpeak_featurizer_ == nullptr)
+    return nullptr;
   return stats;
 }
 
@@ -121,4 +137,20 @@ std::unique_ptr<Hopper> DfStats::tf_hopper_(const std::string &term) {
   assert(chopper != nullptr);
   return std::make_unique<TfHopper>(std::move(tf_hopper), std::move(chopper));
 };
+
+std::unique_ptr<Hopper> DfStats::tfmax_hopper_(const std::string &term) {
+  return warren_->idx()->hopper(tfmax_featurizer_->featurize(term));
+}
+
+std::unique_ptr<Hopper> DfStats::lmin_hopper_(const std::string &term) {
+  return warren_->idx()->hopper(lmin_featurizer_->featurize(term));
+}
+
+std::unique_ptr<Hopper> DfStats::tfpeak_hopper_(const std::string &term) {
+  return warren_->idx()->hopper(tfpeak_featurizer_->featurize(term));
+}
+
+std::unique_ptr<Hopper> DfStats::lpeak_hopper_(const std::string &term) {
+  return warren_->idx()->hopper(lpeak_featurizer_->featurize(term));
+}
 } // namespace cottontail
@@ -34,9 +34,17 @@ private:
   fval idf_(const std::string &term) final;
   fval rsj_(const std::string &term) final;
   std::unique_ptr<Hopper> tf_hopper_(const std::string &term) final;
+  std::unique_ptr<Hopper> tfmax_hopper_(const std::string &term) final;
+  std::unique_ptr<Hopper> lmin_hopper_(const std::string &term) final;
+  std::unique_ptr<Hopper> tfpeak_hopper_(const std::string &term) final;
+  std::unique_ptr<Hopper> lpeak_hopper_(const std::string &term) final;
   fval items_;
   fval average_length_;
   std::shared_ptr<Featurizer> tf_featurizer_;
+  std::shared_ptr<Featurizer> tfmax_featurizer_;
+  std::shared_ptr<Featurizer> lmin_featurizer_;
+  std::shared_ptr<Featurizer> tfpeak_featurizer_;
+  std::shared_ptr<Featurizer> lpeak_featurizer_;
 };
 
 } // namespace cottontail
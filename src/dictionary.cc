@@ -0,0 +1,312 @@
+#include "src/dictionary.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "src/core.h"
+#include "src/tokenizer.h"
+#include "src/txt.h"
+#include "src/vbyte.h"
+#include "src/vocab_featurizer.h"
+#include "src/warren.h"
+#include "src/working.h"
+
+namespace cottontail {
+
+namespace {
+// Decodes the term at *where, given its predecessor in the block.
+bool get_term(const std::string &s, size_t *where, bool first,
+              std::string *term) {
+  size_t shared = 0, length;
+  if (!first && !get_vbyte(s, where, &shared))
+    return false;
+  if (!get_vbyte(s, where, &length) || shared > term->size() ||
+      length > s.size() - *where)
+    return false;
+  term->resize(shared);
+  term->append(s, *where, length);
+  *where += length;
+  return true;
+}
+
+bool starts_with(const std::string &s, const std::string &prefix) {
+  return s.size() >= prefix.size() &&
+         s.compare(0, prefix.size(), prefix) == 0;
+}
+
+bool glob(const char *pattern, const char *s) {
+  const char *star = nullptr, *retry = nullptr;
+  while (*s != '\0') {
+    if (*pattern == '?' || *pattern == *s) {
+      pattern++;
+      s++;
+    } else if (*pattern == '*') {
+      star = pattern++;
+      retry = s;
+    } else if (star != nullptr) {
+      pattern = star + 1;
+      s = ++retry;
+    } else {
+      return false;
+    }
+  }
+  while (*pattern == '*')
+    pattern++;
+  return *pattern == '\0';
+}
+
+// Literal characters every match of a regular expression must start with,
+// conservatively.
+std::string regex_prefix(const std::string &pattern) {
+  if (pattern.find('|') != std::string::npos)
+    return "";
+  std::string prefix;
+  for (size_t i = 0; i < pattern.size(); i++) {
+    unsigned char c = static_cast<unsigned char>(pattern[i]);
+    if (!std::isalnum(c) && c != '_' && c != '-' && c < 128)
+      break;
+    if (i + 1 < pattern.size() &&
+        (pattern[i + 1] == '*' || pattern[i + 1] == '?' ||
+         pattern[i + 1] == '{'))
+      break;
+    prefix.push_back(pattern[i]);
+  }
+  return prefix;
+}
+} // namespace
+
+std::shared_ptr<Dictionary> Dictionary::make(std::vector<std::string> terms) {
+  std::sort(terms.begin(), terms.end());
+  terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+  std::shared_ptr<Dictionary> dictionary =
+      std::shared_ptr<Dictionary>(new Dictionary());
+  std::string previous;
+  for (size_t i = 0; i < terms.size(); i++) {
+    if (i % BLOCK == 0) {
+      dictionary->blocks_.push_back(dictionary->data_.size());
+    } else {
+      size_t shared = 0;
+      while (shared < previous.size() && shared < terms[i].size() &&
+             previous[shared] == terms[i][shared])
+        shared++;
+      put_vbyte(shared, &dictionary->data_);
+      put_vbyte(terms[i].size() - shared, &dictionary->data_);
+      dictionary->data_.append(terms[i], shared, std::string::npos);
+      previous = terms[i];
+      continue;
+    }
+    put_vbyte(terms[i].size(), &dictionary->data_);
+    dictionary->data_.append(terms[i]);
+    previous = terms[i];
+  }
+  dictionary->size_ = terms.size();
+  return dictionary;
+}
+
+std::shared_ptr<Dictionary> Dictionary::build(std::shared_ptr<Warren> warren,
+                                              std::string *error) {
+  if (warren == nullptr || !warren->started()) {
+    safe_error(error) = "Dictionary needs a started warren";
+    return nullptr;
+  }
+  std::vector<std::string> terms;
+  if (warren->working() != nullptr) {
+    std::ifstream vocabf(warren->working()->make_name(VOCAB_NAME));
+    if (!vocabf.fail()) {
+      std::string line;
+      while (std::getline(vocabf, line)) {
+        size_t first = line.find(' ');
+        size_t second =
+            first == std::string::npos ? first : line.find(' ', first + 1);
+        if (second != std::string::npos && second + 1 < line.size())
+          terms.push_back(line.substr(second + 1));
+      }
+      return make(terms);
+    }
+  }
+  std::set<std::string> vocabulary;
+  addr p, q;
+  if (warren->txt()->range(&p, &q)) {
+    constexpr addr WINDOW = 1024 * 1024;
+    for (addr start = p; start <= q; start += WINDOW) {
+      addr end = std::min(q, start + WINDOW - 1);
+      for (auto &token :
+           warren->tokenizer()->split(warren->txt()->translate(start, end)))
+        vocabulary.insert(token);
+    }
+  }
+  std::copy(vocabulary.begin(), vocabulary.end(), std::back_inserter(terms));
+  return make(terms);
+}
+
+std::shared_ptr<Dictionary> Dictionary::load(std::shared_ptr<Working> working,
+                                             std::string *error) {
+  if (working == nullptr) {
+    safe_error(error) = "Dictionary needs a working directory";
+    return nullptr;
+  }
+  std::ifstream f(working->make_name(DICTIONARY_NAME), std::ios::binary);
+  if (f.fail()) {
+    safe_error(error) = "No dictionary in: " + working->make_name("");
+    return nullptr;
+  }
+  std::stringstream ss;
+  ss << f.rdbuf();
+  std::string contents = ss.str();
+  size_t where = 0, size;
+  if (!get_vbyte(contents, &where, &size)) {
+    safe_error(error) = "Bad dictionary header";
+    return nullptr;
+  }
+  std::shared_ptr<Dictionary> dictionary =
+      std::shared_ptr<Dictionary>(new Dictionary());
+  dictionary->size_ = size;
+  dictionary->data_ = contents.substr(where);
+  if (!dictionary->index()) {
+    safe_error(error) = "Corrupt dictionary";
+    return nullptr;
+  }
+  return dictionary;
+}
+
+bool Dictionary::store(std::shared_ptr<Working> working, std::string *error) {
+  if (working == nullptr) {
+    safe_error(error) = "Dictionary needs a working directory";
+    return false;
+  }
+  std::string temp = working->make_temp("dictionary");
+  std::ofstream f(temp, std::ios::binary);
+  if (f.fail()) {
+    safe_error(error) = "Can't create: " + temp;
+    return false;
+  }
+  std::string header;
+  put_vbyte(size_, &header);
+  f.write(header.data(), header.size());
+  f.write(data_.data(), data_.size());
+  f.close();
+  if (f.fail() ||
+      std::rename(temp.c_str(),
+                  working->make_name(DICTIONARY_NAME).c_str()) != 0) {
+    std::remove(temp.c_str());
+    safe_error(error) = "Can't write dictionary";
+    return false;
+  }
+  return true;
+}
+
+bool Dictionary::index() {
+  blocks_.clear();
+  size_t where = 0;
+  std::string term;
+  for (size_t i = 0; i < size_; i++) {
+    if (i % BLOCK == 0)
+      blocks_.push_back(where);
+    if (!get_term(data_, &where, i % BLOCK == 0, &term))
+      return false;
+  }
+  return where == data_.size();
+}
+
+std::string Dictionary::head(size_t block) {
+  size_t where = blocks_[block];
+  std::string term;
+  get_term(data_, &where, true, &term);
+  return term;
+}
+
+// Last block whose first term is no greater than key
+size_t Dictionary::lower_block(const std::string &key) {
+  size_t lo = 0, hi = blocks_.size();
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (head(mid) <= key)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+template <typename Match>
+bool Dictionary::scan(size_t block, const std::string &prefix, Match match,
+                      std::vector<std::string> *terms, size_t limit,
+                      const std::string &what, std::string *error) {
+  size_t found = 0, where = 0;
+  std::string term;
+  for (size_t i = block * BLOCK; i < size_; i++) {
+    if (i % BLOCK == 0)
+      where = blocks_[i / BLOCK];
+    if (!get_term(data_, &where, i % BLOCK == 0, &term)) {
+      safe_error(error) = "Corrupt dictionary";
+      return false;
+    }
+    if (term < prefix)
+      continue;
+    if (!starts_with(term, prefix))
+      break;
+    if (match(term)) {
+      if (++found > limit) {
+        safe_error(error) = "Expansion of " + what + " exceeds " +
+                            std::to_string(limit) + " terms";
+        return false;
+      }
+      terms->push_back(term);
+    }
+  }
+  return true;
+}
+
+bool Dictionary::prefix(const std::string &prefix,
+                        std::vector<std::string> *terms, size_t limit,
+                        std::string *error) {
+  if (size_ == 0)
+    return true;
+  return scan(
+      lower_block(prefix), prefix, [](const std::string &) { return true; },
+      terms, limit, prefix + "*", error);
+}
+
+bool Dictionary::wildcard(const std::string &pattern,
+                          std::vector<std::string> *terms, size_t limit,
+                          std::string *error) {
+  if (size_ == 0)
+    return true;
+  std::string prefix = pattern.substr(0, pattern.find_first_of("*?"));
+  return scan(
+      lower_block(prefix), prefix,
+      [&](const std::string &term) {
+        return glob(pattern.c_str(), term.c_str());
+      },
+      terms, limit, pattern, error);
+}
+
+bool Dictionary::regex(const std::string &pattern,
+                       std::vector<std::string> *terms, size_t limit,
+                       std::string *error) {
+  std::regex re;
+  try {
+    re = std::regex(pattern);
+  } catch (const std::regex_error &e) {
+    safe_error(error) = "Bad regular expression: " + pattern;
+    return false;
+  }
+  if (size_ == 0)
+    return true;
+  std::string prefix = regex_prefix(pattern);
+  return scan(
+      lower_block(prefix), prefix,
+      [&](const std::string &term) { return std::regex_match(term, re); },
+      terms, limit, pattern, error);
+}
+
+} // namespace cottontail
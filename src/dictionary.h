@@ -0,0 +1,71 @@
+#ifndef COTTONTAIL_SRC_DICTIONARY_H_
+#define COTTONTAIL_SRC_DICTIONARY_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/core.h"
+#include "src/working.h"
+
+namespace cottontail {
+
+static const std::string DICTIONARY_NAME = "dictionary";
+
+class Warren;
+
+// Sorted term dictionary for prefix, wildcard and regular expression
+// expansion of GCL terms. Terms are stored in front-coded blocks: the first
+// term of each block in full, the rest as the length of the prefix shared
+// with their predecessor plus the remaining suffix. Lookups binary search on
+// the first terms of the blocks and then decode forward.
+//
+// The dictionary is a snapshot of the vocabulary when it was built. Terms
+// appended to a dynamic warren afterwards are not found until it is rebuilt.
+class Dictionary final {
+public:
+  static constexpr size_t BLOCK = 16;
+  static constexpr size_t DEFAULT_EXPANSIONS = 1024;
+  static std::shared_ptr<Dictionary> make(std::vector<std::string> terms);
+  // Built from the vocabulary file left by VocabFeaturizer if there is one,
+  // otherwise by tokenizing all the text in a started warren.
+  static std::shared_ptr<Dictionary> build(std::shared_ptr<Warren> warren,
+                                           std::string *error = nullptr);
+  static std::shared_ptr<Dictionary> load(std::shared_ptr<Working> working,
+                                          std::string *error = nullptr);
+  bool store(std::shared_ptr<Working> working, std::string *error = nullptr);
+  inline size_t size() { return size_; };
+  // Each expansion appends the matching terms, in order, to terms. Each
+  // fails if there are more than limit of them.
+  bool prefix(const std::string &prefix, std::vector<std::string> *terms,
+              size_t limit = DEFAULT_EXPANSIONS, std::string *error = nullptr);
+  // Wildcards are "*", matching any sequence, and "?", matching any one
+  // character.
+  bool wildcard(const std::string &pattern, std::vector<std::string> *terms,
+                size_t limit = DEFAULT_EXPANSIONS,
+                std::string *error = nullptr);
+  // ECMAScript syntax, matched against the whole term.
+  bool regex(const std::string &pattern, std::vector<std::string> *terms,
+             size_t limit = DEFAULT_EXPANSIONS, std::string *error = nullptr);
+  Dictionary(Dictionary const &) = delete;
+  Dictionary &operator=(Dictionary const &) = delete;
+  Dictionary(Dictionary &&) = delete;
+  Dictionary &operator=(Dictionary &&) = delete;
+
+private:
+  Dictionary(){};
+  bool index();
+  std::string head(size_t block);
+  size_t lower_block(const std::string &key);
+  template <typename Match>
+  bool scan(size_t block, const std::string &prefix, Match match,
+            std::vector<std::string> *terms, size_t limit,
+            const std::string &what, std::string *error);
+  size_t size_ = 0;
+  std::string data_;
+  std::vector<size_t> blocks_;
+};
+
+} // namespace cottontail
+
+#endif // COTTONTAIL_SRC_DICTIONARY_H_
@@ -0,0 +1,301 @@
+#include "src/docno_index.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "src/core.h"
+#include "src/eval.h"
+#include "src/json.h"
+#include "src/warren.h"
+#include "src/working.h"
+
+namespace cottontail {
+
+namespace {
+const std::string DOCNO_INDEX_MAGIC = "COTTONTAIL_DOCNOS_2\n";
+
+// Header fields after the magic, in order.
+enum Field {
+  SLOTS,
+  SIZE,
+  SNAPSHOT,
+  EXTENT,
+  CONTAINER,
+  ID,
+  TABLE,
+  STRINGS,
+  FIELDS
+};
+
+// A zero hash marks an empty slot; a container of maxfinity marks a docno
+// held by more than one container.
+struct Slot {
+  uint64_t hash;
+  uint64_t offset;
+  int64_t p;
+  int64_t q;
+};
+
+// FNV-1a, kept off zero.
+uint64_t hash(const std::string &docno) {
+  uint64_t h = 14695981039346656037ULL;
+  for (unsigned char c : docno) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  return h == 0 ? 1 : h;
+}
+
+void put_u64(uint64_t value, std::string *image) {
+  image->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// The last address of the text, or minfinity if there is none.
+addr extent(std::shared_ptr<Warren> warren) {
+  addr p, q;
+  if (!warren->txt()->range(&p, &q))
+    return minfinity;
+  return q;
+}
+
+uint64_t get_u64(const char *data, size_t where) {
+  uint64_t value;
+  std::memcpy(&value, data + where, sizeof(value));
+  return value;
+}
+
+void pad(std::string *image) {
+  while (image->size() % sizeof(uint64_t) != 0)
+    image->push_back('\0');
+}
+} // namespace
+
+std::shared_ptr<DocnoIndex> DocnoIndex::build(std::shared_ptr<Warren> warren,
+                                              const std::string &container,
+                                              const std::string &id,
+                                              std::string *error) {
+  std::string container_query = container, id_query = id;
+  if (container_query == "")
+    container_query = warren->default_container();
+  if (container_query == "") {
+    safe_error(error) = "No rankable items in warren";
+    return nullptr;
+  }
+  if (id_query == "" && !warren->get_parameter("id", &id_query, error))
+    return nullptr;
+  if (id_query == "") {
+    safe_error(error) = "Rankable items in warren don't have identifiers";
+    return nullptr;
+  }
+  std::unique_ptr<Hopper> chopper =
+      warren->hopper_from_gcl(container_query, error);
+  if (chopper == nullptr)
+    return nullptr;
+  std::unique_ptr<Hopper> ihopper = warren->hopper_from_gcl(id_query, error);
+  if (ihopper == nullptr)
+    return nullptr;
+  std::map<std::string, std::pair<addr, addr>> docnos;
+  addr cp, cq, ip, iq;
+  for (chopper->tau(minfinity + 1, &cp, &cq); cp < maxfinity;
+       chopper->tau(cp + 1, &cp, &cq)) {
+    ihopper->tau(cp, &ip, &iq);
+    if (iq > cq)
+      continue;
+    std::string docno =
+        trec_docno(json_translate(warren->txt()->translate(ip, iq)));
+    if (docno == "")
+      continue;
+    auto found = docnos.find(docno);
+    if (found == docnos.end())
+      docnos[docno] = std::make_pair(cp, cq);
+    else
+      found->second = std::make_pair(maxfinity, maxfinity);
+  }
+  size_t slots = 2;
+  while (slots < 2 * docnos.size())
+    slots *= 2;
+  std::string strings;
+  std::vector<Slot> table(slots, Slot{0, 0, 0, 0});
+  for (auto &docno : docnos) {
+    uint64_t h = hash(docno.first);
+    size_t i = h & (slots - 1);
+    while (table[i].hash != 0)
+      i = (i + 1) & (slots - 1);
+    table[i] = Slot{h, strings.size(), docno.second.first,
+                    docno.second.second};
+    uint32_t length = docno.first.size();
+    strings.append(reinterpret_cast<const char *>(&length), sizeof(length));
+    strings += docno.first;
+  }
+  std::shared_ptr<DocnoIndex> index =
+      std::shared_ptr<DocnoIndex>(new DocnoIndex());
+  std::string &image = index->image_;
+  image = DOCNO_INDEX_MAGIC;
+  size_t header = image.size() + FIELDS * sizeof(uint64_t);
+  size_t table_offset = header + container_query.size() + id_query.size();
+  table_offset += (sizeof(uint64_t) - table_offset % sizeof(uint64_t)) %
+                  sizeof(uint64_t);
+  put_u64(slots, &image);
+  put_u64(docnos.size(), &image);
+  put_u64(warren->snapshot(), &image);
+  put_u64(extent(warren), &image);
+  put_u64(container_query.size(), &image);
+  put_u64(id_query.size(), &image);
+  put_u64(table_offset, &image);
+  put_u64(table_offset + slots * sizeof(Slot), &image);
+  image += container_query;
+  image += id_query;
+  pad(&image);
+  image.append(reinterpret_cast<const char *>(table.data()),
+               slots * sizeof(Slot));
+  image += strings;
+  if (!index->attach(image.data(), image.size(), error))
+    return nullptr;
+  return index;
+}
+
+bool DocnoIndex::attach(const char *data, size_t length, std::string *error) {
+  size_t where = DOCNO_INDEX_MAGIC.size();
+  if (length < where + FIELDS * sizeof(uint64_t) ||
+      std::memcmp(data, DOCNO_INDEX_MAGIC.data(), where) != 0) {
+    safe_error(error) = "Bad docno index header";
+    return false;
+  }
+  uint64_t fields[FIELDS];
+  for (size_t i = 0; i < FIELDS; i++)
+    fields[i] = get_u64(data, where + i * sizeof(uint64_t));
+  where += FIELDS * sizeof(uint64_t);
+  if (fields[SLOTS] == 0 || (fields[SLOTS] & (fields[SLOTS] - 1)) != 0 ||
+      fields[CONTAINER] + fields[ID] > length - where ||
+      fields[TABLE] < where + fields[CONTAINER] + fields[ID] ||
+      fields[TABLE] % sizeof(uint64_t) != 0 ||
+      fields[SLOTS] > (length - fields[TABLE]) / sizeof(Slot) ||
+      fields[STRINGS] != fields[TABLE] + fields[SLOTS] * sizeof(Slot)) {
+    safe_error(error) = "Corrupt docno index";
+    return false;
+  }
+  container_ = std::string(data + where, fields[CONTAINER]);
+  id_ = std::string(data + where + fields[CONTAINER], fields[ID]);
+  slots_ = fields[SLOTS];
+  size_ = fields[SIZE];
+  snapshot_ = fields[SNAPSHOT];
+  extent_ = fields[EXTENT];
+  data_ = data;
+  length_ = length;
+  return true;
+}
+
+std::shared_ptr<DocnoIndex> DocnoIndex::load(std::shared_ptr<Working> working,
+                                             std::string *error) {
+  if (working == nullptr) {
+    safe_error(error) = "Docno index needs a working directory";
+    return nullptr;
+  }
+  std::string name = working->make_name(DOCNO_INDEX_NAME);
+  int fd = open(name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    safe_error(error) = "No docno index in: " + working->make_name("");
+    return nullptr;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0 || status.st_size == 0) {
+    close(fd);
+    safe_error(error) = "Can't read: " + name;
+    return nullptr;
+  }
+  void *mapped = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    safe_error(error) = "Can't map: " + name;
+    return nullptr;
+  }
+  std::shared_ptr<DocnoIndex> index =
+      std::shared_ptr<DocnoIndex>(new DocnoIndex());
+  index->mapped_ = mapped;
+  index->mapped_length_ = status.st_size;
+  if (!index->attach(static_cast<const char *>(mapped), status.st_size, error))
+    return nullptr;
+  return index;
+}
+
+bool DocnoIndex::store(std::shared_ptr<Working> working, std::string *error) {
+  if (working == nullptr) {
+    safe_error(error) = "Docno index needs a working directory";
+    return false;
+  }
+  std::string temp = working->make_temp("docnos");
+  std::ofstream f(temp, std::ios::binary);
+  if (f.fail()) {
+    safe_error(error) = "Can't create: " + temp;
+    return false;
+  }
+  f.write(data_, length_);
+  f.close();
+  if (f.fail() ||
+      std::rename(temp.c_str(),
+                  working->make_name(DOCNO_INDEX_NAME).c_str()) != 0) {
+    std::remove(temp.c_str());
+    safe_error(error) = "Can't write docno index";
+    return false;
+  }
+  return true;
+}
+
+bool DocnoIndex::lookup(const std::string &docno, addr *p, addr *q,
+                        std::string *error) const {
+  uint64_t h = hash(docno);
+  size_t table = get_u64(data_, DOCNO_INDEX_MAGIC.size() +
+                                    TABLE * sizeof(uint64_t));
+  size_t strings = table + slots_ * sizeof(Slot);
+  *p = *q = minfinity;
+  // Tables built here always have an empty slot, but a damaged one may not
+  size_t i = h & (slots_ - 1);
+  for (size_t probes = 0; probes < slots_;
+       probes++, i = (i + 1) & (slots_ - 1)) {
+    Slot slot;
+    std::memcpy(&slot, data_ + table + i * sizeof(Slot), sizeof(Slot));
+    if (slot.hash == 0)
+      break;
+    if (slot.hash != h || slot.offset + sizeof(uint32_t) > length_ - strings)
+      continue;
+    uint32_t length;
+    std::memcpy(&length, data_ + strings + slot.offset, sizeof(length));
+    size_t start = strings + slot.offset + sizeof(length);
+    if (length != docno.size() || length > length_ - start ||
+        std::memcmp(data_ + start, docno.data(), length) != 0)
+      continue;
+    if (slot.p == maxfinity) {
+      *p = *q = maxfinity;
+      safe_error(error) = "Ambiguous docno: " + docno;
+      return false;
+    }
+    *p = slot.p;
+    *q = slot.q;
+    return true;
+  }
+  safe_error(error) = "Item not found in warren: " + docno;
+  return false;
+}
+
+bool DocnoIndex::current(std::shared_ptr<Warren> warren) const {
+  return warren->snapshot() == snapshot_ && extent(warren) == extent_;
+}
+
+DocnoIndex::~DocnoIndex() {
+  if (mapped_ != nullptr)
+    munmap(mapped_, mapped_length_);
+}
+
+} // namespace cottontail
@@ -0,0 +1,72 @@
+#ifndef COTTONTAIL_SRC_DOCNO_INDEX_H_
+#define COTTONTAIL_SRC_DOCNO_INDEX_H_
+
+#include <memory>
+#include <string>
+
+#include "src/core.h"
+#include "src/working.h"
+
+namespace cottontail {
+
+static const std::string DOCNO_INDEX_NAME = "docnos";
+
+class Warren;
+
+// Hash table from docno to the container holding it, so that a document can
+// be found without a GCL search. Docnos are taken from the identifier in
+// each container, as trec_docno reads them. The table is open addressed,
+// with slots holding a hash, the position of the docno string, and the
+// container, and is stored in the burrow as one file that is mapped into
+// memory by load, so that opening it reads nothing and a lookup touches a
+// page or two. The container and identifier queries are recorded, so that
+// callers can tell whether the index answers their question.
+//
+// Like the dictionary, the index is a snapshot of the burrow when it was
+// built, and must be rebuilt after items are added or removed. The snapshot
+// and the end of the text are recorded, so that current can tell whether a
+// warren has changed since.
+class DocnoIndex final {
+public:
+  // Container and identifier queries default to those of the warren.
+  static std::shared_ptr<DocnoIndex> build(std::shared_ptr<Warren> warren,
+                                           const std::string &container = "",
+                                           const std::string &id = "",
+                                           std::string *error = nullptr);
+  static std::shared_ptr<DocnoIndex> load(std::shared_ptr<Working> working,
+                                          std::string *error = nullptr);
+  bool store(std::shared_ptr<Working> working, std::string *error = nullptr);
+  // Fails for a docno that is missing, when p and q are set to minfinity, or
+  // held by more than one container, when they are set to maxfinity.
+  bool lookup(const std::string &docno, addr *p, addr *q,
+              std::string *error = nullptr) const;
+  // True if the warren is as it was when the index was built.
+  bool current(std::shared_ptr<Warren> warren) const;
+  inline size_t size() const { return size_; };
+  inline const std::string &container() const { return container_; };
+  inline const std::string &id() const { return id_; };
+  ~DocnoIndex();
+  DocnoIndex(DocnoIndex const &) = delete;
+  DocnoIndex &operator=(DocnoIndex const &) = delete;
+  DocnoIndex(DocnoIndex &&) = delete;
+  DocnoIndex &operator=(DocnoIndex &&) = delete;
+
+private:
+  DocnoIndex(){};
+  bool attach(const char *data, size_t length, std::string *error);
+  std::string image_;
+  void *mapped_ = nullptr;
+  size_t mapped_length_ = 0;
+  const char *data_ = nullptr;
+  size_t length_ = 0;
+  size_t slots_ = 0;
+  size_t size_ = 0;
+  addr snapshot_ = 0;
+  addr extent_ = 0;
+  std::string container_;
+  std::string id_;
+};
+
+} // namespace cottontail
+
+#endif // COTTONTAIL_SRC_DOCNO_INDEX_H_
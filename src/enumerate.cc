@@ -0,0 +1,116 @@
+#include "src/enumerate.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/core.h"
+#include "src/hopper.h"
+#include "src/warren.h"
+
+namespace cottontail {
+
+namespace {
+// Enough chunks per thread that threads finishing early can pick up slack
+constexpr size_t CHUNKS_PER_THREAD = 8;
+// Not worth a clone for less than this
+constexpr addr MINIMUM_CHUNK_TOKENS = 4096;
+
+bool enumerate_chunk(std::shared_ptr<Warren> warren, Hopper *hopper,
+                     size_t chunk, addr begin, addr limit, addr end,
+                     const EnumerationCallback &callback) {
+  addr p, q;
+  fval v;
+  for (hopper->tau(begin, &p, &q, &v); p < limit && q <= end;
+       hopper->tau(p + 1, &p, &q, &v))
+    if (!callback(warren, chunk, p, q, v))
+      return false;
+  return true;
+}
+} // namespace
+
+size_t enumeration_chunks(size_t threads) {
+  return CHUNKS_PER_THREAD * allowed_threads(threads);
+}
+
+bool parallel_enumerate(std::shared_ptr<Warren> warren, const std::string &gcl,
+                        addr start, addr end, size_t threads,
+                        EnumerationCallback callback, std::string *error) {
+  if (warren == nullptr) {
+    safe_error(error) = "parallel_enumerate needs a warren";
+    return false;
+  }
+  std::unique_ptr<Hopper> hopper = warren->hopper_from_gcl(gcl, error);
+  if (hopper == nullptr)
+    return false;
+  if (start == minfinity)
+    start++;
+  if (end == maxfinity)
+    end--;
+  addr p, q, first, last;
+  hopper->tau(start, &p, &q);
+  if (p == maxfinity || q > end)
+    return true;
+  first = p;
+  hopper->uat(end, &p, &q);
+  if (p < first)
+    return true;
+  last = p;
+  addr span = last - first + 1;
+  threads = allowed_threads(threads);
+  size_t chunks = std::min(
+      CHUNKS_PER_THREAD * threads,
+      std::max<size_t>(1, static_cast<size_t>(span / MINIMUM_CHUNK_TOKENS)));
+  if (threads <= 1 || chunks <= 1)
+    return enumerate_chunk(warren, hopper.get(), 0, first, last + 1, end,
+                           callback);
+  threads = std::min(threads, chunks);
+
+  std::vector<addr> boundaries;
+  addr d = static_cast<addr>(chunks);
+  for (addr n = 0; n <= d; n++)
+    boundaries.push_back(first + (span / d) * n + ((span % d) * n) / d);
+
+  std::atomic<size_t> next(0);
+  std::atomic<bool> stopped(false);
+  std::mutex lock;
+  bool failed = false;
+  auto worker = [&]() {
+    std::string terror;
+    std::shared_ptr<Warren> local_warren = warren->clone(&terror);
+    std::unique_ptr<Hopper> local_hopper;
+    if (local_warren != nullptr) {
+      if (!local_warren->started())
+        local_warren->start();
+      local_hopper = local_warren->hopper_from_gcl(gcl, &terror);
+    }
+    if (local_hopper == nullptr) {
+      std::lock_guard<std::mutex> _(lock);
+      if (!failed) {
+        failed = true;
+        safe_error(error) = terror;
+      }
+      stopped = true;
+    } else {
+      for (size_t chunk = next++; chunk < chunks && !stopped; chunk = next++)
+        if (!enumerate_chunk(local_warren, local_hopper.get(), chunk,
+                             boundaries[chunk], boundaries[chunk + 1], end,
+                             callback))
+          stopped = true;
+    }
+    if (local_warren != nullptr)
+      local_warren->end();
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < threads; i++)
+    workers.emplace_back(std::thread(worker));
+  for (auto &worker : workers)
+    worker.join();
+  return !stopped;
+}
+
+} // namespace cottontail
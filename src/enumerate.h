@@ -0,0 +1,42 @@
+#ifndef COTTONTAIL_SRC_ENUMERATE_H_
+#define COTTONTAIL_SRC_ENUMERATE_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "src/core.h"
+#include "src/warren.h"
+
+namespace cottontail {
+
+// Called once for each interval, from a worker thread, with a started warren
+// private to that thread. Returning false stops the enumeration.
+typedef std::function<bool(std::shared_ptr<Warren> warren, size_t chunk,
+                           addr p, addr q, fval v)>
+    EnumerationCallback;
+
+// Enumerates the intervals [p,q] generated by a GCL expression with
+// start <= p and q <= end, in parallel over clones of a started warren.
+//
+// The address range is cut into chunks, which threads claim in turn as they
+// finish earlier ones, so a range with skewed density does not leave threads
+// idle. Each interval belongs to the chunk containing its start, so intervals
+// crossing chunk boundaries are reported exactly once. Within a chunk,
+// intervals are reported in order, and chunk numbers increase with address.
+// Chunk numbers are less than enumeration_chunks(threads), and a chunk is
+// only ever processed by one thread, so callers may collect results in a
+// vector indexed by chunk without locking and then concatenate them in order.
+// Returns false if the expression is bad, a clone fails, or the callback stops
+// the enumeration.
+bool parallel_enumerate(std::shared_ptr<Warren> warren, const std::string &gcl,
+                        addr start, addr end, size_t threads,
+                        EnumerationCallback callback,
+                        std::string *error = nullptr);
+
+// Upper bound on chunk numbers passed to the callback.
+size_t enumeration_chunks(size_t threads);
+
+} // namespace cottontail
+
+#endif // COTTONTAIL_SRC_ENUMERATE_H_
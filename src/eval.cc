@@ -11,6 +11,8 @@
 #include <regex>
 #include <vector>
 
+#include "src/docno_index.h"
+
 namespace cottontail {
 
 std::string trec_docno(const std::string &text) {
@@ -43,8 +45,23 @@ std::string trec_docno(const std::string &text) {
 }
 
 namespace {
+// The docno index of the warren, if it was built for the warren's items as
+// they are now.
+std::shared_ptr<DocnoIndex> docno_index(std::shared_ptr<Warren> warren) {
+  std::shared_ptr<DocnoIndex> index = DocnoIndex::load(warren->working());
+  std::string id;
+  if (index == nullptr || index->container() != warren->default_container() ||
+      !warren->get_parameter("id", &id) || index->id() != id ||
+      !index->current(warren))
+    return nullptr;
+  return index;
+}
+
 bool translate_docno(std::shared_ptr<Warren> warren, const std::string &docno,
-                     addr *p, addr *q, std::string *error) {
+                     addr *p, addr *q, std::string *error,
+                     std::shared_ptr<DocnoIndex> index = nullptr) {
+  if (index != nullptr)
+    return index->lookup(docno, p, q, error);
   std::string container_query = warren->default_container();
   if (container_query == "") {
     safe_error(error) = "No rankable items in warren";
@@ -103,6 +120,7 @@ bool load_trec_qrels(std::shared_ptr<Warren> warren,
   std::regex ws_re("\\s+");
   std::string line;
   fval max_level = 0.0;
+  std::shared_ptr<DocnoIndex> index = docno_index(warren);
   while (std::getline(qrelsf, line)) {
     std::vector<std::string> field{
         std::sregex_token_iterator(line.begin(), line.end(), ws_re, -1), {}};
@@ -113,7 +131,7 @@ bool load_trec_qrels(std::shared_ptr<Warren> warren,
     fval level = std::max(0.0, atof(field[3].c_str()));
     max_level = std::max(level, max_level);
     addr p, q;
-    if (!translate_docno(warren, field[2], &p, &q, error))
+    if (!translate_docno(warren, field[2], &p, &q, error, index))
       return false;
     if (qrels != nullptr)
       (*qrels)[field[0]][p] = level;
@@ -0,0 +1,279 @@
+#include "src/federation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/core.h"
+#include "src/hopper.h"
+#include "src/parameters.h"
+#include "src/ranking.h"
+#include "src/stats.h"
+#include "src/tagging_featurizer.h"
+#include "src/warren.h"
+
+namespace cottontail {
+
+std::vector<size_t> schedule_threads(const std::vector<fval> &costs,
+                                     size_t threads) {
+  std::vector<size_t> schedule(costs.size(), 1);
+  if (threads <= costs.size())
+    return schedule;
+  size_t extra = threads - costs.size();
+  fval total = 0.0;
+  for (auto cost : costs)
+    total += std::max(cost, 0.0);
+  if (total <= 0.0) {
+    for (size_t i = 0; i < costs.size(); i++)
+      schedule[i] += extra / costs.size() + (i < extra % costs.size() ? 1 : 0);
+    return schedule;
+  }
+  // Largest remainders take what is left after rounding down
+  std::vector<std::pair<fval, size_t>> remainders;
+  size_t given = 0;
+  for (size_t i = 0; i < costs.size(); i++) {
+    fval share = extra * std::max(costs[i], 0.0) / total;
+    size_t whole = static_cast<size_t>(share);
+    schedule[i] += whole;
+    given += whole;
+    remainders.emplace_back(share - whole, i);
+  }
+  std::sort(remainders.begin(), remainders.end(),
+            [](const std::pair<fval, size_t> &a,
+               const std::pair<fval, size_t> &b) { return a.first > b.first; });
+  for (size_t i = 0; given < extra && i < remainders.size(); i++, given++)
+    schedule[remainders[i].second]++;
+  return schedule;
+}
+
+// Statistics over the federation for the terms of one query.
+struct Federation::Terms {
+  fval items, avgl, tokens;
+  std::map<std::string, fval> df;
+  std::map<std::string, fval> occurrences;
+  // Postings of the terms in each member, as the cost of ranking it
+  std::vector<fval> postings;
+};
+
+// Statistics of a member, with idf, rsj, average length and occurrences
+// taken over the federation. Terms outside the query have none.
+class Federation::MemberStats final : public Stats {
+public:
+  MemberStats(std::shared_ptr<Stats> local, std::shared_ptr<Terms> terms)
+      : Stats(local->warren(), local->stemmer(), local->tokenizer()),
+        local_(local), terms_(terms){};
+  virtual ~MemberStats(){};
+  MemberStats(const MemberStats &) = delete;
+  MemberStats &operator=(const MemberStats &) = delete;
+  MemberStats(MemberStats &&) = delete;
+  MemberStats &operator=(MemberStats &&) = delete;
+
+private:
+  fval df(const std::string &term) {
+    auto found = terms_->df.find(term);
+    return found == terms_->df.end() ? 0.0 : found->second;
+  }
+  std::string recipe_() final { return local_->recipe(); }
+  bool have_(const std::string &name) final { return local_->have(name); };
+  fval avgl_() final { return terms_->avgl; };
+  fval tokens_() final { return terms_->tokens; };
+  fval occurrences_(const std::string &term) final {
+    auto found = terms_->occurrences.find(term);
+    return found == terms_->occurrences.end() ? 0.0 : found->second;
+  }
+  fval idf_(const std::string &term) final {
+    fval n = df(term);
+    if (n == 0.0)
+      return 0.0;
+    return std::max(std::log(terms_->items / n), 0.0);
+  }
+  fval rsj_(const std::string &term) final {
+    fval n = df(term);
+    if (n == 0.0)
+      return 0.0;
+    return std::max(std::log((terms_->items - n + 0.5) / (n + 0.5)), 0.0);
+  }
+  std::unique_ptr<Hopper> tf_hopper_(const std::string &term) final {
+    return local_->tf_hopper(term);
+  }
+  std::unique_ptr<Hopper> tfmax_hopper_(const std::string &term) final {
+    return local_->tfmax_hopper(term);
+  }
+  std::unique_ptr<Hopper> lmin_hopper_(const std::string &term) final {
+    return local_->lmin_hopper(term);
+  }
+  std::unique_ptr<Hopper> tfpeak_hopper_(const std::string &term) final {
+    return local_->tfpeak_hopper(term);
+  }
+  std::unique_ptr<Hopper> lpeak_hopper_(const std::string &term) final {
+    return local_->lpeak_hopper(term);
+  }
+  std::unique_ptr<Hopper> container_hopper_() final {
+    return local_->container_hopper();
+  }
+  std::unique_ptr<Hopper> id_hopper_() final { return local_->id_hopper(); }
+  std::shared_ptr<Stats> clone_(std::shared_ptr<Warren> warren) final {
+    std::shared_ptr<Stats> local = local_->clone(warren);
+    if (local == nullptr)
+      return nullptr;
+    return std::make_shared<MemberStats>(local, terms_);
+  }
+  std::shared_ptr<Stats> local_;
+  std::shared_ptr<Terms> terms_;
+};
+
+std::shared_ptr<Federation>
+Federation::make(const std::vector<std::shared_ptr<Warren>> &warrens,
+                 std::string *error) {
+  if (warrens.size() == 0) {
+    safe_error(error) = "Federation without members";
+    return nullptr;
+  }
+  std::shared_ptr<Federation> federation =
+      std::shared_ptr<Federation>(new Federation());
+  fval length = 0.0;
+  for (auto &warren : warrens) {
+    Member member;
+    member.warren = warren;
+    member.stats = Stats::make(warren, error);
+    if (member.stats == nullptr)
+      return nullptr;
+    std::unique_ptr<Hopper> hopper = content_hopper(warren, error);
+    if (hopper == nullptr)
+      return nullptr;
+    addr p, q, items = 0;
+    for (hopper->tau(minfinity + 1, &p, &q); p < maxfinity;
+         hopper->tau(p + 1, &p, &q))
+      items++;
+    federation->items_ += items;
+    length += items * member.stats->avgl();
+    federation->tokens_ += warren->txt()->tokens();
+    federation->members_.push_back(member);
+  }
+  if (federation->items_ < 1) {
+    safe_error(error) = "No items to rank in federation";
+    return nullptr;
+  }
+  federation->avgl_ = length / federation->items_;
+  return federation;
+}
+
+std::shared_ptr<Federation::Terms>
+Federation::gather(const std::map<std::string, fval> &query) {
+  std::shared_ptr<Terms> terms = std::make_shared<Terms>();
+  terms->items = items_;
+  terms->avgl = avgl_;
+  terms->tokens = tokens_;
+  terms->postings.assign(members_.size(), 0.0);
+  for (size_t i = 0; i < members_.size(); i++) {
+    std::shared_ptr<Warren> warren = members_[i].warren;
+    TaggingFeaturizer tf_featurizer(warren->featurizer(), "tf");
+    for (auto &term : query) {
+      fval df = warren->idx()->count(tf_featurizer.featurize(term.first));
+      terms->df[term.first] += df;
+      terms->postings[i] += df;
+      terms->occurrences[term.first] +=
+          warren->idx()->count(warren->featurizer()->featurize(term.first));
+    }
+  }
+  return terms;
+}
+
+std::shared_ptr<Stats> Federation::member_stats(size_t member,
+                                                std::shared_ptr<Terms> terms) {
+  return std::make_shared<MemberStats>(members_[member].stats, terms);
+}
+
+std::shared_ptr<Stats>
+Federation::stats(size_t member, const std::map<std::string, fval> &query) {
+  if (member >= members_.size())
+    return nullptr;
+  return member_stats(member, gather(query));
+}
+
+namespace {
+size_t depth_parameter(const std::string &ranker_name,
+                       const std::map<std::string, fval> &parameters) {
+  auto found = parameters.find(ranker_name + ":depth");
+  if (found == parameters.end())
+    found = parameters.find("depth");
+  if (found == parameters.end())
+    return static_cast<size_t>(Parameters::default_depth());
+  return static_cast<size_t>(found->second);
+}
+} // namespace
+
+std::vector<FederatedResult>
+Federation::rank(bool lmd, const std::map<std::string, fval> &query,
+                 const std::map<std::string, fval> &parameters,
+                 size_t threads, size_t *skipped) {
+  size_t depth = depth_parameter(lmd ? "lmd" : "bm25", parameters);
+  std::shared_ptr<Terms> terms = gather(query);
+  std::vector<std::shared_ptr<Stats>> stats;
+  std::vector<fval> bounds;
+  std::vector<size_t> order;
+  for (size_t i = 0; i < members_.size(); i++) {
+    stats.push_back(member_stats(i, terms));
+    bounds.push_back(lmd ? lmd_bound(stats[i], query, parameters)
+                         : bm25_bound(stats[i], query, parameters));
+    if (terms->postings[i] > 0.0 && bounds[i] > 0.0)
+      order.push_back(i);
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return bounds[a] > bounds[b];
+  });
+  threads = allowed_threads(threads);
+  std::vector<FederatedResult> top;
+  size_t ranked = 0, next = 0;
+  // Waves double in size, so that the first, most promising members set a
+  // threshold for the rest
+  for (size_t wave = 1; depth > 0 && next < order.size(); wave *= 2) {
+    fval threshold = (top.size() >= depth ? top.back().result.score() : 0.0);
+    std::vector<size_t> members;
+    std::vector<fval> costs;
+    for (; next < order.size() && members.size() < wave; next++) {
+      if (bounds[order[next]] <= threshold)
+        break;
+      members.push_back(order[next]);
+      costs.push_back(terms->postings[order[next]]);
+    }
+    if (members.size() == 0)
+      break;
+    std::vector<size_t> schedule = schedule_threads(costs, threads);
+    std::vector<std::vector<RankingResult>> rankings(members.size());
+    std::vector<std::thread> workers;
+    for (size_t j = 0; j < members.size(); j++)
+      workers.emplace_back(std::thread([&, j] {
+        std::shared_ptr<Stats> member = stats[members[j]];
+        if (lmd)
+          rankings[j] = parallel_lmd(member, query, parameters, schedule[j]);
+        else
+          rankings[j] = parallel_bm25(member, query, parameters, schedule[j]);
+      }));
+    for (auto &worker : workers)
+      worker.join();
+    for (size_t j = 0; j < members.size(); j++)
+      for (auto &result : rankings[j])
+        top.push_back(FederatedResult{members[j], result});
+    std::stable_sort(top.begin(), top.end(),
+                     [](const FederatedResult &a, const FederatedResult &b) {
+                       if (a.result.score() != b.result.score())
+                         return a.result.score() > b.result.score();
+                       if (a.member != b.member)
+                         return a.member < b.member;
+                       return a.result.p() < b.result.p();
+                     });
+    if (top.size() > depth)
+      top.resize(depth);
+    ranked += members.size();
+  }
+  if (skipped != nullptr)
+    *skipped = members_.size() - ranked;
+  return top;
+}
+
+} // namespace cottontail
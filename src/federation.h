@@ -0,0 +1,91 @@
+#ifndef COTTONTAIL_SRC_FEDERATION_H_
+#define COTTONTAIL_SRC_FEDERATION_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/core.h"
+#include "src/ranking.h"
+#include "src/stats.h"
+#include "src/warren.h"
+
+namespace cottontail {
+
+// A result from one member of a federation.
+struct FederatedResult {
+  size_t member;
+  RankingResult result;
+};
+
+// Threads for work split between parts of the given costs: one each, with
+// the rest shared in proportion to cost.
+std::vector<size_t> schedule_threads(const std::vector<fval> &costs,
+                                     size_t threads);
+
+// Collections in separate warrens, ranked together by bm25 or lmd with
+// statistics taken over all of them, so that their scores are comparable
+// and can be merged. The number of items and their average length are
+// gathered once, when the federation is made; document frequencies and
+// occurrences of the query terms are gathered from every member for each
+// query. Members whose score bounds cannot beat the results in hand are
+// skipped: they are ranked in waves, most promising first, with threads
+// split between the members of a wave by their postings. Like a warren, a
+// federation is used by one thread at a time.
+class Federation final {
+public:
+  // Members must have ranking statistics; see Stats::make.
+  static std::shared_ptr<Federation>
+  make(const std::vector<std::shared_ptr<Warren>> &warrens,
+       std::string *error = nullptr);
+  inline size_t size() const { return members_.size(); };
+  inline fval items() const { return items_; };
+  inline fval avgl() const { return avgl_; };
+  inline fval tokens() const { return tokens_; };
+  // Statistics for ranking one member with the terms of the query.
+  std::shared_ptr<Stats> stats(size_t member,
+                               const std::map<std::string, fval> &query);
+  // Rankings over all members, merged to the depth given by the parameters.
+  // Skipped, if given, counts members that were not ranked.
+  std::vector<FederatedResult>
+  bm25(const std::map<std::string, fval> &query,
+       const std::map<std::string, fval> &parameters, size_t threads = 0,
+       size_t *skipped = nullptr) {
+    return rank(false, query, parameters, threads, skipped);
+  };
+  std::vector<FederatedResult>
+  lmd(const std::map<std::string, fval> &query,
+      const std::map<std::string, fval> &parameters, size_t threads = 0,
+      size_t *skipped = nullptr) {
+    return rank(true, query, parameters, threads, skipped);
+  };
+  Federation(const Federation &) = delete;
+  Federation &operator=(const Federation &) = delete;
+  Federation(Federation &&) = delete;
+  Federation &operator=(Federation &&) = delete;
+
+private:
+  Federation() = default;
+  struct Member {
+    std::shared_ptr<Warren> warren;
+    std::shared_ptr<Stats> stats;
+  };
+  struct Terms;
+  class MemberStats;
+  std::shared_ptr<Terms> gather(const std::map<std::string, fval> &query);
+  std::shared_ptr<Stats> member_stats(size_t member,
+                                      std::shared_ptr<Terms> terms);
+  std::vector<FederatedResult>
+  rank(bool lmd, const std::map<std::string, fval> &query,
+       const std::map<std::string, fval> &parameters, size_t threads,
+       size_t *skipped);
+  std::vector<Member> members_;
+  fval items_ = 0.0;
+  fval avgl_ = 1.0;
+  fval tokens_ = 0.0;
+};
+
+} // namespace cottontail
+
+#endif // COTTONTAIL_SRC_FEDERATION_H_
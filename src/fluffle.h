@@ -30,6 +30,7 @@ struct Fluffle {
   size_t max_workers;
   addr address = 0;
   addr sequence = 0;
+  addr snapshot = 0;
   std::set<std::shared_ptr<Owsla>> merging;
   std::vector<std::shared_ptr<Owsla>> warrens;
   std::vector<HazelMergeRecovery> hazel_merges;
@@ -93,6 +93,14 @@ public:
 
 protected:
   Hopper(){};
+  // Rekey the memos on the interval they currently hold, which is still the
+  // correct answer for that key, since no two intervals in a GC-list share a
+  // start or an end. Decorators that must see (nearly) every call, rather
+  // than only the calls the memo misses, call these at the end of tau_ etc.
+  inline void rekey_tau() { tau_k_ = tau_p_; };
+  inline void rekey_rho() { rho_k_ = rho_q_; };
+  inline void rekey_uat() { uat_k_ = uat_q_; };
+  inline void rekey_ohr() { ohr_k_ = ohr_p_; };
 
 private:
   virtual addr L_(addr k);
@@ -45,6 +45,22 @@ std::shared_ptr<Stats> IdfStats::make(const std::string &recipe,
       TaggingFeaturizer::make(warren->featurizer(), "tf", error);
   if (stats->tf_featurizer_ == nullptr)
     return nullptr;
+  stats->tfmax_featurizer_ =
+      TaggingFeaturizer::make(warren->featurizer(), "tfmax", error);
+  if (stats->tfmax_featurizer_ == nullptr)
+    return nullptr;
+  stats->lmin_featurizer_ =
+      TaggingFeaturizer::make(warren->featurizer(), "lmin", error);
+  if (stats->lmin_featurizer_ == nullptr)
+    return nullptr;
+  stats->tfpeak_featurizer_ =
+      TaggingFeaturizer::make(warren->featurizer(), "tfpeak", error);
+  if (stats->tfpeak_featurizer_ == nullptr)
+    return nullptr;
+  stats->lpeak_featurizer_ =
+      TaggingFeaturizer::make(warren->featurizer(), "lpeak", error);
+  if (stats->lpeak_featurizer_ == nullptr)
+    return nullptr;
   std::string value;
   std::string unstemmed = "unstemmed";
   if (!warren->get_parameter(unstemmed, &value, error))
@@ -115,4 +131,19 @@ std::unique_ptr<Hopper> IdfStats::tf_hopper_(const std::string &term) {
   return warren_->idx()->hopper(tf_featurizer_->featurize(term));
 }
 
+std::unique_ptr<Hopper> IdfStats::tfmax_hopper_(const std::string &term) {
+  return warren_->idx()->hopper(tfmax_featurizer_->featurize(term));
+}
+
+std::unique_ptr<Hopper> IdfStats::lmin_hopper_(const std::string &term) {
+  return warren_->idx()->hopper(lmin_featurizer_->featurize(term));
+}
+
+std::unique_ptr<Hopper> IdfStats::tfpeak_hopper_(const std::string &term) {
+  return warren_->idx()->hopper(tfpeak_featurizer_->featurize(term));
+}
+
+std::unique_ptr<Hopper> IdfStats::lpeak_hopper_(const std::string &term) {
+  return warren_->idx()->hopper(lpeak_featurizer_->featurize(term));
+}
 } // namespace cottontail
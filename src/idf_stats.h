@@ -34,6 +34,10 @@ private:
   fval idf_(const std::string &term) final;
   fval rsj_(const std::string &term) final;
   std::unique_ptr<Hopper> tf_hopper_(const std::string &term) final;
+  std::unique_ptr<Hopper> tfmax_hopper_(const std::string &term) final;
+  std::unique_ptr<Hopper> lmin_hopper_(const std::string &term) final;
+  std::unique_ptr<Hopper> tfpeak_hopper_(const std::string &term) final;
+  std::unique_ptr<Hopper> lpeak_hopper_(const std::string &term) final;
   bool have_unstemmed_ = true;
   bool have_idf_ = true;
   bool have_rsj_ = true;
@@ -41,6 +45,10 @@ private:
   std::shared_ptr<Featurizer> idf_featurizer_;
   std::shared_ptr<Featurizer> rsj_featurizer_;
   std::shared_ptr<Featurizer> tf_featurizer_;
+  std::shared_ptr<Featurizer> tfmax_featurizer_;
+  std::shared_ptr<Featurizer> lmin_featurizer_;
+  std::shared_ptr<Featurizer> tfpeak_featurizer_;
+  std::shared_ptr<Featurizer> lpeak_featurizer_;
 };
 
 } // namespace cottontail
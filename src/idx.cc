@@ -5,6 +5,7 @@
 
 #include "src/core.h"
 #include "src/hopper.h"
+#include "src/warmup.h"
 #include "src/null_idx.h"
 #include "src/simple_idx.h"
 #include "src/working.h"
@@ -46,7 +47,7 @@ addr Idx::count_(addr feature) {
   // Brute force implementation for convenience, but you almost certainly want
   // to replace this virtual method with one that does direct calls to your
   // index.
-  std::unique_ptr<Hopper> h = hopper(feature);
+  std::unique_ptr<Hopper> h = hopper_(feature);
   cottontail::addr k = cottontail::minfinity + 1, n = 0, p, q;
   for (h->tau(k, &p, &q); p < cottontail::maxfinity; h->tau(k, &p, &q)) {
     n++;
@@ -55,4 +56,13 @@ addr Idx::count_(addr feature) {
   return n;
 }
 
+void Idx::warm_(addr feature) {
+  // Postings may be decoded lazily, so read the first of them
+  std::unique_ptr<Hopper> h = hopper_(feature);
+  addr p, q;
+  h->tau(minfinity + 1, &p, &q);
+}
+
+void Idx::record(addr feature) { log_->record(feature); }
+
 } // namespace cottontail
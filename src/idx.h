@@ -10,6 +10,8 @@
 
 namespace cottontail {
 
+class FeatureLog;
+
 class Idx {
 public:
   static std::shared_ptr<Idx> make(const std::string &name,
@@ -22,8 +24,19 @@ public:
   inline std::string name() { return name_; }
 
   inline std::unique_ptr<Hopper> hopper(addr feature) {
+    if (log_ != nullptr)
+      record(feature);
     return hopper_(feature);
   };
+  // Features whose hoppers are made are counted in the log, if any, which
+  // should be set before the idx is shared between threads.
+  inline std::shared_ptr<FeatureLog> log() { return log_; };
+  inline void set_log(std::shared_ptr<FeatureLog> log) { log_ = log; };
+  // Loads the postings of a feature into whatever cache the idx keeps,
+  // without counting it in the log.
+  inline void warm(addr feature) { warm_(feature); };
+  // True if the postings of a feature are held in that cache.
+  inline bool cached(addr feature) { return cached_(feature); };
   inline addr count(addr feature) { return count_(feature); };
   inline addr vocab() { return vocab_(); }
   inline void reset(){reset_();};
@@ -44,7 +57,11 @@ private:
   virtual addr count_(addr feature);
   virtual addr vocab_() = 0;
   virtual void reset_(){};
+  virtual void warm_(addr feature);
+  virtual bool cached_(addr feature) { return false; };
+  void record(addr feature);
   std::string name_ = "";
+  std::shared_ptr<FeatureLog> log_ = nullptr;
 };
 } // namespace cottontail
 #endif // COTTONTAIL_SRC_IDX_H_
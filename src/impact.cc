@@ -0,0 +1,263 @@
+#include "src/impact.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "src/core.h"
+#include "src/hopper.h"
+#include "src/ranking.h"
+#include "src/tagging_featurizer.h"
+#include "src/top_k.h"
+#include "src/vbyte.h"
+#include "src/warren.h"
+#include "src/working.h"
+
+namespace cottontail {
+
+namespace {
+// Checks that postings hold well-formed segments.
+bool check_segments(const std::string &postings) {
+  size_t where = 0, count, gap;
+  while (where < postings.size()) {
+    if (postings[where++] == 0 || !get_vbyte(postings, &where, &count))
+      return false;
+    for (size_t i = 0; i < count; i++)
+      if (!get_vbyte(postings, &where, &gap))
+        return false;
+  }
+  return true;
+}
+
+std::string impact_name(const std::string &tag) { return tag + ".impact"; }
+} // namespace
+
+std::shared_ptr<ImpactIndex>
+ImpactIndex::build(std::shared_ptr<Warren> warren, const std::string &tag,
+                   const std::vector<std::string> &terms, bool convert,
+                   std::string *error) {
+  if (warren == nullptr || !warren->started()) {
+    safe_error(error) = "ImpactIndex needs a started warren";
+    return nullptr;
+  }
+  std::shared_ptr<Featurizer> featurizer =
+      TaggingFeaturizer::make(warren->featurizer(), tag, error);
+  if (featurizer == nullptr)
+    return nullptr;
+  auto impact = [convert](fval v) -> fval {
+    return convert ? static_cast<fval>(fval2addr(v)) : v;
+  };
+  // The first pass finds the largest impact, which sets the scale
+  fval maximum = 0.0;
+  for (auto &term : terms) {
+    std::unique_ptr<Hopper> hopper =
+        warren->idx()->hopper(featurizer->featurize(term));
+    addr p, q;
+    fval v;
+    for (hopper->tau(minfinity + 1, &p, &q, &v); p < maxfinity;
+         hopper->tau(p + 1, &p, &q, &v))
+      maximum = std::max(maximum, impact(v));
+  }
+  std::shared_ptr<ImpactIndex> index =
+      std::shared_ptr<ImpactIndex>(new ImpactIndex());
+  if (maximum > 0.0)
+    index->scale_ = maximum / LEVELS;
+  for (auto &term : terms) {
+    if (index->postings_.find(term) != index->postings_.end())
+      continue;
+    std::unique_ptr<Hopper> hopper =
+        warren->idx()->hopper(featurizer->featurize(term));
+    std::vector<std::vector<addr>> levels(LEVELS + 1);
+    addr p, q;
+    fval v;
+    for (hopper->tau(minfinity + 1, &p, &q, &v); p < maxfinity;
+         hopper->tau(p + 1, &p, &q, &v)) {
+      fval value = impact(v);
+      if (value <= 0.0 || p < 0)
+        continue;
+      size_t level = static_cast<size_t>(std::lround(value / index->scale_));
+      levels[std::min(LEVELS, std::max<size_t>(1, level))].push_back(p);
+    }
+    std::string postings;
+    for (size_t level = LEVELS; level > 0; level--) {
+      if (levels[level].size() == 0)
+        continue;
+      postings.push_back(static_cast<char>(level));
+      put_vbyte(levels[level].size(), &postings);
+      addr previous = 0;
+      for (addr p : levels[level]) {
+        put_vbyte(p - previous, &postings);
+        previous = p;
+      }
+    }
+    if (postings.size() > 0)
+      index->postings_[term] = postings;
+  }
+  return index;
+}
+
+std::shared_ptr<ImpactIndex> ImpactIndex::load(std::shared_ptr<Working> working,
+                                               const std::string &tag,
+                                               std::string *error) {
+  if (working == nullptr) {
+    safe_error(error) = "ImpactIndex needs a working directory";
+    return nullptr;
+  }
+  std::ifstream f(working->make_name(impact_name(tag)), std::ios::binary);
+  if (f.fail()) {
+    safe_error(error) = "No impact index for: " + tag;
+    return nullptr;
+  }
+  std::stringstream ss;
+  ss << f.rdbuf();
+  std::string contents = ss.str();
+  std::shared_ptr<ImpactIndex> index =
+      std::shared_ptr<ImpactIndex>(new ImpactIndex());
+  size_t where = 0, terms;
+  if (contents.size() < sizeof(index->scale_) ||
+      !get_vbyte(contents, &where, &terms) ||
+      contents.size() - where < sizeof(index->scale_)) {
+    safe_error(error) = "Bad impact index header";
+    return nullptr;
+  }
+  memcpy(&index->scale_, contents.data() + where, sizeof(index->scale_));
+  where += sizeof(index->scale_);
+  for (size_t i = 0; i < terms; i++) {
+    size_t length, size;
+    if (!get_vbyte(contents, &where, &length) ||
+        length > contents.size() - where) {
+      safe_error(error) = "Corrupt impact index";
+      return nullptr;
+    }
+    std::string term = contents.substr(where, length);
+    where += length;
+    if (!get_vbyte(contents, &where, &size) ||
+        size > contents.size() - where) {
+      safe_error(error) = "Corrupt impact index";
+      return nullptr;
+    }
+    std::string postings = contents.substr(where, size);
+    where += size;
+    if (!check_segments(postings)) {
+      safe_error(error) = "Corrupt impact index";
+      return nullptr;
+    }
+    index->postings_[term] = postings;
+  }
+  return index;
+}
+
+bool ImpactIndex::store(std::shared_ptr<Working> working,
+                        const std::string &tag, std::string *error) {
+  if (working == nullptr) {
+    safe_error(error) = "ImpactIndex needs a working directory";
+    return false;
+  }
+  std::string temp = working->make_temp("impact");
+  std::ofstream f(temp, std::ios::binary);
+  if (f.fail()) {
+    safe_error(error) = "Can't create: " + temp;
+    return false;
+  }
+  std::string header;
+  put_vbyte(postings_.size(), &header);
+  f.write(header.data(), header.size());
+  f.write(reinterpret_cast<const char *>(&scale_), sizeof(scale_));
+  for (auto &term : postings_) {
+    std::string prefix;
+    put_vbyte(term.first.size(), &prefix);
+    prefix += term.first;
+    put_vbyte(term.second.size(), &prefix);
+    f.write(prefix.data(), prefix.size());
+    f.write(term.second.data(), term.second.size());
+  }
+  f.close();
+  if (f.fail() || std::rename(temp.c_str(),
+                              working->make_name(impact_name(tag)).c_str()) !=
+                      0) {
+    std::remove(temp.c_str());
+    safe_error(error) = "Can't write impact index";
+    return false;
+  }
+  return true;
+}
+
+std::vector<RankingResult>
+ImpactIndex::rank(const std::map<std::string, fval> &query, size_t depth,
+                  size_t postings, size_t microseconds) {
+  std::vector<RankingResult> top;
+  if (depth == 0)
+    return top;
+  auto start = std::chrono::steady_clock::now();
+  struct Segment {
+    fval contribution;
+    const std::string *postings;
+    size_t where, count;
+  };
+  std::vector<Segment> segments;
+  for (auto &term : query) {
+    auto it = postings_.find(term.first);
+    if (it == postings_.end() || term.second <= 0.0)
+      continue;
+    const std::string &data = it->second;
+    size_t where = 0, count, gap;
+    while (where < data.size()) {
+      unsigned char level = static_cast<unsigned char>(data[where++]);
+      get_vbyte(data, &where, &count);
+      segments.push_back(
+          Segment{term.second * level * scale_, &data, where, count});
+      for (size_t i = 0; i < count; i++)
+        get_vbyte(data, &where, &gap);
+    }
+  }
+  std::stable_sort(segments.begin(), segments.end(),
+                   [](const Segment &a, const Segment &b) {
+                     return a.contribution > b.contribution;
+                   });
+  // Time is only checked between segments and every so often within one,
+  // and stops processing even in the middle of a segment.
+  constexpr size_t CHECK = 4096;
+  auto late = [&]() {
+    return microseconds > 0 &&
+           std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - start)
+                   .count() >= static_cast<int64_t>(microseconds);
+  };
+  std::unordered_map<addr, fval> accumulators;
+  size_t processed = 0;
+  bool stopped = false;
+  for (auto &segment : segments) {
+    if (postings > 0 && processed >= postings)
+      break;
+    if (processed > 0 && late())
+      break;
+    size_t where = segment.where, gap;
+    addr p = 0;
+    for (size_t i = 0; i < segment.count && !stopped; i++) {
+      get_vbyte(*segment.postings, &where, &gap);
+      p += gap;
+      accumulators[p] += segment.contribution;
+      stopped = (++processed % CHECK == 0 && late());
+    }
+    if (stopped)
+      break;
+  }
+  TopK best(depth);
+  for (auto &accumulator : accumulators)
+    if (accumulator.second > best.threshold())
+      best.push(RankingResult(accumulator.first, accumulator.first,
+                              accumulator.second));
+  return best.results();
+}
+
+} // namespace cottontail
@@ -0,0 +1,65 @@
+#ifndef COTTONTAIL_SRC_IMPACT_H_
+#define COTTONTAIL_SRC_IMPACT_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/core.h"
+#include "src/ranking.h"
+#include "src/warren.h"
+#include "src/working.h"
+
+namespace cottontail {
+
+// Impact-ordered index for learned sparse retrieval. The impacts annotated
+// under a tag (as by splade-annotate) are quantized to eight bits, and the
+// postings of each term are grouped into segments of equal impact, highest
+// first, each listing its addresses in order.
+//
+// Ranking is score-at-a-time, after
+// Vo Ngoc Anh and Alistair Moffat.
+// Pruned query evaluation using pre-computed impacts.
+// SIGIR 2006.
+// Segments from all query terms are processed in decreasing order of their
+// contribution to the score, so evaluation can stop after a budget of
+// postings or time with the most important work done.
+class ImpactIndex final {
+public:
+  static constexpr size_t LEVELS = 255;
+  // Impacts are the integer values of the annotations for each term under
+  // the tag, or the fval values when convert is false.
+  static std::shared_ptr<ImpactIndex>
+  build(std::shared_ptr<Warren> warren, const std::string &tag,
+        const std::vector<std::string> &terms, bool convert = true,
+        std::string *error = nullptr);
+  static std::shared_ptr<ImpactIndex> load(std::shared_ptr<Working> working,
+                                           const std::string &tag,
+                                           std::string *error = nullptr);
+  bool store(std::shared_ptr<Working> working, const std::string &tag,
+             std::string *error = nullptr);
+  inline size_t size() { return postings_.size(); };
+  // Impacts are multiples of the scale.
+  inline fval scale() { return scale_; };
+  // Stops after at least postings postings, finishing the segment it is in,
+  // or soon after microseconds microseconds, even within a segment, where
+  // these are non-zero. Results are [p,p] as for product_ranking.
+  std::vector<RankingResult> rank(const std::map<std::string, fval> &query,
+                                  size_t depth, size_t postings = 0,
+                                  size_t microseconds = 0);
+  ImpactIndex(ImpactIndex const &) = delete;
+  ImpactIndex &operator=(ImpactIndex const &) = delete;
+  ImpactIndex(ImpactIndex &&) = delete;
+  ImpactIndex &operator=(ImpactIndex &&) = delete;
+
+private:
+  ImpactIndex(){};
+  fval scale_ = 1.0;
+  // term -> segments: impact byte, vbyte count, vbyte address gaps
+  std::map<std::string, std::string> postings_;
+};
+
+} // namespace cottontail
+
+#endif // COTTONTAIL_SRC_IMPACT_H_
@@ -105,12 +105,12 @@ public:
 
   static std::shared_ptr<Parameters>
   from_ranker_name(const std::string &ranker_name);
+  static fval default_depth();
 
 protected:
   Parameters() = default;
 
 private:
-  fval default_depth();
   virtual std::map<std::string, fval> random_() = 0;
   virtual std::map<std::string, fval> defaults_() = 0;
 };
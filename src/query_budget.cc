@@ -0,0 +1,27 @@
+#include "src/query_budget.h"
+
+#include "src/core.h"
+
+namespace cottontail {
+
+thread_local QueryBudget *QueryBudget::current_ = nullptr;
+thread_local addr QueryBudget::steps_ = 0;
+
+bool QueryBudget::spent() {
+  if (cancelled_.load(std::memory_order_relaxed))
+    return true;
+  if (deadline_ > 0 && now() >= deadline_) {
+    cancel();
+    return true;
+  }
+  return false;
+}
+
+bool QueryBudget::exhausted() {
+  if (!spent())
+    return false;
+  truncate();
+  return true;
+}
+
+} // namespace cottontail
@@ -0,0 +1,93 @@
+#ifndef COTTONTAIL_SRC_QUERY_BUDGET_H_
+#define COTTONTAIL_SRC_QUERY_BUDGET_H_
+
+#include <atomic>
+
+#include "src/core.h"
+
+namespace cottontail {
+
+// Cooperative limit on the work done for one query. Ranking loops check it
+// every so often and, once it is spent, stop and return the best results
+// found so far, marking the budget as truncated. A budget may be shared by
+// the workers ranking a query in parallel and cancelled from any thread.
+//
+// A budget made current on a thread with a Scope is also checked by the
+// hoppers that loop internally (containment and materialization), which
+// then stop as if at the end of their postings, and by hopper construction,
+// which then fails. Results from them are partial only when the budget is
+// marked truncated.
+class QueryBudget final {
+public:
+  // No deadline when milliseconds is zero.
+  QueryBudget(addr milliseconds = 0)
+      : deadline_(milliseconds > 0 ? now() + milliseconds : 0){};
+  inline void cancel() { cancelled_.store(true, std::memory_order_relaxed); };
+  // True once cancelled or past the deadline.
+  bool spent();
+  inline void truncate() { truncated_.store(true, std::memory_order_relaxed); };
+  inline bool truncated() const {
+    return truncated_.load(std::memory_order_relaxed);
+  };
+  // Steps between checks of the clock in ranking loops.
+  static constexpr addr STEPS = 1024;
+  // Makes a budget current on this thread until the scope ends. A null budget
+  // leaves any current budget in place.
+  class Scope final {
+  public:
+    explicit Scope(QueryBudget *budget) : previous_(current_) {
+      if (budget != nullptr)
+        current_ = budget;
+    };
+    ~Scope() { current_ = previous_; };
+    Scope(Scope const &) = delete;
+    Scope &operator=(Scope const &) = delete;
+    Scope(Scope &&) = delete;
+    Scope &operator=(Scope &&) = delete;
+
+  private:
+    QueryBudget *previous_;
+  };
+  // The budget current on this thread, if any.
+  static inline QueryBudget *current() { return current_; };
+  // Counts a step against the current budget, if any, looking at the clock
+  // every STEPS steps. True, with the budget marked truncated, once it is
+  // spent.
+  static inline bool expired() {
+    QueryBudget *budget = current_;
+    if (budget == nullptr)
+      return false;
+    if (++steps_ % STEPS != 0 &&
+        !budget->cancelled_.load(std::memory_order_relaxed))
+      return false;
+    return budget->exhausted();
+  };
+  // As above, but looking at the clock now, for loops with costly steps.
+  static inline bool expired_now() {
+    QueryBudget *budget = current_;
+    return budget != nullptr && budget->exhausted();
+  };
+  // True if the current budget, if any, has cut anything short, so that
+  // results computed under it may be partial and must not be kept.
+  static inline bool cut_short() {
+    QueryBudget *budget = current_;
+    return budget != nullptr && budget->truncated();
+  };
+  QueryBudget(QueryBudget const &) = delete;
+  QueryBudget &operator=(QueryBudget const &) = delete;
+  QueryBudget(QueryBudget &&) = delete;
+  QueryBudget &operator=(QueryBudget &&) = delete;
+
+private:
+  bool exhausted();
+
+  addr deadline_;
+  std::atomic<bool> cancelled_{false};
+  std::atomic<bool> truncated_{false};
+  static thread_local QueryBudget *current_;
+  static thread_local addr steps_;
+};
+
+} // namespace cottontail
+
+#endif // COTTONTAIL_SRC_QUERY_BUDGET_H_
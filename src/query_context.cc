@@ -0,0 +1,109 @@
+#include "src/query_context.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "src/core.h"
+#include "src/ranker.h"
+#include "src/ranking.h"
+#include "src/stats.h"
+#include "src/warren.h"
+
+namespace cottontail {
+
+QueryContext::~QueryContext() {
+  if (warren_ != nullptr)
+    warren_->end();
+}
+
+std::shared_ptr<Stats> QueryContext::stats(std::string *error) {
+  if (stats_ == nullptr)
+    safe_error(error) = stats_error_;
+  return stats_;
+}
+
+std::shared_ptr<Ranker> QueryContext::ranker(const std::string &pipeline,
+                                             std::string *error) {
+  auto it = rankers_.find(pipeline);
+  if (it != rankers_.end())
+    return it->second;
+  std::shared_ptr<Stats> the_stats = stats(error);
+  if (the_stats == nullptr)
+    return nullptr;
+  std::shared_ptr<Ranker> ranker =
+      Ranker::from_pipeline(pipeline, the_stats, error);
+  if (ranker != nullptr)
+    rankers_[pipeline] = ranker;
+  return ranker;
+}
+
+std::shared_ptr<QueryContextPool>
+QueryContextPool::make(std::shared_ptr<Warren> warren,
+                       const std::string &stats_name,
+                       const std::string &stats_recipe, std::string *error) {
+  if (warren == nullptr || !warren->started()) {
+    safe_error(error) = "QueryContextPool needs a started warren";
+    return nullptr;
+  }
+  std::shared_ptr<QueryContextPool> pool =
+      std::shared_ptr<QueryContextPool>(new QueryContextPool());
+  pool->warren_ = warren;
+  pool->stats_name_ = stats_name;
+  pool->stats_recipe_ = stats_recipe;
+  pool->self_ = pool;
+  return pool;
+}
+
+std::shared_ptr<QueryContext> QueryContextPool::acquire(std::string *error) {
+  addr snapshot = warren_->snapshot();
+  std::unique_ptr<QueryContext> context;
+  {
+    std::lock_guard<std::mutex> _(lock_);
+    while (context == nullptr && idle_.size() > 0) {
+      context = std::move(idle_.back());
+      idle_.pop_back();
+      if (context->snapshot_ != snapshot)
+        context = nullptr;
+    }
+  }
+  if (context == nullptr) {
+    std::shared_ptr<Warren> clone;
+    {
+      std::lock_guard<std::mutex> _(clone_lock_);
+      clone = warren_->clone(error);
+    }
+    if (clone == nullptr)
+      return nullptr;
+    if (!clone->started())
+      clone->start();
+    context = std::unique_ptr<QueryContext>(new QueryContext());
+    context->warren_ = clone;
+    context->snapshot_ = snapshot;
+    context->stats_ = Stats::make(stats_name_, stats_recipe_, clone,
+                                  &context->stats_error_);
+  }
+  std::weak_ptr<QueryContextPool> pool = self_;
+  return std::shared_ptr<QueryContext>(
+      context.release(), [pool](QueryContext *context) {
+        std::shared_ptr<QueryContextPool> the_pool = pool.lock();
+        if (the_pool == nullptr)
+          delete context;
+        else
+          the_pool->release(context);
+      });
+}
+
+void QueryContextPool::release(QueryContext *context) {
+  std::lock_guard<std::mutex> _(lock_);
+  idle_.emplace_back(context);
+}
+
+size_t QueryContextPool::idle() {
+  std::lock_guard<std::mutex> _(lock_);
+  return idle_.size();
+}
+
+} // namespace cottontail
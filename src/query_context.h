@@ -0,0 +1,81 @@
+#ifndef COTTONTAIL_SRC_QUERY_CONTEXT_H_
+#define COTTONTAIL_SRC_QUERY_CONTEXT_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "src/core.h"
+#include "src/ranker.h"
+#include "src/ranking.h"
+#include "src/stats.h"
+#include "src/warren.h"
+
+namespace cottontail {
+
+// A started clone of a warren, with its ranking statistics and rankers,
+// checked out from a QueryContextPool by one thread at a time.
+class QueryContext final {
+public:
+  inline std::shared_ptr<Warren> warren() { return warren_; };
+  // Fails if the warren has no statistics of the kind named by the pool.
+  std::shared_ptr<Stats> stats(std::string *error = nullptr);
+  // Built once for each pipeline and kept.
+  std::shared_ptr<Ranker> ranker(const std::string &pipeline,
+                                 std::string *error = nullptr);
+  ~QueryContext();
+  QueryContext(QueryContext const &) = delete;
+  QueryContext &operator=(QueryContext const &) = delete;
+  QueryContext(QueryContext &&) = delete;
+  QueryContext &operator=(QueryContext &&) = delete;
+
+private:
+  friend class QueryContextPool;
+  QueryContext(){};
+  std::shared_ptr<Warren> warren_;
+  addr snapshot_ = 0;
+  std::shared_ptr<Stats> stats_;
+  std::string stats_error_;
+  std::map<std::string, std::shared_ptr<Ranker>> rankers_;
+};
+
+// Saves cloning a warren, and building its statistics and rankers, for
+// every query. Contexts are cloned from a started warren as needed and
+// returned to the pool when the last copy of a checkout is released. A
+// context cloned before the snapshot of the warren changed, as when a
+// Bigwig is restarted after a commit, is dropped rather than reused.
+class QueryContextPool final {
+public:
+  // Statistics are made as by Stats::make, with the default when the name
+  // is empty.
+  static std::shared_ptr<QueryContextPool>
+  make(std::shared_ptr<Warren> warren, const std::string &stats_name = "",
+       const std::string &stats_recipe = "", std::string *error = nullptr);
+  std::shared_ptr<QueryContext> acquire(std::string *error = nullptr);
+  inline std::shared_ptr<Warren> warren() { return warren_; };
+  inline std::string stats_name() { return stats_name_; };
+  inline std::string stats_recipe() { return stats_recipe_; };
+  // Contexts waiting to be checked out.
+  size_t idle();
+  QueryContextPool(QueryContextPool const &) = delete;
+  QueryContextPool &operator=(QueryContextPool const &) = delete;
+  QueryContextPool(QueryContextPool &&) = delete;
+  QueryContextPool &operator=(QueryContextPool &&) = delete;
+
+private:
+  QueryContextPool(){};
+  void release(QueryContext *context);
+  std::shared_ptr<Warren> warren_;
+  std::string stats_name_;
+  std::string stats_recipe_;
+  std::weak_ptr<QueryContextPool> self_;
+  std::mutex lock_;
+  std::mutex clone_lock_;
+  std::vector<std::unique_ptr<QueryContext>> idle_;
+};
+
+} // namespace cottontail
+
+#endif // COTTONTAIL_SRC_QUERY_CONTEXT_H_
@@ -19,6 +19,7 @@
 #include "gcl/gcl.h"
 #include "src/hopper.h"
 #include "src/parameters.h"
+#include "src/query_context.h"
 #include "gcl/parse.h"
 #include "src/ranking.h"
 #include "src/stats.h"
@@ -46,7 +47,29 @@ public:
   std::map<std::string, fval> parameters() { return parameters_; };
   std::vector<RankingResult> ranking() { return ranking_; };
 
+  // Limits the next stage to a page, following after if given.
+  void page(size_t size, const RankingResult *after) {
+    parameters_["depth"] = size;
+    for (auto it = parameters_.begin(); it != parameters_.end();)
+      if (it->first.size() > 6 &&
+          it->first.compare(it->first.size() - 6, 6, ":depth") == 0)
+        it = parameters_.erase(it);
+      else
+        ++it;
+    if (after != nullptr)
+      resume_after(*after, &parameters_);
+  };
+
 private:
+  // Set by a "threads=n" stage, for range-parallel rankers; 0 for all the
+  // hardware allows.
+  size_t threads() {
+    auto it = parameters_.find("threads");
+    if (it == parameters_.end() || it->second < 0.0)
+      return 1;
+    return static_cast<size_t>(it->second);
+  };
+
   void cook() {
     if (weighted_query_.size() == 0 && raw_query_ != "") {
       std::vector<std::string> terms = stats_->tokenizer()->split(raw_query_);
@@ -63,6 +86,7 @@ private:
   friend class ExpansionTransformer;
   friend class LMDTransformer;
   friend class ParameterTransformer;
+  friend class ProductTransformer;
   friend class RandomParameterTransformer;
   friend class StemTransformer;
   friend class StopTransformer;
@@ -77,6 +101,8 @@ private:
 class RankingContextTransformer {
 public:
   void transform(class RankingContext *context) { return transform_(context); };
+  // True if the stage ranks, and can resume after a given result.
+  bool resumes() { return resumes_(); };
 
   virtual ~RankingContextTransformer(){};
   RankingContextTransformer(const RankingContextTransformer &) = default;
@@ -90,6 +116,7 @@ protected:
 
 private:
   virtual void transform_(class RankingContext *context) = 0;
+  virtual bool resumes_() { return false; };
 };
 
 class BM25Transformer : public RankingContextTransformer {
@@ -97,8 +124,15 @@ public:
   virtual ~BM25Transformer(){};
 
 private:
+  bool resumes_() final { return true; };
   void transform_(class RankingContext *context) {
-    if (context->weighted_query_.size() > 0)
+    size_t threads = context->threads();
+    if (threads != 1) {
+      context->cook();
+      context->ranking_ =
+          parallel_bm25(context->stats_, context->weighted_query_,
+                        context->parameters_, threads);
+    } else if (context->weighted_query_.size() > 0)
       context->ranking_ = bm25_ranking(
           context->stats_, context->weighted_query_, context->parameters_);
     else
@@ -112,8 +146,15 @@ public:
   virtual ~LMDTransformer(){};
 
 private:
+  bool resumes_() final { return true; };
   void transform_(class RankingContext *context) {
-    if (context->weighted_query_.size() > 0)
+    size_t threads = context->threads();
+    if (threads != 1) {
+      context->cook();
+      context->ranking_ =
+          parallel_lmd(context->stats_->warren(), context->weighted_query_,
+                       context->parameters_, threads);
+    } else if (context->weighted_query_.size() > 0)
       context->ranking_ =
           lmd_ranking(context->stats_->warren(), context->weighted_query_,
                       context->parameters_);
@@ -123,6 +164,28 @@ private:
   }
 };
 
+// Dot product with the integer impacts annotated under a tag, as by
+// splade-annotate.
+class ProductTransformer : public RankingContextTransformer {
+public:
+  ProductTransformer(const std::string &tag) : tag_(tag){};
+  virtual ~ProductTransformer(){};
+
+private:
+  std::string tag_;
+  bool resumes_() final { return true; };
+  void transform_(class RankingContext *context) {
+    context->cook();
+    std::map<std::string, fval> parameters = context->parameters_;
+    if (parameters.find(tag_ + ":depth") == parameters.end() &&
+        parameters.find("depth") == parameters.end())
+      parameters["depth"] = Parameters::default_depth();
+    context->ranking_ =
+        parallel_product(context->stats_->warren(), context->weighted_query_,
+                         parameters, tag_, true, context->threads());
+  }
+};
+
 class ExpansionTransformer : public RankingContextTransformer {
 public:
   virtual ~ExpansionTransformer(){};
@@ -280,6 +343,8 @@ RankingContextTransformer::from_name(std::string transformation) {
         return transformer;
       else
         return nullptr;
+    } else if (name == "product" && argument != "") {
+      return std::make_shared<ProductTransformer>(argument);
     } else {
       return nullptr;
     }
@@ -327,6 +392,41 @@ private:
       *parameters = context.parameters();
     return context.ranking();
   }
+  virtual std::vector<RankingResult> page_(const std::string &query,
+                                           size_t size,
+                                           const RankingResult *after) final {
+    if (transformers_.size() == 0 || !transformers_.back()->resumes())
+      return slice(rank_(query, nullptr), size, after);
+    RankingContext context(stats_);
+    context.clear(query);
+    for (size_t i = 0; i + 1 < transformers_.size(); i++)
+      transformers_[i]->transform(&context);
+    context.page(size, after);
+    if (transformers_.size() > 0)
+      transformers_.back()->transform(&context);
+    std::vector<RankingResult> ranking = context.ranking();
+    if (ranking.size() > size)
+      ranking.resize(size);
+    return ranking;
+  }
+  // The page of a full ranking following after, which is empty if after
+  // isn't in it.
+  static std::vector<RankingResult>
+  slice(const std::vector<RankingResult> &ranking, size_t size,
+        const RankingResult *after) {
+    size_t start = 0;
+    if (after != nullptr) {
+      start = ranking.size();
+      for (size_t i = 0; i < ranking.size(); i++)
+        if (ranking[i].p() == after->p() && ranking[i].q() == after->q()) {
+          start = i + 1;
+          break;
+        }
+    }
+    size_t end = std::min(ranking.size(), start + size);
+    return std::vector<RankingResult>(ranking.begin() + start,
+                                      ranking.begin() + end);
+  }
 };
 
 } // namespace
@@ -371,6 +471,31 @@ bool trec(std::shared_ptr<Warren> warren, const std::string &stats_name,
     *time = 0;
   if (queries.size() == 0)
     return true;
+  bool end_warren = false;
+  if (!warren->started()) {
+    warren->start();
+    end_warren = true;
+  }
+  bool okay = false;
+  {
+    std::shared_ptr<QueryContextPool> pool =
+        QueryContextPool::make(warren, stats_name, stats_recipe, error);
+    if (pool != nullptr)
+      okay = trec(pool, pipeline, queries, results, error, threads, time);
+  }
+  if (end_warren)
+    warren->end();
+  return okay;
+}
+
+bool trec(std::shared_ptr<QueryContextPool> pool, const std::string &pipeline,
+          std::map<std::string, std::string> queries,
+          std::map<std::string, std::vector<std::string>> *results,
+          std::string *error, size_t threads, addr *time) {
+  if (time != nullptr)
+    *time = 0;
+  if (queries.size() == 0)
+    return true;
   assert(results != nullptr);
   results->clear();
   std::vector<std::pair<std::string, std::string>> work;
@@ -378,12 +503,6 @@ bool trec(std::shared_ptr<Warren> warren, const std::string &stats_name,
     work.push_back(q);
   threads = allowed_threads(threads);
   threads = std::min(threads, work.size());
-  bool end_warren = false;
-  if (!warren->started()) {
-    warren->start();
-    end_warren = true;
-  }
-  std::mutex clone_lock;
   std::mutex state_lock;
   std::vector<addr> worker_times(threads, 0);
   bool stop = false;
@@ -403,35 +522,26 @@ bool trec(std::shared_ptr<Warren> warren, const std::string &stats_name,
 
   auto solver = [&](size_t i) {
     std::string local_error;
-    std::shared_ptr<Warren> local_warren;
-    {
-      std::lock_guard<std::mutex> _(clone_lock);
-      if (stopping())
-        return;
-      local_warren = warren->clone(&local_error);
-    }
-    if (local_warren == nullptr) {
+    if (stopping())
+      return;
+    std::shared_ptr<QueryContext> context = pool->acquire(&local_error);
+    if (context == nullptr) {
       fail(local_error);
       return;
     }
-    std::shared_ptr<Stats> local_stats;
-    local_stats =
-        Stats::make(stats_name, stats_recipe, local_warren, &local_error);
+    std::shared_ptr<Stats> local_stats = context->stats(&local_error);
     if (local_stats == nullptr) {
-      local_warren->end();
       fail(local_error);
       return;
     }
     std::shared_ptr<cottontail::Ranker> rank =
-        cottontail::Ranker::from_pipeline(pipeline, local_stats, &local_error);
+        context->ranker(pipeline, &local_error);
     if (rank == nullptr) {
-      local_warren->end();
       fail(local_error);
       return;
     }
     std::unique_ptr<cottontail::Hopper> id_hopper = local_stats->id_hopper();
     if (id_hopper == nullptr) {
-      local_warren->end();
       fail("Can't find identifiers");
       return;
     }
@@ -458,15 +568,12 @@ bool trec(std::shared_ptr<Warren> warren, const std::string &stats_name,
       }
     }
     worker_times[i] = now() - start;
-    local_warren->end();
   };
   std::vector<std::thread> workers;
   for (size_t i = 0; i < threads; i++)
     workers.emplace_back(std::thread(solver, i));
   for (auto &worker : workers)
     worker.join();
-  if (end_warren)
-    warren->end();
   if (!stop && time != nullptr)
     *time = *std::max_element(worker_times.begin(), worker_times.end());
   return !stop;
@@ -14,6 +14,8 @@
 
 namespace cottontail {
 
+class QueryContextPool;
+
 class Ranker {
 public:
   std::vector<RankingResult>
@@ -21,6 +23,17 @@ public:
              std::map<std::string, fval> *parameters = nullptr) {
     return rank_(query, parameters);
   };
+  // The page of size results following after, or the first page when after
+  // is null. Paging applies to the final stage of the pipeline, so it is
+  // cheap when that stage resumes (see resume_after), as bm25, lmd and
+  // product do; earlier stages, such as those feeding expansion, rank in
+  // full for every page. When the final stage doesn't rank, as for stop or
+  // parameter stages, each page is sliced from the full ranking, and the
+  // page is empty if after isn't in it.
+  std::vector<RankingResult> page(const std::string &query, size_t size,
+                                  const RankingResult *after = nullptr) {
+    return page_(query, size, after);
+  };
 
   virtual ~Ranker(){};
   Ranker(const Ranker &) = delete;
@@ -41,6 +54,9 @@ protected:
 private:
   virtual std::vector<RankingResult>
   rank_(const std::string &query, std::map<std::string, fval> *parameters) = 0;
+  virtual std::vector<RankingResult> page_(const std::string &query,
+                                           size_t size,
+                                           const RankingResult *after) = 0;
 };
 
 bool trec(std::shared_ptr<Warren> warren, const std::string &stats_name,
@@ -49,6 +65,13 @@ bool trec(std::shared_ptr<Warren> warren, const std::string &stats_name,
           std::map<std::string, std::vector<std::string>> *results,
           std::string *error, size_t threads, addr *time = nullptr);
 
+// As above, with workers taking their warrens, statistics and rankers from a
+// pool, which may be kept between calls.
+bool trec(std::shared_ptr<QueryContextPool> pool, const std::string &pipeline,
+          std::map<std::string, std::string> queries,
+          std::map<std::string, std::vector<std::string>> *results,
+          std::string *error, size_t threads, addr *time = nullptr);
+
 } // namespace cottontail
 
 #endif // COTTONTAIL_SRC_BUILDER_H_
@@ -7,22 +7,31 @@
 #include <cstdlib>
 #include <ctime>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <regex>
 #include <set>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "src/columns.h"
 #include "src/cottontail.h"
+#include "src/enumerate.h"
+#include "gcl/cache.h"
 #include "gcl/gcl.h"
 #include "src/hopper.h"
 #include "src/parameters.h"
+#include "src/query_budget.h"
+#include "src/query_context.h"
 #include "gcl/parse.h"
 #include "src/stats.h"
 #include "src/tagging_featurizer.h"
+#include "src/top_k.h"
 
 namespace cottontail {
 
@@ -42,6 +51,18 @@ fval ranking_parameter(std::string ranker_name, std::string parameter_name,
   return defaults[parameter_name];
 }
 
+const std::string RESUME_SCORE = "resume:score";
+const std::string RESUME_P = "resume:p";
+
+// Picks up where the page ending with the result named by the parameters
+// left off.
+void resume(const std::map<std::string, fval> &parameters, TopK *top) {
+  auto score = parameters.find(RESUME_SCORE);
+  auto p = parameters.find(RESUME_P);
+  if (score != parameters.end() && p != parameters.end())
+    top->resume(score->second, static_cast<addr>(p->second));
+}
+
 void maybe_add_container(std::shared_ptr<Stats> stats,
                          std::vector<RankingResult> *ranking) {
   if (ranking == nullptr)
@@ -57,6 +78,12 @@ void maybe_add_container(std::shared_ptr<Stats> stats,
 }
 } // namespace
 
+void resume_after(const RankingResult &last,
+                  std::map<std::string, fval> *parameters) {
+  (*parameters)[RESUME_SCORE] = last.score();
+  (*parameters)[RESUME_P] = static_cast<fval>(last.p());
+}
+
 // Reciprocal rank fusion based on:
 // Gordon V. Cormack, Charles L A Clarke, and Stefan Buettcher. 2009. Reciprocal
 // rank fusion outperforms condorcet and individual rank learning methods.
@@ -233,22 +260,108 @@ build_tiers(std::shared_ptr<Warren> warren, const std::string &query,
   return tiers;
 }
 
+namespace {
+// Shortest-substring ranking of the intervals from a hopper, skipping any
+// containers in skip.
+std::vector<RankingResult>
+ssr_hopper(std::shared_ptr<Warren> warren, std::unique_ptr<Hopper> hopper,
+           const std::string &container,
+           const std::map<std::string, fval> &parameters, size_t depth,
+           addr start, addr end, SharedThreshold *shared,
+           const std::set<addr> *skip = nullptr) {
+  fval K = ranking_parameter("ssr", "K", parameters);
+  std::vector<RankingResult> top;
+  if (depth == 0 || hopper == nullptr)
+    return top;
+  if (start == minfinity)
+    start += 1;
+  if (start >= end)
+    return top;
+  std::string error;
+  std::unique_ptr<cottontail::Hopper> chopper =
+      warren->cached_hopper_from_gcl(container, &error);
+  if (chopper == nullptr)
+    return top;
+  auto wanted = [&](addr cp) {
+    return skip == nullptr || skip->find(cp) == skip->end();
+  };
+  TopK current(depth, 0.0, shared);
+  resume(parameters, &current);
+  addr p, q, cp, cq;
+  chopper->tau(start, &cp, &cq);
+  if (cp >= end)
+    return top;
+  hopper->tau(cp, &p, &q);
+  fval score = 0.0;
+  addr best_p = maxfinity, best_q = maxfinity;
+  while (p < maxfinity && cq < maxfinity && cp < end) {
+    // The container in hand is only partly scored
+    if (QueryBudget::expired())
+      return current.results();
+    if (p < cp) {
+      hopper->tau(cp, &p, &q);
+    } else if (q > cq) {
+      if (score > current.threshold() && wanted(cp))
+        current.push(RankingResult(best_p, best_q, cp, cq, score));
+      score = 0.0;
+      best_p = best_q = maxfinity;
+      chopper->rho(q, &cp, &cq);
+    } else {
+      score += 1.0 / (K + q - p);
+      if (best_p == maxfinity || q - p < best_q - best_p) {
+        best_p = p;
+        best_q = q;
+      }
+      hopper->tau(p + 1, &p, &q);
+    }
+  }
+  // Hoppers stopped by the budget leave the last container partly scored
+  QueryBudget *budget = QueryBudget::current();
+  if (budget != nullptr && budget->truncated())
+    return current.results();
+  if (score > current.threshold() && cq < maxfinity && cp < end && wanted(cp))
+    current.push(RankingResult(best_p, best_q, cp, cq, score));
+  return current.results();
+}
+} // namespace
+
 // Ranking with tiered Boolean queries, based on:
 // C. L. A. Clarke, G. V. Cormack, F. J. Burkowski. 1995.
 // Shortest Substring Ranking (MultiText Experiments for TREC-4).
 // https://trec.nist.gov/pubs/trec4/papers/uwaterloo.ps.gz
+//
+// Each tier skips the containers placed by earlier tiers and keeps only as
+// many as are still needed, so its threshold rises sooner. Terms are shared
+// between tiers through a cache, since generated tiers overlap heavily. With
+// threads, the next few tiers are ranked speculatively in parallel and placed
+// in order. This gives the same results as ranking them one by one, since a
+// tier ranked with fewer containers placed just ranks a few more of them.
 std::vector<RankingResult>
 tiered_ranking(std::shared_ptr<Warren> warren,
                const std::vector<std::string> &tiers,
                const std::string &container,
-               const std::map<std::string, fval> &parameters, size_t depth) {
+               const std::map<std::string, fval> &parameters, size_t depth,
+               size_t threads) {
   std::vector<RankingResult> top;
-  if (tiers.size() == 0)
+  if (tiers.size() == 0 || depth == 0)
     return top;
+  // Terms with more postings than this are not worth holding in memory
+  const addr SHARED_POSTINGS = 1024 * 1024;
+  std::shared_ptr<gcl::Cache> cache = warren->gcl_cache();
+  if (cache == nullptr && warren->started())
+    cache = gcl::Cache::make();
   std::set<addr> container_seen;
-  for (auto &&tier : tiers) {
-    std::vector<RankingResult> ranking =
-        ssr_ranking(warren, tier, container, depth);
+  auto rank_tier = [&](std::shared_ptr<Warren> local_warren,
+                       const std::string &tier, size_t needed) {
+    std::string error;
+    std::unique_ptr<Hopper> hopper =
+        cache == nullptr ? local_warren->hopper_from_gcl(tier, &error)
+                         : gcl::shared_hopper(tier, local_warren.get(), cache,
+                                              SHARED_POSTINGS, &error);
+    return ssr_hopper(local_warren, std::move(hopper), container, {}, needed,
+                      minfinity + 1, maxfinity, nullptr, &container_seen);
+  };
+  auto place = [&](const std::vector<RankingResult> &ranking) {
     for (size_t i = 0; i < ranking.size() && top.size() < depth; i++)
       if (container_seen.find(ranking[i].container_p()) ==
           container_seen.end()) {
@@ -258,9 +371,43 @@ tiered_ranking(std::shared_ptr<Warren> warren,
                          ranking[i].container_p(), ranking[i].container_q(),
                          fake_score);
       }
-    if (top.size() == depth)
+  };
+  threads = allowed_threads(threads);
+  QueryBudget *budget = QueryBudget::current();
+  std::vector<std::shared_ptr<Warren>> clones;
+  for (size_t t = 0; t < tiers.size() && top.size() < depth;) {
+    if (QueryBudget::expired_now())
       break;
-  }
+    size_t batch = std::min(threads, tiers.size() - t);
+    while (batch > 1 && clones.size() < batch) {
+      std::shared_ptr<Warren> clone = warren->clone();
+      if (clone == nullptr) {
+        threads = batch = std::max<size_t>(1, clones.size());
+        break;
+      }
+      clones.push_back(clone);
+    }
+    size_t needed = depth - top.size();
+    if (batch <= 1) {
+      place(rank_tier(warren, tiers[t++], needed));
+      continue;
+    }
+    std::vector<std::vector<RankingResult>> rankings(batch);
+    std::vector<std::thread> workers;
+    workers.reserve(batch);
+    for (size_t i = 0; i < batch; i++)
+      workers.emplace_back(std::thread([&, i] {
+        QueryBudget::Scope scope(budget);
+        rankings[i] = rank_tier(clones[i], tiers[t + i], needed);
+      }));
+    for (auto &worker : workers)
+      worker.join();
+    for (auto &ranking : rankings)
+      place(ranking);
+    t += batch;
+  }
+  for (auto &clone : clones)
+    clone->end();
   return top;
 }
 
@@ -275,31 +422,11 @@ tiered_ranking(std::shared_ptr<Warren> warren,
 std::vector<RankingResult>
 tiered_ranking(std::shared_ptr<Warren> warren, const std::string &query,
                const std::string &container,
-               const std::map<std::string, fval> &parameters, size_t depth) {
+               const std::map<std::string, fval> &parameters, size_t depth,
+               size_t threads) {
   std::vector<std::string> tiers = build_tiers(warren, query, parameters);
-  return tiered_ranking(warren, tiers, container, parameters, depth);
-}
-
-namespace {
-// Assumes no duplicates. Works for ranking algorithms that compute a score for
-// each item in turn.
-std::vector<RankingResult>
-top_results(const std::vector<RankingResult> &results0,
-            const std::vector<RankingResult> &results1, size_t depth) {
-  std::vector<RankingResult> combined;
-  for (auto &&result : results0)
-    combined.push_back(result);
-  for (auto &&result : results1)
-    combined.push_back(result);
-  std::sort(combined.begin(), combined.end(),
-            [](const auto &a, const auto &b) -> bool {
-              return a.score() > b.score();
-            });
-  if (combined.size() > depth)
-    combined.erase(combined.begin() + depth, combined.end());
-  return combined;
+  return tiered_ranking(warren, tiers, container, parameters, depth, threads);
 }
-} // namespace
 
 // Charles L. A. Clarke and Gordon V. Cormack. 2000.
 // Shortest-substring retrieval and ranking.
@@ -309,61 +436,14 @@ std::vector<RankingResult>
 ssr_ranking(std::shared_ptr<Warren> warren, const std::string &gcl,
             const std::string &container,
             const std::map<std::string, fval> &parameters, size_t depth,
-            addr start, addr end) {
-  fval K = ranking_parameter("ssr", "K", parameters);
-  std::vector<RankingResult> top;
+            addr start, addr end, SharedThreshold *shared,
+            QueryBudget *budget) {
   if (depth == 0)
-    return top;
-  if (start == minfinity)
-    start += 1;
-  if (start >= end)
-    return top;
+    return {};
+  QueryBudget::Scope scope(budget);
   std::string error;
-  std::unique_ptr<cottontail::Hopper> hopper =
-      warren->hopper_from_gcl(gcl, &error);
-  if (hopper == nullptr)
-    return top;
-  std::unique_ptr<cottontail::Hopper> chopper =
-      warren->hopper_from_gcl(container, &error);
-  if (chopper == nullptr)
-    return top;
-  std::vector<RankingResult> current;
-  addr p, q, cp, cq;
-  chopper->tau(start, &cp, &cq);
-  if (cp >= end)
-    return top;
-  hopper->tau(cp, &p, &q);
-  fval score = 0.0;
-  fval target = 0.0;
-  addr best_p = maxfinity, best_q = maxfinity;
-  while (p < maxfinity && cq < maxfinity && cp < end) {
-    target = (top.size() == depth ? top[top.size() - 1].score() : 0.0);
-    if (p < cp) {
-      hopper->tau(cp, &p, &q);
-    } else if (q > cq) {
-      if (score > target) {
-        current.emplace_back(best_p, best_q, cp, cq, score);
-        if (current.size() == depth) {
-          top = top_results(top, current, depth);
-          current.clear();
-        }
-      }
-      score = 0.0;
-      best_p = best_q = maxfinity;
-      chopper->rho(q, &cp, &cq);
-    } else {
-      score += 1.0 / (K + q - p);
-      if (best_p == maxfinity || q - p < best_q - best_p) {
-        best_p = p;
-        best_q = q;
-      }
-      hopper->tau(p + 1, &p, &q);
-    }
-  }
-  if (score > target && cq < maxfinity && cp < end)
-    current.emplace_back(best_p, best_q, cp, cq, score);
-  top = top_results(top, current, depth);
-  return top;
+  return ssr_hopper(warren, warren->hopper_from_gcl(gcl, &error), container,
+                    parameters, depth, start, end, shared);
 }
 
 namespace {
@@ -757,9 +837,126 @@ std::vector<std::string> kld_prf(std::shared_ptr<Warren> warren,
   return expansion_terms;
 }
 
+namespace {
+// Postings per block in block-max annotations
+constexpr size_t BLOCK_MAX_POSTINGS = 64;
+
+// Accumulates block-max annotations for tf postings, which must be added in
+// order for each term. Each run of BLOCK_MAX_POSTINGS postings of a term forms
+// a block, annotated over the span of its items with the largest tf in the
+// block ("tfmax") and the length of its shortest item ("lmin"). Rankers use
+// these to bound the scores of all the items in a block without visiting them.
+// Blocks that no other block beats on both tf and length are also annotated
+// as peaks ("tfpeak" and "lpeak"), so that bounds on a term's score over all
+// of its items need only its peaks.
+class BlockMaxima {
+public:
+  typedef std::function<bool(addr feature, addr p, addr q, fval v)> Sink;
+  static std::unique_ptr<BlockMaxima> make(std::shared_ptr<Warren> warren,
+                                           Sink sink, std::string *error) {
+    std::shared_ptr<Featurizer> tfmax_featurizer =
+        TaggingFeaturizer::make(warren->featurizer(), "tfmax", error);
+    if (tfmax_featurizer == nullptr)
+      return nullptr;
+    std::shared_ptr<Featurizer> lmin_featurizer =
+        TaggingFeaturizer::make(warren->featurizer(), "lmin", error);
+    if (lmin_featurizer == nullptr)
+      return nullptr;
+    std::shared_ptr<Featurizer> tfpeak_featurizer =
+        TaggingFeaturizer::make(warren->featurizer(), "tfpeak", error);
+    if (tfpeak_featurizer == nullptr)
+      return nullptr;
+    std::shared_ptr<Featurizer> lpeak_featurizer =
+        TaggingFeaturizer::make(warren->featurizer(), "lpeak", error);
+    if (lpeak_featurizer == nullptr)
+      return nullptr;
+    return std::unique_ptr<BlockMaxima>(
+        new BlockMaxima(tfmax_featurizer, lmin_featurizer, tfpeak_featurizer,
+                        lpeak_featurizer, sink));
+  }
+  bool add(const std::string &term, addr p, addr q, addr tf) {
+    auto it = blocks_.find(term);
+    if (it == blocks_.end()) {
+      blocks_[term] = Block{p, q, tf, q - p + 1, 1};
+      return true;
+    }
+    Block &block = it->second;
+    block.q = q;
+    block.tf = std::max(block.tf, tf);
+    block.length = std::min(block.length, q - p + 1);
+    if (++block.n < BLOCK_MAX_POSTINGS)
+      return true;
+    bool okay = flush(term, block);
+    blocks_.erase(it);
+    return okay;
+  }
+  bool flush() {
+    for (auto &block : blocks_)
+      if (!flush(block.first, block.second))
+        return false;
+    blocks_.clear();
+    for (auto &term : peaks_)
+      for (auto &block : term.second)
+        if (!(sink_(tfpeak_featurizer_->featurize(term.first), block.p,
+                    block.q, block.tf) &&
+              sink_(lpeak_featurizer_->featurize(term.first), block.p, block.q,
+                    block.length)))
+          return false;
+    peaks_.clear();
+    return true;
+  }
+  BlockMaxima(const BlockMaxima &) = delete;
+  BlockMaxima &operator=(const BlockMaxima &) = delete;
+  BlockMaxima(BlockMaxima &&) = delete;
+  BlockMaxima &operator=(BlockMaxima &&) = delete;
+
+private:
+  struct Block {
+    addr p, q, tf, length;
+    size_t n;
+  };
+  BlockMaxima(std::shared_ptr<Featurizer> tfmax_featurizer,
+              std::shared_ptr<Featurizer> lmin_featurizer,
+              std::shared_ptr<Featurizer> tfpeak_featurizer,
+              std::shared_ptr<Featurizer> lpeak_featurizer, Sink sink)
+      : tfmax_featurizer_(tfmax_featurizer),
+        lmin_featurizer_(lmin_featurizer),
+        tfpeak_featurizer_(tfpeak_featurizer),
+        lpeak_featurizer_(lpeak_featurizer), sink_(sink){};
+  bool flush(const std::string &term, const Block &block) {
+    // Peaks are kept in order of position, dropping any the block beats.
+    std::vector<Block> &peaks = peaks_[term];
+    bool peak = true;
+    size_t kept = 0;
+    for (auto &other : peaks) {
+      if (other.tf >= block.tf && other.length <= block.length) {
+        peak = false;
+        peaks[kept++] = other;
+      } else if (!(block.tf >= other.tf && block.length <= other.length)) {
+        peaks[kept++] = other;
+      }
+    }
+    peaks.resize(kept);
+    if (peak)
+      peaks.push_back(block);
+    return sink_(tfmax_featurizer_->featurize(term), block.p, block.q,
+                 block.tf) &&
+           sink_(lmin_featurizer_->featurize(term), block.p, block.q,
+                 block.length);
+  }
+  std::shared_ptr<Featurizer> tfmax_featurizer_;
+  std::shared_ptr<Featurizer> lmin_featurizer_;
+  std::shared_ptr<Featurizer> tfpeak_featurizer_;
+  std::shared_ptr<Featurizer> lpeak_featurizer_;
+  Sink sink_;
+  std::map<std::string, Block> blocks_;
+  std::map<std::string, std::vector<Block>> peaks_;
+};
+} // namespace
+
 // Generate term frequency annotations over a range.
 bool tf_annotations(std::shared_ptr<Warren> warren, std::string *error,
-                    addr start, addr end) {
+                    addr start, addr end, size_t threads) {
   std::string content_key = "container";
   std::string content_query = "";
   if (!warren->get_parameter(content_key, &content_query, error))
@@ -768,10 +965,6 @@ bool tf_annotations(std::shared_ptr<Warren> warren, std::string *error,
     safe_error(error) =
         "tf_annotations can't find a definition for item content";
   }
-  std::unique_ptr<cottontail::Hopper> hopper =
-      warren->hopper_from_gcl(content_query, error);
-  if (hopper == nullptr)
-    return false;
   std::shared_ptr<Featurizer> tf_featurizer =
       TaggingFeaturizer::make(warren->featurizer(), "tf", error);
   if (tf_featurizer == nullptr)
@@ -782,46 +975,138 @@ bool tf_annotations(std::shared_ptr<Warren> warren, std::string *error,
     return false;
   if (!warren->transaction(error))
     return false;
-  std::map<addr, addr> df;
-  addr HUGE = 1014 * 1024;
-  std::vector<addr> ps, qs;
-  addr p = start, q, total_items = 0, total_length = 0;
-  if (p == minfinity)
-    p += 1;
-  for (hopper->tau(p, &p, &q); q <= end && q < maxfinity;
-       hopper->tau(p + 1, &p, &q)) {
-    if (q <= end && q < maxfinity) {
-      total_items++;
-      total_length += q - p + 1;
-      ps.push_back(p);
-      qs.push_back(q);
+  // Items are tokenized in parallel; only the annotations are serialized.
+  std::mutex lock;
+  std::string terror;
+  addr total_items = 0, total_length = 0;
+  BlockMaxima::Sink sink = [&](addr feature, addr p, addr q, fval v) {
+    return warren->annotator()->annotate(feature, p, q, v, &terror);
+  };
+  // Blocks never cross chunks, so that blocks from different chunks never
+  // overlap. A thread's blocks are flushed when it moves to its next chunk.
+  std::map<size_t, std::unique_ptr<BlockMaxima>> maxima;
+  std::map<std::thread::id, size_t> chunks;
+  auto flush = [&](size_t chunk) {
+    auto it = maxima.find(chunk);
+    if (it == maxima.end())
+      return true;
+    bool okay = it->second->flush();
+    maxima.erase(it);
+    return okay;
+  };
+  // Term frequencies of the item [p,q], whose tokens start at offset.
+  auto count = [&](std::shared_ptr<Warren> local_warren,
+                   const std::vector<std::string> &tokens, size_t offset,
+                   addr p, addr q) {
+    std::map<std::string, addr> tf;
+    for (size_t j = offset;
+         j < tokens.size() && j - offset < static_cast<size_t>(q - p + 1);
+         j++) {
+      std::string stem = local_warren->stemmer()->stem(tokens[j]);
+      auto it = tf.find(stem);
+      if (it == tf.end())
+        tf[stem] = 1;
+      else
+        it->second++;
     }
-    if (ps.size() > 0 &&
-        (q == maxfinity || q >= end || qs.back() - ps.front() > HUGE)) {
-      std::string text = warren->txt()->translate(ps.front(), qs.back());
-      std::vector<std::string> tokens = warren->tokenizer()->split(text);
-      for (size_t i = 0; i < ps.size(); i++) {
-        std::map<addr, addr> tf;
-        for (addr j = ps[i]; j <= qs[i]; j++) {
-          addr feature = tf_featurizer->featurize(
-              warren->stemmer()->stem(tokens[j - ps[0]]));
-          auto it = tf.find(feature);
-          if (it == tf.end())
-            tf[feature] = 1;
-          else
-            it->second++;
+    return tf;
+  };
+  auto featurize = [&](const std::map<std::string, addr> &tf) {
+    std::vector<addr> features;
+    for (auto &term : tf)
+      features.push_back(tf_featurizer->featurize(term.first));
+    return features;
+  };
+  // Annotates an item, with the lock held when threads share the warren.
+  auto record = [&](size_t chunk, addr p, addr q,
+                    const std::map<std::string, addr> &tf,
+                    const std::vector<addr> &features) {
+    auto current = chunks.find(std::this_thread::get_id());
+    if (current == chunks.end()) {
+      chunks[std::this_thread::get_id()] = chunk;
+    } else if (current->second != chunk) {
+      if (!flush(current->second))
+        return false;
+      current->second = chunk;
+    }
+    std::unique_ptr<BlockMaxima> &block_maxima = maxima[chunk];
+    if (block_maxima == nullptr &&
+        (block_maxima = BlockMaxima::make(warren, sink, &terror)) == nullptr)
+      return false;
+    total_items++;
+    total_length += q - p + 1;
+    size_t i = 0;
+    for (auto &term : tf) {
+      if (!warren->annotator()->annotate(features[i++], p, p, term.second,
+                                         &terror))
+        return false;
+      if (!block_maxima->add(term.first, p, q, term.second))
+        return false;
+    }
+    return true;
+  };
+  bool okay;
+  if (allowed_threads(threads) > 1) {
+    okay = parallel_enumerate(
+        warren, content_query, start, end, threads,
+        [&](std::shared_ptr<Warren> local_warren, size_t chunk, addr p,
+            addr q, fval v) {
+          std::string text = local_warren->txt()->translate(p, q);
+          std::vector<std::string> tokens =
+              local_warren->tokenizer()->split(text);
+          std::map<std::string, addr> tf = count(local_warren, tokens, 0, p, q);
+          std::vector<addr> features = featurize(tf);
+          std::lock_guard<std::mutex> _(lock);
+          return record(chunk, p, q, tf, features);
+        },
+        error);
+  } else {
+    // A single thread translates and tokenizes runs of items at once.
+    std::unique_ptr<cottontail::Hopper> hopper =
+        warren->hopper_from_gcl(content_query, error);
+    if (hopper == nullptr) {
+      warren->abort();
+      return false;
+    }
+    okay = true;
+    const addr HUGE = 1024 * 1024;
+    std::vector<addr> ps, qs;
+    addr p = (start == minfinity ? start + 1 : start), q, last = minfinity;
+    for (hopper->tau(p, &p, &q); okay; hopper->tau(p + 1, &p, &q)) {
+      bool done = (q > end || q == maxfinity);
+      if (!done) {
+        ps.push_back(p);
+        qs.push_back(q);
+        last = std::max(last, q);
+      }
+      if (ps.size() > 0 && (done || last - ps.front() > HUGE)) {
+        std::string text = warren->txt()->translate(ps.front(), last);
+        std::vector<std::string> tokens = warren->tokenizer()->split(text);
+        for (size_t i = 0; okay && i < ps.size(); i++) {
+          std::map<std::string, addr> tf =
+              count(warren, tokens, ps[i] - ps[0], ps[i], qs[i]);
+          okay = record(0, ps[i], qs[i], tf, featurize(tf));
         }
-        for (auto &feature : tf)
-          if (!warren->annotator()->annotate(feature.first, ps[i], ps[i],
-                                             feature.second, error)) {
-            warren->abort();
-            return false;
-          }
+        ps.clear();
+        qs.clear();
+        last = minfinity;
       }
-      ps.clear();
-      qs.clear();
+      if (done)
+        break;
     }
   }
+  if (!okay) {
+    if (terror != "")
+      safe_error(error) = terror;
+    warren->abort();
+    return false;
+  }
+  for (auto &block_maxima : maxima)
+    if (!block_maxima.second->flush()) {
+      safe_error(error) = terror;
+      warren->abort();
+      return false;
+    }
   if (total_items == 0) {
     safe_error(error) = "tf_annotations can't find any items for ranking";
     warren->abort();
@@ -850,6 +1135,27 @@ bool tf_annotations(std::shared_ptr<Warren> warren, std::string *error,
   return true;
 }
 
+namespace {
+// Columns cover the text as it stands when they are made.
+addr text_extent(std::shared_ptr<Warren> warren) {
+  addr p, q;
+  if (!warren->txt()->range(&p, &q))
+    return minfinity;
+  return q;
+}
+
+// Keeps columns with the committed annotations that they accompany.
+bool store_columns(std::shared_ptr<Warren> warren,
+                   std::shared_ptr<Columns> columns, std::string *error) {
+  if (warren->working() != nullptr &&
+      !(columns->store(warren->working(), error) &&
+        warren->set_parameter("columns", "yes", error)))
+    return false;
+  warren->set_columns(columns);
+  return true;
+}
+} // namespace
+
 // Generate term frequency and document frequency annotations.
 // Should be an improvement over tf_idf_annotations
 bool tf_df_annotations(std::shared_ptr<Warren> warren, std::string *error) {
@@ -880,6 +1186,18 @@ bool tf_df_annotations(std::shared_ptr<Warren> warren, std::string *error) {
     return false;
   if (!warren->transaction(error))
     return false;
+  std::unique_ptr<BlockMaxima> block_maxima = BlockMaxima::make(
+      warren,
+      [&](addr feature, addr p, addr q, fval v) {
+        return warren->annotator()->annotate(feature, p, q, v, error);
+      },
+      error);
+  if (block_maxima == nullptr) {
+    warren->abort();
+    return false;
+  }
+  std::shared_ptr<Columns> columns =
+      Columns::make(content_query, {COLUMN_LENGTH}, text_extent(warren));
   std::map<addr, addr> df;
   addr HUGE = 1014 * 1024;
   std::vector<addr> ps, qs;
@@ -891,6 +1209,10 @@ bool tf_df_annotations(std::shared_ptr<Warren> warren, std::string *error) {
       total_length += q - p + 1;
       ps.push_back(p);
       qs.push_back(q);
+      if (!columns->append(p, q, {q - p + 1.0}, error)) {
+        warren->abort();
+        return false;
+      }
     }
     if (ps.size() > 0 && (p == maxfinity || qs.back() - ps.front() > HUGE)) {
       std::string text = warren->txt()->translate(ps.front(), qs.back());
@@ -908,7 +1230,8 @@ bool tf_df_annotations(std::shared_ptr<Warren> warren, std::string *error) {
         for (auto &token : tf) {
           addr tf_feature = tf_featurizer->featurize(token.first);
           if (!warren->annotator()->annotate(tf_feature, ps[i], ps[i],
-                                             token.second, error)) {
+                                             token.second, error) ||
+              !block_maxima->add(token.first, ps[i], qs[i], token.second)) {
             warren->abort();
             return false;
           }
@@ -929,6 +1252,10 @@ bool tf_df_annotations(std::shared_ptr<Warren> warren, std::string *error) {
     safe_error(error) = "tf_df_annotations can't find any items for ranking";
     return false;
   }
+  if (!block_maxima->flush()) {
+    warren->abort();
+    return false;
+  }
   for (auto &feature : df)
     if (!warren->annotator()->annotate(feature.first, 0, 0, feature.second,
                                        error)) {
@@ -951,6 +1278,8 @@ bool tf_df_annotations(std::shared_ptr<Warren> warren, std::string *error) {
     return false;
   }
   warren->commit();
+  if (!store_columns(warren, columns, error))
+    return false;
   std::string stats_key = "statistics";
   std::string stats_name = "df";
   if (!warren->set_parameter(stats_key, stats_name, error))
@@ -989,6 +1318,22 @@ bool tf_idf_annotations(std::shared_ptr<Warren> warren, std::string *error,
     warren->abort();
     return false;
   }
+  std::unique_ptr<BlockMaxima> block_maxima = BlockMaxima::make(
+      warren,
+      [&](addr feature, addr p, addr q, fval v) {
+        Annotation a;
+        a.feature = feature;
+        a.p = p;
+        a.q = q;
+        a.v = v;
+        anf.write(reinterpret_cast<char *>(&a), sizeof(a));
+        return true;
+      },
+      error);
+  if (block_maxima == nullptr) {
+    warren->abort();
+    return false;
+  }
   for (hopper->tau(0, &p, &q); p < maxfinity; hopper->tau(p + 1, &p, &q)) {
     N++;
     total_length += q - p + 1;
@@ -1031,8 +1376,10 @@ bool tf_idf_annotations(std::shared_ptr<Warren> warren, std::string *error,
       a.q = q;
       a.v = 1.0 * token.second;
       anf.write(reinterpret_cast<char *>(&a), sizeof(a));
+      block_maxima->add(token.first, p, q, token.second);
     }
   }
+  block_maxima->flush();
   std::shared_ptr<Featurizer> idf_featurizer =
       TaggingFeaturizer::make(warren->featurizer(), "idf", error);
   if (idf_featurizer == nullptr) {
@@ -1198,6 +1545,86 @@ std::vector<std::string> rsj_prf(std::shared_ptr<Warren> warren,
   return expansion_terms;
 }
 
+namespace {
+// MaxScore, after
+// Howard Turtle and James Flood.
+// Query evaluation: Strategies and optimizations.
+// Information Processing & Management 31(6):831-850, 1995.
+// Cursors are ordered by the upper bounds on their scores. Those whose bounds
+// together cannot beat the threshold are non-essential: they never generate
+// candidates, and are only probed for candidates from the others, most
+// promising first, until the remaining bounds cannot lift the candidate over
+// the threshold. Score takes the index of a cursor in the original order and
+// the interval and value of its current posting. Only postings starting in
+// [start, end) are ranked.
+struct MaxScoreCursor {
+  MaxScoreCursor(size_t term, fval bound, std::unique_ptr<Hopper> hopper)
+      : term(term), bound(bound), hopper(std::move(hopper)){};
+  size_t term;
+  fval bound;
+  std::unique_ptr<Hopper> hopper;
+  addr p, q;
+  fval v;
+};
+
+template <typename Score>
+std::vector<RankingResult>
+max_score(std::vector<MaxScoreCursor> *cursors, size_t depth, Score score,
+          addr start, addr end, SharedThreshold *shared,
+          const std::map<std::string, fval> &parameters) {
+  TopK top(depth, 0.0, shared);
+  resume(parameters, &top);
+  std::sort(cursors->begin(), cursors->end(),
+            [](const MaxScoreCursor &a, const MaxScoreCursor &b) -> bool {
+              return a.bound < b.bound;
+            });
+  size_t n = cursors->size();
+  // prefix[i] bounds the total score from the first i cursors
+  std::vector<fval> prefix(n + 1, 0.0);
+  for (size_t i = 0; i < n; i++) {
+    MaxScoreCursor &c = (*cursors)[i];
+    prefix[i + 1] = prefix[i] + c.bound;
+    c.hopper->tau(start, &c.p, &c.q, &c.v);
+  }
+  size_t essential = 0;
+  while (!QueryBudget::expired()) {
+    fval target = top.threshold();
+    while (essential < n && prefix[essential + 1] <= target)
+      essential++;
+    if (essential == n)
+      break;
+    addr p = maxfinity, q = maxfinity;
+    for (size_t i = essential; i < n; i++)
+      if ((*cursors)[i].p < p) {
+        p = (*cursors)[i].p;
+        q = (*cursors)[i].q;
+      }
+    if (p >= end)
+      break;
+    fval candidate = 0.0;
+    for (size_t i = essential; i < n; i++) {
+      MaxScoreCursor &c = (*cursors)[i];
+      if (c.p == p) {
+        candidate += score(c.term, c.p, c.q, c.v);
+        c.hopper->tau(p + 1, &c.p, &c.q, &c.v);
+      }
+    }
+    for (size_t i = essential; i > 0; i--) {
+      if (candidate + prefix[i] <= target)
+        break;
+      MaxScoreCursor &c = (*cursors)[i - 1];
+      if (c.p < p)
+        c.hopper->tau(p, &c.p, &c.q, &c.v);
+      if (c.p == p)
+        candidate += score(c.term, c.p, c.q, c.v);
+    }
+    if (candidate > target)
+      top.push(RankingResult(p, q, candidate));
+  }
+  return top.results();
+}
+} // namespace
+
 // Language modeling with Dirichlet smoothing
 std::vector<RankingResult>
 lmd_ranking(std::shared_ptr<Warren> warren, const std::string &query,
@@ -1218,74 +1645,153 @@ std::vector<RankingResult> lmd_ranking(std::shared_ptr<Warren> warren,
   return lmd_ranking(warren, query, {});
 }
 
+namespace {
+// Bound on the score of a term, given by score(tf, length), from the block
+// maxima in its tf annotations, where they cover all of its postings;
+// infinite otherwise. Scores grow with tf and shrink with length, so only
+// the term's peaks are needed, where the annotations include them.
+template <typename Score>
+fval block_bound(Hopper *hopper, Hopper *tfmax, Hopper *lmin, Hopper *tfpeak,
+                 Hopper *lpeak, Score score) {
+  addr p, q, block_p, block_q;
+  fval block_tf, block_l;
+  hopper->tau(minfinity + 1, &p, &q);
+  tfmax->tau(minfinity + 1, &block_p, &block_q);
+  if (p == maxfinity || block_p > p)
+    return std::numeric_limits<fval>::infinity();
+  tfpeak->tau(minfinity + 1, &block_p, &block_q);
+  if (block_p == maxfinity) {
+    tfpeak = tfmax;
+    lpeak = lmin;
+  }
+  fval bound = 0.0;
+  for (tfpeak->tau(minfinity + 1, &block_p, &block_q, &block_tf);
+       block_p < maxfinity;
+       tfpeak->tau(block_p + 1, &block_p, &block_q, &block_tf)) {
+    lpeak->tau(block_p, &p, &q, &block_l);
+    bound = std::max(bound, score(block_tf, block_l));
+  }
+  return bound;
+}
+
+fval lmd_term_bound(Hopper *hopper, Hopper *tfmax, Hopper *lmin,
+                    Hopper *tfpeak, Hopper *lpeak, fval qt, fval weight,
+                    fval mu) {
+  return block_bound(hopper, tfmax, lmin, tfpeak, lpeak,
+                     [&](fval tf, fval l) {
+                       return qt * (std::log(mu + tf * weight) -
+                                    std::log(mu + l));
+                     });
+}
+
+// Collection statistics come from stats, if given, in place of the warren.
 std::vector<RankingResult>
-lmd_ranking(std::shared_ptr<Warren> warren,
-            const std::map<std::string, fval> &query,
-            const std::map<std::string, fval> &parameters) {
+lmd_range(std::shared_ptr<Warren> warren,
+          const std::map<std::string, fval> &query,
+          const std::map<std::string, fval> &parameters, addr start, addr end,
+          SharedThreshold *shared, Stats *stats = nullptr) {
   fval mu = ranking_parameter("lmd", "mu", parameters);
   size_t depth =
       static_cast<size_t>(ranking_parameter("lmd", "depth", parameters));
   std::vector<RankingResult> top;
   if (depth == 0 || query.size() == 0)
     return top;
-  struct TermHopper {
-    TermHopper(fval qt, fval weight, std::unique_ptr<Hopper> hopper)
-        : qt(qt), weight(weight), hopper(std::move(hopper)){};
-    fval tf, qt, weight;
-    addr p, q;
-    std::unique_ptr<Hopper> hopper;
-  };
+  // Bounds on term scores come from the block maxima in the tf annotations,
+  // where they cover all of a term's postings. Other terms are always
+  // essential.
   TaggingFeaturizer tf_featurizer(warren->featurizer(), "tf");
-  std::vector<TermHopper> toppers;
-  fval tokens = warren->txt()->tokens();
+  TaggingFeaturizer tfmax_featurizer(warren->featurizer(), "tfmax");
+  TaggingFeaturizer lmin_featurizer(warren->featurizer(), "lmin");
+  TaggingFeaturizer tfpeak_featurizer(warren->featurizer(), "tfpeak");
+  TaggingFeaturizer lpeak_featurizer(warren->featurizer(), "lpeak");
+  std::vector<fval> qts, weights;
+  std::vector<MaxScoreCursor> cursors;
+  fval tokens =
+      (stats != nullptr ? stats->tokens() : warren->txt()->tokens());
   for (auto &&term : query) {
-    addr count =
-        warren->idx()->count(warren->featurizer()->featurize(term.first));
-    fval weight = tokens / (1.0 * count);
-    toppers.emplace_back(
-        term.second, weight,
-        warren->idx()->hopper(tf_featurizer.featurize(term.first)));
-  }
-  addr p = maxfinity, q;
-  for (auto &topper : toppers) {
-    topper.hopper->tau(minfinity + 1, &topper.p, &topper.q, &topper.tf);
-    if (topper.p < p) {
-      p = topper.p;
-      q = topper.q;
-    }
-  }
-  std::vector<RankingResult> current;
-  while (p < maxfinity) {
-    fval target = (top.size() >= depth ? top.back().score() : 0.0);
-    fval length_penalty = std::log(mu + (q - p + 1.0));
-    fval score = 0.0;
-    addr next_p = maxfinity, next_q = maxfinity;
-    for (auto &topper : toppers) {
-      if (topper.p == p) {
-        fval term_score =
-            topper.qt *
-            (std::log(mu + topper.tf * topper.weight) - length_penalty);
-        score += term_score;
-        topper.hopper->tau(p + 1, &topper.p, &topper.q, &topper.tf);
-      }
-      if (topper.p < next_p) {
-        next_p = topper.p;
-        next_q = topper.q;
-      }
-    }
-    if (score > target) {
-      current.emplace_back(p, q, score);
-      if (current.size() == depth) {
-        top = top_results(top, current, depth);
-        current.clear();
-      }
-    }
-    p = next_p;
-    q = next_q;
-  }
-  top = top_results(top, current, depth);
+    fval count =
+        (stats != nullptr
+             ? stats->occurrences(term.first)
+             : warren->idx()->count(
+                   warren->featurizer()->featurize(term.first)));
+    fval qt = term.second;
+    fval weight = tokens / count;
+    std::unique_ptr<Hopper> hopper =
+        warren->idx()->hopper(tf_featurizer.featurize(term.first));
+    std::unique_ptr<Hopper> tfmax =
+        warren->idx()->hopper(tfmax_featurizer.featurize(term.first));
+    std::unique_ptr<Hopper> lmin =
+        warren->idx()->hopper(lmin_featurizer.featurize(term.first));
+    std::unique_ptr<Hopper> tfpeak =
+        warren->idx()->hopper(tfpeak_featurizer.featurize(term.first));
+    std::unique_ptr<Hopper> lpeak =
+        warren->idx()->hopper(lpeak_featurizer.featurize(term.first));
+    fval bound = lmd_term_bound(hopper.get(), tfmax.get(), lmin.get(),
+                                tfpeak.get(), lpeak.get(), qt, weight, mu);
+    cursors.emplace_back(qts.size(), bound, std::move(hopper));
+    qts.push_back(qt);
+    weights.push_back(weight);
+  }
+  top = max_score(
+      &cursors, depth,
+      [&](size_t term, addr p, addr q, fval tf) {
+        return qts[term] * (std::log(mu + tf * weights[term]) -
+                            std::log(mu + (q - p + 1.0)));
+      },
+      start, end, shared, parameters);
   return top;
 }
+} // namespace
+
+std::vector<RankingResult>
+lmd_ranking(std::shared_ptr<Warren> warren,
+            const std::map<std::string, fval> &query,
+            const std::map<std::string, fval> &parameters) {
+  return lmd_range(warren, query, parameters, minfinity + 1, maxfinity,
+                   nullptr);
+}
+
+std::vector<RankingResult>
+lmd_ranking(std::shared_ptr<Stats> stats,
+            const std::map<std::string, fval> &query,
+            const std::map<std::string, fval> &parameters) {
+  return lmd_range(stats->warren(), query, parameters, minfinity + 1,
+                   maxfinity, nullptr, stats.get());
+}
+
+fval lmd_bound(std::shared_ptr<Stats> stats,
+               const std::map<std::string, fval> &query,
+               const std::map<std::string, fval> &parameters) {
+  fval mu = ranking_parameter("lmd", "mu", parameters);
+  std::shared_ptr<Warren> warren = stats->warren();
+  TaggingFeaturizer tf_featurizer(warren->featurizer(), "tf");
+  TaggingFeaturizer tfmax_featurizer(warren->featurizer(), "tfmax");
+  TaggingFeaturizer lmin_featurizer(warren->featurizer(), "lmin");
+  TaggingFeaturizer tfpeak_featurizer(warren->featurizer(), "tfpeak");
+  TaggingFeaturizer lpeak_featurizer(warren->featurizer(), "lpeak");
+  fval tokens = stats->tokens();
+  fval bound = 0.0;
+  for (auto &&term : query) {
+    std::unique_ptr<Hopper> hopper =
+        warren->idx()->hopper(tf_featurizer.featurize(term.first));
+    addr p, q;
+    hopper->tau(minfinity + 1, &p, &q);
+    if (p == maxfinity)
+      continue;
+    std::unique_ptr<Hopper> tfmax =
+        warren->idx()->hopper(tfmax_featurizer.featurize(term.first));
+    std::unique_ptr<Hopper> lmin =
+        warren->idx()->hopper(lmin_featurizer.featurize(term.first));
+    std::unique_ptr<Hopper> tfpeak =
+        warren->idx()->hopper(tfpeak_featurizer.featurize(term.first));
+    std::unique_ptr<Hopper> lpeak =
+        warren->idx()->hopper(lpeak_featurizer.featurize(term.first));
+    bound += lmd_term_bound(hopper.get(), tfmax.get(), lmin.get(),
+                            tfpeak.get(), lpeak.get(), term.second,
+                            tokens / stats->occurrences(term.first), mu);
+  }
+  return bound;
+}
 
 // Standard BM25.
 
@@ -1320,10 +1826,13 @@ bm25_ranking(std::shared_ptr<Stats> stats, const std::string &query,
   return ranking<bm25_ranking>(stats, query, parameters);
 }
 
+namespace {
+// Ranks items starting in [start, end), without containers.
 std::vector<RankingResult>
-bm25_ranking(std::shared_ptr<Stats> stats,
-             const std::map<std::string, fval> &query,
-             const std::map<std::string, fval> &parameters) {
+bm25_range(std::shared_ptr<Stats> stats,
+           const std::map<std::string, fval> &query,
+           const std::map<std::string, fval> &parameters, addr start, addr end,
+           SharedThreshold *shared) {
   std::vector<RankingResult> top;
   if (!(stats->have("avgl") && stats->have("rsj") && stats->have("tf")))
     return top;
@@ -1335,63 +1844,165 @@ bm25_ranking(std::shared_ptr<Stats> stats,
     return top;
   if (query.size() == 0)
     return top;
+  // Block-Max WAND, after
+  // Shuai Ding and Torsten Suel.
+  // Faster top-k document retrieval using block-max indexes.
+  // SIGIR 2011.
+  // Terms with block maxima in their tf annotations are bounded block by
+  // block; others fall back to their global bound, which is their idf.
   struct WandHopper {
-    WandHopper(fval idf, std::unique_ptr<Hopper> hopper)
-        : idf(idf), hopper(std::move(hopper)){};
+    WandHopper(fval idf, std::unique_ptr<Hopper> hopper,
+               std::unique_ptr<Hopper> tfmax, std::unique_ptr<Hopper> lmin)
+        : idf(idf), hopper(std::move(hopper)), tfmax(std::move(tfmax)),
+          lmin(std::move(lmin)){};
     fval tf, idf;
     addr p, q;
     std::unique_ptr<Hopper> hopper;
+    std::unique_ptr<Hopper> tfmax, lmin;
+    bool blocked = false;
+    addr block_p = minfinity, block_q = minfinity;
+    fval block_bound = 0.0;
   };
   fval avgl = stats->avgl();
   std::vector<WandHopper> wand;
   for (auto &wt : query) {
     fval idf = stats->rsj(wt.first);
     if (idf != 0.0)
-      wand.emplace_back(wt.second * idf, stats->tf_hopper(wt.first));
+      wand.emplace_back(wt.second * idf, stats->tf_hopper(wt.first),
+                        stats->tfmax_hopper(wt.first),
+                        stats->lmin_hopper(wt.first));
+  }
+  std::vector<WandHopper *> order;
+  for (auto &w : wand) {
+    w.hopper->tau(start, &w.p, &w.q, &w.tf);
+    // Block maxima are only trusted if they cover the postings from the start
+    addr p, q;
+    w.tfmax->tau(minfinity + 1, &p, &q);
+    w.blocked = (p <= w.p);
+    order.push_back(&w);
   }
-  for (auto &w : wand)
-    w.hopper->tau(minfinity + 1, &w.p, &w.q, &w.tf);
-  fval target = 0.0;
-  std::vector<RankingResult> current;
-  for (;;) {
-    target = (top.size() == depth ? top[top.size() - 1].score() : 0.0);
-    std::sort(wand.begin(), wand.end(),
-              [](const auto &a, const auto &b) -> bool { return a.p < b.p; });
-    while (wand.size() > 0 && wand.back().p == maxfinity)
-      wand.pop_back();
+  std::sort(order.begin(), order.end(),
+            [](const WandHopper *a, const WandHopper *b) -> bool {
+              return a->p < b->p;
+            });
+  // Only the first few cursors move on each step, so order is restored by
+  // inserting them back into the sorted remainder.
+  auto reorder = [&](size_t moved) {
+    for (size_t j = moved; j > 0; j--)
+      for (size_t k = j - 1;
+           k + 1 < order.size() && order[k]->p > order[k + 1]->p; k++)
+        std::swap(order[k], order[k + 1]);
+  };
+  // Bound on the score of a term at the pivot, lowering limit to the first
+  // address past the pivot where that bound might change.
+  auto block_bound = [&](WandHopper *w, addr pivot, addr *limit) -> fval {
+    if (!w->blocked)
+      return w->idf;
+    if (w->block_q < pivot) {
+      addr p, q;
+      fval tfmax, lmin;
+      w->tfmax->rho(pivot, &w->block_p, &w->block_q, &tfmax);
+      w->lmin->rho(pivot, &p, &q, &lmin);
+      w->block_bound = bm25(tfmax, w->idf, lmin, avgl, b, k1);
+    }
+    if (w->block_p > pivot) {
+      *limit = std::min(*limit, w->block_p);
+      return 0.0;
+    }
+    *limit = std::min(*limit, w->block_q + 1);
+    return w->block_bound;
+  };
+  TopK current(depth, 0.0, shared);
+  resume(parameters, &current);
+  while (!QueryBudget::expired()) {
+    fval target = current.threshold();
+    while (order.size() > 0 && order.back()->p >= end)
+      order.pop_back();
     fval x = 0.0;
     size_t i;
-    for (i = 0; i < wand.size(); i++) {
-      x += wand[i].idf;
+    for (i = 0; i < order.size(); i++) {
+      x += order[i]->idf;
       if (x > target)
         break;
     }
-    if (i == wand.size())
+    if (i == order.size())
       break;
-    addr pivot = wand[i].p;
-    addr qivot = wand[i].q;
+    addr pivot = order[i]->p;
+    addr qivot = order[i]->q;
+    while (i + 1 < order.size() && order[i + 1]->p == pivot)
+      i++;
+    addr limit = (i + 1 < order.size() ? order[i + 1]->p : maxfinity);
+    fval bound = 0.0;
+    for (size_t j = 0; j <= i; j++)
+      bound += block_bound(order[j], pivot, &limit);
+    if (bound <= target) {
+      // Nothing from the pivot up to the limit can make the top results
+      for (size_t j = 0; j <= i; j++)
+        order[j]->hopper->tau(limit, &order[j]->p, &order[j]->q,
+                              &order[j]->tf);
+      reorder(i + 1);
+      continue;
+    }
     fval length = qivot - pivot + 1.0;
-    for (size_t j = 0; j < i; j++)
-      wand[j].hopper->tau(pivot, &wand[j].p, &wand[j].q, &wand[j].tf);
     fval score = 0.0;
-    for (size_t j = 0; j < wand.size(); j++)
-      if (wand[j].p == pivot) {
-        score += bm25(wand[j].tf, wand[j].idf, length, avgl, b, k1);
-        wand[j].hopper->tau(pivot + 1, &wand[j].p, &wand[j].q, &wand[j].tf);
-      }
-    if (score > target) {
-      current.emplace_back(pivot, qivot, score);
-      if (current.size() == depth) {
-        top = top_results(top, current, depth);
-        current.clear();
+    for (size_t j = 0; j <= i; j++) {
+      WandHopper *w = order[j];
+      if (w->p < pivot)
+        w->hopper->tau(pivot, &w->p, &w->q, &w->tf);
+      if (w->p == pivot) {
+        score += bm25(w->tf, w->idf, length, avgl, b, k1);
+        w->hopper->tau(pivot + 1, &w->p, &w->q, &w->tf);
       }
     }
+    reorder(i + 1);
+    if (score > target)
+      current.push(RankingResult(pivot, qivot, score));
   }
-  top = top_results(top, current, depth);
+  return current.results();
+}
+} // namespace
+
+std::vector<RankingResult>
+bm25_ranking(std::shared_ptr<Stats> stats,
+             const std::map<std::string, fval> &query,
+             const std::map<std::string, fval> &parameters) {
+  std::vector<RankingResult> top =
+      bm25_range(stats, query, parameters, minfinity + 1, maxfinity, nullptr);
   maybe_add_container(stats, &top);
   return top;
 }
 
+fval bm25_bound(std::shared_ptr<Stats> stats,
+                const std::map<std::string, fval> &query,
+                const std::map<std::string, fval> &parameters) {
+  if (!(stats->have("avgl") && stats->have("rsj") && stats->have("tf")))
+    return 0.0;
+  fval b = ranking_parameter("bm25", "b", parameters);
+  fval k1 = ranking_parameter("bm25", "k1", parameters);
+  fval avgl = stats->avgl();
+  fval bound = 0.0;
+  for (auto &wt : query) {
+    fval idf = wt.second * stats->rsj(wt.first);
+    if (idf == 0.0)
+      continue;
+    std::unique_ptr<Hopper> hopper = stats->tf_hopper(wt.first);
+    addr p, q;
+    hopper->tau(minfinity + 1, &p, &q);
+    if (p == maxfinity)
+      continue;
+    // As for bm25_range, block maxima are trusted only if they cover all the
+    // postings; otherwise a term is bounded by its idf.
+    fval term_bound = block_bound(
+        hopper.get(), stats->tfmax_hopper(wt.first).get(),
+        stats->lmin_hopper(wt.first).get(),
+        stats->tfpeak_hopper(wt.first).get(),
+        stats->lpeak_hopper(wt.first).get(),
+        [&](fval tf, fval l) { return bm25(tf, idf, l, avgl, b, k1); });
+    bound += (std::isinf(term_bound) ? idf : term_bound);
+  }
+  return bound;
+}
+
 std::vector<std::string> qap(std::shared_ptr<Warren> warren,
                              const std::string &query,
                              const std::string &container,
@@ -1521,21 +2132,14 @@ std::vector<RankingResult> random_ranking(std::shared_ptr<Warren> warren,
     return top;
   addr p, q;
   srand((int)time(0));
-  std::vector<RankingResult> current;
+  TopK current(depth);
   for (hopper->tau(minfinity + 1, &p, &q); p < maxfinity;
        hopper->tau(p + 1, &p, &q)) {
     fval score = (1.0 * rand()) / (1.0 * rand());
-    fval target = (top.size() == depth ? top[top.size() - 1].score() : 0.0);
-    if (score > target) {
-      current.emplace_back(RankingResult(p, q, score));
-      if (current.size() == depth) {
-        top = top_results(top, current, depth);
-        current.clear();
-      }
-    }
+    if (score > current.threshold())
+      current.push(RankingResult(p, q, score));
   }
-  top = top_results(top, current, depth);
-  return top;
+  return current.results();
 }
 
 // Dot product
@@ -1561,11 +2165,13 @@ product_ranking(std::shared_ptr<Warren> warren, const std::string &query,
   return product_ranking(warren, weighted_query, parameters, tag, convert);
 }
 
+namespace {
 std::vector<RankingResult>
-product_ranking(std::shared_ptr<Warren> warren,
-                const std::map<std::string, fval> &query,
-                const std::map<std::string, fval> &parameters,
-                const std::string &tag, bool convert) {
+product_range(std::shared_ptr<Warren> warren,
+              const std::map<std::string, fval> &query,
+              const std::map<std::string, fval> &parameters,
+              const std::string &tag, bool convert, addr start, addr end,
+              SharedThreshold *shared) {
   std::vector<RankingResult> top;
   size_t depth =
       static_cast<size_t>(ranking_parameter(tag, "depth", parameters));
@@ -1575,72 +2181,72 @@ product_ranking(std::shared_ptr<Warren> warren,
       TaggingFeaturizer::make(warren->featurizer(), tag);
   if (featurizer == nullptr)
     return top;
-  struct TermHopper {
-    TermHopper(fval weight, std::unique_ptr<Hopper> hopper)
-        : weight(weight), hopper(std::move(hopper)){};
-    fval weight;
-    addr p, q;
-    fval score;
-    std::unique_ptr<Hopper> hopper;
+  std::shared_ptr<Featurizer> max_featurizer =
+      TaggingFeaturizer::make(warren->featurizer(), tag + "max");
+  if (max_featurizer == nullptr)
+    return top;
+  // Values are stored either as integers (convert) or as fvals
+  auto value = [convert](fval v) -> fval {
+    return convert ? static_cast<fval>(fval2addr(v)) : v;
   };
-  std::vector<TermHopper> toppers;
-  for (auto &term : query)
-    toppers.emplace_back(
-        term.second, warren->idx()->hopper(featurizer->featurize(term.first)));
-  addr p = maxfinity, q;
-  for (auto &topper : toppers) {
-    if (convert) {
-      addr v;
-      topper.hopper->tau(minfinity + 1, &topper.p, &topper.q, &v);
-      topper.score = topper.weight * v;
-    } else {
-      fval v;
-      topper.hopper->tau(minfinity + 1, &topper.p, &topper.q, &v);
-      topper.score = topper.weight * v;
-    }
-    if (topper.p < p) {
-      p = topper.p;
-      q = topper.q;
-    }
-  }
-  std::vector<RankingResult> current;
-  while (p < maxfinity) {
-    fval target = (top.size() >= depth ? top.back().score() : 0.0);
-    fval score = 0.0;
-    addr next_p = maxfinity, next_q = maxfinity;
-    for (auto &topper : toppers) {
-      if (topper.p == p) {
-        score += topper.score;
-        if (convert) {
-          addr v;
-          topper.hopper->tau(p + 1, &topper.p, &topper.q, &v);
-          topper.score = topper.weight * v;
-        } else {
-          fval v;
-          topper.hopper->tau(p + 1, &topper.p, &topper.q, &v);
-          topper.score = topper.weight * v;
-        }
-      }
-      if (topper.p < next_p) {
-        next_p = topper.p;
-        next_q = topper.q;
-      }
-    }
-    if (score > target) {
-      current.emplace_back(p, q, score);
-      if (current.size() == depth) {
-        top = top_results(top, current, depth);
-        current.clear();
-      }
+  // Bounds on term scores come from the largest value of each term, where
+  // recorded by impact_max_annotations. Other terms are always essential.
+  std::vector<fval> weights;
+  std::vector<MaxScoreCursor> cursors;
+  for (auto &term : query) {
+    std::unique_ptr<Hopper> maximum =
+        warren->idx()->hopper(max_featurizer->featurize(term.first));
+    fval bound = std::numeric_limits<fval>::infinity();
+    addr p, q;
+    fval v;
+    maximum->tau(minfinity + 1, &p, &q, &v);
+    if (p < maxfinity) {
+      bound = 0.0;
+      for (; p < maxfinity; maximum->tau(p + 1, &p, &q, &v))
+        bound = std::max(bound, term.second * value(v));
     }
-    p = next_p;
-    q = next_q;
-  }
-  top = top_results(top, current, depth);
+    cursors.emplace_back(
+        weights.size(), bound,
+        warren->idx()->hopper(featurizer->featurize(term.first)));
+    weights.push_back(term.second);
+  }
+  top = max_score(
+      &cursors, depth,
+      [&](size_t term, addr p, addr q, fval v) {
+        return weights[term] * value(v);
+      },
+      start, end, shared, parameters);
   return top;
 }
+} // namespace
+
+std::vector<RankingResult>
+product_ranking(std::shared_ptr<Warren> warren,
+                const std::map<std::string, fval> &query,
+                const std::map<std::string, fval> &parameters,
+                const std::string &tag, bool convert) {
+  return product_range(warren, query, parameters, tag, convert, minfinity + 1,
+                       maxfinity, nullptr);
+}
+
+bool impact_max_annotations(std::shared_ptr<Warren> warren,
+                            const std::map<std::string, addr> &maxima,
+                            const std::string &tag, std::string *error) {
+  std::shared_ptr<Featurizer> max_featurizer =
+      TaggingFeaturizer::make(warren->featurizer(), tag + "max", error);
+  if (max_featurizer == nullptr)
+    return false;
+  for (auto &maximum : maxima)
+    if (!warren->annotator()->annotate(max_featurizer->featurize(maximum.first),
+                                       0, 0, maximum.second, error))
+      return false;
+  return true;
+}
 
 bool tf_field_annotations(std::shared_ptr<Warren> warren, std::string *error) {
+  std::string query;
+  if (!content_query(warren, &query, error))
+    return false;
   std::unique_ptr<Hopper> hopper = content_hopper(warren, error);
   if (hopper == nullptr)
     return false;
@@ -1684,6 +2290,11 @@ bool tf_field_annotations(std::shared_ptr<Warren> warren, std::string *error) {
       return false;
     field_featurizers.push_back(featurizer);
   }
+  std::vector<std::string> names{COLUMN_LENGTH};
+  for (size_t i = 0; i < fhoppers.size(); i++)
+    names.push_back(COLUMN_LENGTH + ":" + std::to_string(i));
+  std::shared_ptr<Columns> columns =
+      Columns::make(query, names, text_extent(warren));
   std::map<cottontail::addr, cottontail::addr> df;
   if (!warren->transaction(error))
     return false;
@@ -1692,12 +2303,14 @@ bool tf_field_annotations(std::shared_ptr<Warren> warren, std::string *error) {
        hopper->tau(p + 1, &p, &q)) {
     total_items++;
     addr length = 0;
+    std::vector<fval> values(names.size(), 0.0);
     std::map<std::string, cottontail::addr> tf;
     for (size_t i = 0; i < fhoppers.size(); i++) {
       addr p0, q0;
       fhoppers[i]->tau(p, &p0, &q0);
       if (q0 <= q) {
         length += q0 - p0 + 1;
+        values[i + 1] = q0 - p0 + 1;
         std::string text = warren->txt()->translate(p0, q0);
         std::vector<std::string> tokens = warren->tokenizer()->split(text);
         std::map<std::string, cottontail::addr> ftf;
@@ -1739,6 +2352,11 @@ bool tf_field_annotations(std::shared_ptr<Warren> warren, std::string *error) {
     if (!warren->annotator()->annotate(length_feature, p, p, length, error))
       return false;
     total_length += length;
+    values[0] = length;
+    if (!columns->append(p, q, values, error)) {
+      warren->abort();
+      return false;
+    }
   }
   if (total_items == 0) {
     safe_error(error) = "Can't find any items for ranking";
@@ -1767,6 +2385,8 @@ bool tf_field_annotations(std::shared_ptr<Warren> warren, std::string *error) {
     return false;
   }
   warren->commit();
+  if (!store_columns(warren, columns, error))
+    return false;
   if (!warren->set_parameter("statistics", "field", error))
     return false;
   return true;
@@ -1775,92 +2395,252 @@ bool tf_field_annotations(std::shared_ptr<Warren> warren, std::string *error) {
 namespace {
 constexpr addr MINIMUM_PARALLEL_TOKENS = 1000000;
 
-template <typename RankingAlgorithm>
-std::vector<RankingResult>
-parallel_ranking(std::shared_ptr<Warren> warren, const std::string &gcl,
-                 const std::string &container,
-                 const std::map<std::string, fval> &parameters, size_t depth,
-                 size_t threads, RankingAlgorithm ranking_algorithm) {
-  std::vector<RankingResult> top;
-  if (depth == 0)
-    return top;
-  std::string error;
-  std::unique_ptr<Hopper> hopper = warren->hopper_from_gcl(gcl, &error);
-  if (hopper == nullptr)
-    return top;
-  std::unique_ptr<Hopper> chopper = warren->hopper_from_gcl(container, &error);
-  if (chopper == nullptr)
-    return top;
-  addr p, q, z, start, end;
-  chopper->tau(minfinity + 1, &p, &q);
-  if (p == maxfinity)
-    return top;
-  start = p;
-  chopper->ohr(maxfinity - 1, &p, &q);
-  if (p == minfinity)
-    return top;
-  z = (q == maxfinity ? maxfinity : q + 1);
-  if (z <= start)
-    return top;
-  addr span = z - start;
+// Splits [start, end) into about equal ranges, one per thread, but with at
+// least MINIMUM_PARALLEL_TOKENS in each.
+std::vector<std::pair<addr, addr>> split_range(addr start, addr end,
+                                               size_t threads) {
+  std::vector<std::pair<addr, addr>> ranges;
+  if (end <= start)
+    return ranges;
+  addr span = end - start;
   threads = allowed_threads(threads);
   size_t range_threads =
       std::max<size_t>(1, static_cast<size_t>(span / MINIMUM_PARALLEL_TOKENS));
   threads = std::min(threads, range_threads);
-  if (threads <= 1)
-    return ranking_algorithm(warren, gcl, container, parameters, depth, start,
-                             z);
-
-  std::vector<std::pair<addr, addr>> ranges;
   ranges.reserve(threads);
   for (size_t i = 0; i < threads; i++) {
     addr n = static_cast<addr>(i);
     addr d = static_cast<addr>(threads);
     addr begin = start + (span / d) * n + ((span % d) * n) / d;
     n++;
-    end = start + (span / d) * n + ((span % d) * n) / d;
-    ranges.emplace_back(begin, end);
+    ranges.emplace_back(begin, start + (span / d) * n + ((span % d) * n) / d);
   }
+  return ranges;
+}
 
+// Ranks each range on its own clone of the warren, or context from the
+// pool, with all of them sharing a threshold, and merges the results. Range
+// takes the clone, its context if any, the range, the threshold and where to
+// put its results, returning false if it fails, when the ranking is empty.
+template <typename Range>
+std::vector<RankingResult>
+rank_ranges(std::shared_ptr<Warren> warren,
+            std::shared_ptr<QueryContextPool> pool,
+            const std::vector<std::pair<addr, addr>> &ranges, size_t depth,
+            Range range) {
   std::atomic<bool> failed(false);
+  SharedThreshold shared;
+  QueryBudget *budget = QueryBudget::current();
   std::vector<std::vector<RankingResult>> rankings(ranges.size());
   std::vector<std::thread> workers;
   workers.reserve(ranges.size());
   for (size_t i = 0; i < ranges.size(); i++)
     workers.emplace_back(std::thread([&, i] {
+      QueryBudget::Scope scope(budget);
+      if (pool != nullptr) {
+        std::shared_ptr<QueryContext> context = pool->acquire();
+        if (context == nullptr) {
+          failed.store(true, std::memory_order_relaxed);
+          return;
+        }
+        if (!range(context->warren(), context.get(), ranges[i].first,
+                   ranges[i].second, &shared, &rankings[i]))
+          failed.store(true, std::memory_order_relaxed);
+        return;
+      }
       std::shared_ptr<Warren> local_warren = warren->clone();
       if (local_warren == nullptr) {
         failed.store(true, std::memory_order_relaxed);
         return;
       }
-      rankings[i] = ranking_algorithm(local_warren, gcl, container, parameters,
-                                      depth, ranges[i].first,
-                                      ranges[i].second);
+      if (!range(local_warren, nullptr, ranges[i].first, ranges[i].second,
+                 &shared, &rankings[i]))
+        failed.store(true, std::memory_order_relaxed);
       local_warren->end();
     }));
   for (auto &worker : workers)
     worker.join();
   if (failed.load(std::memory_order_relaxed))
-    return top;
+    return {};
+  TopK merged(depth);
   for (auto &ranking : rankings)
-    top = top_results(top, ranking, depth);
-  return top;
+    merged.push(ranking);
+  return merged.results();
+}
+
+// Ranges cover the text of the warren.
+std::vector<std::pair<addr, addr>>
+text_ranges(std::shared_ptr<Warren> warren, size_t threads) {
+  addr p, q;
+  if (!warren->txt()->range(&p, &q))
+    return {};
+  return split_range(p, q + 1, threads);
+}
+
+template <typename RankingAlgorithm>
+std::vector<RankingResult>
+parallel_ranking(std::shared_ptr<Warren> warren, const std::string &gcl,
+                 const std::string &container,
+                 const std::map<std::string, fval> &parameters, size_t depth,
+                 size_t threads, std::shared_ptr<QueryContextPool> pool,
+                 RankingAlgorithm ranking_algorithm) {
+  std::vector<RankingResult> top;
+  if (depth == 0)
+    return top;
+  std::string error;
+  std::unique_ptr<Hopper> hopper = warren->hopper_from_gcl(gcl, &error);
+  if (hopper == nullptr)
+    return top;
+  std::unique_ptr<Hopper> chopper =
+      warren->cached_hopper_from_gcl(container, &error);
+  if (chopper == nullptr)
+    return top;
+  addr p, q, z, start;
+  chopper->tau(minfinity + 1, &p, &q);
+  if (p == maxfinity)
+    return top;
+  start = p;
+  chopper->ohr(maxfinity - 1, &p, &q);
+  if (p == minfinity)
+    return top;
+  z = (q == maxfinity ? maxfinity : q + 1);
+  if (z <= start)
+    return top;
+  std::vector<std::pair<addr, addr>> ranges = split_range(start, z, threads);
+  if (ranges.size() <= 1)
+    return ranking_algorithm(warren, gcl, container, parameters, depth, start,
+                             z, nullptr);
+  return rank_ranges(warren, pool, ranges, depth,
+                     [&](std::shared_ptr<Warren> local_warren,
+                         QueryContext *context, addr start, addr end,
+                         SharedThreshold *shared,
+                         std::vector<RankingResult> *ranking) {
+                       *ranking = ranking_algorithm(local_warren, gcl,
+                                                    container, parameters,
+                                                    depth, start, end, shared);
+                       return true;
+                     });
 }
 } // namespace
 
 std::vector<RankingResult> parallel_ssr(
     std::shared_ptr<Warren> warren, const std::string &gcl,
     const std::string &container, const std::map<std::string, fval> &parameters,
-    size_t depth, size_t threads) {
+    size_t depth, size_t threads, std::shared_ptr<QueryContextPool> pool,
+    QueryBudget *budget) {
+  QueryBudget::Scope scope(budget);
   return parallel_ranking(
-      warren, gcl, container, parameters, depth, threads,
+      warren, gcl, container, parameters, depth, threads, pool,
       [](std::shared_ptr<Warren> warren, const std::string &gcl,
          const std::string &container,
-          const std::map<std::string, fval> &parameters, size_t depth,
-          addr start, addr end) {
+         const std::map<std::string, fval> &parameters, size_t depth,
+         addr start, addr end, SharedThreshold *shared) {
         return ssr_ranking(warren, gcl, container, parameters, depth, start,
-                           end);
+                           end, shared);
+      });
+}
+
+std::vector<RankingResult>
+parallel_bm25(std::shared_ptr<Stats> stats,
+              const std::map<std::string, fval> &query,
+              const std::map<std::string, fval> &parameters, size_t threads,
+              std::shared_ptr<QueryContextPool> pool) {
+  std::vector<std::pair<addr, addr>> ranges =
+      text_ranges(stats->warren(), threads);
+  if (ranges.size() <= 1)
+    return bm25_ranking(stats, query, parameters);
+  size_t depth =
+      static_cast<size_t>(ranking_parameter("bm25", "depth", parameters));
+  std::string name = stats->name(), recipe = stats->recipe();
+  std::vector<RankingResult> top = rank_ranges(
+      stats->warren(), pool, ranges, depth,
+      [&](std::shared_ptr<Warren> local_warren, QueryContext *context,
+          addr start, addr end, SharedThreshold *shared,
+          std::vector<RankingResult> *ranking) {
+        std::shared_ptr<Stats> local_stats;
+        if (context != nullptr && context->stats() != nullptr &&
+            context->stats()->name() == name &&
+            context->stats()->recipe() == recipe)
+          local_stats = context->stats();
+        else
+          local_stats = stats->clone(local_warren);
+        if (local_stats == nullptr)
+          return false;
+        *ranking =
+            bm25_range(local_stats, query, parameters, start, end, shared);
+        return true;
+      });
+  maybe_add_container(stats, &top);
+  return top;
+}
+
+std::vector<RankingResult>
+parallel_lmd(std::shared_ptr<Warren> warren,
+             const std::map<std::string, fval> &query,
+             const std::map<std::string, fval> &parameters, size_t threads,
+             std::shared_ptr<QueryContextPool> pool) {
+  std::vector<std::pair<addr, addr>> ranges = text_ranges(warren, threads);
+  if (ranges.size() <= 1)
+    return lmd_ranking(warren, query, parameters);
+  size_t depth =
+      static_cast<size_t>(ranking_parameter("lmd", "depth", parameters));
+  return rank_ranges(warren, pool, ranges, depth,
+                     [&](std::shared_ptr<Warren> local_warren,
+                         QueryContext *context, addr start, addr end,
+                         SharedThreshold *shared,
+                         std::vector<RankingResult> *ranking) {
+                       *ranking = lmd_range(local_warren, query, parameters,
+                                            start, end, shared);
+                       return true;
+                     });
+}
+
+std::vector<RankingResult>
+parallel_lmd(std::shared_ptr<Stats> stats,
+             const std::map<std::string, fval> &query,
+             const std::map<std::string, fval> &parameters, size_t threads,
+             std::shared_ptr<QueryContextPool> pool) {
+  std::vector<std::pair<addr, addr>> ranges =
+      text_ranges(stats->warren(), threads);
+  if (ranges.size() <= 1)
+    return lmd_ranking(stats, query, parameters);
+  size_t depth =
+      static_cast<size_t>(ranking_parameter("lmd", "depth", parameters));
+  return rank_ranges(
+      stats->warren(), pool, ranges, depth,
+      [&](std::shared_ptr<Warren> local_warren, QueryContext *context,
+          addr start, addr end, SharedThreshold *shared,
+          std::vector<RankingResult> *ranking) {
+        std::shared_ptr<Stats> local_stats = stats->clone(local_warren);
+        if (local_stats == nullptr)
+          return false;
+        *ranking = lmd_range(local_warren, query, parameters, start, end,
+                             shared, local_stats.get());
+        return true;
       });
 }
 
+std::vector<RankingResult>
+parallel_product(std::shared_ptr<Warren> warren,
+                 const std::map<std::string, fval> &query,
+                 const std::map<std::string, fval> &parameters,
+                 const std::string &tag, bool convert, size_t threads,
+                 std::shared_ptr<QueryContextPool> pool) {
+  std::vector<std::pair<addr, addr>> ranges = text_ranges(warren, threads);
+  if (ranges.size() <= 1)
+    return product_ranking(warren, query, parameters, tag, convert);
+  size_t depth =
+      static_cast<size_t>(ranking_parameter(tag, "depth", parameters));
+  return rank_ranges(warren, pool, ranges, depth,
+                     [&](std::shared_ptr<Warren> local_warren,
+                         QueryContext *context, addr start, addr end,
+                         SharedThreshold *shared,
+                         std::vector<RankingResult> *ranking) {
+                       *ranking = product_range(local_warren, query,
+                                                parameters, tag, convert,
+                                                start, end, shared);
+                       return true;
+                     });
+}
+
 } // namespace cottontail
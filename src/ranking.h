@@ -13,6 +13,10 @@
 
 namespace cottontail {
 
+class QueryBudget;
+class QueryContextPool;
+class SharedThreshold;
+
 class RankingResult {
 public:
   RankingResult(addr p, addr q, fval score)
@@ -40,6 +44,13 @@ private:
   fval score_;
 };
 
+// Paginated ranking. Sets parameters so that the ssr, bm25, lmd and product
+// rankers keep only results ranked after the last result of a page. With the
+// depth set to the page size, they then rank the next page, pruning as for
+// the first.
+void resume_after(const RankingResult &last,
+                  std::map<std::string, fval> *parameters);
+
 // Reciprocal rank fusion based on:
 // Gordon V. Cormack, Charles L A Clarke, and Stefan Buettcher. 2009. Reciprocal
 // rank fusion outperforms condorcet and individual rank learning methods.
@@ -51,10 +62,11 @@ rrf_fusion(const std::vector<std::vector<RankingResult>> &rankings);
 // C. L. A. Clarke, G. V. Cormack, F. J. Burkowski. 1995.
 // Shortest Substring Ranking (MultiText Experiments for TREC-4).
 // https://trec.nist.gov/pubs/trec4/papers/uwaterloo.ps.gz
+// Later tiers may be ranked speculatively in parallel, given threads.
 std::vector<RankingResult> tiered_ranking(
     std::shared_ptr<Warren> warren, const std::vector<std::string> &tiers,
     const std::string &container, const std::map<std::string, fval> &parameters,
-    size_t depth = 1000);
+    size_t depth = 1000, size_t threads = 1);
 
 inline std::vector<RankingResult>
 tiered_ranking(std::shared_ptr<Warren> warren,
@@ -76,7 +88,7 @@ std::vector<RankingResult>
 tiered_ranking(std::shared_ptr<Warren> warren, const std::string &query,
                const std::string &container,
                const std::map<std::string, fval> &parameters,
-               size_t depth = 1000);
+               size_t depth = 1000, size_t threads = 1);
 
 inline std::vector<RankingResult> tiered_ranking(std::shared_ptr<Warren> warren,
                                                  const std::string &query,
@@ -95,11 +107,15 @@ build_tiers(std::shared_ptr<Warren> warren, const std::string &query,
 // Shortest-substring retrieval and ranking.
 // ACM Transactions on Information Systems 18(1):44-78.
 // DOI=http://dx.doi.org/10.1145/333135.333137
+// Workers ranking disjoint ranges may prune against a shared threshold.
+// Ranking stops early, with the budget marked truncated, once a budget is
+// spent.
 std::vector<RankingResult>
 ssr_ranking(std::shared_ptr<Warren> warren, const std::string &gcl,
             const std::string &container,
             const std::map<std::string, fval> &parameters, size_t depth = 1000,
-            addr start = minfinity, addr end = maxfinity);
+            addr start = minfinity, addr end = maxfinity,
+            SharedThreshold *shared = nullptr, QueryBudget *budget = nullptr);
 
 inline std::vector<RankingResult> ssr_ranking(std::shared_ptr<Warren> warren,
                                               const std::string &gcl,
@@ -111,10 +127,14 @@ inline std::vector<RankingResult> ssr_ranking(std::shared_ptr<Warren> warren,
   return ssr_ranking(warren, gcl, container, parameters, depth, start, end);
 }
 
+// Workers take their clones of the warren from a pool, if given, which must
+// be of the same warren, and share the budget, if given.
 std::vector<RankingResult> parallel_ssr(
     std::shared_ptr<Warren> warren, const std::string &gcl,
     const std::string &container, const std::map<std::string, fval> &parameters,
-    size_t depth = 1000, size_t threads = 0);
+    size_t depth = 1000, size_t threads = 0,
+    std::shared_ptr<QueryContextPool> pool = nullptr,
+    QueryBudget *budget = nullptr);
 
 inline std::vector<RankingResult> parallel_ssr(std::shared_ptr<Warren> warren,
                                                const std::string &gcl,
@@ -173,10 +193,11 @@ kld_prf(std::shared_ptr<Warren> warren,
   return kld_prf(warren, ranking, parameters);
 }
 
-// Generate term frequency annotations over a range.
+// Generate term frequency annotations over a range. These, and the tf
+// annotations below, include block maxima for dynamic pruning by bm25_ranking.
 bool tf_annotations(std::shared_ptr<Warren> warren,
                     std::string *error = nullptr, addr start = minfinity,
-                    addr end = maxfinity);
+                    addr end = maxfinity, size_t threads = 1);
 
 // Generate term frequency and document frequency annotations.
 bool tf_df_annotations(std::shared_ptr<Warren> warren,
@@ -239,6 +260,19 @@ lmd_ranking(std::shared_ptr<Warren> warren, const std::string &query,
 std::vector<RankingResult> lmd_ranking(std::shared_ptr<Warren> warren,
                                        const std::string &query);
 
+// As above, with the collection statistics taken from stats in place of
+// those of its warren, as for a federation (see federation.h).
+std::vector<RankingResult>
+lmd_ranking(std::shared_ptr<Stats> stats,
+            const std::map<std::string, fval> &query,
+            const std::map<std::string, fval> &parameters);
+
+// Upper bound on the score of any item ranked by lmd_ranking with these
+// statistics, from the block maxima in the tf annotations where they exist.
+fval lmd_bound(std::shared_ptr<Stats> stats,
+               const std::map<std::string, fval> &query,
+               const std::map<std::string, fval> &parameters);
+
 // Standard BM25.
 // Index must contain appropriate annotations.
 std::vector<RankingResult>
@@ -262,6 +296,12 @@ bm25_ranking(std::shared_ptr<Warren> warren, const std::string &query,
 std::vector<RankingResult> bm25_ranking(std::shared_ptr<Warren> warren,
                                         const std::string &query);
 
+// Upper bound on the score of any item ranked by bm25_ranking with these
+// statistics, as for lmd_bound.
+fval bm25_bound(std::shared_ptr<Stats> stats,
+                const std::map<std::string, fval> &query,
+                const std::map<std::string, fval> &parameters);
+
 // Random ranker.
 std::vector<RankingResult> random_ranking(std::shared_ptr<Warren> warren,
                                           const std::string &container,
@@ -283,6 +323,47 @@ std::vector<RankingResult> product_ranking(std::shared_ptr<Warren> warren,
                                            const std::string &tag,
                                            bool convert);
 
+// Range-parallel versions of the rankers above. The text is split into
+// ranges of at least a million tokens, at most one per thread, each ranked
+// on its own clone of the warren against a shared threshold, and the results
+// merged. Fewer tokens or threads fall back to the serial ranker. As for
+// parallel_ssr, clones may come from a pool.
+std::vector<RankingResult>
+parallel_bm25(std::shared_ptr<Stats> stats,
+              const std::map<std::string, fval> &query,
+              const std::map<std::string, fval> &parameters,
+              size_t threads = 0,
+              std::shared_ptr<QueryContextPool> pool = nullptr);
+
+std::vector<RankingResult>
+parallel_lmd(std::shared_ptr<Warren> warren,
+             const std::map<std::string, fval> &query,
+             const std::map<std::string, fval> &parameters,
+             size_t threads = 0,
+             std::shared_ptr<QueryContextPool> pool = nullptr);
+
+std::vector<RankingResult>
+parallel_lmd(std::shared_ptr<Stats> stats,
+             const std::map<std::string, fval> &query,
+             const std::map<std::string, fval> &parameters,
+             size_t threads = 0,
+             std::shared_ptr<QueryContextPool> pool = nullptr);
+
+std::vector<RankingResult>
+parallel_product(std::shared_ptr<Warren> warren,
+                 const std::map<std::string, fval> &query,
+                 const std::map<std::string, fval> &parameters,
+                 const std::string &tag, bool convert, size_t threads = 0,
+                 std::shared_ptr<QueryContextPool> pool = nullptr);
+
+// Record the largest value annotated for each term under a tag, within an
+// open transaction, so that product_ranking can prune with it. Values are
+// integers, as for convert above.
+bool impact_max_annotations(std::shared_ptr<Warren> warren,
+                            const std::map<std::string, addr> &maxima,
+                            const std::string &tag,
+                            std::string *error = nullptr);
+
 } // namespace cottontail
 
 #endif // COTTONTAIL_SRC_RANKING_H_
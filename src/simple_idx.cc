@@ -416,6 +416,13 @@ addr SimpleIdx::count_(addr feature) {
   return pstp.n;
 }
 
+bool SimpleIdx::cached_(addr feature) {
+  cache_lock_.lock();
+  bool cached = (cache_.find(feature) != cache_.end());
+  cache_lock_.unlock();
+  return cached;
+}
+
 addr SimpleIdx::vocab_() {
   cache_lock_.lock();
   addr vocabulary_size = pst_map_.size();
@@ -42,6 +42,7 @@ private:
   std::string recipe_() final;
   std::unique_ptr<Hopper> hopper_(addr feature) final;
   addr count_(addr feature) final;
+  bool cached_(addr feature) final;
   addr vocab_() final;
   void reset_();
   std::shared_ptr<CacheRecord> load_cache(addr feature);
@@ -8,6 +8,7 @@
 #include "src/core.h"
 #include "src/fastid_txt.h"
 #include "src/featurizer.h"
+#include "gcl/cache.h"
 #include "src/recipe.h"
 #include "src/simple.h"
 #include "src/stemmer.h"
@@ -121,6 +122,10 @@ std::shared_ptr<Warren> SimpleWarren::clone_(std::string *error) {
       new SimpleWarren(working_, featurizer_, tokenizer_, idx_, txt));
   assert(warren != nullptr);
   warren->default_container_ = default_container_;
+  warren->gcl_cache_ = gcl_cache_;
+  warren->feature_log_ = feature_log_;
+  warren->dictionary_ = dictionary_;
+  warren->columns_ = columns_;
   if (stemmer_ != nullptr) {
     std::shared_ptr<cottontail::Stemmer> the_stemmer =
         cottontail::Stemmer::make(stemmer_->name(), stemmer_->recipe(), error);
@@ -167,6 +172,8 @@ bool SimpleWarren::ready_(std::string *error) {
 void SimpleWarren::commit_() {
   appender_->commit();
   annotator_->commit();
+  if (gcl_cache_ != nullptr)
+    gcl_cache_->clear();
 }
 
 void SimpleWarren::abort_() {
@@ -0,0 +1,244 @@
+#include "src/snippet.h"
+
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "src/core.h"
+#include "src/hopper.h"
+#include "src/tokenizer.h"
+#include "src/txt.h"
+#include "src/warren.h"
+
+namespace cottontail {
+
+namespace {
+// Offsets of the starts of up to count tokens in text from Txt::translate,
+// which starts with a token, followed by the length of the text.
+std::vector<size_t> token_offsets(std::shared_ptr<Tokenizer> tokenizer,
+                                  const std::string &text, addr count) {
+  std::vector<size_t> offsets;
+  const char *start = text.c_str();
+  const char *end = start + text.length();
+  const char *current = start;
+  if (current < end)
+    offsets.push_back(0);
+  while (current < end && (addr)offsets.size() < count) {
+    current = tokenizer->skip(current, end - current, 1);
+    if (current >= end)
+      break;
+    offsets.push_back(current - start);
+  }
+  offsets.push_back(text.length());
+  return offsets;
+}
+
+// Length of a term starting at offset b and running up to e, without the
+// spaces and punctuation that follow it.
+size_t term_length(const std::string &text, size_t b, size_t e) {
+  auto word = [&](size_t i) {
+    unsigned char c = text[i];
+    return c >= 0x80 || std::isalnum(c);
+  };
+  size_t end = b;
+  if (b < e && word(b)) {
+    while (end < e && word(end))
+      end++;
+  } else {
+    end = e;
+    while (end > b && std::isspace((unsigned char)text[end - 1]))
+      --end;
+  }
+  return end - b;
+}
+} // namespace
+
+std::shared_ptr<TextCache> TextCache::make(size_t budget, addr block) {
+  if (block < 1)
+    block = 1;
+  return std::shared_ptr<TextCache>(new TextCache(budget, block));
+}
+
+std::shared_ptr<const TextCache::Block>
+TextCache::block(const std::string &name, std::shared_ptr<Txt> txt,
+                 std::shared_ptr<Tokenizer> tokenizer, addr index) {
+  std::pair<std::string, addr> key(name, index);
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto found = entries_.find(key);
+    if (found != entries_.end()) {
+      hits_++;
+      lru_.splice(lru_.begin(), lru_, found->second.lru);
+      return found->second.block;
+    }
+    misses_++;
+  }
+  // Decode outside the lock, so that other threads can go on
+  std::shared_ptr<Block> block = std::make_shared<Block>();
+  addr first = index * block_;
+  block->text = txt->translate(first, first + block_ - 1);
+  block->offsets = token_offsets(tokenizer, block->text, block_);
+  size_t bytes =
+      block->text.capacity() + block->offsets.capacity() * sizeof(size_t);
+  // Short blocks end the text, which may yet grow
+  if ((addr)block->offsets.size() - 1 < block_ || bytes > budget_)
+    return block;
+  std::lock_guard<std::mutex> guard(lock_);
+  auto found = entries_.find(key);
+  if (found != entries_.end())
+    return found->second.block;
+  lru_.push_front(key);
+  entries_[key] = Entry{block, lru_.begin()};
+  bytes_ += bytes;
+  while (bytes_ > budget_) {
+    auto victim = entries_.find(lru_.back());
+    bytes_ -= victim->second.block->text.capacity() +
+              victim->second.block->offsets.capacity() * sizeof(size_t);
+    entries_.erase(victim);
+    lru_.pop_back();
+  }
+  return block;
+}
+
+bool TextCache::text(const std::string &name, std::shared_ptr<Txt> txt,
+                     std::shared_ptr<Tokenizer> tokenizer, addr p, addr q,
+                     std::string *text, std::vector<size_t> *offsets) {
+  if (txt == nullptr || tokenizer == nullptr || text == nullptr)
+    return false;
+  text->clear();
+  if (offsets != nullptr)
+    offsets->clear();
+  if (p < 0)
+    p = 0;
+  if (q == maxfinity)
+    --q;
+  for (addr index = p / block_; p <= q && index <= q / block_; index++) {
+    std::shared_ptr<const Block> block =
+        this->block(name, txt, tokenizer, index);
+    addr first = index * block_;
+    addr tokens = block->offsets.size() - 1;
+    addr from = std::max(p, first) - first;
+    addr to = std::min(q, first + block_ - 1) - first + 1;
+    if (from >= tokens)
+      break;
+    if (to > tokens)
+      to = tokens;
+    size_t start = block->offsets[from];
+    if (offsets != nullptr)
+      for (addr i = from; i < to; i++)
+        offsets->push_back(text->length() + block->offsets[i] - start);
+    text->append(block->text, start, block->offsets[to] - start);
+    if (tokens < block_)
+      break;
+  }
+  if (offsets != nullptr)
+    offsets->push_back(text->length());
+  return true;
+}
+
+size_t TextCache::hits() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return hits_;
+}
+
+size_t TextCache::misses() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return misses_;
+}
+
+size_t TextCache::bytes() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return bytes_;
+}
+
+bool snippet(std::shared_ptr<Warren> warren,
+             const std::vector<std::string> &terms, addr p, addr q,
+             addr width, Snippet *snippet, std::shared_ptr<TextCache> cache,
+             const std::string &name, std::string *error) {
+  if (warren == nullptr || snippet == nullptr) {
+    safe_error(error) = "Snippet without warren";
+    return false;
+  }
+  if (p < 0 || p > q || q == maxfinity || width < 1) {
+    safe_error(error) = "Bad snippet range";
+    return false;
+  }
+  // Occurrences of each distinct term, in order of position
+  std::vector<std::pair<addr, size_t>> occurrences;
+  std::set<std::string> seen;
+  size_t distinct = 0;
+  for (auto &term : terms) {
+    if (!seen.insert(term).second)
+      continue;
+    std::unique_ptr<Hopper> hopper =
+        warren->idx()->hopper(warren->featurizer()->featurize(term));
+    addr hp, hq;
+    for (hopper->tau(p, &hp, &hq); hq <= q; hopper->tau(hp + 1, &hp, &hq))
+      occurrences.emplace_back(hp, distinct);
+    distinct++;
+  }
+  std::sort(occurrences.begin(), occurrences.end());
+  addr start = p, end = std::min(q, p + width - 1);
+  if (q - p + 1 > width && occurrences.size() > 0) {
+    // Slide a window over the occurrences, keeping the best
+    std::vector<size_t> counts(distinct, 0);
+    size_t present = 0, best_present = 0, best_count = 0, first = 0, last = 0;
+    for (size_t i = 0, j = 0; j < occurrences.size(); j++) {
+      if (counts[occurrences[j].second]++ == 0)
+        present++;
+      while (occurrences[j].first - occurrences[i].first + 1 > width)
+        if (--counts[occurrences[i++].second] == 0)
+          --present;
+      if (present > best_present ||
+          (present == best_present && j - i + 1 > best_count)) {
+        best_present = present;
+        best_count = j - i + 1;
+        first = i;
+        last = j;
+      }
+    }
+    addr extra =
+        width - (occurrences[last].first - occurrences[first].first + 1);
+    start = occurrences[first].first - extra / 2;
+    end = start + width - 1;
+    if (start < p) {
+      end += p - start;
+      start = p;
+    }
+    if (end > q) {
+      start -= end - q;
+      end = q;
+    }
+  }
+  std::vector<size_t> offsets;
+  if (cache != nullptr) {
+    if (!cache->text(name, warren->txt(), warren->tokenizer(), start, end,
+                     &snippet->text, &offsets)) {
+      safe_error(error) = "Cannot decode snippet text";
+      return false;
+    }
+  } else {
+    snippet->text = warren->txt()->translate(start, end);
+    offsets = token_offsets(warren->tokenizer(), snippet->text,
+                            end - start + 1);
+  }
+  snippet->p = start;
+  snippet->q = end;
+  snippet->highlights.clear();
+  for (auto &occurrence : occurrences) {
+    addr k = occurrence.first - start;
+    if (k < 0 || k + 1 >= (addr)offsets.size())
+      continue;
+    size_t b = offsets[k];
+    snippet->highlights.emplace_back(
+        b, term_length(snippet->text, b, offsets[k + 1]));
+  }
+  return true;
+}
+
+} // namespace cottontail
@@ -0,0 +1,84 @@
+#ifndef COTTONTAIL_SRC_SNIPPET_H_
+#define COTTONTAIL_SRC_SNIPPET_H_
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "src/core.h"
+#include "src/tokenizer.h"
+#include "src/txt.h"
+#include "src/warren.h"
+
+namespace cottontail {
+
+// Decoded text shared between threads and warren clones. Text is decoded in
+// fixed blocks of tokens, each once, and kept in least recently used order up
+// to a budget in bytes. Blocks are keyed by a name for the text, which
+// clones of the same warren share. Since decoding goes through the Txt
+// interface it works for any kind of txt, however it is compressed.
+class TextCache final {
+public:
+  static std::shared_ptr<TextCache> make(size_t budget, addr block = 512);
+  // Text of tokens p through q, as from Txt::translate, with the offset of
+  // the start of each token in offsets, if given, and the length of the text
+  // at the end.
+  bool text(const std::string &name, std::shared_ptr<Txt> txt,
+            std::shared_ptr<Tokenizer> tokenizer, addr p, addr q,
+            std::string *text, std::vector<size_t> *offsets = nullptr);
+  size_t hits();
+  size_t misses();
+  size_t bytes();
+  TextCache(const TextCache &) = delete;
+  TextCache &operator=(const TextCache &) = delete;
+  TextCache(TextCache &&) = delete;
+  TextCache &operator=(TextCache &&) = delete;
+
+private:
+  TextCache(size_t budget, addr block) : budget_(budget), block_(block){};
+  struct Block {
+    std::string text;
+    std::vector<size_t> offsets;
+  };
+  struct Entry {
+    std::shared_ptr<const Block> block;
+    std::list<std::pair<std::string, addr>>::iterator lru;
+  };
+  std::shared_ptr<const Block> block(const std::string &name,
+                                     std::shared_ptr<Txt> txt,
+                                     std::shared_ptr<Tokenizer> tokenizer,
+                                     addr index);
+  std::mutex lock_;
+  size_t budget_;
+  addr block_;
+  size_t bytes_ = 0;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+  std::map<std::pair<std::string, addr>, Entry> entries_;
+  std::list<std::pair<std::string, addr>> lru_;
+};
+
+// A window of text with the byte ranges of query terms within it.
+struct Snippet {
+  addr p, q;
+  std::string text;
+  std::vector<std::pair<size_t, size_t>> highlights;
+};
+
+// The window of at most width tokens within p through q holding the most
+// distinct terms, then the most occurrences, centred on them. Terms are
+// located from their postings, as featurized by the warren; text is taken
+// through the cache, if given, under the name.
+bool snippet(std::shared_ptr<Warren> warren,
+             const std::vector<std::string> &terms, addr p, addr q,
+             addr width, Snippet *snippet,
+             std::shared_ptr<TextCache> cache = nullptr,
+             const std::string &name = "", std::string *error = nullptr);
+
+} // namespace cottontail
+
+#endif // COTTONTAIL_SRC_SNIPPET_H_
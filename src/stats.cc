@@ -5,6 +5,7 @@
 
 #include "meadowlark/meadowlark.h"
 #include "meadowlark/tf-idf_stats.h"
+#include "src/columns.h"
 #include "src/core.h"
 #include "src/df_stats.h"
 #include "src/field_stats.h"
@@ -110,7 +111,7 @@ std::unique_ptr<Hopper> Stats::container_hopper_() {
   if (container_query == "")
     return std::make_unique<EmptyHopper>();
   std::unique_ptr<cottontail::Hopper> hopper =
-      warren_->hopper_from_gcl(container_query);
+      warren_->cached_hopper_from_gcl(container_query);
   if (hopper == nullptr)
     return std::make_unique<EmptyHopper>();
   return hopper;
@@ -121,28 +122,54 @@ std::unique_ptr<Hopper> Stats::id_hopper_() {
   if (!warren()->get_parameter("id", &id_query))
     return std::make_unique<EmptyHopper>();
   std::unique_ptr<cottontail::Hopper> hopper =
-      warren()->hopper_from_gcl(id_query);
+      warren()->cached_hopper_from_gcl(id_query);
   if (hopper == nullptr)
     return std::make_unique<EmptyHopper>();
   return hopper;
 }
 
-std::unique_ptr<Hopper> content_hopper(std::shared_ptr<Warren> warren,
-                                       std::string *error) {
+fval Stats::tokens_() { return warren_->txt()->tokens(); }
+
+fval Stats::occurrences_(const std::string &term) {
+  return warren_->idx()->count(warren_->featurizer()->featurize(term));
+}
+
+std::shared_ptr<Stats> Stats::clone_(std::shared_ptr<Warren> warren) {
+  return Stats::make(name_, recipe_(), warren);
+}
+
+bool content_query(std::shared_ptr<Warren> warren, std::string *query,
+                   std::string *error) {
   std::string content_query = "";
   if (!warren->get_parameter("content", &content_query, error))
-    return nullptr;
+    return false;
   if (content_query == "" &&
       !warren->get_parameter("container", &content_query, error))
-    return nullptr;
+    return false;
   if (content_query == "")
     content_query = warren->default_container();
   if (content_query == "") {
     safe_error(error) = "No items to rank defined by warren";
-    return nullptr;
+    return false;
   }
+  *query = content_query;
+  return true;
+}
+
+std::unique_ptr<Hopper> content_hopper(std::shared_ptr<Warren> warren,
+                                       std::string *error) {
+  std::string query;
+  if (!content_query(warren, &query, error))
+    return nullptr;
+  // Columns made before items were appended would miss the new ones
+  std::shared_ptr<Columns> columns = warren->columns();
+  addr p, q;
+  if (columns != nullptr && columns->container() == query &&
+      columns->column(COLUMN_LENGTH) != NO_ORDINAL &&
+      warren->txt()->range(&p, &q) && columns->extent() == q)
+    return columns->hopper(COLUMN_LENGTH);
   std::unique_ptr<cottontail::Hopper> hopper =
-      warren->hopper_from_gcl(content_query, error);
+      warren->hopper_from_gcl(query, error);
   if (hopper == nullptr) {
     safe_error(error) = "No items to rank defined by warren";
     return nullptr;
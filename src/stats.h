@@ -32,9 +32,30 @@ public:
   inline fval idf(const std::string &term) { return idf_(term); };
   inline fval rsj(const std::string &term) { return rsj_(term); };
   inline fval avgl() { return avgl_(); };
+  // Tokens in the text and occurrences of a term in it, for language models.
+  inline fval tokens() { return tokens_(); };
+  inline fval occurrences(const std::string &term) {
+    return occurrences_(term);
+  };
   inline std::unique_ptr<Hopper> tf_hopper(const std::string &term) {
     return tf_hopper_(term);
   };
+  // Block maxima for the tf postings of a term, where the annotations
+  // include them: each interval spans a block of items, valued by the largest
+  // tf in the block (tfmax) or the length of its shortest item (lmin).
+  inline std::unique_ptr<Hopper> tfmax_hopper(const std::string &term) {
+    return tfmax_hopper_(term);
+  };
+  inline std::unique_ptr<Hopper> lmin_hopper(const std::string &term) {
+    return lmin_hopper_(term);
+  };
+  // The blocks that no other block of the term beats on both tf and length.
+  inline std::unique_ptr<Hopper> tfpeak_hopper(const std::string &term) {
+    return tfpeak_hopper_(term);
+  };
+  inline std::unique_ptr<Hopper> lpeak_hopper(const std::string &term) {
+    return lpeak_hopper_(term);
+  };
   inline std::unique_ptr<Hopper> container_hopper() {
     return container_hopper_();
   };
@@ -42,6 +63,11 @@ public:
     return id_hopper_();
   }
   inline std::shared_ptr<Warren> warren() { return warren_; }
+  // Statistics of the same kind for a clone of the warren, as used by
+  // workers ranking ranges of it in parallel.
+  inline std::shared_ptr<Stats> clone(std::shared_ptr<Warren> warren) {
+    return clone_(warren);
+  };
   inline std::shared_ptr<Stemmer> stemmer() { return stemmer_; };
   inline std::shared_ptr<Tokenizer> tokenizer() { return tokenizer_; };
 
@@ -66,16 +92,37 @@ private:
   virtual std::string recipe_() { return ""; }
   virtual bool have_(const std::string &name) { return false; };
   virtual fval avgl_() { return 1; };
+  virtual fval tokens_();
+  virtual fval occurrences_(const std::string &term);
   virtual fval idf_(const std::string &term) { return 0.0; }
   virtual fval rsj_(const std::string &term) { return 0.0; }
   virtual std::unique_ptr<Hopper> tf_hopper_(const std::string &term) {
     return std::make_unique<EmptyHopper>();
   }
+  virtual std::unique_ptr<Hopper> tfmax_hopper_(const std::string &term) {
+    return std::make_unique<EmptyHopper>();
+  }
+  virtual std::unique_ptr<Hopper> lmin_hopper_(const std::string &term) {
+    return std::make_unique<EmptyHopper>();
+  }
+  virtual std::unique_ptr<Hopper> tfpeak_hopper_(const std::string &term) {
+    return std::make_unique<EmptyHopper>();
+  }
+  virtual std::unique_ptr<Hopper> lpeak_hopper_(const std::string &term) {
+    return std::make_unique<EmptyHopper>();
+  }
   virtual std::unique_ptr<Hopper> container_hopper_();
   virtual std::unique_ptr<Hopper> id_hopper_();
+  virtual std::shared_ptr<Stats> clone_(std::shared_ptr<Warren> warren);
   std::string name_ = "";
 };
 
+// GCL query for the items to rank.
+bool content_query(std::shared_ptr<Warren> warren, std::string *query,
+                   std::string *error = nullptr);
+// Items to rank, taken from the warren's columns when they hold lengths for
+// the same items over the same text, since these can be walked without
+// evaluating GCL.
 std::unique_ptr<Hopper> content_hopper(std::shared_ptr<Warren> warren,
                                        std::string *error = nullptr);
 } // namespace cottontail
@@ -0,0 +1,61 @@
+#include "src/top_k.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "src/core.h"
+#include "src/ranking.h"
+
+namespace cottontail {
+
+namespace {
+// As a heap comparator, keeps the worst result at the front.
+bool better(const RankingResult &a, const RankingResult &b) {
+  return a.score() > b.score() || (a.score() == b.score() && a.p() < b.p());
+}
+} // namespace
+
+void SharedThreshold::raise(fval score) {
+  fval current = value_.load(std::memory_order_relaxed);
+  while (score > current &&
+         !value_.compare_exchange_weak(current, score,
+                                       std::memory_order_relaxed))
+    ;
+}
+
+bool TopK::push(const RankingResult &result) {
+  if (depth_ == 0)
+    return false;
+  if (resumed_ && (result.score() > after_score_ ||
+                   (result.score() == after_score_ && result.p() <= after_p_)))
+    return false;
+  if (heap_.size() < depth_) {
+    heap_.push_back(result);
+    std::push_heap(heap_.begin(), heap_.end(), better);
+  } else if (better(result, heap_.front())) {
+    std::pop_heap(heap_.begin(), heap_.end(), better);
+    heap_.back() = result;
+    std::push_heap(heap_.begin(), heap_.end(), better);
+  } else {
+    return false;
+  }
+  if (shared_ != nullptr && full())
+    shared_->raise(heap_.front().score());
+  return true;
+}
+
+void TopK::push(const std::vector<RankingResult> &results) {
+  for (auto &result : results)
+    push(result);
+}
+
+std::vector<RankingResult> TopK::results(bool sorted) {
+  if (sorted)
+    std::sort_heap(heap_.begin(), heap_.end(), better);
+  std::vector<RankingResult> results;
+  results.swap(heap_);
+  heap_.reserve(depth_);
+  return results;
+}
+
+} // namespace cottontail
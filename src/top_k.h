@@ -0,0 +1,84 @@
+#ifndef COTTONTAIL_SRC_TOP_K_H_
+#define COTTONTAIL_SRC_TOP_K_H_
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "src/core.h"
+#include "src/ranking.h"
+
+namespace cottontail {
+
+// Score to beat shared by workers ranking disjoint ranges for the same top
+// results. Each raises it to its own worst result once it has depth of them,
+// which can never exceed the worst of the combined results, so all can prune
+// against the best threshold seen by any of them.
+class SharedThreshold final {
+public:
+  SharedThreshold(fval floor = 0.0) : value_(floor){};
+  inline fval value() const { return value_.load(std::memory_order_relaxed); };
+  // Never lowers the threshold.
+  void raise(fval score);
+  SharedThreshold(SharedThreshold const &) = delete;
+  SharedThreshold &operator=(SharedThreshold const &) = delete;
+  SharedThreshold(SharedThreshold &&) = delete;
+  SharedThreshold &operator=(SharedThreshold &&) = delete;
+
+private:
+  std::atomic<fval> value_;
+};
+
+// Collects the best depth ranking results in a bounded min-heap, so the
+// score a candidate must beat is always at hand for pruning. Results are
+// ordered by score, with ties going to the earlier address, so the outcome
+// does not depend on the order of pushes. Assumes no duplicates.
+class TopK final {
+public:
+  // Until depth results are collected, the threshold is floor. A shared
+  // threshold, if given, is raised as results are collected and lifts the
+  // local one.
+  TopK(size_t depth, fval floor = 0.0, SharedThreshold *shared = nullptr)
+      : depth_(depth), floor_(floor), shared_(shared) {
+    heap_.reserve(depth);
+  };
+  inline size_t depth() const { return depth_; };
+  inline size_t size() const { return heap_.size(); };
+  inline bool full() const { return heap_.size() >= depth_; };
+  // Score of the worst result held once full.
+  inline fval threshold() const {
+    fval local = (full() && depth_ > 0 ? heap_.front().score() : floor_);
+    if (shared_ != nullptr)
+      return std::max(local, shared_->value());
+    return local;
+  };
+  // Keeps only results ranked after the given score and address, for the
+  // page that follows a result with them.
+  inline void resume(fval score, addr p) {
+    resumed_ = true;
+    after_score_ = score;
+    after_p_ = p;
+  };
+  // True if the result was kept.
+  bool push(const RankingResult &result);
+  void push(const std::vector<RankingResult> &results);
+  // Empties the collector, sorting best first unless sorted is false.
+  std::vector<RankingResult> results(bool sorted = true);
+  TopK(TopK const &) = delete;
+  TopK &operator=(TopK const &) = delete;
+  TopK(TopK &&) = delete;
+  TopK &operator=(TopK &&) = delete;
+
+private:
+  size_t depth_;
+  fval floor_;
+  SharedThreshold *shared_;
+  bool resumed_ = false;
+  fval after_score_ = 0.0;
+  addr after_p_ = 0;
+  std::vector<RankingResult> heap_;
+};
+
+} // namespace cottontail
+
+#endif // COTTONTAIL_SRC_TOP_K_H_
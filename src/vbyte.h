@@ -0,0 +1,40 @@
+#ifndef COTTONTAIL_SRC_VBYTE_H_
+#define COTTONTAIL_SRC_VBYTE_H_
+
+#include <cstddef>
+#include <string>
+
+namespace cottontail {
+
+// Vbyte coding of sizes and gaps in the files stored alongside a burrow, such
+// as the dictionary, impact index and columns: seven bits to a byte, low
+// bits first, with the high bit set on all but the last byte.
+inline void put_vbyte(size_t n, std::string *s) {
+  while (n >= 128) {
+    s->push_back(static_cast<char>((n & 127) | 128));
+    n >>= 7;
+  }
+  s->push_back(static_cast<char>(n));
+}
+
+// Decodes the number at *where, moving past it. Fails if it runs past the end
+// of the data or the width of a size_t.
+inline bool get_vbyte(const char *data, size_t length, size_t *where,
+                      size_t *n) {
+  *n = 0;
+  for (size_t shift = 0; *where < length && shift < 64; shift += 7) {
+    unsigned char c = static_cast<unsigned char>(data[(*where)++]);
+    *n |= static_cast<size_t>(c & 127) << shift;
+    if (c < 128)
+      return true;
+  }
+  return false;
+}
+
+inline bool get_vbyte(const std::string &s, size_t *where, size_t *n) {
+  return get_vbyte(s.data(), s.size(), where, n);
+}
+
+} // namespace cottontail
+
+#endif // COTTONTAIL_SRC_VBYTE_H_
@@ -0,0 +1,191 @@
+#include "src/warmup.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "src/core.h"
+#include "src/idx.h"
+#include "src/warren.h"
+#include "src/working.h"
+
+namespace cottontail {
+
+namespace {
+const std::string FEATURE_LOG_MAGIC = "COTTONTAIL_FEATURES\n";
+} // namespace
+
+std::shared_ptr<FeatureLog> FeatureLog::make() {
+  return std::shared_ptr<FeatureLog>(new FeatureLog());
+}
+
+std::shared_ptr<FeatureLog> FeatureLog::load(std::shared_ptr<Working> working,
+                                             std::string *error) {
+  if (working == nullptr) {
+    safe_error(error) = "Feature log needs a working directory";
+    return nullptr;
+  }
+  std::string name = working->make_name(FEATURE_LOG_NAME);
+  std::ifstream f(name, std::ios::binary);
+  if (f.fail()) {
+    safe_error(error) = "No feature log in: " + working->make_name("");
+    return nullptr;
+  }
+  std::string magic(FEATURE_LOG_MAGIC.size(), '\0');
+  f.read(&magic[0], magic.size());
+  if (f.fail() || magic != FEATURE_LOG_MAGIC) {
+    safe_error(error) = "Not a feature log: " + name;
+    return nullptr;
+  }
+  std::shared_ptr<FeatureLog> log = make();
+  addr entry[2];
+  while (f.read(reinterpret_cast<char *>(entry), sizeof(entry)))
+    log->counts_[entry[0]] += entry[1];
+  if (f.gcount() != 0) {
+    safe_error(error) = "Truncated feature log: " + name;
+    return nullptr;
+  }
+  return log;
+}
+
+std::vector<std::pair<addr, addr>> FeatureLog::ranked() {
+  std::vector<std::pair<addr, addr>> entries;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    entries.assign(counts_.begin(), counts_.end());
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const std::pair<addr, addr> &a,
+               const std::pair<addr, addr> &b) {
+              if (a.second != b.second)
+                return a.second > b.second;
+              return a.first < b.first;
+            });
+  return entries;
+}
+
+bool FeatureLog::store(std::shared_ptr<Working> working, std::string *error) {
+  if (working == nullptr) {
+    safe_error(error) = "Feature log needs a working directory";
+    return false;
+  }
+  std::string temp = working->make_temp("features");
+  std::ofstream f(temp, std::ios::binary);
+  if (f.fail()) {
+    safe_error(error) = "Can't create: " + temp;
+    return false;
+  }
+  f.write(FEATURE_LOG_MAGIC.data(), FEATURE_LOG_MAGIC.size());
+  for (auto &entry : ranked()) {
+    addr pair[2] = {entry.first, entry.second};
+    f.write(reinterpret_cast<const char *>(pair), sizeof(pair));
+  }
+  f.close();
+  if (f.fail() ||
+      std::rename(temp.c_str(),
+                  working->make_name(FEATURE_LOG_NAME).c_str()) != 0) {
+    std::remove(temp.c_str());
+    safe_error(error) = "Can't write feature log";
+    return false;
+  }
+  return true;
+}
+
+void FeatureLog::record(addr feature) {
+  std::lock_guard<std::mutex> guard(lock_);
+  counts_[feature]++;
+}
+
+std::vector<addr> FeatureLog::features(size_t limit) {
+  std::vector<addr> features;
+  for (auto &entry : ranked()) {
+    if (limit > 0 && features.size() >= limit)
+      break;
+    features.push_back(entry.first);
+  }
+  return features;
+}
+
+size_t FeatureLog::size() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return counts_.size();
+}
+
+std::shared_ptr<Warmer> Warmer::make(std::shared_ptr<Warren> warren,
+                                     std::shared_ptr<FeatureLog> log,
+                                     size_t budget, std::string *error) {
+  if (warren == nullptr || log == nullptr) {
+    safe_error(error) = "Warmer needs a warren and a feature log";
+    return nullptr;
+  }
+  std::shared_ptr<Warren> clone = warren->clone(error);
+  if (clone == nullptr)
+    return nullptr;
+  std::shared_ptr<Warmer> warmer = std::shared_ptr<Warmer>(new Warmer());
+  warmer->warren_ = warren;
+  warmer->log_ = log;
+  warmer->budget_ = budget;
+  warmer->snapshot_ = warren->snapshot();
+  warmer->start(clone);
+  return warmer;
+}
+
+void Warmer::start(std::shared_ptr<Warren> clone) {
+  stop_ = false;
+  done_ = false;
+  features_ = 0;
+  bytes_ = 0;
+  thread_ = std::thread([this, clone] { run(clone); });
+}
+
+void Warmer::run(std::shared_ptr<Warren> clone) {
+  if (!clone->started())
+    clone->start();
+  std::shared_ptr<Idx> idx = clone->idx();
+  for (addr feature : log_->features()) {
+    if (stop_)
+      break;
+    addr n = idx->count(feature);
+    if (n <= 0)
+      continue;
+    size_t bytes = n * (2 * sizeof(addr) + sizeof(fval));
+    if (bytes_ + bytes > budget_)
+      continue;
+    idx->warm(feature);
+    bytes_ += bytes;
+    features_++;
+  }
+  clone->end();
+  done_ = true;
+}
+
+void Warmer::refresh() {
+  addr snapshot = warren_->snapshot();
+  if (snapshot == snapshot_)
+    return;
+  std::shared_ptr<Warren> clone = warren_->clone();
+  if (clone == nullptr)
+    return;
+  stop_ = true;
+  wait();
+  snapshot_ = snapshot;
+  start(clone);
+}
+
+void Warmer::wait() {
+  if (thread_.joinable())
+    thread_.join();
+}
+
+Warmer::~Warmer() {
+  stop_ = true;
+  wait();
+}
+
+} // namespace cottontail
@@ -0,0 +1,87 @@
+#ifndef COTTONTAIL_SRC_WARMUP_H_
+#define COTTONTAIL_SRC_WARMUP_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "src/core.h"
+#include "src/warren.h"
+#include "src/working.h"
+
+namespace cottontail {
+
+static const std::string FEATURE_LOG_NAME = "features";
+
+// Counts of the features whose postings have been read through an idx (see
+// Warren::set_feature_log), so that the caches of a restarted server can be
+// warmed with the postings its queries use most. The log is stored in the
+// burrow as a magic line followed by pairs of feature and count, most used
+// first, eight bytes each.
+class FeatureLog final {
+public:
+  static std::shared_ptr<FeatureLog> make();
+  static std::shared_ptr<FeatureLog> load(std::shared_ptr<Working> working,
+                                          std::string *error = nullptr);
+  bool store(std::shared_ptr<Working> working, std::string *error = nullptr);
+  void record(addr feature);
+  // Features in decreasing order of use, at most limit of them if not zero.
+  std::vector<addr> features(size_t limit = 0);
+  size_t size();
+  FeatureLog(const FeatureLog &) = delete;
+  FeatureLog &operator=(const FeatureLog &) = delete;
+  FeatureLog(FeatureLog &&) = delete;
+  FeatureLog &operator=(FeatureLog &&) = delete;
+
+private:
+  FeatureLog(){};
+  std::vector<std::pair<addr, addr>> ranked();
+  std::mutex lock_;
+  std::unordered_map<addr, addr> counts_;
+};
+
+// Loads postings into the caches of a warren on a background thread, from a
+// clone of it, taking features from a log in order of use. Features whose
+// postings would take the total past the budget in bytes are passed over.
+class Warmer final {
+public:
+  static std::shared_ptr<Warmer> make(std::shared_ptr<Warren> warren,
+                                      std::shared_ptr<FeatureLog> log,
+                                      size_t budget,
+                                      std::string *error = nullptr);
+  // Warms again once the warren has moved to a new snapshot, as after a
+  // commit, since the caches of the old one are gone. Called from the thread
+  // using the warren.
+  void refresh();
+  void wait();
+  inline bool done() { return done_; };
+  inline size_t features() { return features_; };
+  inline size_t bytes() { return bytes_; };
+  ~Warmer();
+  Warmer(const Warmer &) = delete;
+  Warmer &operator=(const Warmer &) = delete;
+  Warmer(Warmer &&) = delete;
+  Warmer &operator=(Warmer &&) = delete;
+
+private:
+  Warmer(){};
+  void start(std::shared_ptr<Warren> clone);
+  void run(std::shared_ptr<Warren> clone);
+  std::shared_ptr<Warren> warren_;
+  std::shared_ptr<FeatureLog> log_;
+  size_t budget_;
+  addr snapshot_ = 0;
+  std::thread thread_;
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> done_{false};
+  std::atomic<size_t> features_{0};
+  std::atomic<size_t> bytes_{0};
+};
+
+} // namespace cottontail
+
+#endif // COTTONTAIL_SRC_WARMUP_H_
@@ -5,7 +5,9 @@
 #include <sys/stat.h>
 
 #include "src/bigwig.h"
+#include "src/columns.h"
 #include "src/core.h"
+#include "src/dictionary.h"
 #include "src/dna.h"
 #include "src/hazel.h"
 #include "src/owsla.h"
@@ -155,6 +157,23 @@ void Warren::commit_all(std::vector<std::shared_ptr<Warren>> warrens) {
     warren->commit();
 }
 
+std::shared_ptr<Dictionary> Warren::dictionary(std::string *error) {
+  if (dictionary_ == nullptr)
+    dictionary_ = Dictionary::load(working_, error);
+  return dictionary_;
+}
+
+std::shared_ptr<Columns> Warren::columns(std::string *error) {
+  std::call_once(columns_->loaded, [&] {
+    // Only columns written for this burrow's annotations, not an old build's
+    std::string value;
+    if (working_ != nullptr && get_parameter("columns", &value, error) &&
+        okay(value))
+      columns_->columns = Columns::load(working_, error);
+  });
+  return columns_->columns;
+}
+
 std::shared_ptr<Warren> Warren::clone_(std::string *error) {
   safe_error(error) = "Warren type does not support cloning: " + name();
   return nullptr;
@@ -3,6 +3,7 @@
 
 #include <cassert>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -20,6 +21,12 @@
 
 namespace cottontail {
 
+namespace gcl {
+class Cache;
+} // namespace gcl
+
+class Columns;
+class Dictionary;
 class Stats;
 
 class Warren : public Committable {
@@ -42,6 +49,10 @@ public:
   inline void start() {
     assert(!started_);
     start_();
+    // Clones share their idx, which may be in use on other threads
+    if (feature_log_ != nullptr && idx_ != nullptr &&
+        idx_->log() != feature_log_)
+      idx_->set_log(feature_log_);
     started_ = true;
   };
   inline void end() {
@@ -89,6 +100,46 @@ public:
                                                  std::string *error = nullptr) {
     return gcl::hopper(query, this, error);
   }
+  inline std::unique_ptr<Hopper>
+  cached_hopper_from_gcl(const std::string &query,
+                         std::string *error = nullptr) {
+    return gcl::cached_hopper(query, this, error);
+  }
+  // Materialized GCL results may be shared between queries, and between
+  // clones, through a cache. Entries are tagged by snapshot, which changes
+  // whenever a commit might change the results of a query.
+  inline std::shared_ptr<gcl::Cache> gcl_cache() { return gcl_cache_; }
+  inline void set_gcl_cache(std::shared_ptr<gcl::Cache> cache) {
+    gcl_cache_ = cache;
+  }
+  // Features read through the idx may be counted in a log, shared with
+  // clones, from which caches can be warmed after a restart; see Warmer.
+  // Set the log before making any clones.
+  inline std::shared_ptr<FeatureLog> feature_log() { return feature_log_; }
+  inline void set_feature_log(std::shared_ptr<FeatureLog> log) {
+    feature_log_ = log;
+    if (idx_ != nullptr)
+      idx_->set_log(log);
+  }
+  // Term dictionary for pattern expansion in GCL, loaded from the burrow
+  // when first needed and shared with clones.
+  std::shared_ptr<Dictionary> dictionary(std::string *error = nullptr);
+  inline void set_dictionary(std::shared_ptr<Dictionary> dictionary) {
+    dictionary_ = dictionary;
+  }
+  // Dense per-container columns written by the tf annotators, loaded from
+  // the burrow when first needed by the warren or any of its clones, and
+  // shared between them; nullptr if none. Columns for a shorter text than
+  // the warren's are stale; see Columns::extent.
+  std::shared_ptr<Columns> columns(std::string *error = nullptr);
+  inline void set_columns(std::shared_ptr<Columns> columns) {
+    columns_ = std::make_shared<ColumnsSlot>();
+    std::call_once(columns_->loaded, [&] { columns_->columns = columns; });
+  }
+  inline addr snapshot() {
+    assert(started_);
+    return snapshot_();
+  }
   inline bool set_parameter(const std::string &key, const std::string &value,
                             std::string *error = nullptr) {
     return set_parameter_(key, value, error);
@@ -117,12 +168,21 @@ protected:
   std::shared_ptr<Txt> txt_ = nullptr;
   std::shared_ptr<Annotator> annotator_ = nullptr;
   std::shared_ptr<Appender> appender_ = nullptr;
+  std::shared_ptr<gcl::Cache> gcl_cache_ = nullptr;
+  std::shared_ptr<FeatureLog> feature_log_ = nullptr;
+  std::shared_ptr<Dictionary> dictionary_ = nullptr;
+  struct ColumnsSlot {
+    std::once_flag loaded;
+    std::shared_ptr<Columns> columns = nullptr;
+  };
+  std::shared_ptr<ColumnsSlot> columns_ = std::make_shared<ColumnsSlot>();
 
 private:
   virtual std::string recipe_() { return ""; };
   virtual std::shared_ptr<Warren> clone_(std::string *error);
   virtual void start_(){};
   virtual void end_(){};
+  virtual addr snapshot_() { return 0; };
   virtual bool set_parameter_(const std::string &key, const std::string &value,
                               std::string *error) = 0;
   virtual bool get_parameter_(const std::string &key, std::string *value,
@@ -559,3 +559,26 @@ TEST(Bigwig, Durable) {
   ASSERT_EQ(removeNulls(bigwig->txt()->translate(p, q)),
             "may come,\nAlas, poor Yorick! ");
 }
+
+TEST(Bigwig, Shards) {
+  std::shared_ptr<cottontail::Featurizer> featurizer =
+      cottontail::Featurizer::make("hashing", "");
+  ASSERT_NE(featurizer, nullptr);
+  std::shared_ptr<cottontail::Tokenizer> tokenizer =
+      cottontail::Tokenizer::make("ascii", "");
+  ASSERT_NE(tokenizer, nullptr);
+  std::shared_ptr<cottontail::Bigwig> bigwig =
+      cottontail::Bigwig::make(nullptr, featurizer, tokenizer);
+  ASSERT_NE(bigwig, nullptr);
+  bigwig->merge(false);
+  EXPECT_EQ(bigwig->shards(), (size_t)0);
+  for (size_t i = 0; i < 3; i++) {
+    cottontail::addr p, q;
+    ASSERT_TRUE(bigwig->transaction());
+    ASSERT_TRUE(bigwig->appender()->append("to be or not to be", &p, &q));
+    ASSERT_TRUE(bigwig->ready());
+    bigwig->commit();
+  }
+  EXPECT_EQ(bigwig->shards(), (size_t)3);
+  EXPECT_EQ(bigwig->merging(), (size_t)0);
+}
@@ -0,0 +1,154 @@
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/cottontail.h"
+
+TEST(Columns, Columns) {
+  std::string error;
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(burrow);
+  ASSERT_NE(working, nullptr);
+  std::shared_ptr<cottontail::Columns> columns =
+      cottontail::Columns::make("items", {"length", "prior"});
+  ASSERT_NE(columns, nullptr);
+  EXPECT_TRUE(columns->append(3, 5, {3.0, 0.5}, &error));
+  EXPECT_TRUE(columns->append(10, 19, {10.0, 0.25}, &error));
+  EXPECT_FALSE(columns->append(8, 20, {13.0, 0.0}, &error));
+  EXPECT_FALSE(columns->append(30, 31, {2.0}, &error));
+  ASSERT_TRUE(columns->store(working, &error)) << error;
+  columns = cottontail::Columns::load(working, &error);
+  ASSERT_NE(columns, nullptr) << error;
+  EXPECT_EQ(columns->container(), "items");
+  EXPECT_EQ(columns->size(), (size_t)2);
+  EXPECT_EQ(columns->column("prior"), (size_t)1);
+  EXPECT_EQ(columns->column("nonsense"), cottontail::NO_ORDINAL);
+  EXPECT_EQ(columns->ordinal(10), (size_t)1);
+  EXPECT_EQ(columns->ordinal(11), cottontail::NO_ORDINAL);
+  EXPECT_EQ(columns->value(1, 0), 0.5);
+  cottontail::addr p, q;
+  cottontail::fval v;
+  std::unique_ptr<cottontail::Hopper> hopper = columns->hopper("length");
+  hopper->tau(4, &p, &q, &v);
+  EXPECT_EQ(p, 10);
+  EXPECT_EQ(v, 10.0);
+  hopper->rho(5, &p, &q, &v);
+  EXPECT_EQ(p, 3);
+  hopper->uat(18, &p, &q, &v);
+  EXPECT_EQ(p, 3);
+  hopper->ohr(18, &p, &q, &v);
+  EXPECT_EQ(p, 10);
+  hopper->tau(11, &p, &q, &v);
+  EXPECT_EQ(p, cottontail::maxfinity);
+  hopper->uat(4, &p, &q, &v);
+  EXPECT_EQ(p, cottontail::minfinity);
+}
+
+TEST(Columns, Ranking) {
+  std::string error;
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(burrow);
+  ASSERT_NE(working, nullptr);
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, "", &error);
+  ASSERT_NE(builder, nullptr);
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back("test/ranking.txt");
+  ASSERT_TRUE(cottontail::build_trec(text, builder, &error));
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", burrow, &error);
+  ASSERT_NE(warren, nullptr);
+  warren->start();
+  EXPECT_EQ(warren->columns(), nullptr);
+  std::string container = "(... <DOC> </DOC>)";
+  ASSERT_TRUE(warren->set_parameter("container", container, &error));
+  ASSERT_TRUE(cottontail::tf_df_annotations(warren, &error)) << error;
+  warren->end();
+  warren = cottontail::Warren::make("simple", burrow, &error);
+  ASSERT_NE(warren, nullptr);
+  warren->start();
+  std::shared_ptr<cottontail::Warren> clone = warren->clone(&error);
+  ASSERT_NE(clone, nullptr) << error;
+  std::shared_ptr<cottontail::Columns> columns = warren->columns(&error);
+  ASSERT_NE(columns, nullptr) << error;
+  EXPECT_EQ(columns->container(), container);
+  ASSERT_EQ(columns->size(), (size_t)4);
+  cottontail::addr text_p, text_q;
+  ASSERT_TRUE(warren->txt()->range(&text_p, &text_q));
+  EXPECT_EQ(columns->extent(), text_q);
+  EXPECT_EQ(clone->columns(), columns);
+  clone->end();
+  std::unique_ptr<cottontail::Hopper> gcl =
+      warren->hopper_from_gcl(container, &error);
+  ASSERT_NE(gcl, nullptr);
+  std::unique_ptr<cottontail::Hopper> hopper = columns->hopper("length");
+  cottontail::addr p, q, p0, q0;
+  cottontail::fval v;
+  for (cottontail::addr k = 0; k < columns->q(3) + 2; k++) {
+    gcl->tau(k, &p0, &q0);
+    hopper->tau(k, &p, &q, &v);
+    EXPECT_EQ(p, p0);
+    EXPECT_EQ(q, q0);
+    if (p < cottontail::maxfinity) {
+      EXPECT_EQ(v, q - p + 1.0);
+    }
+    gcl->ohr(k, &p0, &q0);
+    hopper->ohr(k, &p, &q, &v);
+    EXPECT_EQ(p, p0);
+  }
+  std::shared_ptr<cottontail::Stats> stats =
+      cottontail::Stats::make(warren, &error);
+  ASSERT_NE(stats, nullptr) << error;
+  std::map<std::string, cottontail::fval> parameters;
+  for (std::string query : {"quick fox", "cat hat"}) {
+    std::vector<cottontail::RankingResult> fast =
+        cottontail::bm25_ranking(stats, query, parameters);
+    EXPECT_GT(fast.size(), (size_t)0);
+    warren->set_columns(nullptr);
+    std::vector<cottontail::RankingResult> slow =
+        cottontail::bm25_ranking(stats, query, parameters);
+    warren->set_columns(columns);
+    ASSERT_EQ(fast.size(), slow.size());
+    for (size_t i = 0; i < fast.size(); i++) {
+      EXPECT_EQ(fast[i].p(), slow[i].p());
+      EXPECT_EQ(fast[i].q(), slow[i].q());
+      EXPECT_DOUBLE_EQ(fast[i].score(), slow[i].score());
+    }
+  }
+  // Columns over other text are passed over.
+  std::shared_ptr<cottontail::Columns> stale =
+      cottontail::Columns::make(container, {"length"}, text_q + 1);
+  ASSERT_NE(stale, nullptr);
+  ASSERT_TRUE(stale->append(columns->p(0), columns->q(0), {1.0}, &error));
+  warren->set_columns(stale);
+  std::unique_ptr<cottontail::Hopper> items =
+      cottontail::content_hopper(warren, &error);
+  ASSERT_NE(items, nullptr) << error;
+  for (size_t i = 0; i < columns->size(); i++) {
+    items->tau(columns->p(i), &p, &q);
+    EXPECT_EQ(p, columns->p(i));
+    EXPECT_EQ(q, columns->q(i));
+  }
+  warren->set_columns(columns);
+  for (std::string query : {"quick fox", "cat hat"}) {
+    std::vector<cottontail::RankingResult> fast =
+        cottontail::bm25_ranking(stats, query, parameters);
+    warren->set_columns(stale);
+    std::vector<cottontail::RankingResult> slow =
+        cottontail::bm25_ranking(stats, query, parameters);
+    warren->set_columns(columns);
+    ASSERT_EQ(fast.size(), slow.size());
+    for (size_t i = 0; i < fast.size(); i++) {
+      EXPECT_EQ(fast[i].p(), slow[i].p());
+      EXPECT_EQ(fast[i].q(), slow[i].q());
+      EXPECT_DOUBLE_EQ(fast[i].score(), slow[i].score());
+    }
+  }
+  warren->end();
+}
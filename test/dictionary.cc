@@ -0,0 +1,159 @@
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/cottontail.h"
+#include "src/vocab_featurizer.h"
+
+namespace {
+std::vector<std::string> numbered(size_t n) {
+  std::vector<std::string> terms;
+  for (size_t i = 0; i < n; i++) {
+    std::string term = std::to_string(i);
+    terms.push_back("t" + std::string(3 - term.size(), '0') + term);
+  }
+  return terms;
+}
+
+std::vector<std::pair<cottontail::addr, cottontail::addr>>
+intervals(std::shared_ptr<cottontail::Warren> warren, const std::string &gcl) {
+  std::vector<std::pair<cottontail::addr, cottontail::addr>> result;
+  std::string error;
+  std::unique_ptr<cottontail::Hopper> hopper =
+      warren->hopper_from_gcl(gcl, &error);
+  EXPECT_NE(hopper, nullptr) << error;
+  if (hopper == nullptr)
+    return result;
+  cottontail::addr p, q;
+  for (hopper->tau(cottontail::minfinity + 1, &p, &q);
+       p < cottontail::maxfinity; hopper->tau(p + 1, &p, &q))
+    result.emplace_back(p, q);
+  return result;
+}
+} // namespace
+
+TEST(Dictionary, Expansion) {
+  std::vector<std::string> terms = numbered(300);
+  terms.push_back("apple");
+  terms.push_back("apple");
+  terms.push_back("applesauce");
+  terms.push_back("banana");
+  std::shared_ptr<cottontail::Dictionary> dictionary =
+      cottontail::Dictionary::make(terms);
+  ASSERT_NE(dictionary, nullptr);
+  EXPECT_EQ(dictionary->size(), (size_t)303);
+  std::vector<std::string> found;
+  ASSERT_TRUE(dictionary->prefix("t01", &found));
+  ASSERT_EQ(found.size(), (size_t)10);
+  EXPECT_EQ(found[0], "t010");
+  EXPECT_EQ(found[9], "t019");
+  found.clear();
+  ASSERT_TRUE(dictionary->prefix("apple", &found));
+  EXPECT_EQ(found, std::vector<std::string>({"apple", "applesauce"}));
+  found.clear();
+  ASSERT_TRUE(dictionary->prefix("cherry", &found));
+  EXPECT_EQ(found.size(), (size_t)0);
+  found.clear();
+  ASSERT_TRUE(dictionary->wildcard("t?5?", &found));
+  EXPECT_EQ(found.size(), (size_t)30);
+  found.clear();
+  ASSERT_TRUE(dictionary->wildcard("*a*a*", &found));
+  EXPECT_EQ(found, std::vector<std::string>({"applesauce", "banana"}));
+  found.clear();
+  ASSERT_TRUE(dictionary->regex("t2[0-4]7", &found));
+  EXPECT_EQ(found, std::vector<std::string>(
+                       {"t207", "t217", "t227", "t237", "t247"}));
+  found.clear();
+  ASSERT_TRUE(dictionary->regex("(b|c)an.*", &found));
+  EXPECT_EQ(found, std::vector<std::string>({"banana"}));
+  found.clear();
+  std::string error;
+  EXPECT_FALSE(dictionary->prefix("t", &found, 100, &error));
+  EXPECT_EQ(error.find("Expansion of t* exceeds 100 terms"), (size_t)0);
+  EXPECT_FALSE(dictionary->regex("(", &found, 100, &error));
+}
+
+TEST(Dictionary, StoreLoad) {
+  std::string error;
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir("testing", &error);
+  ASSERT_NE(working, nullptr) << error;
+  std::shared_ptr<cottontail::Dictionary> dictionary =
+      cottontail::Dictionary::make(numbered(1000));
+  ASSERT_TRUE(dictionary->store(working, &error)) << error;
+  std::shared_ptr<cottontail::Dictionary> loaded =
+      cottontail::Dictionary::load(working, &error);
+  ASSERT_NE(loaded, nullptr) << error;
+  EXPECT_EQ(loaded->size(), (size_t)1000);
+  std::vector<std::string> expected, found;
+  ASSERT_TRUE(dictionary->wildcard("t*7", &expected));
+  ASSERT_TRUE(loaded->wildcard("t*7", &found));
+  EXPECT_EQ(found.size(), (size_t)100);
+  EXPECT_EQ(found, expected);
+  working->remove(cottontail::DICTIONARY_NAME);
+  EXPECT_EQ(cottontail::Dictionary::load(working, &error), nullptr);
+}
+
+TEST(Dictionary, GCL) {
+  std::string error;
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir("testing", &error);
+  ASSERT_NE(working, nullptr) << error;
+  working->remove(cottontail::VOCAB_NAME);
+  working->remove(cottontail::DICTIONARY_NAME);
+  std::string filename = working->make_name("patterns.txt");
+  {
+    std::ofstream f(filename);
+    f << "<DOC>\n<DOCNO> one </DOCNO>\nhelp hello world helmet\n</DOC>\n";
+    f << "<DOC>\n<DOCNO> two </DOCNO>\nword hello whirled help\n</DOC>\n";
+  }
+  std::shared_ptr<cottontail::Featurizer> featurizer =
+      cottontail::Featurizer::make("hashing", "", &error);
+  std::shared_ptr<cottontail::Tokenizer> tokenizer =
+      cottontail::Tokenizer::make("ascii", "xml", &error);
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, featurizer, tokenizer, &error);
+  ASSERT_NE(builder, nullptr) << error;
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back(filename);
+  ASSERT_TRUE(cottontail::build_trec(text, builder, &error)) << error;
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", "testing", &error);
+  ASSERT_NE(warren, nullptr) << error;
+  warren->start();
+  EXPECT_EQ(warren->hopper_from_gcl("(prefix hel)", &error), nullptr);
+  std::shared_ptr<cottontail::Dictionary> dictionary =
+      cottontail::Dictionary::build(warren, &error);
+  ASSERT_NE(dictionary, nullptr) << error;
+  ASSERT_TRUE(dictionary->store(working, &error)) << error;
+  warren->end();
+
+  warren = cottontail::Warren::make("simple", "testing", &error);
+  ASSERT_NE(warren, nullptr) << error;
+  warren->start();
+  auto expanded = intervals(warren, "(prefix hel)");
+  EXPECT_EQ(expanded.size(), (size_t)5);
+  EXPECT_EQ(expanded, intervals(warren, "(+ help hello helmet)"));
+  EXPECT_EQ(intervals(warren, "(wildcard w*d)"),
+            intervals(warren, "(+ world word whirled)"));
+  EXPECT_EQ(intervals(warren, "(regex \"wor.*\")"),
+            intervals(warren, "(+ world word)"));
+  EXPECT_EQ(intervals(warren, "(... (prefix hel) (wildcard wor*d))").size(),
+            (size_t)2);
+  EXPECT_EQ(intervals(warren, "(prefix zebra)").size(), (size_t)0);
+  ASSERT_TRUE(warren->set_parameter("expansions", "2", &error)) << error;
+  EXPECT_EQ(warren->hopper_from_gcl("(prefix hel)", &error), nullptr);
+  EXPECT_EQ(error.find("Expansion of hel* exceeds 2 terms"), (size_t)0);
+  for (std::string value : {"lots", "2x", "-2", "99999999999999999999999"}) {
+    ASSERT_TRUE(warren->set_parameter("expansions", value, &error)) << error;
+    EXPECT_EQ(warren->hopper_from_gcl("(prefix hel)", &error), nullptr);
+    EXPECT_EQ(error.find("Invalid expansions parameter: " + value),
+              (size_t)0);
+  }
+  ASSERT_TRUE(warren->set_parameter("expansions", "", &error)) << error;
+  warren->end();
+}
@@ -0,0 +1,75 @@
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/cottontail.h"
+
+TEST(DocnoIndex, Lookup) {
+  std::string error;
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(burrow);
+  ASSERT_NE(working, nullptr);
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, "", &error);
+  ASSERT_NE(builder, nullptr);
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back("test/ranking.txt");
+  ASSERT_TRUE(cottontail::build_trec(text, builder, &error));
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", burrow, &error);
+  ASSERT_NE(warren, nullptr);
+  warren->start();
+  std::string container = "(... <DOC> </DOC>)";
+  std::string id = "(... <DOCNO> </DOCNO>)";
+  EXPECT_EQ(cottontail::DocnoIndex::build(warren, "", id, &error), nullptr);
+  std::shared_ptr<cottontail::DocnoIndex> index =
+      cottontail::DocnoIndex::build(warren, container, id, &error);
+  ASSERT_NE(index, nullptr) << error;
+  ASSERT_TRUE(index->store(working, &error)) << error;
+  index = cottontail::DocnoIndex::load(working, &error);
+  ASSERT_NE(index, nullptr) << error;
+  EXPECT_EQ(index->container(), container);
+  EXPECT_EQ(index->id(), id);
+  ASSERT_EQ(index->size(), (size_t)4);
+  std::unique_ptr<cottontail::Hopper> docs =
+      warren->hopper_from_gcl(container, &error);
+  for (std::string docno : {"doc-000", "doc-001", "doc-002", "doc-003"}) {
+    cottontail::addr p, q, p0, q0;
+    ASSERT_TRUE(index->lookup(docno, &p, &q, &error)) << error;
+    std::unique_ptr<cottontail::Hopper> found = warren->hopper_from_gcl(
+        "(>> " + container + " (>> " + id + " \"" + docno + "\"))", &error);
+    found->tau(cottontail::minfinity + 1, &p0, &q0);
+    EXPECT_EQ(p, p0);
+    EXPECT_EQ(q, q0);
+  }
+  cottontail::addr p, q;
+  EXPECT_FALSE(index->lookup("doc-004", &p, &q));
+  EXPECT_EQ(p, cottontail::minfinity);
+  EXPECT_FALSE(index->lookup("doc-00", &p, &q));
+  EXPECT_EQ(p, cottontail::minfinity);
+  EXPECT_TRUE(index->current(warren));
+  warren->end();
+  // Once items are added, the index is stale and every docno ambiguous
+  working = cottontail::Working::mkdir(burrow);
+  ASSERT_NE(working, nullptr);
+  builder = cottontail::SimpleBuilder::make(working, "", &error);
+  ASSERT_NE(builder, nullptr);
+  builder->verbose(false);
+  text.push_back("test/ranking.txt");
+  ASSERT_TRUE(cottontail::build_trec(text, builder, &error));
+  warren = cottontail::Warren::make("simple", burrow, &error);
+  ASSERT_NE(warren, nullptr);
+  warren->start();
+  EXPECT_FALSE(index->current(warren));
+  index = cottontail::DocnoIndex::build(warren, container, id, &error);
+  ASSERT_NE(index, nullptr) << error;
+  EXPECT_TRUE(index->current(warren));
+  EXPECT_FALSE(index->lookup("doc-001", &p, &q));
+  EXPECT_EQ(p, cottontail::maxfinity);
+  warren->end();
+}
@@ -0,0 +1,171 @@
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/cottontail.h"
+
+namespace {
+std::shared_ptr<cottontail::Warren> skewed_warren(std::string *error) {
+  std::string testing = "testing";
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(testing);
+  if (working == nullptr)
+    return nullptr;
+  std::string filename = working->make_name("skewed.txt");
+  {
+    std::ofstream f(filename);
+    for (size_t i = 0; i < 2000; i++) {
+      f << "<DOC>\n<DOCNO> d" << i << " </DOCNO>\n";
+      // Short documents, with a run of long ones in the middle
+      size_t n = (i > 900 && i < 1000 ? 200 : 5 + i % 7);
+      for (size_t j = 0; j < n; j++)
+        f << (j % 3 == 0 ? "apple " : "banana ");
+      f << "\n</DOC>\n";
+    }
+  }
+  std::shared_ptr<cottontail::Featurizer> featurizer =
+      cottontail::Featurizer::make("hashing", "", error);
+  std::shared_ptr<cottontail::Tokenizer> tokenizer =
+      cottontail::Tokenizer::make("ascii", "xml", error);
+  if (featurizer == nullptr || tokenizer == nullptr)
+    return nullptr;
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, featurizer, tokenizer, error);
+  if (builder == nullptr)
+    return nullptr;
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back(filename);
+  if (!cottontail::build_trec(text, builder, error))
+    return nullptr;
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", testing, error);
+  if (warren == nullptr)
+    return nullptr;
+  warren->start();
+  warren->set_default_container("(... <DOC> </DOC>)");
+  return warren;
+}
+
+std::vector<std::pair<cottontail::addr, cottontail::addr>>
+serial(std::shared_ptr<cottontail::Warren> warren, const std::string &gcl,
+       cottontail::addr start, cottontail::addr end) {
+  std::vector<std::pair<cottontail::addr, cottontail::addr>> intervals;
+  std::unique_ptr<cottontail::Hopper> hopper = warren->hopper_from_gcl(gcl);
+  cottontail::addr p, q;
+  for (hopper->tau(start, &p, &q); q <= end && p < cottontail::maxfinity;
+       hopper->tau(p + 1, &p, &q))
+    intervals.emplace_back(p, q);
+  return intervals;
+}
+
+std::vector<std::pair<cottontail::addr, cottontail::addr>>
+parallel(std::shared_ptr<cottontail::Warren> warren, const std::string &gcl,
+         cottontail::addr start, cottontail::addr end, size_t threads) {
+  std::vector<std::vector<std::pair<cottontail::addr, cottontail::addr>>>
+      chunks(cottontail::enumeration_chunks(threads));
+  std::string error;
+  EXPECT_TRUE(cottontail::parallel_enumerate(
+      warren, gcl, start, end, threads,
+      [&](std::shared_ptr<cottontail::Warren> w, size_t chunk,
+          cottontail::addr p, cottontail::addr q, cottontail::fval v) {
+        EXPECT_LT(chunk, chunks.size());
+        EXPECT_TRUE(w->started());
+        chunks[chunk].emplace_back(p, q);
+        return true;
+      },
+      &error))
+      << error;
+  std::vector<std::pair<cottontail::addr, cottontail::addr>> intervals;
+  for (auto &chunk : chunks)
+    intervals.insert(intervals.end(), chunk.begin(), chunk.end());
+  return intervals;
+}
+} // namespace
+
+TEST(Enumerate, MatchesSerial) {
+  std::string error;
+  std::shared_ptr<cottontail::Warren> warren = skewed_warren(&error);
+  ASSERT_NE(warren, nullptr) << error;
+  std::string container = "(... <DOC> </DOC>)";
+  auto all = serial(warren, container, cottontail::minfinity + 1,
+                    cottontail::maxfinity - 1);
+  ASSERT_EQ(all.size(), (size_t)2000);
+  EXPECT_EQ(parallel(warren, container, cottontail::minfinity,
+                     cottontail::maxfinity, 1),
+            all);
+  EXPECT_EQ(parallel(warren, container, cottontail::minfinity,
+                     cottontail::maxfinity, 4),
+            all);
+  EXPECT_EQ(parallel(warren, "apple", cottontail::minfinity,
+                     cottontail::maxfinity, 3),
+            serial(warren, "apple", cottontail::minfinity + 1,
+                   cottontail::maxfinity - 1));
+  // Bounds falling inside documents
+  cottontail::addr start = all[100].first + 1;
+  cottontail::addr end = all[1500].second - 1;
+  auto some = serial(warren, container, start, end);
+  ASSERT_EQ(some.size(), (size_t)1399);
+  EXPECT_EQ(parallel(warren, container, start, end, 4), some);
+  EXPECT_EQ(parallel(warren, container, start, start, 4).size(),
+            (size_t)0);
+  warren->end();
+}
+
+TEST(Enumerate, Stops) {
+  std::string error;
+  std::shared_ptr<cottontail::Warren> warren = skewed_warren(&error);
+  ASSERT_NE(warren, nullptr) << error;
+  std::atomic<size_t> count(0);
+  EXPECT_FALSE(cottontail::parallel_enumerate(
+      warren, "(... <DOC> </DOC>)", cottontail::minfinity,
+      cottontail::maxfinity, 4,
+      [&](std::shared_ptr<cottontail::Warren> w, size_t chunk,
+          cottontail::addr p, cottontail::addr q,
+          cottontail::fval v) { return ++count < 10; },
+      &error));
+  EXPECT_LT(count.load(), (size_t)2000);
+  EXPECT_FALSE(cottontail::parallel_enumerate(
+      warren, "(... <DOC>", cottontail::minfinity, cottontail::maxfinity, 4,
+      [&](std::shared_ptr<cottontail::Warren> w, size_t chunk,
+          cottontail::addr p, cottontail::addr q,
+          cottontail::fval v) { return true; },
+      &error));
+  warren->end();
+}
+
+TEST(Enumerate, TfAnnotations) {
+  // One thread takes the batched path, more enumerate in parallel
+  for (size_t threads : {1, 4}) {
+    std::string error;
+    std::shared_ptr<cottontail::Warren> warren = skewed_warren(&error);
+    ASSERT_NE(warren, nullptr) << error;
+    ASSERT_TRUE(cottontail::tf_annotations(
+        warren, &error, cottontail::minfinity, cottontail::maxfinity, threads))
+        << error;
+    warren->end();
+    warren = cottontail::Warren::make("simple", "testing", &error);
+    ASSERT_NE(warren, nullptr) << error;
+    warren->start();
+    std::unique_ptr<cottontail::Hopper> tf =
+        warren->hopper_from_gcl("tf:banana", &error);
+    ASSERT_NE(tf, nullptr) << error;
+    auto docs = serial(warren, "(... <DOC> </DOC>)", cottontail::minfinity + 1,
+                       cottontail::maxfinity - 1);
+    ASSERT_EQ(docs.size(), (size_t)2000);
+    cottontail::addr p, q;
+    cottontail::fval v;
+    for (size_t i = 0; i < docs.size(); i += 37) {
+      size_t n = (i > 900 && i < 1000 ? 200 : 5 + i % 7);
+      tf->tau(docs[i].first, &p, &q, &v);
+      EXPECT_EQ(p, docs[i].first);
+      EXPECT_EQ(cottontail::fval2addr(v), (cottontail::addr)(n - (n + 2) / 3));
+    }
+    warren->end();
+  }
+}
@@ -53,6 +53,37 @@ TEST(Eval, Metrics) {
   EXPECT_EQ(qrels["one"][54], 0.0);
   EXPECT_EQ(qrels["two"][0], 0.0);
   EXPECT_EQ(qrels["two"][24], 0.5);
+  // A docno index left over from other text is passed over.
+  {
+    std::string stale_burrow = "stale.burrow";
+    std::shared_ptr<cottontail::Working> stale_working =
+        cottontail::Working::mkdir(stale_burrow);
+    ASSERT_NE(stale_working, nullptr);
+    std::shared_ptr<cottontail::Builder> stale_builder =
+        cottontail::SimpleBuilder::make(stale_working, options, &error);
+    ASSERT_NE(stale_builder, nullptr) << error;
+    std::vector<std::string> stale_text;
+    stale_text.push_back("test/test0.txt");
+    stale_text.push_back("test/ranking.txt");
+    ASSERT_TRUE(cottontail::build_trec(stale_text, stale_builder, &error))
+        << error;
+    std::shared_ptr<cottontail::Warren> stale =
+        cottontail::Warren::make(simple, stale_burrow, &error);
+    ASSERT_NE(stale, nullptr) << error;
+    stale->start();
+    std::shared_ptr<cottontail::DocnoIndex> index =
+        cottontail::DocnoIndex::build(stale, "(... <DOC> </DOC>)",
+                                      "(... <DOCNO> </DOCNO>)", &error);
+    ASSERT_NE(index, nullptr) << error;
+    ASSERT_TRUE(index->store(warren->working(), &error)) << error;
+    stale->end();
+    EXPECT_FALSE(index->current(warren));
+    std::map<std::string, std::map<cottontail::addr, cottontail::fval>>
+        reloaded;
+    ASSERT_TRUE(load_trec_qrels(warren, qrels_filename, &reloaded, &error))
+        << error;
+    EXPECT_EQ(reloaded, qrels);
+  }
   std::string query = "cat in the hat";
   std::vector<cottontail::RankingResult> results =
       cottontail::bm25_ranking(warren, query);
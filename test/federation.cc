@@ -0,0 +1,134 @@
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/cottontail.h"
+
+namespace {
+// Builds a burrow with tf and df annotations from TREC-formatted text.
+std::shared_ptr<cottontail::Warren> build(const std::string &burrow,
+                                          const std::string &filename) {
+  std::string error;
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(burrow);
+  if (working == nullptr)
+    return nullptr;
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, "", &error);
+  if (builder == nullptr)
+    return nullptr;
+  builder->verbose(false);
+  if (!cottontail::build_trec({filename}, builder, &error))
+    return nullptr;
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", burrow, &error);
+  if (warren == nullptr)
+    return nullptr;
+  warren->start();
+  warren->set_default_container("(... <DOC> </DOC>)");
+  if (!cottontail::tf_df_annotations(warren, &error))
+    return nullptr;
+  warren->end();
+  warren = cottontail::Warren::make("simple", burrow, &error);
+  if (warren != nullptr)
+    warren->start();
+  return warren;
+}
+} // namespace
+
+TEST(Federation, Schedule) {
+  EXPECT_EQ(cottontail::schedule_threads({1.0, 3.0}, 6),
+            std::vector<size_t>({2, 4}));
+  EXPECT_EQ(cottontail::schedule_threads({0.0, 0.0}, 5),
+            std::vector<size_t>({3, 2}));
+  EXPECT_EQ(cottontail::schedule_threads({5.0, 1.0, 1.0}, 2),
+            std::vector<size_t>({1, 1, 1}));
+}
+
+TEST(Federation, GlobalStatistics) {
+  // The same documents as one collection and split over two, where only the
+  // first of them has the term "rare"
+  std::ofstream all("federation.txt"), first("federation0.txt"),
+      second("federation1.txt");
+  uint64_t seed = 4242;
+  auto next = [&]() {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return seed >> 33;
+  };
+  for (size_t i = 0; i < 400; i++) {
+    std::string doc = "<DOC>\n<DOCNO> " + std::to_string(i) + " </DOCNO>\n";
+    size_t length = 5 + next() % 40;
+    for (size_t j = 0; j < length; j++) {
+      size_t r = next() % 100;
+      doc += "w" + std::to_string((r * r) / 500) + " ";
+    }
+    if (i < 200 && i % 7 == 0)
+      doc += "rare ";
+    doc += "\n</DOC>\n";
+    all << doc;
+    (i < 200 ? first : second) << doc;
+  }
+  all.close();
+  first.close();
+  second.close();
+  std::shared_ptr<cottontail::Warren> whole =
+      build(cottontail::DEFAULT_BURROW, "federation.txt");
+  ASSERT_NE(whole, nullptr);
+  std::vector<std::shared_ptr<cottontail::Warren>> members;
+  members.push_back(build("federation0.burrow", "federation0.txt"));
+  members.push_back(build("federation1.burrow", "federation1.txt"));
+  ASSERT_NE(members[0], nullptr);
+  ASSERT_NE(members[1], nullptr);
+  std::string error;
+  std::shared_ptr<cottontail::Federation> federation =
+      cottontail::Federation::make(members, &error);
+  ASSERT_NE(federation, nullptr) << error;
+  std::shared_ptr<cottontail::Stats> stats =
+      cottontail::Stats::make(whole, &error);
+  ASSERT_NE(stats, nullptr) << error;
+  EXPECT_EQ(federation->items(), 400.0);
+  EXPECT_NEAR(federation->avgl(), stats->avgl(), 1e-9);
+  EXPECT_EQ(federation->tokens(), whole->txt()->tokens());
+  std::map<std::string, cottontail::fval> parameters;
+  parameters["depth"] = 20;
+  std::map<std::string, cottontail::fval> query;
+  query["w0"] = 1.0;
+  query["w3"] = 1.0;
+  query["w12"] = 2.0;
+  query["rare"] = 1.0;
+  auto same = [](const std::vector<cottontail::FederatedResult> &federated,
+                 const std::vector<cottontail::RankingResult> &expected) {
+    ASSERT_EQ(federated.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); i++)
+      EXPECT_NEAR(federated[i].result.score(), expected[i].score(), 1e-9);
+  };
+  size_t skipped = 99;
+  same(federation->bm25(query, parameters, 1, &skipped),
+       cottontail::bm25_ranking(stats, query, parameters));
+  same(federation->bm25(query, parameters, 4),
+       cottontail::bm25_ranking(stats, query, parameters));
+  same(federation->lmd(query, parameters, 2),
+       cottontail::lmd_ranking(whole, query, parameters));
+  // Only the first member can contribute
+  std::map<std::string, cottontail::fval> rare;
+  rare["rare"] = 1.0;
+  std::vector<cottontail::FederatedResult> results =
+      federation->bm25(rare, parameters, 2, &skipped);
+  EXPECT_EQ(skipped, (size_t)1);
+  ASSERT_GT(results.size(), (size_t)0);
+  for (auto &result : results)
+    EXPECT_EQ(result.member, (size_t)0);
+  same(results, cottontail::bm25_ranking(stats, rare, parameters));
+  // Statistics of a member are those of the whole
+  std::shared_ptr<cottontail::Stats> member = federation->stats(1, query);
+  ASSERT_NE(member, nullptr);
+  EXPECT_NEAR(member->rsj("w3"), stats->rsj("w3"), 1e-9);
+  EXPECT_NEAR(member->avgl(), stats->avgl(), 1e-9);
+  for (auto &warren : members)
+    warren->end();
+  whole->end();
+}
@@ -0,0 +1,125 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "apps/frames.h"
+#include "src/nlohmann.h"
+
+namespace {
+std::string joined(const std::vector<std::string> &pieces) {
+  std::string frame;
+  for (auto &piece : pieces)
+    frame += piece;
+  return frame;
+}
+
+// The fields of a whole frame, after checking its header.
+std::string fields(const std::string &frame) {
+  EXPECT_GE(frame.size(), cottontail::FRAME_HEADER);
+  if (frame.size() < cottontail::FRAME_HEADER)
+    return "";
+  EXPECT_EQ(cottontail::frame_length(frame.data()),
+            frame.size() - cottontail::FRAME_HEADER);
+  return frame.substr(cottontail::FRAME_HEADER);
+}
+} // namespace
+
+TEST(Frames, RoundTrip) {
+  json object;
+  object["text"] = "hello \"world\"\n";
+  object["empty"] = "";
+  object["integer"] = 42;
+  object["negative"] = -7;
+  object["huge"] = INT64_MAX;
+  object["double"] = 3.25;
+  object["true"] = true;
+  object["false"] = false;
+  object["nested"] = {{"a", 1}, {"b", {1, 2, 3}}};
+  object["list"] = {"x", "y"};
+  object["null"] = nullptr;
+  std::string frame = cottontail::encode_frame(object);
+  json decoded;
+  std::string error;
+  ASSERT_TRUE(cottontail::decode_frame(fields(frame), &decoded, &error))
+      << error;
+  EXPECT_EQ(decoded, object);
+  EXPECT_TRUE(decoded["integer"].is_number_integer());
+  EXPECT_TRUE(decoded["double"].is_number_float());
+  EXPECT_TRUE(decoded["true"].is_boolean());
+  // An empty object is a header alone
+  frame = cottontail::encode_frame(json::object());
+  ASSERT_EQ(frame.size(), cottontail::FRAME_HEADER);
+  ASSERT_TRUE(cottontail::decode_frame(fields(frame), &decoded, &error));
+  EXPECT_EQ(decoded, json::object());
+}
+
+TEST(Frames, Big) {
+  json object;
+  object["op"] = "query";
+  object["snippet"] = std::string(1000, 's');
+  object["rank"] = 3;
+  object["document"] = "<DOC> text </DOC>";
+  json expected = object;
+  std::vector<std::string> pieces;
+  cottontail::encode_frame(&object, {"snippet", "document"}, &pieces);
+  // Big strings are moved into pieces of their own
+  EXPECT_EQ(object["snippet"], "");
+  EXPECT_EQ(object["document"], "");
+  ASSERT_GE(pieces.size(), (size_t)3);
+  size_t found = 0;
+  for (auto &piece : pieces)
+    if (piece == expected["snippet"] || piece == expected["document"])
+      found++;
+  EXPECT_EQ(found, (size_t)2);
+  json decoded;
+  std::string error;
+  ASSERT_TRUE(cottontail::decode_frame(fields(joined(pieces)), &decoded,
+                                       &error))
+      << error;
+  EXPECT_EQ(decoded, expected);
+  // A big field that isn't a string stays in place
+  object = expected;
+  cottontail::encode_frame(&object, {"rank"}, &pieces);
+  EXPECT_EQ(pieces.size(), (size_t)1);
+  EXPECT_EQ(object["rank"], 3);
+}
+
+TEST(Frames, Errors) {
+  json object;
+  object["text"] = "hello";
+  object["number"] = 1;
+  std::string all = fields(cottontail::encode_frame(object));
+  json decoded;
+  std::string error;
+  // Cut anywhere within a field, a frame is truncated
+  for (size_t length = 1; length < all.size(); length++) {
+    std::string cut = all.substr(0, length);
+    if (cottontail::decode_frame(cut, &decoded))
+      continue;
+    error = "";
+    EXPECT_FALSE(cottontail::decode_frame(cut, &decoded, &error));
+    EXPECT_EQ(error.find("Truncated frame field"), (size_t)0) << length;
+  }
+  json one;
+  one["k"] = "v";
+  std::string field = fields(cottontail::encode_frame(one));
+  ASSERT_EQ(field.size(), (size_t)(1 + 1 + 1 + 4 + 1));
+  ASSERT_EQ(field[2], 's');
+  // Unknown types, and known types of the wrong length, are refused
+  std::string bad = field;
+  bad[2] = 'x';
+  EXPECT_FALSE(cottontail::decode_frame(bad, &decoded, &error));
+  EXPECT_EQ(error.find("Bad frame field type"), (size_t)0);
+  bad[2] = 'i';
+  EXPECT_FALSE(cottontail::decode_frame(bad, &decoded, &error));
+  EXPECT_EQ(error.find("Bad frame field type"), (size_t)0);
+  bad[2] = 'j';
+  bad[7] = '{';
+  EXPECT_FALSE(cottontail::decode_frame(bad, &decoded, &error));
+  EXPECT_EQ(error.find("Bad JSON in frame field"), (size_t)0);
+  // An empty field list is an empty object
+  EXPECT_TRUE(cottontail::decode_frame("", &decoded, &error));
+  EXPECT_EQ(decoded, json::object());
+}
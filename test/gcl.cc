@@ -161,6 +161,304 @@ TEST(GCLTest, E2E) {
   EXPECT_EQ(q, 7);
 }
 
+TEST(GCLTest, Substitute) {
+  std::string testing = "testing";
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(testing);
+  std::string error;
+  std::shared_ptr<cottontail::Featurizer> featurizer =
+      cottontail::Featurizer::make("hashing", "", &error);
+  ASSERT_NE(featurizer, nullptr) << error;
+  std::shared_ptr<cottontail::Tokenizer> tokenizer =
+      cottontail::Tokenizer::make("ascii", "xml", &error);
+  ASSERT_NE(tokenizer, nullptr) << error;
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, featurizer, tokenizer, &error);
+  ASSERT_NE(builder, nullptr) << error;
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back("test/test0.txt");
+  ASSERT_TRUE(cottontail::build_trec(text, builder, &error)) << error;
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", testing, &error);
+  ASSERT_NE(warren, nullptr) << error;
+  warren->start();
+
+  auto intervals = [&](std::string g) -> std::string {
+    std::unique_ptr<cottontail::Hopper> hopper =
+        warren->hopper_from_gcl(g, &error);
+    EXPECT_NE(hopper, nullptr) << error;
+    if (hopper == nullptr)
+      return "";
+    std::string s;
+    cottontail::addr p, q;
+    for (hopper->tau(cottontail::minfinity + 1, &p, &q);
+         p < cottontail::maxfinity; hopper->tau(p + 1, &p, &q))
+      s += "(" + std::to_string(p) + "," + std::to_string(q) + ")";
+    return s;
+  };
+
+  EXPECT_EQ(intervals("(substitute hello world (^ ($ 1) ($ 2)))"),
+            intervals("(^ hello world)"));
+  EXPECT_EQ(
+      intervals("(substitute (^ hello world) (>> (... <TITLE> </TITLE>) ($ "
+                "1)))"),
+      intervals("(>> (... <TITLE> </TITLE>) (^ hello world))"));
+  EXPECT_EQ(intervals("(substitute (... hello world) (... world hello) (+ ($ "
+                      "1) ($ 2) ($ 1)))"),
+            intervals("(+ (... hello world) (... world hello))"));
+  EXPECT_EQ(intervals("(substitute hello (substitute world (^ ($ 1) ($ 1))))"),
+            intervals("world"));
+  EXPECT_EQ(intervals("(substitute hello)"), intervals("hello"));
+  EXPECT_EQ(intervals("(substitute nothing (... ($ 1) hello))"), "");
+
+  std::shared_ptr<cottontail::gcl::Cache> cache =
+      cottontail::gcl::Cache::make();
+  for (std::string g : {"(+ (^ hello world) (... world hello))",
+                        "(^ hello (+ hello world))", "hello",
+                        "(substitute hello (^ ($ 1) world))"}) {
+    std::unique_ptr<cottontail::Hopper> hopper =
+        cottontail::gcl::shared_hopper(g, warren.get(), cache, 1000, &error);
+    ASSERT_NE(hopper, nullptr) << error;
+    std::string s;
+    cottontail::addr p, q;
+    for (hopper->tau(cottontail::minfinity + 1, &p, &q);
+         p < cottontail::maxfinity; hopper->tau(p + 1, &p, &q))
+      s += "(" + std::to_string(p) + "," + std::to_string(q) + ")";
+    EXPECT_EQ(s, intervals(g)) << g;
+  }
+  EXPECT_GT(cache->metrics().hits, 0);
+
+  std::shared_ptr<cottontail::gcl::SExpression> expr =
+      cottontail::gcl::SExpression::from_string(
+          "(substitute (^ a b) (<< ($ 1) c))", &error);
+  ASSERT_NE(expr, nullptr) << error;
+  EXPECT_EQ(expr->to_string(), "(substitute (^ a b) (<< ($ 1) c))");
+  EXPECT_EQ(cottontail::gcl::SExpression::from_string("($ 1)", &error),
+            nullptr);
+  EXPECT_EQ(
+      cottontail::gcl::SExpression::from_string("(substitute ($ 1))", &error),
+      nullptr);
+  EXPECT_EQ(cottontail::gcl::SExpression::from_string(
+                "(substitute a (^ ($ 1) ($ 2)))", &error),
+            nullptr);
+  EXPECT_EQ(cottontail::gcl::SExpression::from_string(
+                "(substitute a (substitute b ($ 2)))", &error),
+            nullptr);
+  EXPECT_EQ(
+      cottontail::gcl::SExpression::from_string("(substitute a ($))", &error),
+      nullptr);
+  warren->end();
+}
+
+TEST(GCLTest, Cache) {
+  std::string testing = "testing";
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(testing);
+  std::string error;
+  std::shared_ptr<cottontail::Featurizer> featurizer =
+      cottontail::Featurizer::make("hashing", "", &error);
+  ASSERT_NE(featurizer, nullptr) << error;
+  std::shared_ptr<cottontail::Tokenizer> tokenizer =
+      cottontail::Tokenizer::make("ascii", "xml", &error);
+  ASSERT_NE(tokenizer, nullptr) << error;
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, featurizer, tokenizer, &error);
+  ASSERT_NE(builder, nullptr) << error;
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back("test/test0.txt");
+  ASSERT_TRUE(cottontail::build_trec(text, builder, &error)) << error;
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", testing, &error);
+  ASSERT_NE(warren, nullptr) << error;
+  std::shared_ptr<cottontail::gcl::Cache> cache =
+      cottontail::gcl::Cache::make();
+  ASSERT_NE(cache, nullptr);
+  warren->set_gcl_cache(cache);
+  warren->start();
+
+  auto intervals = [&](std::shared_ptr<cottontail::Warren> w,
+                       std::string g) -> std::string {
+    std::unique_ptr<cottontail::Hopper> hopper =
+        w->cached_hopper_from_gcl(g, &error);
+    EXPECT_NE(hopper, nullptr) << error;
+    if (hopper == nullptr)
+      return "";
+    std::string s;
+    cottontail::addr p, q;
+    for (hopper->tau(cottontail::minfinity + 1, &p, &q);
+         p < cottontail::maxfinity; hopper->tau(p + 1, &p, &q))
+      s += "(" + std::to_string(p) + "," + std::to_string(q) + ")";
+    return s;
+  };
+
+  std::string container = "(... <DOC> </DOC>)";
+  std::string expected = intervals(warren, container);
+  EXPECT_NE(expected, "");
+  cottontail::gcl::CacheMetrics metrics = cache->metrics();
+  EXPECT_EQ(metrics.hits, 0);
+  EXPECT_EQ(metrics.misses, 1);
+  EXPECT_EQ(metrics.entries, 1);
+  EXPECT_EQ(intervals(warren, container), expected);
+  std::shared_ptr<cottontail::Warren> clone = warren->clone(&error);
+  ASSERT_NE(clone, nullptr) << error;
+  EXPECT_EQ(clone->gcl_cache(), cache);
+  EXPECT_EQ(intervals(clone, container), expected);
+  metrics = cache->metrics();
+  EXPECT_EQ(metrics.hits, 2);
+  EXPECT_EQ(metrics.entries, 1);
+
+  // A substitute stage is shared with a later query naming the same intervals.
+  std::string s = intervals(
+      warren, "(substitute (^ hello world) (<< ($ 1) " + container + "))");
+  EXPECT_EQ(s, intervals(warren, "(<< (^ hello world) " + container + ")"));
+  EXPECT_EQ(intervals(warren, "(^ hello world)"),
+            intervals(warren, "(substitute (^ hello world) ($ 1))"));
+  metrics = cache->metrics();
+  EXPECT_GT(metrics.hits, 2);
+
+  cache->retire(1);
+  metrics = cache->metrics();
+  EXPECT_EQ(metrics.entries, 0);
+  EXPECT_EQ(metrics.bytes, 0);
+  EXPECT_GT(metrics.invalidations, 0);
+  EXPECT_EQ(intervals(warren, container), expected);
+
+  // Intervals cut short by the query budget are not cached.
+  std::string contained = "(<< world " + container + ")";
+  std::unique_ptr<cottontail::Hopper> hopper =
+      warren->hopper_from_gcl(contained, &error);
+  ASSERT_NE(hopper, nullptr) << error;
+  std::string full;
+  cottontail::addr p, q;
+  for (hopper->tau(cottontail::minfinity + 1, &p, &q);
+       p < cottontail::maxfinity; hopper->tau(p + 1, &p, &q))
+    full += "(" + std::to_string(p) + "," + std::to_string(q) + ")";
+  EXPECT_NE(full, "");
+  hopper = warren->cached_hopper_from_gcl(contained, &error);
+  ASSERT_NE(hopper, nullptr) << error;
+  {
+    cottontail::QueryBudget cancelled;
+    cancelled.cancel();
+    cottontail::QueryBudget::Scope scope(&cancelled);
+    hopper->tau(cottontail::minfinity + 1, &p, &q);
+    EXPECT_EQ(p, cottontail::maxfinity);
+    EXPECT_TRUE(cancelled.truncated());
+  }
+  EXPECT_EQ(intervals(warren, contained), full);
+
+  std::shared_ptr<cottontail::gcl::Cache> tiny =
+      cottontail::gcl::Cache::make(1024 * 1024, 1);
+  ASSERT_NE(tiny, nullptr);
+  warren->set_gcl_cache(tiny);
+  EXPECT_EQ(intervals(warren, "hello"), intervals(warren, "hello"));
+  EXPECT_EQ(intervals(warren, "world"), intervals(warren, "world"));
+  metrics = tiny->metrics();
+  EXPECT_EQ(metrics.entries, 1);
+  EXPECT_EQ(metrics.evictions, 1);
+  EXPECT_EQ(metrics.hits, 2);
+  EXPECT_EQ(cottontail::gcl::Cache::make(0), nullptr);
+  clone->end();
+  warren->end();
+}
+
+TEST(GCLTest, Profile) {
+  std::string testing = "testing";
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(testing);
+  std::string error;
+  std::shared_ptr<cottontail::Featurizer> featurizer =
+      cottontail::Featurizer::make("hashing", "", &error);
+  ASSERT_NE(featurizer, nullptr) << error;
+  std::shared_ptr<cottontail::Tokenizer> tokenizer =
+      cottontail::Tokenizer::make("ascii", "xml", &error);
+  ASSERT_NE(tokenizer, nullptr) << error;
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, featurizer, tokenizer, &error);
+  ASSERT_NE(builder, nullptr) << error;
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back("test/test0.txt");
+  ASSERT_TRUE(cottontail::build_trec(text, builder, &error)) << error;
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", testing, &error);
+  ASSERT_NE(warren, nullptr) << error;
+  warren->start();
+
+  std::vector<std::string> queries = {
+      "hello", "(... hello world)", "(<< (^ hello world) (... <DOC> </DOC>))",
+      "(+ hello world the)", "(substitute hello (^ ($ 1) world))"};
+  for (auto &query : queries) {
+    std::shared_ptr<cottontail::gcl::Profile> profile;
+    std::unique_ptr<cottontail::Hopper> profiled =
+        cottontail::gcl::profiled_hopper(query, warren.get(), &profile, &error);
+    ASSERT_NE(profiled, nullptr) << error;
+    ASSERT_NE(profile, nullptr);
+    std::unique_ptr<cottontail::Hopper> plain =
+        warren->hopper_from_gcl(query, &error);
+    ASSERT_NE(plain, nullptr) << error;
+    // Repeat each probe, and probe again at the endpoints of the answer, to
+    // exercise the rekeyed memos.
+    for (cottontail::addr k = 0; k < 600; k += 7) {
+      cottontail::addr p0, q0, p1, q1;
+      for (int i = 0; i < 2; i++) {
+        plain->tau(k, &p0, &q0);
+        profiled->tau(k, &p1, &q1);
+        EXPECT_EQ(p0, p1);
+        EXPECT_EQ(q0, q1);
+        plain->tau(p0, &p0, &q0);
+        profiled->tau(p1, &p1, &q1);
+        EXPECT_EQ(p0, p1);
+        EXPECT_EQ(q0, q1);
+        plain->rho(k, &p0, &q0);
+        profiled->rho(k, &p1, &q1);
+        EXPECT_EQ(p0, p1);
+        EXPECT_EQ(q0, q1);
+        plain->uat(k, &p0, &q0);
+        profiled->uat(k, &p1, &q1);
+        EXPECT_EQ(p0, p1);
+        EXPECT_EQ(q0, q1);
+        plain->ohr(k, &p0, &q0);
+        profiled->ohr(k, &p1, &q1);
+        EXPECT_EQ(p0, p1);
+        EXPECT_EQ(q0, q1);
+        plain->ohr(p0, &p0, &q0);
+        profiled->ohr(p1, &p1, &q1);
+        EXPECT_EQ(p0, p1);
+        EXPECT_EQ(q0, q1);
+      }
+    }
+    ASSERT_EQ(profile->children().size(), (size_t)1);
+    std::shared_ptr<cottontail::gcl::Profile> root = profile->children()[0];
+    EXPECT_GT(root->tau.calls, 0);
+    EXPECT_GT(root->tau.memo_hits, 0);
+    EXPECT_GT(root->calls(), root->tau.calls);
+    EXPECT_GE(root->nanoseconds, root->self_nanoseconds());
+    std::string dump = profile->dump();
+    EXPECT_EQ(dump.find(root->label() + ": tau "), (size_t)0);
+  }
+  std::shared_ptr<cottontail::gcl::Profile> profile;
+  std::unique_ptr<cottontail::Hopper> profiled =
+      cottontail::gcl::profiled_hopper("(<< hello (... <DOC> </DOC>))",
+                                       warren.get(), &profile, &error);
+  ASSERT_NE(profiled, nullptr) << error;
+  cottontail::addr p, q;
+  profiled->tau(cottontail::minfinity + 1, &p, &q);
+  ASSERT_EQ(profile->children().size(), (size_t)1);
+  std::shared_ptr<cottontail::gcl::Profile> root = profile->children()[0];
+  EXPECT_EQ(root->label(), "<<");
+  ASSERT_EQ(root->children().size(), (size_t)2);
+  EXPECT_EQ(root->children()[0]->label(), "hello");
+  EXPECT_EQ(root->children()[1]->label(), "...");
+  EXPECT_EQ(root->children()[1]->children().size(), (size_t)2);
+  EXPECT_NE(profile->dump().find("\n  hello: tau "), std::string::npos);
+  EXPECT_EQ(cottontail::gcl::profiled_hopper("(<< hello", warren.get(),
+                                             &profile, &error),
+            nullptr);
+  warren->end();
+}
+
 TEST(GCLTest, Link) {
   cottontail::addr n = 763;
   std::string burrow = cottontail::DEFAULT_BURROW;
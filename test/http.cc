@@ -0,0 +1,335 @@
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "apps/http.h"
+#include "src/cottontail.h"
+#include "src/nlohmann.h"
+
+namespace {
+std::shared_ptr<cottontail::Warren> http_warren(std::string *error) {
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(burrow);
+  if (working == nullptr)
+    return nullptr;
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, "", error);
+  if (builder == nullptr)
+    return nullptr;
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back("test/ranking.txt");
+  if (!cottontail::build_trec(text, builder, error))
+    return nullptr;
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", burrow, error);
+  if (warren == nullptr)
+    return nullptr;
+  warren->start();
+  warren->set_default_container("(... <DOC> </DOC>)");
+  if (!warren->set_parameter("id", "(... <DOCNO> </DOCNO>)", error) ||
+      !cottontail::tf_idf_annotations(warren, error))
+    return nullptr;
+  warren->end();
+  warren = cottontail::Warren::make("simple", burrow, error);
+  if (warren == nullptr)
+    return nullptr;
+  warren->start();
+  return warren;
+}
+
+cottontail::http::Request get(const std::string &target) {
+  cottontail::http::Request request;
+  int status;
+  std::string input = "GET " + target + " HTTP/1.1\r\n\r\n";
+  EXPECT_EQ(cottontail::http::parse_request(input, &request, &status),
+            input.size());
+  EXPECT_EQ(status, 0);
+  return request;
+}
+
+json body(const cottontail::http::Response &response) {
+  return json::parse(response.body);
+}
+
+// Reads responses from a blocking socket until count have arrived or the
+// server closes it, giving their status lines and bodies.
+std::vector<std::pair<std::string, std::string>> read_responses(int fd,
+                                                                size_t count) {
+  std::vector<std::pair<std::string, std::string>> responses;
+  std::string input;
+  char buffer[4096];
+  while (responses.size() < count) {
+    size_t header_end = input.find("\r\n\r\n");
+    if (header_end != std::string::npos) {
+      size_t length_at = input.find("Content-Length: ");
+      size_t length = std::stoul(input.substr(length_at + 16));
+      if (input.size() >= header_end + 4 + length) {
+        responses.emplace_back(input.substr(0, input.find("\r\n")),
+                               input.substr(header_end + 4, length));
+        input.erase(0, header_end + 4 + length);
+        continue;
+      }
+    }
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0)
+      break;
+    input.append(buffer, n);
+  }
+  return responses;
+}
+
+int connect_local(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  timeval timeout = {10, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) !=
+      0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool send_all(int fd, const std::string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, 0);
+    if (n <= 0)
+      return false;
+    sent += n;
+  }
+  return true;
+}
+} // namespace
+
+TEST(Http, Parse) {
+  cottontail::http::Request request;
+  int status;
+  std::string input = "GET /query?gcl=hello&n=5&text HTTP/1.1\r\n"
+                      "Host: localhost\r\n\r\n";
+  EXPECT_EQ(cottontail::http::parse_request(input.substr(0, 20), &request,
+                                            &status),
+            (size_t)0);
+  EXPECT_EQ(status, 0);
+  EXPECT_EQ(cottontail::http::parse_request(input, &request, &status),
+            input.size());
+  EXPECT_EQ(status, 0);
+  EXPECT_EQ(request.method, "GET");
+  EXPECT_EQ(request.path, "/query");
+  EXPECT_EQ(request.parameters["gcl"], "hello");
+  EXPECT_EQ(request.parameters["n"], "5");
+  EXPECT_EQ(request.parameters.count("text"), (size_t)1);
+  EXPECT_TRUE(request.keep_alive);
+  // Pipelined requests are taken one at a time
+  std::string second = "POST /rank HTTP/1.0\r\nContent-Type: application/json"
+                       "\r\nContent-Length: 24\r\n\r\n"
+                       "{\"query\":\"a+b\",\"n\":3}   ";
+  std::string third = "POST /rank HTTP/1.1\r\nConnection: close\r\n"
+                      "Content-Length: 17\r\n\r\nquery=a%2Bb&n=%33";
+  std::string pipelined = input + second + third;
+  size_t used = cottontail::http::parse_request(pipelined, &request, &status);
+  EXPECT_EQ(used, input.size());
+  pipelined.erase(0, used);
+  used = cottontail::http::parse_request(pipelined, &request, &status);
+  EXPECT_EQ(used, second.size());
+  EXPECT_EQ(request.parameters["query"], "a+b");
+  EXPECT_EQ(request.parameters["n"], "3");
+  EXPECT_EQ(request.parameters.count("gcl"), (size_t)0);
+  EXPECT_FALSE(request.keep_alive);
+  pipelined.erase(0, used);
+  used = cottontail::http::parse_request(pipelined, &request, &status);
+  EXPECT_EQ(used, third.size());
+  EXPECT_EQ(request.parameters["query"], "a+b");
+  EXPECT_EQ(request.parameters["n"], "3");
+  EXPECT_FALSE(request.keep_alive);
+  // Malformed requests
+  for (std::string bad :
+       {"GET\r\n\r\n", "GET / FTP/1.0\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: lots\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Type: application/json\r\n"
+        "Content-Length: 2\r\n\r\n[]"}) {
+    EXPECT_EQ(cottontail::http::parse_request(bad, &request, &status),
+              (size_t)0);
+    EXPECT_EQ(status, 400) << bad;
+  }
+  EXPECT_EQ(cottontail::http::parse_request(
+                "POST / HTTP/1.1\r\nContent-Length: 999999999999\r\n\r\n",
+                &request, &status),
+            (size_t)0);
+  EXPECT_EQ(status, 413);
+  EXPECT_EQ(cottontail::http::parse_request(
+                std::string(cottontail::http::MAX_HEADER + 1, 'x'), &request,
+                &status),
+            (size_t)0);
+  EXPECT_EQ(status, 413);
+}
+
+TEST(Http, Handle) {
+  std::string error;
+  std::shared_ptr<cottontail::Warren> warren = http_warren(&error);
+  ASSERT_NE(warren, nullptr) << error;
+  std::shared_ptr<cottontail::QueryContextPool> pool =
+      cottontail::QueryContextPool::make(warren, "", "", &error);
+  ASSERT_NE(pool, nullptr) << error;
+  cottontail::http::Service service(cottontail::DEFAULT_BURROW, warren, pool,
+                                    "bm25", cottontail::TextCache::make(1024));
+  cottontail::http::Response response =
+      service.handle(get("/query?gcl=hello&n=2&text"));
+  EXPECT_EQ(response.status, 200);
+  json answer = body(response);
+  ASSERT_EQ(answer["results"].size(), (size_t)2);
+  cottontail::addr p = answer["results"][0]["p"];
+  EXPECT_EQ(answer["results"][0]["text"], warren->txt()->translate(p, p));
+  cottontail::addr next = answer["next"];
+  response = service.handle(get("/query?gcl=hello&n=100&from=" +
+                                std::to_string(next)));
+  answer = body(response);
+  EXPECT_EQ(answer["results"][0]["p"], next);
+  EXPECT_EQ(answer.count("next"), (size_t)0);
+  response = service.handle(get("/rank?query=cat+hat&n=1"));
+  EXPECT_EQ(response.status, 200);
+  answer = body(response);
+  ASSERT_EQ(answer["results"].size(), (size_t)1);
+  EXPECT_NE(answer["results"][0]["snippet"].get<std::string>().find("cat"),
+            std::string::npos);
+  response = service.handle(get("/document?p=0&q=3"));
+  EXPECT_EQ(response.status, 200);
+  answer = body(response);
+  EXPECT_EQ(answer["text"], warren->txt()->translate(0, 3));
+  EXPECT_EQ(answer.count("next"), (size_t)0);
+  // Long ranges are capped
+  response = service.handle(get("/document?p=1&q=1000000000"));
+  EXPECT_EQ(response.status, 200);
+  answer = body(response);
+  EXPECT_EQ(answer["q"], cottontail::http::MAX_TOKENS);
+  EXPECT_EQ(answer["next"], cottontail::http::MAX_TOKENS + 1);
+  response = service.handle(get("/stats"));
+  EXPECT_EQ(response.status, 200);
+  answer = body(response);
+  EXPECT_EQ(answer["tokens"], warren->txt()->tokens());
+  EXPECT_GT(answer["text_cache"]["hits"].get<size_t>() +
+                answer["text_cache"]["misses"].get<size_t>(),
+            (size_t)0);
+  EXPECT_EQ(service.handle(get("/query")).status, 400);
+  EXPECT_EQ(service.handle(get("/query?gcl=(+")).status, 400);
+  EXPECT_EQ(service.handle(get("/query?gcl=hello&n=x")).status, 400);
+  EXPECT_EQ(service.handle(get("/rank?query=hat&pipeline=nonsense")).status,
+            400);
+  EXPECT_EQ(service.handle(get("/document?p=3&q=2")).status, 400);
+  EXPECT_EQ(service.handle(get("/document?p=3")).status, 400);
+  EXPECT_EQ(service.handle(get("/nowhere")).status, 404);
+  cottontail::http::Request request = get("/stats");
+  request.method = "DELETE";
+  EXPECT_EQ(service.handle(request).status, 405);
+  response = service.handle(get("/metrics"));
+  EXPECT_EQ(response.status, 200);
+  EXPECT_EQ(response.type, "text/plain; version=0.0.4");
+  EXPECT_NE(response.body.find("cottontail_http_requests_total{endpoint="
+                               "\"query\",code=\"200\"} 2"),
+            std::string::npos);
+  EXPECT_NE(response.body.find("cottontail_http_requests_total{endpoint="
+                               "\"other\",code=\"404\"} 1"),
+            std::string::npos);
+  warren->end();
+}
+
+TEST(Http, Loopback) {
+  std::string error;
+  std::shared_ptr<cottontail::Warren> warren = http_warren(&error);
+  ASSERT_NE(warren, nullptr) << error;
+  std::shared_ptr<cottontail::QueryContextPool> pool =
+      cottontail::QueryContextPool::make(warren, "", "", &error);
+  ASSERT_NE(pool, nullptr) << error;
+  cottontail::http::Service service(cottontail::DEFAULT_BURROW, warren, pool,
+                                    "bm25", nullptr);
+  uint16_t port = 0;
+  int listener = cottontail::http::listen_local(0, &port);
+  ASSERT_GE(listener, 0);
+  cottontail::http::EventLoop loop(&service, listener, 2);
+  bool served = false;
+  std::thread server([&] { served = loop.run(&error); });
+  int fd = connect_local(port);
+  ASSERT_GE(fd, 0);
+  // Pipelined requests are answered in order on one connection
+  std::string requests =
+      "GET /query?gcl=hat HTTP/1.1\r\n\r\n"
+      "POST /rank HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded"
+      "\r\nContent-Length: 17\r\n\r\nquery=quick&n=100"
+      "GET /document?p=0&q=1 HTTP/1.1\r\n\r\n"
+      "GET /stats HTTP/1.1\r\n\r\n"
+      "GET /metrics HTTP/1.1\r\n\r\n";
+  ASSERT_TRUE(send_all(fd, requests));
+  std::vector<std::pair<std::string, std::string>> responses =
+      read_responses(fd, 5);
+  ASSERT_EQ(responses.size(), (size_t)5);
+  for (auto &response : responses)
+    EXPECT_EQ(response.first, "HTTP/1.1 200 OK");
+  EXPECT_EQ(json::parse(responses[0].second)["results"].size(), (size_t)4);
+  EXPECT_EQ(json::parse(responses[1].second)["results"].size(), (size_t)1);
+  EXPECT_EQ(json::parse(responses[2].second)["text"],
+            warren->txt()->translate(0, 1));
+  EXPECT_EQ(json::parse(responses[3].second)["connections"], 1);
+  EXPECT_NE(responses[4].second.find("cottontail_http_connections 1"),
+            std::string::npos);
+  // A request split across writes is answered once complete
+  ASSERT_TRUE(send_all(fd, "GET /stats HT"));
+  ASSERT_TRUE(send_all(fd, "TP/1.1\r\nConnection: close\r\n\r\n"));
+  responses = read_responses(fd, 2);
+  ASSERT_EQ(responses.size(), (size_t)1);
+  EXPECT_EQ(responses[0].first, "HTTP/1.1 200 OK");
+  close(fd);
+  // A malformed request is answered and ends the connection, along with
+  // anything pipelined behind it
+  fd = connect_local(port);
+  ASSERT_GE(fd, 0);
+  ASSERT_TRUE(send_all(fd, "GET /stats HTTP/1.1\r\n\r\n"
+                           "NONSENSE\r\n\r\n"
+                           "GET /stats HTTP/1.1\r\n\r\n"));
+  responses = read_responses(fd, 3);
+  ASSERT_EQ(responses.size(), (size_t)2);
+  EXPECT_EQ(responses[0].first, "HTTP/1.1 200 OK");
+  EXPECT_EQ(responses[1].first, "HTTP/1.1 400 Bad Request");
+  close(fd);
+  fd = connect_local(port);
+  ASSERT_GE(fd, 0);
+  ASSERT_TRUE(send_all(fd, "GET /nowhere HTTP/1.1\r\n\r\n"
+                           "DELETE /stats HTTP/1.1\r\n\r\n"
+                           "GET /metrics HTTP/1.1\r\n\r\n"));
+  responses = read_responses(fd, 3);
+  ASSERT_EQ(responses.size(), (size_t)3);
+  EXPECT_EQ(responses[0].first, "HTTP/1.1 404 Not Found");
+  EXPECT_EQ(responses[1].first, "HTTP/1.1 405 Method Not Allowed");
+  EXPECT_NE(responses[2].second.find("cottontail_http_requests_total{endpoint="
+                                     "\"other\",code=\"400\"} 1"),
+            std::string::npos);
+  loop.stop();
+  server.join();
+  EXPECT_TRUE(served) << error;
+  // Connections still open are closed when the loop stops
+  char byte;
+  EXPECT_EQ(recv(fd, &byte, 1, 0), 0);
+  close(fd);
+  close(listener);
+  warren->end();
+}
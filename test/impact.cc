@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/cottontail.h"
+
+namespace {
+// Integer impacts no greater than 255, so quantization loses nothing. With
+// a unit, annotations are fval multiples of it instead.
+std::shared_ptr<cottontail::Warren>
+impact_warren(std::map<std::string,
+                       std::map<cottontail::addr, cottontail::addr>> *impacts,
+              std::string *error, cottontail::fval unit = 0.0) {
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  std::string filename = "testing.txt";
+  {
+    std::ofstream f(filename);
+    for (size_t i = 0; i < 1000; i++)
+      f << "<DOC>\n<DOCNO> " << i << " </DOCNO>\nsome text\n</DOC>\n";
+  }
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(burrow);
+  if (working == nullptr)
+    return nullptr;
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, "", error);
+  if (builder == nullptr)
+    return nullptr;
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back(filename);
+  if (!cottontail::build_trec(text, builder, error))
+    return nullptr;
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", burrow, error);
+  if (warren == nullptr)
+    return nullptr;
+  warren->start();
+  if (!warren->transaction(error))
+    return nullptr;
+  std::shared_ptr<cottontail::Featurizer> featurizer =
+      cottontail::TaggingFeaturizer::make(warren->featurizer(), "impact");
+  std::unique_ptr<cottontail::Hopper> docs =
+      warren->hopper_from_gcl("(... <DOC> </DOC>)", error);
+  cottontail::addr p, q;
+  size_t n = 0;
+  for (docs->tau(cottontail::minfinity + 1, &p, &q);
+       p < cottontail::maxfinity; docs->tau(p + 1, &p, &q), n++)
+    for (size_t i = 0; i < 10; i++)
+      if ((n * (i + 3)) % (i + 2) == 0) {
+        std::string term = "w" + std::to_string(i);
+        cottontail::addr impact = 1 + (n * 7919 + i * 104729) % 255;
+        bool okay =
+            unit > 0.0
+                ? warren->annotator()->annotate(featurizer->featurize(term), p,
+                                                p, impact * unit, error)
+                : warren->annotator()->annotate(featurizer->featurize(term), p,
+                                                p, impact, error);
+        if (!okay)
+          return nullptr;
+        (*impacts)[term][p] = impact;
+      }
+  if (!warren->ready())
+    return nullptr;
+  warren->commit();
+  warren->end();
+  warren = cottontail::Warren::make("simple", burrow, error);
+  if (warren == nullptr)
+    return nullptr;
+  warren->start();
+  return warren;
+}
+} // namespace
+
+TEST(Impact, Rank) {
+  std::string error;
+  std::map<std::string, std::map<cottontail::addr, cottontail::addr>> impacts;
+  std::shared_ptr<cottontail::Warren> warren = impact_warren(&impacts, &error);
+  ASSERT_NE(warren, nullptr) << error;
+  std::vector<std::string> terms;
+  for (size_t i = 0; i < 12; i++)
+    terms.push_back("w" + std::to_string(i));
+  std::shared_ptr<cottontail::ImpactIndex> built =
+      cottontail::ImpactIndex::build(warren, "impact", terms, true, &error);
+  ASSERT_NE(built, nullptr) << error;
+  EXPECT_EQ(built->size(), (size_t)10);
+  EXPECT_EQ(built->scale(), 1.0);
+  ASSERT_TRUE(built->store(warren->working(), "impact", &error)) << error;
+  std::shared_ptr<cottontail::ImpactIndex> index =
+      cottontail::ImpactIndex::load(warren->working(), "impact", &error);
+  ASSERT_NE(index, nullptr) << error;
+  EXPECT_EQ(index->size(), (size_t)10);
+  EXPECT_EQ(cottontail::ImpactIndex::load(warren->working(), "missing"),
+            nullptr);
+  for (size_t depth : {1, 10, 100}) {
+    for (std::string query : {"w0 w3", "w1 w2 w4 w5 w6 w7 w8 w9", "w9 w11"}) {
+      std::map<std::string, cottontail::fval> weighted;
+      std::map<cottontail::addr, cottontail::fval> scores;
+      for (auto &term : warren->tokenizer()->split(query)) {
+        weighted[term] += 1.0;
+        for (auto &impact : impacts[term])
+          scores[impact.first] += impact.second;
+      }
+      std::vector<cottontail::fval> expected;
+      for (auto &score : scores)
+        expected.push_back(score.second);
+      std::sort(expected.rbegin(), expected.rend());
+      if (expected.size() > depth)
+        expected.resize(depth);
+      std::vector<cottontail::RankingResult> results =
+          index->rank(weighted, depth);
+      ASSERT_EQ(results.size(), expected.size()) << query;
+      for (size_t i = 0; i < results.size(); i++) {
+        EXPECT_EQ(results[i].score(), expected[i]) << query;
+        EXPECT_EQ(results[i].score(), scores[results[i].p()]) << query;
+      }
+    }
+  }
+  warren->end();
+}
+
+TEST(Impact, Budget) {
+  std::string error;
+  std::map<std::string, std::map<cottontail::addr, cottontail::addr>> impacts;
+  std::shared_ptr<cottontail::Warren> warren = impact_warren(&impacts, &error);
+  ASSERT_NE(warren, nullptr) << error;
+  std::vector<std::string> terms = {"w0", "w1"};
+  std::shared_ptr<cottontail::ImpactIndex> index =
+      cottontail::ImpactIndex::build(warren, "impact", terms, true, &error);
+  ASSERT_NE(index, nullptr) << error;
+  std::map<std::string, cottontail::fval> query;
+  query["w0"] = 1.0;
+  query["w1"] = 1.0;
+  // A budget of one posting processes only the single highest segment
+  cottontail::addr highest = 0;
+  for (auto &term : terms)
+    for (auto &impact : impacts[term])
+      highest = std::max(highest, impact.second);
+  std::vector<cottontail::RankingResult> results = index->rank(query, 100, 1);
+  ASSERT_GT(results.size(), (size_t)0);
+  for (auto &result : results)
+    EXPECT_EQ(result.score(), highest);
+  EXPECT_LT(results.size(), index->rank(query, 100).size());
+  // Out of time after the highest segment, nothing more is processed
+  std::vector<cottontail::RankingResult> timed =
+      index->rank(query, 100, 0, 1);
+  ASSERT_EQ(timed.size(), results.size());
+  for (size_t i = 0; i < timed.size(); i++)
+    EXPECT_EQ(timed[i].p(), results[i].p());
+  warren->end();
+}
+
+TEST(Impact, Scale) {
+  std::string error;
+  std::map<std::string, std::map<cottontail::addr, cottontail::addr>> impacts;
+  cottontail::fval unit = 0.001;
+  std::shared_ptr<cottontail::Warren> warren =
+      impact_warren(&impacts, &error, unit);
+  ASSERT_NE(warren, nullptr) << error;
+  std::vector<std::string> terms = {"w0", "w1", "w2"};
+  cottontail::addr highest = 0;
+  for (auto &term : terms)
+    for (auto &impact : impacts[term])
+      highest = std::max(highest, impact.second);
+  // Impacts below one still spread over the levels
+  std::shared_ptr<cottontail::ImpactIndex> index =
+      cottontail::ImpactIndex::build(warren, "impact", terms, false, &error);
+  ASSERT_NE(index, nullptr) << error;
+  cottontail::fval scale = highest * unit / cottontail::ImpactIndex::LEVELS;
+  EXPECT_DOUBLE_EQ(index->scale(), scale);
+  std::map<std::string, cottontail::fval> query;
+  std::map<cottontail::addr, cottontail::fval> scores;
+  for (auto &term : terms) {
+    query[term] = 1.0;
+    for (auto &impact : impacts[term])
+      scores[impact.first] += impact.second * unit;
+  }
+  std::vector<cottontail::RankingResult> results = index->rank(query, 100);
+  ASSERT_EQ(results.size(), (size_t)100);
+  for (auto &result : results)
+    EXPECT_NEAR(result.score(), scores[result.p()], terms.size() * scale);
+  // No impacts at all
+  index = cottontail::ImpactIndex::build(warren, "impact", {"w99"}, false,
+                                         &error);
+  ASSERT_NE(index, nullptr) << error;
+  EXPECT_EQ(index->scale(), 1.0);
+  EXPECT_EQ(index->rank(query, 10).size(), (size_t)0);
+  warren->end();
+}
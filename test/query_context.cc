@@ -0,0 +1,79 @@
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/cottontail.h"
+
+TEST(QueryContext, Pool) {
+  std::string error;
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(burrow);
+  ASSERT_NE(working, nullptr);
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, "", &error);
+  ASSERT_NE(builder, nullptr);
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back("test/ranking.txt");
+  ASSERT_TRUE(cottontail::build_trec(text, builder, &error));
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", burrow, &error);
+  ASSERT_NE(warren, nullptr);
+  EXPECT_EQ(cottontail::QueryContextPool::make(warren, "", "", &error),
+            nullptr);
+  warren->start();
+  warren->set_default_container("(... <DOC> </DOC>)");
+  ASSERT_TRUE(warren->set_parameter("id", "(... <DOCNO> </DOCNO>)", &error));
+  ASSERT_TRUE(cottontail::tf_idf_annotations(warren, &error)) << error;
+  warren->end();
+  warren = cottontail::Warren::make("simple", burrow, &error);
+  ASSERT_NE(warren, nullptr);
+  warren->start();
+  std::shared_ptr<cottontail::QueryContextPool> pool =
+      cottontail::QueryContextPool::make(warren, "", "", &error);
+  ASSERT_NE(pool, nullptr) << error;
+  cottontail::QueryContext *first;
+  {
+    std::shared_ptr<cottontail::QueryContext> a = pool->acquire(&error);
+    ASSERT_NE(a, nullptr) << error;
+    std::shared_ptr<cottontail::QueryContext> b = pool->acquire(&error);
+    ASSERT_NE(b, nullptr) << error;
+    EXPECT_NE(a.get(), b.get());
+    EXPECT_NE(a->warren(), warren);
+    EXPECT_TRUE(a->warren()->started());
+    ASSERT_NE(a->stats(), nullptr);
+    std::shared_ptr<cottontail::Ranker> ranker = a->ranker("bm25", &error);
+    ASSERT_NE(ranker, nullptr) << error;
+    EXPECT_EQ(a->ranker("bm25"), ranker);
+    EXPECT_EQ(a->ranker("nonsense", &error), nullptr);
+    first = a.get();
+    EXPECT_EQ(pool->idle(), (size_t)0);
+  }
+  EXPECT_EQ(pool->idle(), (size_t)2);
+  {
+    std::shared_ptr<cottontail::QueryContext> c = pool->acquire(&error);
+    ASSERT_NE(c, nullptr) << error;
+    EXPECT_TRUE(c.get() == first || pool->idle() == 1);
+  }
+  // Reused contexts rank as fresh ones do
+  std::map<std::string, std::string> queries;
+  queries["1"] = "quick fox";
+  queries["2"] = "cat hat";
+  std::map<std::string, std::vector<std::string>> pooled, fresh;
+  ASSERT_TRUE(cottontail::trec(pool, "bm25", queries, &pooled, &error, 2))
+      << error;
+  ASSERT_TRUE(cottontail::trec(pool, "bm25", queries, &pooled, &error, 2))
+      << error;
+  ASSERT_TRUE(cottontail::trec(warren, "", "", "bm25", queries, &fresh,
+                               &error, 2))
+      << error;
+  EXPECT_EQ(pooled, fresh);
+
+  EXPECT_GT(fresh["1"].size(), (size_t)0);
+  EXPECT_LE(pool->idle(), (size_t)2);
+  warren->end();
+}
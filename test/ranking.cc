@@ -1,4 +1,12 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <map>
 #include <memory>
+#include <set>
+#include <string>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -166,3 +174,690 @@ TEST(Ranking, DF) {
   EXPECT_EQ(topdoc, "<DOCNO> doc-002 </DOCNO>\n");
   warren->end();
 }
+
+namespace {
+// Skewed random text, so that some terms have long posting lists
+std::string skewed_collection(cottontail::addr documents) {
+  std::string filename = "testing.txt";
+  std::ofstream f(filename);
+  uint64_t seed = 12345;
+  auto next = [&]() {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return seed >> 33;
+  };
+  for (cottontail::addr i = 0; i < documents; i++) {
+    f << "<DOC>\n<DOCNO> " << i << " </DOCNO>\n";
+    size_t length = 5 + next() % 60;
+    for (size_t j = 0; j < length; j++) {
+      size_t r = next() % 1000;
+      f << "w" << (r * r) / 10000 << " ";
+    }
+    f << "\n</DOC>\n";
+  }
+  return filename;
+}
+
+std::vector<cottontail::fval>
+brute_bm25(std::shared_ptr<cottontail::Stats> stats,
+           const std::vector<std::string> &terms, cottontail::fval b,
+           cottontail::fval k1, size_t depth) {
+  std::map<cottontail::addr, cottontail::fval> scores;
+  cottontail::fval avgl = stats->avgl();
+  for (auto &term : terms) {
+    cottontail::fval idf = stats->rsj(term);
+    std::unique_ptr<cottontail::Hopper> hopper = stats->tf_hopper(term);
+    cottontail::addr p, q;
+    cottontail::fval tf;
+    for (hopper->tau(cottontail::minfinity + 1, &p, &q, &tf);
+         p < cottontail::maxfinity; hopper->tau(p + 1, &p, &q, &tf)) {
+      cottontail::fval l = q - p + 1.0;
+      scores[p] += tf * idf / (k1 * ((1.0 - b) + b * (l / avgl)) + tf);
+    }
+  }
+  std::vector<cottontail::fval> result;
+  for (auto &score : scores)
+    result.push_back(score.second);
+  std::sort(result.rbegin(), result.rend());
+  if (result.size() > depth)
+    result.resize(depth);
+  return result;
+}
+
+// Statistics that can be cloned only once, so that some of the workers
+// ranking ranges in parallel fail.
+class CloneOnceStats final : public cottontail::Stats {
+public:
+  CloneOnceStats(std::shared_ptr<cottontail::Stats> stats)
+      : Stats(stats->warren(), stats->stemmer(), stats->tokenizer()),
+        stats_(stats){};
+
+private:
+  bool have_(const std::string &name) final { return stats_->have(name); };
+  cottontail::fval avgl_() final { return stats_->avgl(); };
+  cottontail::fval tokens_() final { return stats_->tokens(); };
+  cottontail::fval occurrences_(const std::string &term) final {
+    return stats_->occurrences(term);
+  };
+  cottontail::fval idf_(const std::string &term) final {
+    return stats_->idf(term);
+  };
+  cottontail::fval rsj_(const std::string &term) final {
+    return stats_->rsj(term);
+  };
+  std::unique_ptr<cottontail::Hopper>
+  tf_hopper_(const std::string &term) final {
+    return stats_->tf_hopper(term);
+  };
+  std::unique_ptr<cottontail::Hopper>
+  tfmax_hopper_(const std::string &term) final {
+    return stats_->tfmax_hopper(term);
+  };
+  std::unique_ptr<cottontail::Hopper>
+  lmin_hopper_(const std::string &term) final {
+    return stats_->lmin_hopper(term);
+  };
+  std::unique_ptr<cottontail::Hopper>
+  tfpeak_hopper_(const std::string &term) final {
+    return stats_->tfpeak_hopper(term);
+  };
+  std::unique_ptr<cottontail::Hopper>
+  lpeak_hopper_(const std::string &term) final {
+    return stats_->lpeak_hopper(term);
+  };
+  std::unique_ptr<cottontail::Hopper> container_hopper_() final {
+    return stats_->container_hopper();
+  };
+  std::unique_ptr<cottontail::Hopper> id_hopper_() final {
+    return stats_->id_hopper();
+  };
+  std::shared_ptr<cottontail::Stats>
+  clone_(std::shared_ptr<cottontail::Warren> warren) final {
+    if (cloned_.exchange(true))
+      return nullptr;
+    return stats_->clone(warren);
+  };
+  std::shared_ptr<cottontail::Stats> stats_;
+  std::atomic<bool> cloned_{false};
+};
+} // namespace
+
+TEST(Ranking, BlockMax) {
+  std::string error;
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  std::string container = "(... <DOC> </DOC>)";
+  std::string filename = skewed_collection(5000);
+  for (size_t threads : {0, 1, 4}) {
+    std::shared_ptr<cottontail::Working> working =
+        cottontail::Working::mkdir(burrow);
+    ASSERT_NE(working, nullptr);
+    std::shared_ptr<cottontail::Builder> builder =
+        cottontail::SimpleBuilder::make(working, "", &error);
+    ASSERT_NE(builder, nullptr);
+    builder->verbose(false);
+    std::vector<std::string> text;
+    text.push_back(filename);
+    ASSERT_TRUE(cottontail::build_trec(text, builder, &error));
+    std::shared_ptr<cottontail::Warren> warren =
+        cottontail::Warren::make("simple", burrow, &error);
+    ASSERT_NE(warren, nullptr);
+    warren->start();
+    warren->set_default_container(container);
+    if (threads == 0)
+      ASSERT_TRUE(tf_df_annotations(warren, &error)) << error;
+    else
+      ASSERT_TRUE(
+          tf_annotations(warren, &error, 0, cottontail::maxfinity, threads))
+          << error;
+    warren->end();
+    warren = cottontail::Warren::make("simple", burrow, &error);
+    ASSERT_NE(warren, nullptr);
+    warren->start();
+    std::shared_ptr<cottontail::Stats> stats =
+        cottontail::Stats::make(warren, &error);
+    ASSERT_NE(stats, nullptr) << error;
+    std::unique_ptr<cottontail::Hopper> tfmax = stats->tfmax_hopper("w0");
+    cottontail::addr p, q;
+    tfmax->tau(cottontail::minfinity + 1, &p, &q);
+    EXPECT_LT(p, cottontail::maxfinity);
+    std::map<std::string, cottontail::fval> parameters;
+    parameters["b"] = 0.75;
+    parameters["k1"] = 0.9;
+    // Bounds from the peaks match bounds from all the blocks.
+    for (std::string term : {"w0", "w3", "w50", "w99"}) {
+      cottontail::fval idf = stats->rsj(term), avgl = stats->avgl();
+      cottontail::fval tf, l, expected = 0.0;
+      size_t blocks = 0, peaks = 0;
+      std::unique_ptr<cottontail::Hopper> tfmax = stats->tfmax_hopper(term);
+      std::unique_ptr<cottontail::Hopper> lmin = stats->lmin_hopper(term);
+      for (tfmax->tau(cottontail::minfinity + 1, &p, &q, &tf);
+           p < cottontail::maxfinity; tfmax->tau(p + 1, &p, &q, &tf)) {
+        cottontail::addr p0, q0;
+        lmin->tau(p, &p0, &q0, &l);
+        expected = std::max(
+            expected, tf * idf / (0.9 * (0.25 + 0.75 * (l / avgl)) + tf));
+        blocks++;
+      }
+      std::unique_ptr<cottontail::Hopper> tfpeak = stats->tfpeak_hopper(term);
+      for (tfpeak->tau(cottontail::minfinity + 1, &p, &q);
+           p < cottontail::maxfinity; tfpeak->tau(p + 1, &p, &q))
+        peaks++;
+      EXPECT_GT(peaks, (size_t)0) << term;
+      EXPECT_LE(peaks, blocks) << term;
+      EXPECT_NEAR(cottontail::bm25_bound(stats, {{term, 1.0}}, parameters),
+                  expected, 1e-9)
+          << term;
+    }
+    for (size_t depth : {1, 10, 100}) {
+      parameters["depth"] = depth;
+      for (std::string query : {"w0 w3 w50", "w1 w2 w4 w90 w99", "w7"}) {
+        std::vector<cottontail::RankingResult> results =
+            cottontail::bm25_ranking(stats, query, parameters);
+        std::vector<cottontail::fval> expected = brute_bm25(
+            stats, stats->tokenizer()->split(query), 0.75, 0.9, depth);
+        ASSERT_EQ(results.size(), expected.size()) << query;
+        for (size_t i = 0; i < results.size(); i++)
+          EXPECT_NEAR(results[i].score(), expected[i], 1e-9) << query;
+      }
+    }
+    warren->end();
+  }
+}
+
+TEST(Ranking, MaxScore) {
+  std::string error;
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  std::string container = "(... <DOC> </DOC>)";
+  std::string filename = skewed_collection(3000);
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(burrow);
+  ASSERT_NE(working, nullptr);
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, "", &error);
+  ASSERT_NE(builder, nullptr);
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back(filename);
+  ASSERT_TRUE(cottontail::build_trec(text, builder, &error));
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", burrow, &error);
+  ASSERT_NE(warren, nullptr);
+  warren->start();
+  warren->set_default_container(container);
+  ASSERT_TRUE(tf_idf_annotations(warren, &error)) << error;
+  // Impacts for the first ten terms, as from splade-annotate
+  ASSERT_TRUE(warren->transaction(&error)) << error;
+  std::shared_ptr<cottontail::Featurizer> impact_featurizer =
+      cottontail::TaggingFeaturizer::make(warren->featurizer(), "impact");
+  std::map<std::string, std::map<cottontail::addr, cottontail::addr>> impacts;
+  std::map<std::string, cottontail::addr> maxima;
+  std::unique_ptr<cottontail::Hopper> docs =
+      warren->hopper_from_gcl(container, &error);
+  cottontail::addr p, q;
+  size_t n = 0;
+  for (docs->tau(cottontail::minfinity + 1, &p, &q);
+       p < cottontail::maxfinity; docs->tau(p + 1, &p, &q), n++)
+    for (size_t i = 0; i < 10; i++)
+      if ((n * (i + 3)) % (i + 2) == 0) {
+        std::string term = "w" + std::to_string(i);
+        cottontail::addr impact = 1 + (n * 7919 + i * 104729) % 97;
+        ASSERT_TRUE(warren->annotator()->annotate(
+            impact_featurizer->featurize(term), p, p, impact, &error));
+        impacts[term][p] = impact;
+        maxima[term] = std::max(maxima[term], impact);
+      }
+  ASSERT_TRUE(cottontail::impact_max_annotations(warren, maxima, "impact",
+                                                 &error))
+      << error;
+  ASSERT_TRUE(warren->ready());
+  warren->commit();
+  warren->end();
+  warren = cottontail::Warren::make("simple", burrow, &error);
+  ASSERT_NE(warren, nullptr);
+  warren->start();
+
+  cottontail::fval mu = 100.0;
+  cottontail::fval tokens = warren->txt()->tokens();
+  std::shared_ptr<cottontail::Featurizer> tf_featurizer =
+      cottontail::TaggingFeaturizer::make(warren->featurizer(), "tf");
+  for (size_t depth : {1, 10, 100}) {
+    std::map<std::string, cottontail::fval> parameters;
+    parameters["mu"] = mu;
+    parameters["depth"] = depth;
+    for (std::string query : {"w0 w3 w50", "w1 w2 w4 w90 w99 w99", "w7"}) {
+      std::map<cottontail::addr, cottontail::fval> scores;
+      std::map<std::string, cottontail::fval> weighted;
+      for (auto &term : warren->tokenizer()->split(query))
+        weighted[term] += 1.0;
+      for (auto &term : weighted) {
+        cottontail::fval weight =
+            tokens / warren->idx()->count(
+                         warren->featurizer()->featurize(term.first));
+        std::unique_ptr<cottontail::Hopper> hopper =
+            warren->idx()->hopper(tf_featurizer->featurize(term.first));
+        cottontail::fval tf;
+        for (hopper->tau(cottontail::minfinity + 1, &p, &q, &tf);
+             p < cottontail::maxfinity; hopper->tau(p + 1, &p, &q, &tf))
+          scores[p] += term.second * (std::log(mu + tf * weight) -
+                                      std::log(mu + (q - p + 1.0)));
+      }
+      std::vector<cottontail::fval> expected;
+      for (auto &score : scores)
+        if (score.second > 0.0)
+          expected.push_back(score.second);
+      std::sort(expected.rbegin(), expected.rend());
+      if (expected.size() > depth)
+        expected.resize(depth);
+      std::vector<cottontail::RankingResult> results =
+          cottontail::lmd_ranking(warren, query, parameters);
+      ASSERT_EQ(results.size(), expected.size()) << query;
+      for (size_t i = 0; i < results.size(); i++)
+        EXPECT_NEAR(results[i].score(), expected[i], 1e-9) << query;
+    }
+    for (std::string query : {"w0 w3", "w1 w2 w4 w5 w6 w7 w8 w9", "w9 w9 w0"}) {
+      std::map<cottontail::addr, cottontail::fval> scores;
+      for (auto &term : warren->tokenizer()->split(query))
+        for (auto &impact : impacts[term])
+          scores[impact.first] += impact.second;
+      std::vector<cottontail::fval> expected;
+      for (auto &score : scores)
+        expected.push_back(score.second);
+      std::sort(expected.rbegin(), expected.rend());
+      if (expected.size() > depth)
+        expected.resize(depth);
+      std::vector<cottontail::RankingResult> results =
+          cottontail::product_ranking(warren, query, parameters, "impact",
+                                      true);
+      ASSERT_EQ(results.size(), expected.size()) << query;
+      for (size_t i = 0; i < results.size(); i++)
+        EXPECT_EQ(results[i].score(), expected[i]) << query;
+    }
+  }
+  warren->end();
+}
+
+TEST(Ranking, SharedThreshold) {
+  std::string error;
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  std::string container = "(... <DOC> </DOC>)";
+  std::string filename = skewed_collection(2000);
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(burrow);
+  ASSERT_NE(working, nullptr);
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, "", &error);
+  ASSERT_NE(builder, nullptr);
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back(filename);
+  ASSERT_TRUE(cottontail::build_trec(text, builder, &error));
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", burrow, &error);
+  ASSERT_NE(warren, nullptr);
+  warren->start();
+  std::map<std::string, cottontail::fval> parameters;
+  cottontail::addr p, q;
+  ASSERT_TRUE(warren->txt()->range(&p, &q));
+  // Ranges ranked one after another, each pruning against the threshold
+  // left by the others, combine to the serial ranking
+  for (std::string gcl : {"(+ w0 w3 w7)", "(^ w1 w2)", "w40"}) {
+    for (size_t depth : {1, 10, 100}) {
+      std::vector<cottontail::RankingResult> serial =
+          cottontail::ssr_ranking(warren, gcl, container, parameters, depth);
+      cottontail::SharedThreshold shared;
+      cottontail::TopK merged(depth);
+      for (size_t i = 0; i < 4; i++) {
+        cottontail::addr start = p + (q - p + 1) * i / 4;
+        cottontail::addr end = p + (q - p + 1) * (i + 1) / 4;
+        merged.push(cottontail::ssr_ranking(warren, gcl, container,
+                                            parameters, depth, start, end,
+                                            &shared));
+      }
+      if (serial.size() == depth) {
+        EXPECT_LE(shared.value(), serial.back().score()) << gcl;
+      }
+      std::vector<cottontail::RankingResult> parallel = merged.results();
+      ASSERT_EQ(parallel.size(), serial.size()) << gcl;
+      for (size_t i = 0; i < serial.size(); i++)
+        EXPECT_EQ(parallel[i].score(), serial[i].score()) << gcl;
+    }
+  }
+  warren->end();
+}
+
+TEST(Ranking, Tiered) {
+  std::string error;
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  std::string container = "(... <DOC> </DOC>)";
+  std::string filename = skewed_collection(2000);
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(burrow);
+  ASSERT_NE(working, nullptr);
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, "", &error);
+  ASSERT_NE(builder, nullptr);
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back(filename);
+  ASSERT_TRUE(cottontail::build_trec(text, builder, &error));
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", burrow, &error);
+  ASSERT_NE(warren, nullptr);
+  warren->start();
+  std::map<std::string, cottontail::fval> parameters;
+  for (std::string query : {"w0 w3 w50 w7", "w1 w2 w90", "w40"}) {
+    std::vector<std::string> tiers =
+        cottontail::build_tiers(warren, query, parameters);
+    for (size_t depth : {1, 10, 100}) {
+      // Each tier ranked in full, as before early termination
+      std::vector<cottontail::RankingResult> expected;
+      std::set<cottontail::addr> seen;
+      for (auto &tier : tiers) {
+        for (auto &result : cottontail::ssr_ranking(warren, tier, container,
+                                                    parameters, depth))
+          if (expected.size() < depth &&
+              seen.insert(result.container_p()).second)
+            expected.push_back(result);
+      }
+      EXPECT_GT(expected.size(), (size_t)0) << query;
+      for (size_t threads : {1, 4}) {
+        std::vector<cottontail::RankingResult> results =
+            cottontail::tiered_ranking(warren, tiers, container, parameters,
+                                       depth, threads);
+        ASSERT_EQ(results.size(), expected.size()) << query;
+        for (size_t i = 0; i < results.size(); i++) {
+          EXPECT_EQ(results[i].container_p(), expected[i].container_p())
+              << query;
+          EXPECT_EQ(results[i].p(), expected[i].p()) << query;
+        }
+      }
+    }
+  }
+  warren->end();
+}
+
+TEST(Ranking, Parallel) {
+  std::string error;
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  std::string container = "(... <DOC> </DOC>)";
+  // Enough text for more than one range
+  std::string filename = skewed_collection(60000);
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(burrow);
+  ASSERT_NE(working, nullptr);
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, "", &error);
+  ASSERT_NE(builder, nullptr);
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back(filename);
+  ASSERT_TRUE(cottontail::build_trec(text, builder, &error));
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", burrow, &error);
+  ASSERT_NE(warren, nullptr);
+  warren->start();
+  ASSERT_GT(warren->txt()->tokens(), 2000000);
+  warren->set_default_container(container);
+  ASSERT_TRUE(tf_idf_annotations(warren, &error)) << error;
+  ASSERT_TRUE(warren->transaction(&error)) << error;
+  std::shared_ptr<cottontail::Featurizer> impact_featurizer =
+      cottontail::TaggingFeaturizer::make(warren->featurizer(), "impact");
+  std::map<std::string, cottontail::addr> maxima;
+  std::unique_ptr<cottontail::Hopper> docs =
+      warren->hopper_from_gcl(container, &error);
+  cottontail::addr p, q;
+  size_t n = 0;
+  for (docs->tau(cottontail::minfinity + 1, &p, &q);
+       p < cottontail::maxfinity; docs->tau(p + 1, &p, &q), n++)
+    for (size_t i = 0; i < 4; i++)
+      if (n % (i + 2) == 0) {
+        std::string term = "w" + std::to_string(i);
+        cottontail::addr impact = 1 + (n * 7919 + i * 104729) % 97;
+        ASSERT_TRUE(warren->annotator()->annotate(
+            impact_featurizer->featurize(term), p, p, impact, &error));
+        maxima[term] = std::max(maxima[term], impact);
+      }
+  ASSERT_TRUE(cottontail::impact_max_annotations(warren, maxima, "impact",
+                                                 &error))
+      << error;
+  ASSERT_TRUE(warren->ready());
+  warren->commit();
+  warren->end();
+  warren = cottontail::Warren::make("simple", burrow, &error);
+  ASSERT_NE(warren, nullptr);
+  warren->start();
+  std::shared_ptr<cottontail::Stats> stats =
+      cottontail::Stats::make(warren, &error);
+  ASSERT_NE(stats, nullptr) << error;
+  auto same = [](const std::vector<cottontail::RankingResult> &a,
+                 const std::vector<cottontail::RankingResult> &b) {
+    ASSERT_EQ(a.size(), b.size());
+    for (size_t i = 0; i < a.size(); i++)
+      EXPECT_NEAR(a[i].score(), b[i].score(), 1e-9);
+  };
+  std::map<std::string, cottontail::fval> parameters;
+  parameters["depth"] = 20;
+  std::map<std::string, cottontail::fval> query;
+  query["w0"] = 1.0;
+  query["w2"] = 2.0;
+  query["w30"] = 1.0;
+  std::vector<cottontail::RankingResult> serial =
+      cottontail::bm25_ranking(stats, query, parameters);
+  ASSERT_EQ(serial.size(), (size_t)20);
+  same(cottontail::parallel_bm25(stats, query, parameters, 4), serial);
+  serial = cottontail::lmd_ranking(warren, query, parameters);
+  ASSERT_EQ(serial.size(), (size_t)20);
+  same(cottontail::parallel_lmd(warren, query, parameters, 4), serial);
+  serial = cottontail::product_ranking(warren, query, parameters, "impact",
+                                       true);
+  ASSERT_EQ(serial.size(), (size_t)20);
+  same(cottontail::parallel_product(warren, query, parameters, "impact", true,
+                                    4),
+       serial);
+  for (std::string pipeline : {"bm25", "lmd", "product:impact"}) {
+    std::shared_ptr<cottontail::Ranker> ranker =
+        cottontail::Ranker::from_pipeline(pipeline, stats, &error);
+    ASSERT_NE(ranker, nullptr) << error;
+    std::shared_ptr<cottontail::Ranker> parallel =
+        cottontail::Ranker::from_pipeline("threads=4 " + pipeline, stats,
+                                          &error);
+    ASSERT_NE(parallel, nullptr) << error;
+    same((*parallel)("w0 w2 w2 w30"), (*ranker)("w0 w2 w2 w30"));
+  }
+  // A worker that can't clone the statistics fails the whole ranking
+  std::shared_ptr<cottontail::Stats> once =
+      std::make_shared<CloneOnceStats>(stats);
+  EXPECT_EQ(cottontail::parallel_bm25(once, query, parameters, 4).size(),
+            (size_t)0);
+  once = std::make_shared<CloneOnceStats>(stats);
+  EXPECT_EQ(cottontail::parallel_lmd(once, query, parameters, 4).size(),
+            (size_t)0);
+  for (size_t threads : {1, 4}) {
+    cottontail::QueryBudget cancelled;
+    cancelled.cancel();
+    cottontail::QueryBudget::Scope scope(&cancelled);
+    EXPECT_EQ(cottontail::parallel_bm25(stats, query, parameters, threads)
+                  .size(),
+              (size_t)0);
+    EXPECT_EQ(cottontail::parallel_lmd(warren, query, parameters, threads)
+                  .size(),
+              (size_t)0);
+    EXPECT_EQ(cottontail::parallel_product(warren, query, parameters,
+                                           "impact", true, threads)
+                  .size(),
+              (size_t)0);
+    EXPECT_TRUE(cancelled.truncated());
+  }
+  warren->end();
+}
+
+TEST(Ranking, Pages) {
+  std::string error;
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  std::string container = "(... <DOC> </DOC>)";
+  std::string filename = skewed_collection(2000);
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(burrow);
+  ASSERT_NE(working, nullptr);
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, "", &error);
+  ASSERT_NE(builder, nullptr);
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back(filename);
+  ASSERT_TRUE(cottontail::build_trec(text, builder, &error));
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", burrow, &error);
+  ASSERT_NE(warren, nullptr);
+  warren->start();
+  warren->set_default_container(container);
+  ASSERT_TRUE(tf_idf_annotations(warren, &error)) << error;
+  warren->end();
+  warren = cottontail::Warren::make("simple", burrow, &error);
+  ASSERT_NE(warren, nullptr);
+  warren->start();
+  std::shared_ptr<cottontail::Stats> stats =
+      cottontail::Stats::make(warren, &error);
+  ASSERT_NE(stats, nullptr) << error;
+  constexpr size_t DEPTH = 60;
+  constexpr size_t PAGE = 7;
+  auto same = [](const std::vector<cottontail::RankingResult> &a,
+                 const std::vector<cottontail::RankingResult> &b) {
+    ASSERT_EQ(a.size(), b.size());
+    for (size_t i = 0; i < a.size(); i++) {
+      EXPECT_EQ(a[i].p(), b[i].p());
+      EXPECT_EQ(a[i].score(), b[i].score());
+    }
+  };
+  // Pages ranked one after another, each resuming after the last result of
+  // the one before, concatenate to the full ranking
+  auto pages = [&](std::function<std::vector<cottontail::RankingResult>(
+                       std::map<std::string, cottontail::fval> &)>
+                       rank) {
+    std::map<std::string, cottontail::fval> parameters;
+    parameters["depth"] = DEPTH;
+    std::vector<cottontail::RankingResult> full = rank(parameters);
+    EXPECT_GT(full.size(), PAGE);
+    std::vector<cottontail::RankingResult> paged;
+    parameters["depth"] = PAGE;
+    while (paged.size() < DEPTH) {
+      std::vector<cottontail::RankingResult> page = rank(parameters);
+      for (size_t i = 0; i < page.size() && paged.size() < DEPTH; i++)
+        paged.push_back(page[i]);
+      if (page.size() < PAGE)
+        break;
+      cottontail::resume_after(page.back(), &parameters);
+    }
+    same(paged, full);
+  };
+  std::map<std::string, cottontail::fval> query;
+  query["w0"] = 1.0;
+  query["w3"] = 2.0;
+  query["w50"] = 1.0;
+  pages([&](std::map<std::string, cottontail::fval> &parameters) {
+    return cottontail::ssr_ranking(warren, "(+ w0 w3 w50)", container,
+                                   parameters, parameters["depth"]);
+  });
+  pages([&](std::map<std::string, cottontail::fval> &parameters) {
+    return cottontail::bm25_ranking(stats, query, parameters);
+  });
+  pages([&](std::map<std::string, cottontail::fval> &parameters) {
+    return cottontail::lmd_ranking(warren, query, parameters);
+  });
+  std::shared_ptr<cottontail::Ranker> ranker =
+      cottontail::Ranker::from_pipeline("bm25", stats, &error);
+  ASSERT_NE(ranker, nullptr) << error;
+  std::map<std::string, cottontail::fval> parameters;
+  parameters["depth"] = DEPTH;
+  std::vector<cottontail::RankingResult> full =
+      (*ranker)("w0 w3 w3 w50", &parameters);
+  std::vector<cottontail::RankingResult> paged =
+      ranker->page("w0 w3 w3 w50", PAGE);
+  while (paged.size() < full.size()) {
+    std::vector<cottontail::RankingResult> page =
+        ranker->page("w0 w3 w3 w50", PAGE, &paged.back());
+    ASSERT_GT(page.size(), (size_t)0);
+    paged.insert(paged.end(), page.begin(), page.end());
+  }
+  paged.resize(full.size());
+  same(paged, full);
+  // Pages end when the final stage doesn't resume
+  for (std::string pipeline :
+       {"bm25 stem", "bm25 kld", "depth=20 bm25 stop"}) {
+    ranker = cottontail::Ranker::from_pipeline(pipeline, stats, &error);
+    ASSERT_NE(ranker, nullptr) << error;
+    full = ranker->page("w0 w3 w3 w50", 1000);
+    EXPECT_GT(full.size(), PAGE) << pipeline;
+    paged = ranker->page("w0 w3 w3 w50", PAGE);
+    for (size_t i = 0; i < full.size() && paged.size() > 0; i++) {
+      std::vector<cottontail::RankingResult> page =
+          ranker->page("w0 w3 w3 w50", PAGE, &paged.back());
+      if (page.size() == 0)
+        break;
+      paged.insert(paged.end(), page.begin(), page.end());
+    }
+    same(paged, full);
+  }
+  warren->end();
+}
+
+TEST(Ranking, Budget) {
+  std::string error;
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  std::string container = "(... <DOC> </DOC>)";
+  std::string filename = skewed_collection(2000);
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(burrow);
+  ASSERT_NE(working, nullptr);
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, "", &error);
+  ASSERT_NE(builder, nullptr);
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back(filename);
+  ASSERT_TRUE(cottontail::build_trec(text, builder, &error));
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", burrow, &error);
+  ASSERT_NE(warren, nullptr);
+  warren->start();
+  std::map<std::string, cottontail::fval> parameters;
+  std::string gcl = "(+ w0 w3 w7)";
+  std::vector<cottontail::RankingResult> full =
+      cottontail::ssr_ranking(warren, gcl, container, parameters, 100);
+  ASSERT_EQ(full.size(), (size_t)100);
+  cottontail::QueryBudget ample(60 * 1000);
+  std::vector<cottontail::RankingResult> results = cottontail::ssr_ranking(
+      warren, gcl, container, parameters, 100, cottontail::minfinity,
+      cottontail::maxfinity, nullptr, &ample);
+  EXPECT_FALSE(ample.truncated());
+  ASSERT_EQ(results.size(), full.size());
+  for (size_t i = 0; i < full.size(); i++)
+    EXPECT_EQ(results[i].p(), full[i].p());
+  for (size_t threads : {1, 4}) {
+    cottontail::QueryBudget cancelled;
+    EXPECT_FALSE(cancelled.spent());
+    cancelled.cancel();
+    EXPECT_TRUE(cancelled.spent());
+    results = cottontail::parallel_ssr(warren, gcl, container, parameters,
+                                       100, threads, nullptr, &cancelled);
+    EXPECT_TRUE(cancelled.truncated());
+    EXPECT_LE(results.size(), full.size());
+  }
+  std::unique_ptr<cottontail::Hopper> hopper =
+      warren->hopper_from_gcl("(<< w7 " + container + ")", &error);
+  ASSERT_NE(hopper, nullptr) << error;
+  cottontail::addr p, q;
+  {
+    cottontail::QueryBudget cancelled;
+    cancelled.cancel();
+    cottontail::QueryBudget::Scope scope(&cancelled);
+    hopper->tau(cottontail::minfinity + 1, &p, &q);
+    EXPECT_EQ(p, cottontail::maxfinity);
+    EXPECT_EQ(warren->hopper_from_gcl(gcl, &error), nullptr);
+    EXPECT_TRUE(cancelled.truncated());
+  }
+  hopper = warren->hopper_from_gcl("(<< w7 " + container + ")", &error);
+  ASSERT_NE(hopper, nullptr) << error;
+  hopper->tau(cottontail::minfinity + 1, &p, &q);
+  EXPECT_LT(p, cottontail::maxfinity);
+  warren->end();
+}
@@ -0,0 +1,133 @@
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/bigwig.h"
+#include "src/cottontail.h"
+
+namespace {
+// Text from the cache must match the txt, with tokens at the offsets.
+void same_text(std::shared_ptr<cottontail::Warren> warren,
+               std::shared_ptr<cottontail::TextCache> cache,
+               cottontail::addr tokens) {
+  std::shared_ptr<cottontail::Tokenizer> tokenizer = warren->tokenizer();
+  for (cottontail::addr p = 0; p < tokens; p += 3)
+    for (cottontail::addr q = p; q < tokens + 2; q += 5) {
+      std::string text;
+      std::vector<size_t> offsets;
+      ASSERT_TRUE(cache->text("test", warren->txt(), tokenizer, p, q, &text,
+                              &offsets));
+      EXPECT_EQ(text, warren->txt()->translate(p, q));
+      cottontail::addr last = std::min(q, tokens - 1);
+      ASSERT_EQ(offsets.size(), (size_t)(last - p + 2));
+      for (cottontail::addr i = p; i <= last; i++) {
+        std::string token = warren->txt()->translate(i, i);
+        EXPECT_EQ(text.substr(offsets[i - p], token.length()), token);
+      }
+    }
+}
+} // namespace
+
+TEST(Snippet, SimpleText) {
+  std::ofstream out("snippet.txt");
+  std::string words[] = {"alpha", "beta", "gamma", "delta", "epsilon"};
+  for (size_t i = 0; i < 4; i++) {
+    out << "<DOC>\n<DOCNO> " << i << " </DOCNO>\n";
+    for (size_t j = 0; j < 60; j++)
+      out << words[(i * 7 + j * j) % 5] << (j % 9 == 8 ? ".\n" : " ");
+    if (i == 2)
+      out << "tiger, burning bright. ";
+    for (size_t j = 0; j < 60; j++)
+      out << words[(i + j) % 5] << " ";
+    out << "\n</DOC>\n";
+  }
+  out.close();
+  std::string error;
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(cottontail::DEFAULT_BURROW);
+  ASSERT_NE(working, nullptr);
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, "", &error);
+  ASSERT_NE(builder, nullptr) << error;
+  builder->verbose(false);
+  ASSERT_TRUE(cottontail::build_trec({"snippet.txt"}, builder, &error));
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", cottontail::DEFAULT_BURROW, &error);
+  ASSERT_NE(warren, nullptr) << error;
+  warren->start();
+  cottontail::addr tokens = warren->txt()->tokens();
+  std::shared_ptr<cottontail::TextCache> cache =
+      cottontail::TextCache::make(1024 * 1024, 7);
+  same_text(warren, cache, tokens);
+  EXPECT_GT(cache->hits(), (size_t)0);
+  EXPECT_GT(cache->bytes(), (size_t)0);
+  // A budget too small for a block caches nothing
+  std::shared_ptr<cottontail::TextCache> tiny =
+      cottontail::TextCache::make(16, 7);
+  same_text(warren, tiny, tokens);
+  EXPECT_EQ(tiny->hits(), (size_t)0);
+  EXPECT_EQ(tiny->bytes(), (size_t)0);
+  // The window goes to the rare terms, which are highlighted
+  std::unique_ptr<cottontail::Hopper> docs =
+      warren->hopper_from_gcl("(... <DOC> </DOC>)");
+  ASSERT_NE(docs, nullptr);
+  cottontail::addr p, q;
+  docs->tau(0, &p, &q);
+  docs->tau(q + 1, &p, &q);
+  docs->tau(q + 1, &p, &q);
+  cottontail::Snippet snippet;
+  for (auto with : {cache, std::shared_ptr<cottontail::TextCache>()}) {
+    ASSERT_TRUE(cottontail::snippet(warren, {"burning", "tiger", "tiger"}, p,
+                                    q, 10, &snippet, with, "test", &error))
+        << error;
+    EXPECT_EQ(snippet.q - snippet.p + 1, 10);
+    EXPECT_GE(snippet.p, p);
+    EXPECT_LE(snippet.q, q);
+    EXPECT_EQ(snippet.text, warren->txt()->translate(snippet.p, snippet.q));
+    ASSERT_EQ(snippet.highlights.size(), (size_t)2);
+    EXPECT_EQ(snippet.text.substr(snippet.highlights[0].first,
+                                  snippet.highlights[0].second),
+              "tiger");
+    EXPECT_EQ(snippet.text.substr(snippet.highlights[1].first,
+                                  snippet.highlights[1].second),
+              "burning");
+  }
+  // A short range is taken whole
+  ASSERT_TRUE(cottontail::snippet(warren, {"alpha"}, p, p + 4, 10, &snippet,
+                                  cache, "test", &error));
+  EXPECT_EQ(snippet.p, p);
+  EXPECT_EQ(snippet.q, p + 4);
+  EXPECT_FALSE(cottontail::snippet(warren, {"alpha"}, q, p, 10, &snippet));
+  warren->end();
+}
+
+TEST(Snippet, BigwigText) {
+  std::shared_ptr<cottontail::Featurizer> featurizer =
+      cottontail::Featurizer::make("hashing", "");
+  ASSERT_NE(featurizer, nullptr);
+  std::shared_ptr<cottontail::Tokenizer> tokenizer =
+      cottontail::Tokenizer::make("ascii", "");
+  ASSERT_NE(tokenizer, nullptr);
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Bigwig::make(nullptr, featurizer, tokenizer);
+  ASSERT_NE(warren, nullptr);
+  for (size_t i = 0; i < 5; i++) {
+    cottontail::addr p, q;
+    ASSERT_TRUE(warren->transaction());
+    ASSERT_TRUE(warren->appender()->append(
+        "Tyger Tyger, burning bright, in the forests of the night; " +
+            std::to_string(i),
+        &p, &q));
+    ASSERT_TRUE(warren->ready());
+    warren->commit();
+  }
+  warren->start();
+  std::shared_ptr<cottontail::TextCache> cache =
+      cottontail::TextCache::make(1024 * 1024, 4);
+  same_text(warren, cache, warren->txt()->tokens());
+  EXPECT_GT(cache->hits(), (size_t)0);
+  warren->end();
+}
@@ -0,0 +1,403 @@
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "apps/frames.h"
+#include "apps/ssr.h"
+#include "src/cottontail.h"
+#include "src/nlohmann.h"
+
+namespace {
+const std::string CONTAINER = "(... <DOC> </DOC>)";
+const std::string DOCNO = "(... <DOCNO> </DOCNO>)";
+
+std::shared_ptr<cottontail::Warren> ssr_warren(std::string *error) {
+  std::string burrow = cottontail::DEFAULT_BURROW;
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(burrow);
+  if (working == nullptr)
+    return nullptr;
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, "", error);
+  if (builder == nullptr)
+    return nullptr;
+  builder->verbose(false);
+  std::vector<std::string> text;
+  text.push_back("test/ranking.txt");
+  if (!cottontail::build_trec(text, builder, error))
+    return nullptr;
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", burrow, error);
+  if (warren == nullptr)
+    return nullptr;
+  warren->start();
+  return warren;
+}
+
+std::unique_ptr<cottontail::ssr::Server>
+ssr_server(std::shared_ptr<cottontail::Warren> warren, cottontail::addr ttl,
+           std::string *error) {
+  std::shared_ptr<cottontail::QueryContextPool> pool =
+      cottontail::QueryContextPool::make(warren, "", "", error);
+  if (pool == nullptr)
+    return nullptr;
+  std::vector<cottontail::ssr::Collection> collections;
+  collections.push_back({cottontail::DEFAULT_BURROW, warren, pool, nullptr,
+                         nullptr, nullptr, nullptr});
+  return std::make_unique<cottontail::ssr::Server>(
+      CONTAINER, CONTAINER, DOCNO, std::vector<std::string>(), collections,
+      1024 * 1024, 0, 100, ttl, nullptr);
+}
+
+cottontail::ssr::Page page_of(size_t size) {
+  cottontail::ssr::Page page;
+  page.results.resize(size);
+  page.results.shrink_to_fit();
+  page.done = true;
+  return page;
+}
+
+// Pages through a query, giving the docnos in the order returned.
+std::vector<std::string> docnos(cottontail::ssr::Server *server,
+                                const std::string &query) {
+  std::vector<std::string> found;
+  json request;
+  request["op"] = "query";
+  request["query"] = query;
+  json response = json::parse(server->respond(request.dump()))["response"];
+  while (response["ok"] == true && response.contains("docno")) {
+    found.push_back(response["docno"]);
+    request = json::object();
+    request["op"] = "next";
+    request["qid"] = response["qid"];
+    response = json::parse(server->respond(request.dump()))["response"];
+  }
+  EXPECT_EQ(response["ok"], true);
+  EXPECT_EQ(response["done"], true);
+  return found;
+}
+
+int connect_local(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  timeval timeout = {10, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) !=
+      0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool send_all(int fd, const std::string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0)
+      return false;
+    sent += n;
+  }
+  return true;
+}
+
+// Reads from a blocking socket until at least size bytes have arrived or the
+// server closes it.
+bool receive(int fd, std::string *input, size_t size) {
+  char buffer[4096];
+  while (input->size() < size) {
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0)
+      return false;
+    input->append(buffer, n);
+  }
+  return true;
+}
+
+// The responses recorded on count lines, or on as many as arrive.
+std::vector<json> read_lines(int fd, std::string *input, size_t count) {
+  std::vector<json> responses;
+  while (responses.size() < count) {
+    size_t end = input->find('\n');
+    if (end != std::string::npos) {
+      responses.push_back(json::parse(input->substr(0, end))["response"]);
+      input->erase(0, end + 1);
+    } else if (!receive(fd, input, input->size() + 1)) {
+      break;
+    }
+  }
+  return responses;
+}
+
+// The responses of count frames, or of as many as arrive.
+std::vector<json> read_frames(int fd, std::string *input, size_t count) {
+  std::vector<json> responses;
+  while (responses.size() < count) {
+    if (!receive(fd, input, cottontail::FRAME_HEADER))
+      break;
+    size_t length = cottontail::frame_length(input->data());
+    if (!receive(fd, input, cottontail::FRAME_HEADER + length))
+      break;
+    json response;
+    std::string error;
+    EXPECT_TRUE(cottontail::decode_frame(
+        input->substr(cottontail::FRAME_HEADER, length), &response, &error))
+        << error;
+    responses.push_back(response);
+    input->erase(0, cottontail::FRAME_HEADER + length);
+  }
+  return responses;
+}
+
+std::map<int, json> by_id(const std::vector<json> &responses) {
+  std::map<int, json> ids;
+  for (auto &response : responses)
+    ids[response.value("id", -1)] = response;
+  return ids;
+}
+} // namespace
+
+TEST(Ssr, ResultCache) {
+  std::string key(8, 'a');
+  // The size of one entry, to set budgets in whole entries
+  size_t entry;
+  {
+    cottontail::ssr::ResultCache cache(1024 * 1024);
+    cache.insert(0, 1, key, page_of(2));
+    entry = cache.metrics()["bytes"];
+    ASSERT_GT(entry, (size_t)0);
+  }
+  cottontail::ssr::ResultCache cache(2 * entry);
+  cottontail::ssr::Page page;
+  cache.insert(0, 1, std::string(8, 'a'), page_of(2));
+  cache.insert(0, 1, std::string(8, 'b'), page_of(2));
+  EXPECT_TRUE(cache.find(0, 1, std::string(8, 'a'), &page));
+  EXPECT_EQ(page.results.size(), (size_t)2);
+  EXPECT_TRUE(page.done);
+  // The least recently used page makes way for a new one
+  cache.insert(0, 1, std::string(8, 'c'), page_of(2));
+  EXPECT_FALSE(cache.find(0, 1, std::string(8, 'b'), &page));
+  EXPECT_TRUE(cache.find(0, 1, std::string(8, 'a'), &page));
+  EXPECT_TRUE(cache.find(0, 1, std::string(8, 'c'), &page));
+  json metrics = cache.metrics();
+  EXPECT_EQ(metrics["entries"], 2);
+  EXPECT_EQ(metrics["bytes"], 2 * entry);
+  EXPECT_EQ(metrics["hits"], 3);
+  EXPECT_EQ(metrics["misses"], 1);
+  // Pages bigger than the budget are never kept
+  cache.insert(0, 1, std::string(8, 'd'), page_of(100));
+  EXPECT_FALSE(cache.find(0, 1, std::string(8, 'd'), &page));
+  // Pages are found only for the snapshot they were ranked against
+  cottontail::ssr::ResultCache snapshots(1024 * 1024);
+  snapshots.insert(0, 1, "k0", page_of(1));
+  snapshots.insert(1, 1, "k1", page_of(1));
+  EXPECT_TRUE(snapshots.find(0, 1, "k0", &page));
+  EXPECT_FALSE(snapshots.find(0, 2, "k0", &page));
+  // Once a collection moves on, its older pages are dropped, but not those
+  // of other collections
+  EXPECT_FALSE(snapshots.find(0, 1, "k0", &page));
+  EXPECT_TRUE(snapshots.find(1, 1, "k1", &page));
+  EXPECT_EQ(snapshots.metrics()["entries"], 1);
+  snapshots.insert(0, 2, "k0", page_of(3));
+  EXPECT_TRUE(snapshots.find(0, 2, "k0", &page));
+  EXPECT_EQ(page.results.size(), (size_t)3);
+  // A cache without a budget keeps nothing
+  cottontail::ssr::ResultCache none(0);
+  none.insert(0, 1, key, page_of(1));
+  EXPECT_FALSE(none.find(0, 1, key, &page));
+}
+
+TEST(Ssr, Sessions) {
+  using cottontail::ssr::QueryState;
+  cottontail::ssr::Sessions sessions(2, 60000);
+  std::string q0 = sessions.insert(std::make_shared<QueryState>());
+  std::string q1 = sessions.insert(std::make_shared<QueryState>());
+  EXPECT_NE(q0, q1);
+  EXPECT_NE(sessions.find(q0), nullptr);
+  // The least recently used session is evicted beyond the limit
+  std::string q2 = sessions.insert(std::make_shared<QueryState>());
+  EXPECT_EQ(sessions.find(q1), nullptr);
+  EXPECT_NE(sessions.find(q0), nullptr);
+  EXPECT_NE(sessions.find(q2), nullptr);
+  EXPECT_EQ(sessions.find("nonsense"), nullptr);
+  json metrics = sessions.metrics();
+  EXPECT_EQ(metrics["sessions"], 2);
+  EXPECT_EQ(metrics["evicted"], 1);
+  EXPECT_EQ(metrics["expired"], 0);
+  // Idle sessions expire
+  cottontail::ssr::Sessions brief(10, 1);
+  std::string q = brief.insert(std::make_shared<QueryState>());
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(brief.find(q), nullptr);
+  metrics = brief.metrics();
+  EXPECT_EQ(metrics["sessions"], 0);
+  EXPECT_EQ(metrics["expired"], 1);
+  EXPECT_EQ(metrics["evicted"], 0);
+}
+
+TEST(Ssr, Server) {
+  std::string error;
+  std::shared_ptr<cottontail::Warren> warren = ssr_warren(&error);
+  ASSERT_NE(warren, nullptr) << error;
+  std::unique_ptr<cottontail::ssr::Server> server =
+      ssr_server(warren, 60000, &error);
+  ASSERT_NE(server, nullptr) << error;
+  std::vector<std::string> found = docnos(server.get(), "hello");
+  EXPECT_EQ(std::set<std::string>(found.begin(), found.end()),
+            std::set<std::string>({"doc-000", "doc-001", "doc-002"}));
+  // Asked again, in another form, the query is answered from the cache
+  EXPECT_EQ(docnos(server.get(), "hello"), found);
+  json stats = json::parse(server->respond("{\"op\":\"stats\"}"))["response"];
+  EXPECT_EQ(stats["ok"], true);
+  EXPECT_GT(stats["cache"]["hits"], 0);
+  EXPECT_GT(stats["sessions"]["sessions"], 0);
+  json response = json::parse(server->respond(
+      "{\"op\":\"document\",\"docno\":\"doc-001\",\"id\":7}"))["response"];
+  EXPECT_EQ(response["ok"], true);
+  EXPECT_EQ(response["id"], 7);
+  EXPECT_NE(response["document"].get<std::string>().find("hello world"),
+            std::string::npos);
+  response = json::parse(server->respond(
+      "{\"op\":\"query\",\"query\":\"hello\",\"deadline\":0}"))["response"];
+  EXPECT_EQ(response["ok"], false);
+  EXPECT_EQ(response["error"], "Deadline must be positive");
+  response = json::parse(server->respond(
+      "{\"op\":\"query\",\"query\":\"hello\"}", true))["response"];
+  EXPECT_EQ(response["error"], "Server busy");
+  response = json::parse(
+      server->respond("{\"op\":\"next\",\"qid\":\"q99\"}"))["response"];
+  EXPECT_EQ(response["error"], "Unknown qid");
+  response = json::parse(server->respond("{\"op\":"))["response"];
+  EXPECT_EQ(response["op"], "parse");
+  EXPECT_EQ(response["ok"], false);
+  // A session outlives its time to live only while in use
+  server = ssr_server(warren, 1, &error);
+  ASSERT_NE(server, nullptr) << error;
+  response = json::parse(server->respond(
+      "{\"op\":\"query\",\"query\":\"hello\"}"))["response"];
+  ASSERT_EQ(response["ok"], true);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  json next;
+  next["op"] = "next";
+  next["qid"] = response["qid"];
+  response = json::parse(server->respond(next.dump()))["response"];
+  EXPECT_EQ(response["error"], "Unknown qid");
+  warren->end();
+}
+
+TEST(Ssr, Loopback) {
+  std::string error;
+  std::shared_ptr<cottontail::Warren> warren = ssr_warren(&error);
+  ASSERT_NE(warren, nullptr) << error;
+  std::unique_ptr<cottontail::ssr::Server> server =
+      ssr_server(warren, 60000, &error);
+  ASSERT_NE(server, nullptr) << error;
+  uint16_t port = 0;
+  int listener = cottontail::ssr::listen_local(0, &port);
+  ASSERT_GE(listener, 0);
+  cottontail::ssr::EventLoop loop(server.get(), listener, 2);
+  bool served = false;
+  std::thread thread([&] { served = loop.run(&error); });
+  // Pipelined lines are all answered, matched to their requests by id
+  int fd = connect_local(port);
+  ASSERT_GE(fd, 0);
+  ASSERT_TRUE(send_all(fd, "{\"op\":\"query\",\"query\":\"hello\",\"id\":1}\n"
+                           "{\"op\":\"stats\",\"id\":2}\n"
+                           "{\"op\":\"document\",\"docno\":\"doc-003\","
+                           "\"id\":3}\n"
+                           "{\"op\":\"nonsense\",\"id\":4}\n"));
+  std::string input;
+  std::map<int, json> responses = by_id(read_lines(fd, &input, 4));
+  ASSERT_EQ(responses.size(), (size_t)4);
+  EXPECT_EQ(responses[1]["rank"], 1);
+  EXPECT_EQ(responses[2]["op"], "stats");
+  EXPECT_EQ(responses[3]["docno"], "doc-003");
+  EXPECT_EQ(responses[4]["error"], "Unknown op");
+  // A request split across writes is answered once complete
+  json next;
+  next["op"] = "next";
+  next["qid"] = responses[1]["qid"];
+  next["id"] = 5;
+  std::string line = next.dump() + "\n";
+  ASSERT_TRUE(send_all(fd, line.substr(0, 10)));
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ASSERT_TRUE(send_all(fd, line.substr(10)));
+  std::vector<json> records = read_lines(fd, &input, 1);
+  ASSERT_EQ(records.size(), (size_t)1);
+  EXPECT_EQ(records[0]["id"], 5);
+  EXPECT_EQ(records[0]["rank"], 2);
+  close(fd);
+  // Binary frames follow the protocol request, pipelined behind it
+  fd = connect_local(port);
+  ASSERT_GE(fd, 0);
+  std::string requests = "{\"op\":\"protocol\",\"protocol\":\"binary\"}\n";
+  json request;
+  request["op"] = "query";
+  request["query"] = "hello";
+  request["id"] = 1;
+  requests += cottontail::encode_frame(request);
+  request = json::object();
+  request["op"] = "document";
+  request["docno"] = "doc-001";
+  request["id"] = 2;
+  requests += cottontail::encode_frame(request);
+  request = json::object();
+  request["op"] = "stats";
+  request["id"] = 3;
+  requests += cottontail::encode_frame(request);
+  ASSERT_TRUE(send_all(fd, requests));
+  input.clear();
+  records = read_lines(fd, &input, 1);
+  ASSERT_EQ(records.size(), (size_t)1);
+  EXPECT_EQ(records[0]["protocol"], "binary");
+  responses = by_id(read_frames(fd, &input, 3));
+  ASSERT_EQ(responses.size(), (size_t)3);
+  EXPECT_EQ(responses[1]["rank"], 1);
+  EXPECT_FALSE(responses[1]["snippet"].get<std::string>().empty());
+  EXPECT_NE(responses[2]["document"].get<std::string>().find("hello world"),
+            std::string::npos);
+  EXPECT_EQ(responses[3]["op"], "stats");
+  close(fd);
+  // A line longer than any frame is refused, and ends the connection
+  fd = connect_local(port);
+  ASSERT_GE(fd, 0);
+  ASSERT_TRUE(send_all(fd, std::string(cottontail::MAX_FRAME + 1, 'x')));
+  input.clear();
+  records = read_lines(fd, &input, 2);
+  ASSERT_EQ(records.size(), (size_t)1);
+  EXPECT_EQ(records[0]["error"], "Request line too long");
+  close(fd);
+  // Connections still open are closed when the loop stops
+  fd = connect_local(port);
+  ASSERT_GE(fd, 0);
+  ASSERT_TRUE(send_all(fd, "{\"op\":\"stats\"}\n"));
+  input.clear();
+  ASSERT_EQ(read_lines(fd, &input, 1).size(), (size_t)1);
+  loop.stop();
+  thread.join();
+  EXPECT_TRUE(served) << error;
+  char byte;
+  EXPECT_EQ(recv(fd, &byte, 1, 0), 0);
+  close(fd);
+  close(listener);
+  warren->end();
+}
@@ -0,0 +1,71 @@
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/cottontail.h"
+
+TEST(TopK, Collect) {
+  cottontail::TopK top(5);
+  EXPECT_EQ(top.threshold(), 0.0);
+  std::vector<cottontail::RankingResult> all;
+  for (cottontail::addr p = 0; p < 100; p++) {
+    cottontail::fval score = (p * 37) % 23;
+    all.emplace_back(p, p, score);
+    top.push(all.back());
+  }
+  EXPECT_TRUE(top.full());
+  EXPECT_EQ(top.threshold(), 21.0);
+  std::sort(all.begin(), all.end(),
+            [](const cottontail::RankingResult &a,
+               const cottontail::RankingResult &b) {
+              return a.score() > b.score() ||
+                     (a.score() == b.score() && a.p() < b.p());
+            });
+  std::vector<cottontail::RankingResult> results = top.results();
+  ASSERT_EQ(results.size(), (size_t)5);
+  for (size_t i = 0; i < results.size(); i++) {
+    EXPECT_EQ(results[i].p(), all[i].p());
+    EXPECT_EQ(results[i].score(), all[i].score());
+  }
+  EXPECT_EQ(top.size(), (size_t)0);
+  // Ties resolve the same way whatever the order of pushes
+  std::reverse(all.begin(), all.end());
+  top.push(all);
+  results = top.results();
+  ASSERT_EQ(results.size(), (size_t)5);
+  for (size_t i = 0; i < results.size(); i++)
+    EXPECT_EQ(results[i].p(), all[all.size() - 1 - i].p());
+  cottontail::TopK none(0);
+  EXPECT_FALSE(none.push(cottontail::RankingResult(0, 0, 1.0)));
+  EXPECT_EQ(none.results().size(), (size_t)0);
+}
+
+TEST(TopK, Shared) {
+  cottontail::SharedThreshold shared;
+  cottontail::TopK a(2, 0.0, &shared), b(2, 0.0, &shared);
+  a.push(cottontail::RankingResult(0, 0, 5.0));
+  EXPECT_EQ(b.threshold(), 0.0);
+  a.push(cottontail::RankingResult(1, 1, 3.0));
+  EXPECT_EQ(shared.value(), 3.0);
+  EXPECT_EQ(b.threshold(), 3.0);
+  b.push(cottontail::RankingResult(2, 2, 1.0));
+  b.push(cottontail::RankingResult(3, 3, 2.0));
+  EXPECT_EQ(shared.value(), 3.0);
+  EXPECT_EQ(b.threshold(), 3.0);
+  shared.raise(4.0);
+  EXPECT_EQ(a.threshold(), 4.0);
+}
+
+TEST(TopK, Resume) {
+  cottontail::TopK top(3);
+  top.resume(2.0, 5);
+  for (cottontail::addr p = 0; p < 10; p++)
+    top.push(cottontail::RankingResult(p, p, (p % 2 == 0) ? 2.0 : 1.0));
+  // Only results ranked after (2.0, 5): ties on score beyond 5, then lower
+  std::vector<cottontail::RankingResult> results = top.results();
+  ASSERT_EQ(results.size(), (size_t)3);
+  EXPECT_EQ(results[0].p(), 6);
+  EXPECT_EQ(results[1].p(), 8);
+  EXPECT_EQ(results[2].p(), 1);
+}
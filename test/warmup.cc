@@ -0,0 +1,81 @@
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/cottontail.h"
+
+TEST(Warmup, FeatureLog) {
+  std::ofstream out("warmup.txt");
+  for (size_t i = 0; i < 50; i++)
+    out << "<DOC>\n<DOCNO> " << i << " </DOCNO>\nthe cat in the hat "
+        << (i % 3 == 0 ? "came back" : "sat") << "\n</DOC>\n";
+  out.close();
+  std::string error;
+  std::shared_ptr<cottontail::Working> working =
+      cottontail::Working::mkdir(cottontail::DEFAULT_BURROW);
+  ASSERT_NE(working, nullptr);
+  std::shared_ptr<cottontail::Builder> builder =
+      cottontail::SimpleBuilder::make(working, "", &error);
+  ASSERT_NE(builder, nullptr) << error;
+  builder->verbose(false);
+  ASSERT_TRUE(cottontail::build_trec({"warmup.txt"}, builder, &error));
+  std::shared_ptr<cottontail::Warren> warren =
+      cottontail::Warren::make("simple", cottontail::DEFAULT_BURROW, &error);
+  ASSERT_NE(warren, nullptr) << error;
+  std::shared_ptr<cottontail::FeatureLog> log =
+      cottontail::FeatureLog::make();
+  warren->set_feature_log(log);
+  warren->start();
+  // Queries through a clone are counted in the same log
+  std::shared_ptr<cottontail::Warren> clone = warren->clone(&error);
+  ASSERT_NE(clone, nullptr) << error;
+  for (size_t i = 0; i < 3; i++)
+    ASSERT_NE(clone->hopper_from_gcl("hat"), nullptr);
+  ASSERT_NE(warren->hopper_from_gcl("(+ hat back)"), nullptr);
+  ASSERT_NE(warren->hopper_from_gcl("(<> cat back)"), nullptr);
+  clone->end();
+  cottontail::addr hat = warren->featurizer()->featurize("hat");
+  cottontail::addr back = warren->featurizer()->featurize("back");
+  cottontail::addr cat = warren->featurizer()->featurize("cat");
+  EXPECT_EQ(log->features(), std::vector<cottontail::addr>({hat, back, cat}));
+  EXPECT_EQ(log->features(1), std::vector<cottontail::addr>({hat}));
+  EXPECT_EQ(warren->idx()->count(hat), 50);
+  EXPECT_EQ(log->size(), (size_t)3);
+  // Stored and loaded in order
+  ASSERT_TRUE(log->store(working, &error)) << error;
+  std::shared_ptr<cottontail::FeatureLog> loaded =
+      cottontail::FeatureLog::load(working, &error);
+  ASSERT_NE(loaded, nullptr) << error;
+  EXPECT_EQ(loaded->features(), log->features());
+  // Warming reads postings into the idx cache without counting them
+  warren->end();
+  warren =
+      cottontail::Warren::make("simple", cottontail::DEFAULT_BURROW, &error);
+  ASSERT_NE(warren, nullptr) << error;
+  warren->set_feature_log(log);
+  warren->start();
+  EXPECT_FALSE(warren->idx()->cached(hat));
+  std::shared_ptr<cottontail::Warmer> warmer =
+      cottontail::Warmer::make(warren, loaded, 1024 * 1024, &error);
+  ASSERT_NE(warmer, nullptr) << error;
+  warmer->wait();
+  EXPECT_TRUE(warmer->done());
+  EXPECT_EQ(warmer->features(), (size_t)3);
+  EXPECT_GT(warmer->bytes(), (size_t)0);
+  for (cottontail::addr feature : {hat, back, cat})
+    EXPECT_TRUE(warren->idx()->cached(feature));
+  EXPECT_FALSE(warren->idx()->cached(warren->featurizer()->featurize("sat")));
+  EXPECT_EQ(log->features(), std::vector<cottontail::addr>({hat, back, cat}));
+  // Only the smaller postings fit a small budget
+  warmer = cottontail::Warmer::make(warren, loaded, 20 * 24, &error);
+  ASSERT_NE(warmer, nullptr) << error;
+  warmer->wait();
+  EXPECT_EQ(warmer->features(), (size_t)1);
+  warmer->refresh();
+  warmer->wait();
+  EXPECT_EQ(warmer->features(), (size_t)1);
+  warren->end();
+}